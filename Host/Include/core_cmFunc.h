@@ -0,0 +1,37 @@
+#pragma once
+
+// Host version of the CMSIS core register access functions. It shadows
+// Drivers/CMSIS/Include/core_cmFunc.h in the host build (see Host/Makefile):
+// the special registers of the core are kept by the simulation.
+
+// Declared in sim.h, which cannot be included here: this header is part of
+// stm32f4xx.h.
+void Sim_SetPrimask(uint32_t primask);
+uint32_t Sim_GetPrimask(void);
+void Sim_SetBasepri(uint32_t basepri);
+uint32_t Sim_GetBasepri(void);
+uint32_t Sim_GetIPSR(void);
+
+static __INLINE void __enable_irq(void)			{ Sim_SetPrimask(0); }
+static __INLINE void __disable_irq(void)		{ Sim_SetPrimask(1); }
+static __INLINE uint32_t __get_PRIMASK(void)		{ return Sim_GetPrimask(); }
+static __INLINE void __set_PRIMASK(uint32_t priMask)	{ Sim_SetPrimask(priMask & 1); }
+static __INLINE uint32_t __get_BASEPRI(void)		{ return Sim_GetBasepri(); }
+static __INLINE void __set_BASEPRI(uint32_t value)	{ Sim_SetBasepri(value & 0xFF); }
+static __INLINE uint32_t __get_IPSR(void)		{ return Sim_GetIPSR(); }
+static __INLINE uint32_t __get_xPSR(void)		{ return Sim_GetIPSR(); }
+static __INLINE uint32_t __get_APSR(void)		{ return 0; }
+
+// Not modelled: the program always runs privileged on the main stack.
+static __INLINE uint32_t __get_CONTROL(void)		{ return 0; }
+static __INLINE void __set_CONTROL(uint32_t control)	{ (void)control; }
+static __INLINE uint32_t __get_PSP(void)		{ return 0; }
+static __INLINE void __set_PSP(uint32_t topOfProcStack)	{ (void)topOfProcStack; }
+static __INLINE uint32_t __get_MSP(void)		{ return 0; }
+static __INLINE void __set_MSP(uint32_t topOfMainStack)	{ (void)topOfMainStack; }
+static __INLINE void __enable_fault_irq(void)		{ }
+static __INLINE void __disable_fault_irq(void)		{ }
+static __INLINE uint32_t __get_FAULTMASK(void)		{ return 0; }
+static __INLINE void __set_FAULTMASK(uint32_t faultMask) { (void)faultMask; }
+static __INLINE uint32_t __get_FPSCR(void)		{ return 0; }
+static __INLINE void __set_FPSCR(uint32_t fpscr)	{ (void)fpscr; }
@@ -0,0 +1,94 @@
+#pragma once
+
+// Host version of the CMSIS core instruction intrinsics. It shadows
+// Drivers/CMSIS/Include/core_cmInstr.h in the host build (see Host/Makefile).
+
+// Declared in sim.h, which cannot be included here: this header is part of
+// stm32f4xx.h.
+void Sim_WaitForInterrupt(void);
+void Sim_ClearExclusive(void);
+uint32_t Sim_LoadExclusive(volatile void* addr, uint32_t size);
+uint32_t Sim_StoreExclusive(uint32_t value, volatile void* addr, uint32_t size);
+
+static __INLINE void __NOP(void)	{ __asm volatile ("nop"); }
+static __INLINE void __WFI(void)	{ Sim_WaitForInterrupt(); }
+static __INLINE void __WFE(void)	{ Sim_WaitForInterrupt(); }
+static __INLINE void __SEV(void)	{ }
+static __INLINE void __ISB(void)	{ __sync_synchronize(); }
+static __INLINE void __DSB(void)	{ __sync_synchronize(); }
+static __INLINE void __DMB(void)	{ __sync_synchronize(); }
+
+static __INLINE uint32_t __REV(uint32_t value)
+{
+    return __builtin_bswap32(value);
+}
+
+static __INLINE uint32_t __REV16(uint32_t value)
+{
+    return ((value & 0x00FF00FF) << 8) | ((value >> 8) & 0x00FF00FF);
+}
+
+static __INLINE int32_t __REVSH(int32_t value)
+{
+    return (int16_t)__builtin_bswap16((uint16_t)value);
+}
+
+static __INLINE uint32_t __RBIT(uint32_t value)
+{
+    uint32_t result = 0;
+    for (int i=0; i<32; i++, value >>= 1)
+    {
+	result = (result << 1) | (value & 1);
+    }
+    return result;
+}
+
+static __INLINE uint8_t __CLZ(uint32_t value)
+{
+    return value ? __builtin_clz(value) : 32;
+}
+
+// Exclusive accesses go through the simulated exclusive monitor, which is
+// cleared on every exception entry and return as on the core.
+static __INLINE uint8_t __LDREXB(volatile uint8_t* addr)
+{
+    return (uint8_t)Sim_LoadExclusive(addr, 1);
+}
+
+static __INLINE uint16_t __LDREXH(volatile uint16_t* addr)
+{
+    return (uint16_t)Sim_LoadExclusive(addr, 2);
+}
+
+static __INLINE uint32_t __LDREXW(volatile uint32_t* addr)
+{
+    return Sim_LoadExclusive(addr, 4);
+}
+
+static __INLINE uint32_t __STREXB(uint8_t value, volatile uint8_t* addr)
+{
+    return Sim_StoreExclusive(value, addr, 1);
+}
+
+static __INLINE uint32_t __STREXH(uint16_t value, volatile uint16_t* addr)
+{
+    return Sim_StoreExclusive(value, addr, 2);
+}
+
+static __INLINE uint32_t __STREXW(uint32_t value, volatile uint32_t* addr)
+{
+    return Sim_StoreExclusive(value, addr, 4);
+}
+
+static __INLINE void __CLREX(void)
+{
+    Sim_ClearExclusive();
+}
+
+#define __SSAT(ARG1, ARG2) \
+    ((int32_t)(ARG1) > ((1 << ((ARG2) - 1)) - 1) ? ((1 << ((ARG2) - 1)) - 1) : \
+     (int32_t)(ARG1) < -(1 << ((ARG2) - 1)) ? -(1 << ((ARG2) - 1)) : (int32_t)(ARG1))
+
+#define __USAT(ARG1, ARG2) \
+    ((int32_t)(ARG1) < 0 ? 0 : \
+     (uint32_t)(ARG1) > ((1u << (ARG2)) - 1) ? ((1u << (ARG2)) - 1) : (uint32_t)(ARG1))
@@ -0,0 +1,54 @@
+#pragma once
+
+/////////////////////////////// HOST SIMULATION ///////////////////////////////
+// The host simulation maps the STM32F407 peripheral address space onto a
+// simulated peripheral model driven by a virtual clock. The Basic programs
+// and the standard peripheral library are compiled for the host unchanged
+// and every register access they make is counted and charged in bus cycles.
+// See Host/Source/sim.c for how it works and Host/Makefile for how to run it.
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Virtual time. The virtual clock counts HCLK (core) cycles since reset.
+uint64_t Sim_GetCycles(void);
+uint64_t Sim_GetTimeNs(void);
+u32 Sim_GetHCLK(void);
+
+// Drives an input pin from outside the device (push button, signal
+// generator). Edges are seen by the EXTI and by timer input channels.
+void Sim_SetPin(GPIO_TypeDef* GPIOx, u16 GPIO_Pin, u8 level);
+
+// Schedules Sim_SetPin() at an absolute virtual time.
+void Sim_SchedulePin(uint64_t timeNs, GPIO_TypeDef* GPIOx, u16 GPIO_Pin,
+                     u8 level);
+
+// Stops the simulation, prints the report and exits the process.
+void Sim_Stop(void);
+
+// Core state used by the host versions of core_cmFunc.h/core_cmInstr.h.
+void Sim_SetPrimask(u32 primask);
+u32 Sim_GetPrimask(void);
+void Sim_SetBasepri(u32 basepri);
+u32 Sim_GetBasepri(void);
+u32 Sim_GetIPSR(void);
+void Sim_WaitForInterrupt(void);
+void Sim_ClearExclusive(void);
+u32 Sim_LoadExclusive(volatile void* addr, u32 size);
+u32 Sim_StoreExclusive(u32 value, volatile void* addr, u32 size);
+
+// Execution contexts for a preemptive kernel (see Source/kernel.c), each on
+// a host stack of its own. Called by the PendSV handler, Sim_SwitchContext()
+// saves the running context in 'from' (0 drops it) and goes on with 'to':
+// where its PendSV handler switched away, or at its entry when it is new.
+typedef struct SimContext SimContext;
+SimContext* Sim_CreateContext(void (*entry)(void* arg), void* arg);
+void Sim_SwitchContext(SimContext* from, SimContext* to);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+// Interfaces shared by the simulation sources. Not for use by the programs.
+
+#include "sim.h"
+
+// The simulated register space is mapped twice: once at the real device
+// address with all access denied (so that every access traps) and once at
+// a private alias which the model uses to read and write registers freely.
+// REG() gives the model access to a 32-bit register by its device address.
+void* SimAlias(u32 addr);
+#define REG(addr)	(*(volatile u32*)SimAlias(addr))
+#define REG16(addr)	(*(volatile u16*)SimAlias(addr))
+#define REG8(addr)	(*(volatile u8*)SimAlias(addr))
+
+// Clocks (sim_periph.c).
+u32 SimRcc_SYSCLK(void);
+u32 SimRcc_HCLK(void);
+u32 SimRcc_PCLK1(void);
+u32 SimRcc_PCLK2(void);
+
+// Peripheral models (sim_periph.c). A write is applied after the storing
+// instruction has executed: 'old' is the aligned word before and 'value'
+// the aligned word after the store.
+void SimPeriph_Reset(void);
+void SimPeriph_Write(u32 addr, u32 old, u32 value);
+void SimPeriph_Read(u32 addr);
+uint64_t SimPeriph_CyclesToEvent(void);
+void SimPeriph_Step(uint64_t cycles);
+int SimPeriph_IrqLine(int irq);
+void SimPeriph_SetPin(u32 port, u32 pin, u8 level);
+void SimPeriph_Wire(u32 fromPort, u32 fromPin, u32 toPort, u32 toPin);
+void SimPeriph_Report(void);
+
+// Core peripherals: NVIC, SCB, SysTick, DWT (sim_core.c).
+void SimCore_Reset(void);
+void SimCore_Write(u32 addr, u32 old, u32 value);
+void SimCore_Read(u32 addr);
+uint64_t SimCore_CyclesToEvent(void);
+void SimCore_Step(uint64_t cycles);
+void SimCore_SetPending(int exception);
+void SimCore_Dispatch(void);
+void SimCore_ExitException(void);
+int SimCore_HasPending(void);
+u32 SimCore_TakenCount(void);
+void SimCore_Report(void);
+
+// Vector table in exception number order, mirroring startup_stm32f4xx.s.
+typedef void (*SimHandler)(void);
+#define SIM_EXCEPTIONS		98
+extern SimHandler const g_simVectors[SIM_EXCEPTIONS];
+
+// g_simVectors is copied to the start of the flash (see sim.c), where
+// startup_stm32f4xx.s puts the vector table on the device.
+#define SIM_FLASH_TABLE_SIZE	0x1000
+extern const char* const g_simVectorNames[SIM_EXCEPTIONS];
+
+// Virtual time (sim.c). Advances the clock, stepping the peripherals from
+// one event to the next. Interrupts are only taken when 'dispatch' is set;
+// the fault handler advances the clock in the middle of an instruction.
+void Sim_Advance(uint64_t cycles, int dispatch);
+void Sim_DispatchFromThread(void);
+void Sim_Printf(const char* format, ...);
+void Sim_Trace(const char* format, ...);
+extern int g_simTrace;
@@ -0,0 +1,223 @@
+/////////////////////////////// DITHERING MODEL ///////////////////////////////
+// Runs the modulator of Source/dither.c on the host and checks what it is
+// for: the resolution of the average and the shape of the noise spectrum.
+// Build and run with 'make dither'. Exits with 1 when a check fails.
+
+// RESOLUTION: For targets with all sorts of fractions, the average of
+// MODEL_N compare values must be within 1/MODEL_N tick of the target.
+
+// NOISE SHAPING: The target follows a slow sine. The noise is the output
+// minus the target, its spectrum taken with an FFT over MODEL_N periods.
+// The sine has a whole number of cycles in them, so no window is needed.
+// The spectral density of the noise, averaged over octaves, must rise by
+// about 20 dB per decade of frequency with the first order and 40 with the
+// second, where plain rounding is flat. The noise below the carrier /
+// (2 * MODEL_OSR) gives the effective resolution: the bits of an ideal
+// quantizer with as much noise.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stdafx.h"
+#include "dither.h"
+
+
+#define MODEL_N			65536	// Periods of a run, a power of two.
+#define MODEL_MAX		1000	// Highest compare value.
+#define MODEL_OSR		64
+#define MODEL_CYCLES		17	// Of the sine over MODEL_N periods.
+#define MODEL_OCTAVES		15	// Bins 1..2^15 of the spectrum.
+#define MODEL_PI		3.14159265358979323846
+
+
+static double s_re[MODEL_N];
+static double s_im[MODEL_N];
+
+
+// In place, radix 2.
+static void Fft(double* re, double* im, u32 n)
+{
+    for (u32 i=1, j=0; i<n; i++)
+    {
+	u32 bit = n >> 1;
+	for (; j & bit; bit >>= 1)
+	{
+	    j ^= bit;
+	}
+	j ^= bit;
+	if (i < j)
+	{
+	    double t = re[i]; re[i] = re[j]; re[j] = t;
+	    t = im[i]; im[i] = im[j]; im[j] = t;
+	}
+    }
+
+    for (u32 len=2; len<=n; len<<=1)
+    {
+	double a = -2 * MODEL_PI / len;
+	for (u32 i=0; i<n; i+=len)
+	{
+	    for (u32 k=0; k<len/2; k++)
+	    {
+		double wr = cos(a * k);
+		double wi = sin(a * k);
+		double* ur = &re[i + k];
+		double* ui = &im[i + k];
+		double* vr = &re[i + k + len/2];
+		double* vi = &im[i + k + len/2];
+		double xr = *vr * wr - *vi * wi;
+		double xi = *vr * wi + *vi * wr;
+		*vr = *ur - xr;
+		*vi = *ui - xi;
+		*ur += xr;
+		*ui += xi;
+	    }
+	}
+    }
+}
+
+
+// Compare value for 'target'. Order 0 is plain rounding.
+static u32 Next(Dither* dither, u32 order, u32 target)
+{
+    if (order == 0)
+    {
+	return (target + DITHER_ONE / 2) >> DITHER_BITS;
+    }
+    return Dither_Next(dither, target);
+}
+
+
+static int CheckResolution()
+{
+    static const u32 targets[] = {
+	DITHER_TARGET(0, 1), DITHER_TARGET(0, 0x5555), DITHER_TARGET(3, 0x8001),
+	DITHER_TARGET(500, 0x1234), DITHER_TARGET(998, 0xFFFF),
+    };
+    int failed = 0;
+
+    printf("Resolution: average of %u periods\n", MODEL_N);
+    printf("  order  target (ticks)      error (ticks)\n");
+
+    for (u32 order=1; order<=2; order++)
+    {
+	for (u32 t=0; t<sizeof(targets)/sizeof(targets[0]); t++)
+	{
+	    Dither dither;
+	    Dither_Init(&dither, order, MODEL_MAX);
+
+	    uint64_t sum = 0;
+	    for (u32 n=0; n<MODEL_N; n++)
+	    {
+		sum += (uint64_t)Dither_Next(&dither, targets[t]) << DITHER_BITS;
+	    }
+
+	    double error = ((double)sum / MODEL_N - targets[t]) / DITHER_ONE;
+	    int ok = fabs(error) <= 1.0 / MODEL_N;
+	    failed |= !ok;
+	    printf("  %5u  %14.7f  %+17.2e  %s\n", order, (double)targets[t] / DITHER_ONE,
+		   error, ok ? "" : "FAILED");
+	}
+    }
+    return failed;
+}
+
+
+// Noise density of each octave of the spectrum, in dB, and the in-band rms
+// noise in ticks.
+static void Spectrum(u32 order, double* octaves, double* inBand)
+{
+    Dither dither;
+    Dither_Init(&dither, order, MODEL_MAX);
+
+    for (u32 n=0; n<MODEL_N; n++)
+    {
+	double x = MODEL_MAX / 2 + MODEL_MAX / 4 * sin(2 * MODEL_PI * MODEL_CYCLES * n / MODEL_N);
+	u32 target = (u32)(x * DITHER_ONE + 0.5);
+	s_re[n] = Next(&dither, order, target) - (double)target / DITHER_ONE;
+	s_im[n] = 0;
+    }
+    Fft(s_re, s_im, MODEL_N);
+
+    // Power of each bin, both sides, normalized so that they add up to the
+    // mean square.
+    double band = 0;
+    for (u32 k=0; k<MODEL_OCTAVES; k++)
+    {
+	double power = 0;
+	for (u32 bin=1u<<k; bin<(2u<<k); bin++)
+	{
+	    double p = 2 * (s_re[bin] * s_re[bin] + s_im[bin] * s_im[bin]) / ((double)MODEL_N * MODEL_N);
+	    power += p;
+	    if (bin < MODEL_N / (2 * MODEL_OSR))
+	    {
+		band += p;
+	    }
+	}
+	octaves[k] = 10 * log10(power / (1u << k) + 1e-300);
+    }
+    *inBand = sqrt(band);
+}
+
+
+// Least squares slope of the octaves 'from' to 'to', in dB per decade.
+static double Slope(const double* octaves, u32 from, u32 to)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    u32 n = to - from + 1;
+
+    for (u32 k=from; k<=to; k++)
+    {
+	double x = k * log10(2.0);
+	sx += x;
+	sy += octaves[k];
+	sxx += x * x;
+	sxy += x * octaves[k];
+    }
+    return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+
+static int CheckShaping()
+{
+    double octaves[3][MODEL_OCTAVES];
+    double inBand[3];
+    int failed = 0;
+
+    for (u32 order=0; order<=2; order++)
+    {
+	Spectrum(order, octaves[order], &inBand[order]);
+    }
+
+    printf("\nNoise density (dB) of a sine of %u cycles in %u periods\n", MODEL_CYCLES, MODEL_N);
+    printf("  frequency / carrier   rounding   order 1   order 2\n");
+    for (u32 k=0; k<MODEL_OCTAVES; k++)
+    {
+	printf("  %19.6f  %9.1f  %8.1f  %8.1f\n", (double)(1u << k) / MODEL_N,
+	       octaves[0][k], octaves[1][k], octaves[2][k]);
+    }
+
+    // The lowest octaves hold a few bins only, and the highest flatten out
+    // toward half the carrier.
+    printf("\n  order  slope (dB/decade)  in-band noise (ticks rms)  effective bits\n");
+    for (u32 order=0; order<=2; order++)
+    {
+	static const double expected[] = { 0, 20, 40 };
+	double slope = Slope(octaves[order], 4, 11);
+	double bits = log2(MODEL_MAX / (inBand[order] * sqrt(12.0)));
+	int ok = fabs(slope - expected[order]) < 5;
+	failed |= !ok;
+	printf("  %5u  %17.1f  %25.2e  %14.1f  %s\n", order, slope, inBand[order], bits,
+	       ok ? "" : "FAILED");
+    }
+    return failed;
+}
+
+
+int main()
+{
+    int failed = CheckResolution();
+    failed |= CheckShaping();
+    return failed;
+}
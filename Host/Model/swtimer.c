@@ -0,0 +1,157 @@
+/////////////////////////// SOFTWARE TIMER MODEL //////////////////////////////
+// Runs the timer wheel of Source/swtimer.c on the host the way tickless.c
+// drives it and checks what matters after a long sleep. Build and run with
+// 'make swtimer'. Exits with 1 when a check fails.
+
+// The core sleeps until SwTimer_NextDelay() is over, no longer than the
+// 32-bit compare of tickless.c reaches (TICKLESS_MAX_SLEEP_US, about 36
+// minutes), then runs SwTimer_Process() as its PendSV handler would. The run
+// lasts MODEL_HOURS, several turns of the wheel (2^24 ticks, 4.7 hours), with
+// nothing due for hours in between.
+
+// DEADLINES: Every callback must run at the tick its timer expires, one-shot
+// or periodic, near or further away than the wheel reaches.
+
+// LATENCY: Every interrupt waits while PRIMASK is set. The longest time
+// it stays set, in CPU time of the host, must stay below MODEL_MASKED_US.
+// Turning the wheel tick by tick after a sleep of 36 minutes takes two
+// million steps, several milliseconds even on the host.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "stdafx.h"
+#include "swtimer.h"
+
+
+#define MODEL_HOURS		12
+#define MODEL_HOUR		3600000u	// Ticks of 1 ms.
+#define MODEL_MAX_SLEEP		(0x7FFFFFFF / 1000)	// Ticks.
+#define MODEL_MASKED_US		50
+#define MODEL_TIMERS		5
+
+
+typedef struct
+{
+    SwTimer timer;
+    u32 delay;
+    u32 period;
+    u32 expires;	// Next tick the callback is due.
+    u32 runs;
+    u32 late;		// Runs not at the tick due.
+} ModelTimer;
+
+
+static u32 s_tick = 0;
+static u32 s_primask = 0;
+static uint64_t s_maskedNs = 0;
+static uint64_t s_maxMaskedNs = 0;
+
+static ModelTimer s_timers[MODEL_TIMERS] = {
+    { .delay = 10000 },
+    { .delay = 5 * MODEL_HOUR },
+    { .delay = 100, .period = 3 * MODEL_HOUR },
+    { .delay = MODEL_HOUR, .period = MODEL_HOUR },
+    { .delay = 0x7FFFFFFF },
+};
+
+
+// The core functions of Host/Include/core_cmFunc.h, kept here instead of by
+// the simulation.
+static uint64_t CpuNs()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+void Sim_SetPrimask(uint32_t primask)
+{
+    if (!s_primask && primask)
+    {
+	s_maskedNs = CpuNs();
+    }
+    if (s_primask && !primask)
+    {
+	uint64_t masked = CpuNs() - s_maskedNs;
+	if (masked > s_maxMaskedNs)
+	{
+	    s_maxMaskedNs = masked;
+	}
+    }
+    s_primask = primask;
+}
+
+
+uint32_t Sim_GetPrimask(void)
+{
+    return s_primask;
+}
+
+
+static u32 Clock()
+{
+    return s_tick;
+}
+
+
+static void Expired(void* context)
+{
+    ModelTimer* m = context;
+    m->runs++;
+    m->late += (s_tick != m->expires);
+    m->expires += m->period;
+}
+
+
+int main()
+{
+    // SwTimer_Init() sets the priority of PendSV and SwTimer_Wake() pends it
+    // in the System Control Block.
+    mmap((void*)(SCS_BASE & ~0xFFFu), 0x1000, PROT_READ | PROT_WRITE,
+	 MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    SwTimer_Init();
+    SwTimer_SetClock(Clock);
+    for (u32 i=0; i<MODEL_TIMERS; i++)
+    {
+	ModelTimer* m = &s_timers[i];
+	m->expires = m->delay;
+	SwTimer_Start(&m->timer, m->delay, m->period, Expired, m);
+    }
+
+    u32 wakes = 0;
+    while (s_tick < MODEL_HOURS * MODEL_HOUR)
+    {
+	__disable_irq();
+	u32 delay = SwTimer_NextDelay();
+	__enable_irq();
+
+	s_tick += (delay > MODEL_MAX_SLEEP) ? MODEL_MAX_SLEEP : delay;
+	SwTimer_Process();
+	wakes++;
+    }
+
+    int failed = 0;
+    printf("Deadlines: %u hours, %u wakes\n", MODEL_HOURS, wakes);
+    printf("  timer      delay     period  runs  late\n");
+    for (u32 i=0; i<MODEL_TIMERS; i++)
+    {
+	ModelTimer* m = &s_timers[i];
+	u32 expected = (m->delay > s_tick) ? 0 :
+		       m->period ? (s_tick - m->delay) / m->period + 1 : 1;
+	int ok = m->runs == expected && !m->late;
+	failed |= !ok;
+	printf("  %5u %10u %10u %5u %5u  %s\n", i, m->delay, m->period, m->runs,
+	       m->late, ok ? "" : "FAILED");
+    }
+
+    int ok = s_maxMaskedNs < MODEL_MASKED_US * 1000;
+    failed |= !ok;
+    printf("\nLatency: PRIMASK set for %llu us at most  %s\n",
+	   (unsigned long long)(s_maxMaskedNs / 1000), ok ? "" : "FAILED");
+    return failed;
+}
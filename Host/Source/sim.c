@@ -0,0 +1,941 @@
+//////////////////////////////// HOST SIMULATION //////////////////////////////
+// Runs the programs of this project on a Linux x86-64 host.
+
+// The peripheral address space (APB1, APB2 and AHB1 at 0x40000000 and the
+// Cortex-M private peripheral bus at 0xE0000000) is mapped at its real
+// address with no access rights. Every register access made by the program
+// or by the standard peripheral library therefore raises a SIGSEGV. The fault
+// handler counts the access, charges it in bus cycles on the virtual clock,
+// opens the page and single steps the faulting instruction (x86 trap flag).
+// The SIGTRAP that follows closes the page again and hands the stored value
+// to the peripheral model which applies the register side effects (BSRR,
+// write-0-to-clear status flags, UG, ...).
+
+// The same memory is also mapped a second time at a private alias. The model
+// keeps the registers up to date through the alias without trapping, so a
+// read by the program simply sees the current register value.
+
+// The bit-band alias of the peripherals (0x42000000) is mapped the same way.
+// A read of an alias word is prepared with the value of its register bit and
+// a write is carried over to the register bit after the instruction. The
+// SRAM bit-band alias is not simulated: program variables live in host memory.
+
+// The virtual clock also advances while the program does not touch any
+// register (empty superloops, busy waits): a host interval timer (SIGALRM)
+// moves it forward by a fixed quantum. Interrupts are taken from the SIGALRM
+// and SIGTRAP handlers, i.e. at instruction boundaries as on the device, by
+// calling the handlers of the vector table (sim_vectors.c).
+
+// Environment variables:
+//	SIM_TIME_MS	Simulated time to run before the report (default 3000).
+//	SIM_SPEED	Simulated time per host time (default 10).
+//	SIM_BUTTON	User push button (PA0) presses as "at_ms:hold_ms,...".
+//			Default "500:150,1500:150,2500:150". Empty for none.
+//	SIM_BOUNCE	Contact bounce of the button: the number of times PA0
+//			flips back during the first 2 ms of each press and
+//			release (default 0).
+//	SIM_WIRE	Pins wired together as "from:to,...", e.g. "PD12:PA15":
+//			'to' follows the level of 'from' as an input. Default
+//			"PD12:PA15,PD12:PB4,PD13:PB5", the jumpers of Basic22
+//			and Basic23. Empty for none.
+//	SIM_TRACE	1 prints every pin change and interrupt with its time.
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/ucontext.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "sim_internal.h"
+
+
+#define SIM_PAGE		4096u
+#define SIM_TRAP_FLAG		0x100	// x86 EFLAGS.TF
+#define SIM_PF_WRITE		0x2	// Page fault error code: write access.
+#define SIM_HOST_PERIOD_US	50	// Host interval timer period.
+#define SIM_MAX_STIMULI		256
+#define SIM_BITBAND_SIZE	0x01000000	// 32 alias bytes per register byte
+#define SIM_CCM_SIZE		0x10000
+#define SIM_CONTEXT_STACK	(256 * 1024)	// Host stack of a kernel context.
+
+
+typedef struct
+{
+    u32 base;
+    u32 size;
+    u8* alias;
+} SimRegion;
+
+static SimRegion s_regions[] = {
+    { PERIPH_BASE,	0x00080000 },	// APB1, APB2, AHB1
+    { 0xE0000000,	0x00100000 },	// Private peripheral bus
+    { PERIPH_BB_BASE,	SIM_BITBAND_SIZE },	// Bit-band alias of the first region
+};
+
+#define SIM_REGIONS	(sizeof(s_regions) / sizeof(s_regions[0]))
+
+
+// Bus of a peripheral block. It decides the cost of an access.
+typedef enum
+{
+    SIM_BUS_AHB,
+    SIM_BUS_APB1,
+    SIM_BUS_APB2,
+    SIM_BUS_PPB,
+} SimBus;
+
+typedef struct
+{
+    const char* name;
+    u32 base;
+    u32 size;
+    SimBus bus;
+    u32 reads;
+    u32 writes;
+    uint64_t cycles;
+} SimBlock;
+
+// Blocks are matched in order so the catch-all bus entries come last.
+static SimBlock s_blocks[] = {
+    { "TIM2",		TIM2_BASE,	0x400,		SIM_BUS_APB1 },
+    { "TIM3",		TIM3_BASE,	0x400,		SIM_BUS_APB1 },
+    { "TIM4",		TIM4_BASE,	0x400,		SIM_BUS_APB1 },
+    { "TIM5",		TIM5_BASE,	0x400,		SIM_BUS_APB1 },
+    { "TIM6",		TIM6_BASE,	0x400,		SIM_BUS_APB1 },
+    { "TIM7",		TIM7_BASE,	0x400,		SIM_BUS_APB1 },
+    { "PWR",		PWR_BASE,	0x400,		SIM_BUS_APB1 },
+    { "TIM8",		TIM8_BASE,	0x400,		SIM_BUS_APB2 },
+    { "SYSCFG",		SYSCFG_BASE,	0x400,		SIM_BUS_APB2 },
+    { "EXTI",		EXTI_BASE,	0x400,		SIM_BUS_APB2 },
+    { "GPIOA",		GPIOA_BASE,	0x400,		SIM_BUS_AHB },
+    { "GPIOB",		GPIOB_BASE,	0x400,		SIM_BUS_AHB },
+    { "GPIOC",		GPIOC_BASE,	0x400,		SIM_BUS_AHB },
+    { "GPIOD",		GPIOD_BASE,	0x400,		SIM_BUS_AHB },
+    { "GPIOE",		GPIOE_BASE,	0x400,		SIM_BUS_AHB },
+    { "CRC",		CRC_BASE,	0x400,		SIM_BUS_AHB },
+    { "RCC",		RCC_BASE,	0x400,		SIM_BUS_AHB },
+    { "FLASH",		FLASH_R_BASE,	0x400,		SIM_BUS_AHB },
+    { "DMA1",		DMA1_BASE,	0x400,		SIM_BUS_AHB },
+    { "DMA2",		DMA2_BASE,	0x400,		SIM_BUS_AHB },
+    { "SysTick",	SysTick_BASE,	0x10,		SIM_BUS_PPB },
+    { "SCB",		SCB_BASE,	0x90,		SIM_BUS_PPB },
+    { "CoreDebug",	CoreDebug_BASE,	0x10,		SIM_BUS_PPB },
+    { "NVIC",		NVIC_BASE,	0xE04,		SIM_BUS_PPB },
+    { "DWT",		0xE0001000,	0x1000,		SIM_BUS_PPB },
+    { "DBGMCU",		DBGMCU_BASE,	0x10,		SIM_BUS_PPB },
+    { "APB1",		APB1PERIPH_BASE, 0x10000,	SIM_BUS_APB1 },
+    { "APB2",		APB2PERIPH_BASE, 0x10000,	SIM_BUS_APB2 },
+    { "AHB1",		AHB1PERIPH_BASE, 0x60000,	SIM_BUS_AHB },
+    { "PPB",		0xE0000000,	0x100000,	SIM_BUS_PPB },
+};
+
+#define SIM_BLOCKS	(sizeof(s_blocks) / sizeof(s_blocks[0]))
+
+
+// The access currently being single stepped.
+typedef struct
+{
+    int pending;
+    int write;
+    int alarmBlocked;
+    u32 addr;
+    u32 old;
+    void* page;
+    u32 bitband;	// Bit-band access: the alias word at 'addr' stands
+    u32 target;		// for this bit mask of the register at 'target'.
+} SimAccess;
+
+typedef struct
+{
+    uint64_t timeNs;
+    u32 port;
+    u32 pin;
+    u8 level;
+} SimStimulus;
+
+
+struct SimContext
+{
+    ucontext_t uc;
+    void (*entry)(void* arg);
+    void* arg;
+};
+
+
+static SimAccess s_access;
+static uint64_t s_cycles;
+static uint64_t s_timeNs;
+static uint64_t s_timeRemainder;
+static uint64_t s_endNs;
+static uint64_t s_quantumNs;
+static SimStimulus s_stimuli[SIM_MAX_STIMULI];
+static u32 s_stimulusCount;
+static volatile int s_stopping;
+static SimContext* s_context;		// The context switched to last.
+static sigset_t s_threadMask;		// Signals blocked outside handlers.
+int g_simTrace;
+
+
+void* SimAlias(u32 addr)
+{
+    for (u32 i=0; i<SIM_REGIONS; i++)
+    {
+	if (addr - s_regions[i].base < s_regions[i].size)
+	{
+	    return s_regions[i].alias + (addr - s_regions[i].base);
+	}
+    }
+
+    Sim_Printf("sim: no register at 0x%08X\n", addr);
+    abort();
+}
+
+
+static SimRegion* FindRegion(uintptr_t addr)
+{
+    for (u32 i=0; i<SIM_REGIONS; i++)
+    {
+	if (addr - s_regions[i].base < s_regions[i].size)
+	{
+	    return &s_regions[i];
+	}
+    }
+    return 0;
+}
+
+
+static SimBlock* FindBlock(u32 addr)
+{
+    for (u32 i=0; i<SIM_BLOCKS; i++)
+    {
+	if (addr - s_blocks[i].base < s_blocks[i].size)
+	{
+	    return &s_blocks[i];
+	}
+    }
+    return 0;
+}
+
+
+// Approximate cost of a register access in core cycles. An access crosses
+// the bus matrix (1 cycle) and, on APB, the AHB/APB bridge which waits for
+// the slower bus clock.
+static u32 BusCycles(SimBus bus)
+{
+    switch (bus)
+    {
+    case SIM_BUS_AHB:
+	return 2;
+    case SIM_BUS_APB1:
+	return 2 + SimRcc_HCLK() / SimRcc_PCLK1();
+    case SIM_BUS_APB2:
+	return 2 + SimRcc_HCLK() / SimRcc_PCLK2();
+    default:
+	return 1;
+    }
+}
+
+
+static void Fatal(const char* what, uintptr_t addr)
+{
+    Sim_Printf("sim: %s at %p\n", what, (void*)addr);
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGTRAP, SIG_DFL);
+    abort();
+}
+
+
+// A register access. Charge it and let the instruction execute alone.
+static void OnFault(int sig, siginfo_t* info, void* context)
+{
+    ucontext_t* uc = (ucontext_t*)context;
+    uintptr_t a = (uintptr_t)info->si_addr;
+
+    if (!FindRegion(a) || s_access.pending)
+    {
+	// Not a register: let the access fault again as an ordinary crash.
+	Sim_Printf("sim: access outside the simulated peripherals at %p (pc %p)\n",
+	           (void*)a, (void*)uc->uc_mcontext.gregs[REG_RIP]);
+	signal(SIGSEGV, SIG_DFL);
+	return;
+    }
+
+    u32 addr = (u32)a;
+    u32 target = addr;
+    u32 bit = 0;
+
+    // A word in the bit-band alias stands for one bit of a register. The
+    // access is made on the alias word and carried over to the register.
+    if (addr - PERIPH_BB_BASE < SIM_BITBAND_SIZE)
+    {
+	u32 offset = (addr - PERIPH_BB_BASE) >> 2;
+	target = PERIPH_BASE + ((offset >> 3) & ~3u);
+	bit = offset & 31;
+    }
+
+    SimBlock* block = FindBlock(target);
+    u32 cost = BusCycles(block->bus);
+    int write = (uc->uc_mcontext.gregs[REG_ERR] & SIM_PF_WRITE) != 0;
+
+    if (write)
+    {
+	block->writes++;
+    }
+    else
+    {
+	block->reads++;
+    }
+    block->cycles += cost;
+    Sim_Advance(cost, 0);
+
+    s_access.pending = 1;
+    s_access.write = write;
+    s_access.addr = addr & ~3u;
+    s_access.bitband = 0;
+    s_access.target = target;
+    if (addr - PERIPH_BB_BASE < SIM_BITBAND_SIZE)
+    {
+	s_access.bitband = 1u << bit;
+	s_access.old = REG(target);
+	REG(s_access.addr) = (s_access.old >> bit) & 1;
+    }
+    else
+    {
+	s_access.old = REG(s_access.addr);
+    }
+    s_access.page = (void*)(a & ~(uintptr_t)(SIM_PAGE - 1));
+    mprotect(s_access.page, SIM_PAGE, PROT_READ | PROT_WRITE);
+
+    // Single step and keep the host timer out until the instruction is done.
+    uc->uc_mcontext.gregs[REG_EFL] |= SIM_TRAP_FLAG;
+    s_access.alarmBlocked = sigismember(&uc->uc_sigmask, SIGALRM);
+    sigaddset(&uc->uc_sigmask, SIGALRM);
+}
+
+
+// The access has been made. Apply its side effects and take interrupts.
+static void OnTrap(int sig, siginfo_t* info, void* context)
+{
+    ucontext_t* uc = (ucontext_t*)context;
+
+    if (!s_access.pending)
+    {
+	Fatal("unexpected trap", (uintptr_t)info->si_addr);
+    }
+
+    uc->uc_mcontext.gregs[REG_EFL] &= ~SIM_TRAP_FLAG;
+    if (!s_access.alarmBlocked)
+    {
+	sigdelset(&uc->uc_sigmask, SIGALRM);
+    }
+    mprotect(s_access.page, SIM_PAGE, PROT_NONE);
+    s_access.pending = 0;
+
+    u32 addr = s_access.addr;
+    if (s_access.bitband)
+    {
+	// Only bit 0 of a word written to the alias counts.
+	u32 old = s_access.old;
+	u32 value = (REG(addr) & 1) ? (old | s_access.bitband) : (old & ~s_access.bitband);
+	REG(addr) = 0;
+	addr = s_access.target;
+	if (s_access.write)
+	{
+	    REG(addr) = value;
+	}
+    }
+
+    if (addr >= 0xE0000000)
+    {
+	if (s_access.write)
+	{
+	    SimCore_Write(addr, s_access.old, REG(addr));
+	}
+	else
+	{
+	    SimCore_Read(addr);
+	}
+    }
+    else
+    {
+	if (s_access.write)
+	{
+	    SimPeriph_Write(addr, s_access.old, REG(addr));
+	}
+	else
+	{
+	    SimPeriph_Read(addr);
+	}
+    }
+
+    SimCore_Dispatch();
+}
+
+
+// The host timer is one-shot and armed again after every tick, so that the
+// program always gets a host period to run however long the interrupts of a
+// tick take to simulate. A tick that came meanwhile, as from the timer armed
+// by a context switch in the middle of a tick, is dropped or it would come
+// again at once.
+static void ArmTick(void)
+{
+    sigset_t set;
+    struct timespec now = { 0, 0 };
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigtimedwait(&set, 0, &now);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 0;
+    timer.it_value.tv_sec = 0;
+    timer.it_value.tv_usec = SIM_HOST_PERIOD_US;
+    setitimer(ITIMER_REAL, &timer, 0);
+}
+
+
+// The host timer. Lets virtual time pass while the program is busy.
+static void OnTick(int sig)
+{
+    uint64_t cycles = s_quantumNs * SimRcc_HCLK() / 1000000000ull;
+    Sim_Advance(cycles ? cycles : 1, 1);
+    if (!s_stopping)
+    {
+	ArmTick();
+    }
+}
+
+
+static void RunStimuli(void)
+{
+    while (s_stimulusCount && s_stimuli[0].timeNs <= s_timeNs)
+    {
+	SimStimulus s = s_stimuli[0];
+	s_stimulusCount--;
+	memmove(&s_stimuli[0], &s_stimuli[1], s_stimulusCount * sizeof(s));
+	SimPeriph_SetPin(s.port, s.pin, s.level);
+    }
+}
+
+
+static uint64_t CyclesToStimulus(void)
+{
+    if (!s_stimulusCount)
+    {
+	return UINT64_MAX;
+    }
+
+    uint64_t ns = s_stimuli[0].timeNs - s_timeNs;
+    uint64_t hclk = SimRcc_HCLK();
+    uint64_t cycles = (ns * hclk + 999999999ull) / 1000000000ull;
+    return cycles ? cycles : 1;
+}
+
+
+void Sim_Advance(uint64_t cycles, int dispatch)
+{
+    uint64_t target = s_cycles + cycles;
+
+    while (s_cycles < target)
+    {
+	uint64_t step = target - s_cycles;
+	uint64_t next = SimCore_CyclesToEvent();
+	uint64_t n = SimPeriph_CyclesToEvent();
+
+	if (n < next)
+	{
+	    next = n;
+	}
+	n = CyclesToStimulus();
+	if (n < next)
+	{
+	    next = n;
+	}
+	if (next < step)
+	{
+	    step = next;
+	}
+
+	// Keep the time in ns exact across clock changes.
+	uint64_t hclk = SimRcc_HCLK();
+	uint64_t ns = step * 1000000000ull + s_timeRemainder;
+	s_timeNs += ns / hclk;
+	s_timeRemainder = ns % hclk;
+	s_cycles += step;
+
+	SimCore_Step(step);
+	SimPeriph_Step(step);
+	RunStimuli();
+
+	if (s_timeNs >= s_endNs)
+	{
+	    Sim_Stop();
+	}
+	if (dispatch)
+	{
+	    SimCore_Dispatch();
+	}
+    }
+}
+
+
+// Interrupts made pending by the program itself (PRIMASK cleared, NVIC
+// pended) are taken at once, with the host timer held off.
+void Sim_DispatchFromThread(void)
+{
+    sigset_t set;
+    sigset_t old;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigprocmask(SIG_BLOCK, &set, &old);
+    SimCore_Dispatch();
+    sigprocmask(SIG_SETMASK, &old, 0);
+}
+
+
+// Sleep until an interrupt is taken or becomes pending. Nothing happens in
+// between so the clock jumps straight to the next event.
+void Sim_WaitForInterrupt(void)
+{
+    sigset_t set;
+    sigset_t old;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigprocmask(SIG_BLOCK, &set, &old);
+
+    u32 taken = SimCore_TakenCount();
+    while (!SimCore_HasPending() && SimCore_TakenCount() == taken)
+    {
+	uint64_t next = SimCore_CyclesToEvent();
+	uint64_t n = SimPeriph_CyclesToEvent();
+
+	if (n < next)
+	{
+	    next = n;
+	}
+	n = CyclesToStimulus();
+	if (n < next)
+	{
+	    next = n;
+	}
+	n = s_quantumNs * SimRcc_HCLK() / 1000000000ull;
+	if (n < next)
+	{
+	    next = n ? n : 1;
+	}
+	Sim_Advance(next, !Sim_GetPrimask());
+    }
+
+    // The clock has been moved by the sleep already. A host tick that came
+    // meanwhile would add its time again once unblocked.
+    sigset_t pending;
+    sigpending(&pending);
+    if (sigismember(&pending, SIGALRM))
+    {
+	int sig;
+	sigwait(&set, &sig);
+	ArmTick();
+    }
+
+    sigprocmask(SIG_SETMASK, &old, 0);
+}
+
+
+// A new context starts as if its PendSV handler had switched to it and
+// returns from that handler first.
+static void ContextEntry(void)
+{
+    SimContext* context = s_context;
+
+    SimCore_ExitException();
+    SimCore_Dispatch();
+    sigprocmask(SIG_SETMASK, &s_threadMask, 0);
+
+    context->entry(context->arg);
+    Sim_Printf("sim: a context returned from its entry\n");
+    Sim_Stop();
+}
+
+
+SimContext* Sim_CreateContext(void (*entry)(void* arg), void* arg)
+{
+    SimContext* context = calloc(1, sizeof(SimContext));
+    void* stack = malloc(SIM_CONTEXT_STACK);
+
+    if (!context || !stack || getcontext(&context->uc) < 0)
+    {
+	Sim_Printf("sim: cannot create a context\n");
+	abort();
+    }
+
+    // The host timer stays out until the context has left the exception.
+    context->uc.uc_stack.ss_sp = stack;
+    context->uc.uc_stack.ss_size = SIM_CONTEXT_STACK;
+    context->uc.uc_link = 0;
+    sigemptyset(&context->uc.uc_sigmask);
+    sigaddset(&context->uc.uc_sigmask, SIGALRM);
+    context->entry = entry;
+    context->arg = arg;
+    makecontext(&context->uc, ContextEntry, 0);
+    return context;
+}
+
+
+// The exception bookkeeping of the core model is global, and every context
+// that is switched away sits in a PendSV handler. Resuming one returns from
+// that handler on its own stack. The host timer is armed again since the
+// context switched away may have been in the middle of a tick.
+void Sim_SwitchContext(SimContext* from, SimContext* to)
+{
+    static SimContext dropped;
+
+    s_context = to;
+    ArmTick();
+    swapcontext(from ? &from->uc : &dropped.uc, &to->uc);
+}
+
+
+uint64_t Sim_GetCycles(void)
+{
+    return s_cycles;
+}
+
+
+uint64_t Sim_GetTimeNs(void)
+{
+    return s_timeNs;
+}
+
+
+u32 Sim_GetHCLK(void)
+{
+    return SimRcc_HCLK();
+}
+
+
+static u32 PortIndex(GPIO_TypeDef* GPIOx)
+{
+    return ((u32)(uintptr_t)GPIOx - GPIOA_BASE) / 0x400;
+}
+
+
+void Sim_SetPin(GPIO_TypeDef* GPIOx, u16 GPIO_Pin, u8 level)
+{
+    for (u32 pin=0; pin<16; pin++)
+    {
+	if (GPIO_Pin & (1 << pin))
+	{
+	    SimPeriph_SetPin(PortIndex(GPIOx), pin, level);
+	}
+    }
+}
+
+
+void Sim_SchedulePin(uint64_t timeNs, GPIO_TypeDef* GPIOx, u16 GPIO_Pin,
+                     u8 level)
+{
+    for (u32 pin=0; pin<16; pin++)
+    {
+	if (!(GPIO_Pin & (1 << pin)) || s_stimulusCount == SIM_MAX_STIMULI)
+	{
+	    continue;
+	}
+
+	// Keep the list sorted by time.
+	u32 i = s_stimulusCount++;
+	while (i && s_stimuli[i - 1].timeNs > timeNs)
+	{
+	    s_stimuli[i] = s_stimuli[i - 1];
+	    i--;
+	}
+	s_stimuli[i].timeNs = timeNs;
+	s_stimuli[i].port = PortIndex(GPIOx);
+	s_stimuli[i].pin = pin;
+	s_stimuli[i].level = level;
+    }
+}
+
+
+void Sim_Printf(const char* format, ...)
+{
+    // Called from signal handlers, so no stdio buffering.
+    char buffer[256];
+    va_list args;
+
+    va_start(args, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (n > (int)sizeof(buffer) - 1)
+    {
+	n = sizeof(buffer) - 1;
+    }
+    if (n > 0 && write(1, buffer, n) < 0)
+    {
+    }
+}
+
+
+void Sim_Trace(const char* format, ...)
+{
+    char buffer[200];
+    va_list args;
+
+    if (!g_simTrace)
+    {
+	return;
+    }
+
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    Sim_Printf("%10llu.%06llu ms  %s\n", (unsigned long long)(s_timeNs / 1000000),
+               (unsigned long long)(s_timeNs % 1000000), buffer);
+}
+
+
+static void Report(void)
+{
+    u32 reads = 0;
+    u32 writes = 0;
+    uint64_t cycles = 0;
+
+    Sim_Printf("\nSimulated %llu.%03llu ms, %llu cycles, HCLK %u Hz\n",
+               (unsigned long long)(s_timeNs / 1000000),
+               (unsigned long long)(s_timeNs / 1000 % 1000),
+               (unsigned long long)s_cycles, SimRcc_HCLK());
+
+    Sim_Printf("\n%-10s %10s %10s %12s\n", "Registers", "Reads", "Writes", "Bus cycles");
+    for (u32 i=0; i<SIM_BLOCKS; i++)
+    {
+	SimBlock* b = &s_blocks[i];
+	if (b->reads || b->writes)
+	{
+	    Sim_Printf("%-10s %10u %10u %12llu\n", b->name, b->reads, b->writes,
+		       (unsigned long long)b->cycles);
+	    reads += b->reads;
+	    writes += b->writes;
+	    cycles += b->cycles;
+	}
+    }
+    Sim_Printf("%-10s %10u %10u %12llu\n", "Total", reads, writes,
+	       (unsigned long long)cycles);
+
+    SimCore_Report();
+    SimPeriph_Report();
+}
+
+
+void Sim_Stop(void)
+{
+    if (s_stopping)
+    {
+	return;
+    }
+    s_stopping = 1;
+
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_REAL, &off, 0);
+
+    // Whatever the program printed comes before the report.
+    fflush(stdout);
+    Report();
+    _exit(0);
+}
+
+
+static void MapRegions(void)
+{
+    u32 total = 0;
+    for (u32 i=0; i<SIM_REGIONS; i++)
+    {
+	total += s_regions[i].size;
+    }
+
+    int fd = memfd_create("stm32f4-registers", 0);
+    if (fd < 0 || ftruncate(fd, total) < 0)
+    {
+	perror("sim: memfd");
+	exit(1);
+    }
+
+    u32 offset = 0;
+    for (u32 i=0; i<SIM_REGIONS; i++)
+    {
+	SimRegion* r = &s_regions[i];
+	void* device = mmap((void*)(uintptr_t)r->base, r->size, PROT_NONE,
+	                    MAP_SHARED | MAP_FIXED_NOREPLACE, fd, offset);
+	void* alias = mmap(0, r->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                   fd, offset);
+
+	if (device != (void*)(uintptr_t)r->base || alias == MAP_FAILED)
+	{
+	    Sim_Printf("sim: cannot map the registers at 0x%08X\n", r->base);
+	    exit(1);
+	}
+	r->alias = (u8*)alias;
+	offset += r->size;
+    }
+    close(fd);
+}
+
+
+// The vector table at the start of the flash, for programs that read it or
+// move it to RAM. It is read-only like the flash.
+static void MapFlash(void)
+{
+    void* flash = mmap((void*)(uintptr_t)FLASH_BASE, SIM_FLASH_TABLE_SIZE,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (flash != (void*)(uintptr_t)FLASH_BASE)
+    {
+	Sim_Printf("sim: cannot map the flash at 0x%08X\n", FLASH_BASE);
+	exit(1);
+    }
+    memcpy(flash, g_simVectors, sizeof(g_simVectors));
+    mprotect(flash, SIM_FLASH_TABLE_SIZE, PROT_READ);
+}
+
+
+// The 64 KB of CCM RAM, plain memory.
+static void MapCcm(void)
+{
+    void* ccm = mmap((void*)(uintptr_t)CCMDATARAM_BASE, SIM_CCM_SIZE,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (ccm != (void*)(uintptr_t)CCMDATARAM_BASE)
+    {
+	Sim_Printf("sim: cannot map the CCM RAM at 0x%08X\n", CCMDATARAM_BASE);
+	exit(1);
+    }
+}
+
+
+static void InstallHandlers(void)
+{
+    struct sigaction sa;
+
+    // Faults and traps nest when an interrupt handler called from the trap
+    // handler accesses a register itself.
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sigaddset(&sa.sa_mask, SIGALRM);
+    sa.sa_sigaction = OnFault;
+    sigaction(SIGSEGV, &sa, 0);
+    sa.sa_sigaction = OnTrap;
+    sigaction(SIGTRAP, &sa, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = OnTick;
+    sigaction(SIGALRM, &sa, 0);
+}
+
+
+// An edge of the button to 'level' at 'timeNs', with 'bounces' short pulses
+// back to the other level after it.
+static void ScheduleEdge(uint64_t timeNs, u8 level, uint64_t bounces)
+{
+    uint64_t step = bounces ? 2000000 / (2 * bounces) : 0;
+
+    Sim_SchedulePin(timeNs, GPIOA, GPIO_Pin_0, level);
+    for (uint64_t i=0; i<bounces; i++)
+    {
+	Sim_SchedulePin(timeNs + (2 * i + 1) * step, GPIOA, GPIO_Pin_0, !level);
+	Sim_SchedulePin(timeNs + (2 * i + 2) * step, GPIOA, GPIO_Pin_0, level);
+    }
+}
+
+
+static void ScheduleButton(const char* presses, uint64_t bounces)
+{
+    // "at_ms:hold_ms,..." The button on the Discovery board pulls PA0 high.
+    while (presses && *presses)
+    {
+	char* end;
+	uint64_t at = strtoull(presses, &end, 10);
+	uint64_t hold = 100;
+
+	if (*end == ':')
+	{
+	    hold = strtoull(end + 1, &end, 10);
+	}
+	ScheduleEdge(at * 1000000, 1, bounces);
+	ScheduleEdge((at + hold) * 1000000, 0, bounces);
+
+	presses = (*end == ',') ? end + 1 : 0;
+    }
+}
+
+
+// "PD12:PA15,..."
+static void WirePins(const char* wires)
+{
+    while (wires && wires[0] == 'P' && wires[1])
+    {
+	char* end;
+	u32 fromPort = wires[1] - 'A';
+	u32 fromPin = strtoul(wires + 2, &end, 10);
+
+	if (end[0] != ':' || end[1] != 'P' || !end[2])
+	{
+	    return;
+	}
+	u32 toPort = end[2] - 'A';
+	u32 toPin = strtoul(end + 3, &end, 10);
+	SimPeriph_Wire(fromPort, fromPin, toPort, toPin);
+
+	wires = (*end == ',') ? end + 1 : 0;
+    }
+}
+
+
+static uint64_t EnvNumber(const char* name, uint64_t value)
+{
+    const char* s = getenv(name);
+    return (s && *s) ? strtoull(s, 0, 10) : value;
+}
+
+
+// Runs before main() like Reset_Handler in startup_stm32f4xx.s.
+__attribute__((constructor)) static void Sim_Init(void)
+{
+    const char* button = getenv("SIM_BUTTON");
+    const char* wires = getenv("SIM_WIRE");
+
+    s_endNs = EnvNumber("SIM_TIME_MS", 3000) * 1000000;
+    s_quantumNs = EnvNumber("SIM_SPEED", 10) * SIM_HOST_PERIOD_US * 1000;
+    g_simTrace = (int)EnvNumber("SIM_TRACE", 0);
+
+    MapRegions();
+    MapFlash();
+    MapCcm();
+    InstallHandlers();
+    sigprocmask(SIG_SETMASK, 0, &s_threadMask);
+    SimCore_Reset();
+    SimPeriph_Reset();
+    ScheduleButton(button ? button : "500:150,1500:150,2500:150",
+                   EnvNumber("SIM_BOUNCE", 0));
+    WirePins(wires ? wires : "PD12:PA15,PD12:PB4,PD13:PB5");
+
+    SystemInit();
+
+    // The report is also printed if main() ever returns.
+    atexit(Sim_Stop);
+
+    ArmTick();
+}
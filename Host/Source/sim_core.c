@@ -0,0 +1,643 @@
+///////////////////////////// HOST SIMULATION CORE ////////////////////////////
+// Model of the Cortex-M4 core peripherals: NVIC, System Control Block,
+// SysTick and the DWT cycle counter. Also takes the exceptions, i.e. calls
+// the handlers in priority order as the NVIC would.
+
+#include <string.h>
+
+#include "sim_internal.h"
+
+
+#define SIM_IRQS		(SIM_EXCEPTIONS - 16)
+#define SIM_WORDS		((SIM_EXCEPTIONS + 31) / 32)
+#define SIM_THREAD_PRIORITY	0x100
+
+#define NVIC_ISER		(NVIC_BASE + 0x000)
+#define NVIC_ICER		(NVIC_BASE + 0x080)
+#define NVIC_ISPR		(NVIC_BASE + 0x100)
+#define NVIC_ICPR		(NVIC_BASE + 0x180)
+#define NVIC_IABR		(NVIC_BASE + 0x200)
+#define NVIC_IP			(NVIC_BASE + 0x300)
+#define NVIC_STIR		(NVIC_BASE + 0xE00)
+
+#define SCB_ICSR		(SCB_BASE + 0x04)
+#define SCB_VTOR		(SCB_BASE + 0x08)
+#define SCB_AIRCR		(SCB_BASE + 0x0C)
+#define SCB_SHP			(SCB_BASE + 0x18)
+
+#define SYSTICK_CTRL		(SysTick_BASE + 0x0)
+#define SYSTICK_LOAD		(SysTick_BASE + 0x4)
+#define SYSTICK_VAL		(SysTick_BASE + 0x8)
+
+#define DWT_CTRL		0xE0001000
+#define DWT_CYCCNT		0xE0001004
+#define COREDEBUG_DEMCR		(CoreDebug_BASE + 0xC)
+
+// Cycles spent by the core stacking and unstacking an exception frame.
+#define SIM_ENTRY_CYCLES	12
+#define SIM_EXIT_CYCLES		10
+
+#define SIM_SVCALL		11
+#define SIM_PENDSV		14
+#define SIM_SYSTICK		15
+
+
+typedef struct
+{
+    u32 count;
+    uint64_t cycles;
+    uint64_t maxCycles;
+} SimExceptionStats;
+
+
+static u32 s_enabled[SIM_WORDS];
+static u32 s_pending[SIM_WORDS];
+static u32 s_active[SIM_WORDS];
+static int s_stack[SIM_EXCEPTIONS];
+static uint64_t s_nested[SIM_EXCEPTIONS + 1];
+static uint64_t s_start[SIM_EXCEPTIONS + 1];
+static int s_depth;
+static u32 s_primask;
+static u32 s_basepri;
+static u32 s_taken;
+static uint64_t s_tickPhase;
+static SimExceptionStats s_stats[SIM_EXCEPTIONS];
+
+static volatile void* s_exclusiveAddr;
+static u32 s_exclusiveValue;
+
+
+static int IsSet(const u32* bits, int n)
+{
+    return (bits[n / 32] >> (n % 32)) & 1;
+}
+
+
+static void Set(u32* bits, int n, int value)
+{
+    if (value)
+    {
+	bits[n / 32] |= 1u << (n % 32);
+    }
+    else
+    {
+	bits[n / 32] &= ~(1u << (n % 32));
+    }
+}
+
+
+// Priority of an exception as programmed (8 bits, only the top 4 used).
+static int Priority(int e)
+{
+    switch (e)
+    {
+    case 2:
+	return -2;
+    case 3:
+	return -1;
+    }
+
+    if (e < 16)
+    {
+	return REG8(SCB_SHP + e - 4);
+    }
+    return REG8(NVIC_IP + e - 16);
+}
+
+
+// Only the group (preemption) part of a priority decides preemption.
+static int GroupPriority(int priority)
+{
+    u32 group = (REG(SCB_AIRCR) >> 8) & 7;
+    if (priority < 0)
+    {
+	return priority;
+    }
+    return priority & (0xFF << (group + 1)) & 0xFF;
+}
+
+
+static int CurrentPriority(void)
+{
+    int current = SIM_THREAD_PRIORITY;
+
+    if (s_depth)
+    {
+	current = GroupPriority(Priority(s_stack[s_depth - 1]));
+    }
+    if (s_basepri && GroupPriority(s_basepri) < current)
+    {
+	current = GroupPriority(s_basepri);
+    }
+    if (s_primask)
+    {
+	current = 0;
+    }
+    return current;
+}
+
+
+static int IsPending(int e)
+{
+    if (e < 16)
+    {
+	return IsSet(s_pending, e);
+    }
+
+    // Peripheral interrupt lines are levels. The NVIC latches them as
+    // pending until the handler is entered and pends again if the line is
+    // still asserted when it returns.
+    return IsSet(s_enabled, e - 16) && (IsSet(s_pending, e) || SimPeriph_IrqLine(e - 16));
+}
+
+
+// Highest priority pending exception. Ties go to the lower number.
+static int HighestPending(void)
+{
+    int best = -1;
+    int bestPriority = 0;
+
+    for (int w=0; w<SIM_WORDS; w++)
+    {
+	u32 candidates = s_pending[w];
+	if (w * 32 + 31 >= 16)
+	{
+	    // Enabled interrupts may be pending through their line.
+	    u32 e = (w == 0) ? (s_enabled[0] << 16) : ((s_enabled[w] << 16) | (s_enabled[w - 1] >> 16));
+	    candidates |= e;
+	}
+
+	while (candidates)
+	{
+	    int e = w * 32 + __builtin_ctz(candidates);
+	    candidates &= candidates - 1;
+
+	    if (e >= SIM_EXCEPTIONS || IsSet(s_active, e) || !IsPending(e))
+	    {
+		continue;
+	    }
+	    if (best < 0 || Priority(e) < bestPriority)
+	    {
+		best = e;
+		bestPriority = Priority(e);
+	    }
+	}
+    }
+    return best;
+}
+
+
+static void UpdateICSR(void)
+{
+    u32 icsr = 0;
+
+    if (s_depth)
+    {
+	icsr |= (u32)s_stack[s_depth - 1];
+    }
+    if (IsSet(s_pending, SIM_PENDSV))
+    {
+	icsr |= SCB_ICSR_PENDSVSET_Msk;
+    }
+    if (IsSet(s_pending, SIM_SYSTICK))
+    {
+	icsr |= SCB_ICSR_PENDSTSET_Msk;
+    }
+    REG(SCB_ICSR) = icsr;
+
+    for (int w=0; w<SIM_WORDS - 1; w++)
+    {
+	u32 pending = (s_pending[w] >> 16) | (s_pending[w + 1] << 16);
+	u32 active = (s_active[w] >> 16) | (s_active[w + 1] << 16);
+	REG(NVIC_ISPR + 4 * w) = pending;
+	REG(NVIC_ICPR + 4 * w) = pending;
+	REG(NVIC_IABR + 4 * w) = active;
+    }
+}
+
+
+void SimCore_SetPending(int exception)
+{
+    Set(s_pending, exception, 1);
+    UpdateICSR();
+}
+
+
+int SimCore_HasPending(void)
+{
+    return HighestPending() >= 0;
+}
+
+
+u32 SimCore_TakenCount(void)
+{
+    return s_taken;
+}
+
+
+// The handler is fetched from the vector table VTOR points to, as on the
+// core. VTOR 0 is the boot alias of the flash.
+static SimHandler Vector(int e)
+{
+    u32 vtor = REG(SCB_VTOR) & ~0x7Fu;
+    if (vtor < SIM_FLASH_TABLE_SIZE)
+    {
+	vtor += FLASH_BASE;
+    }
+    return ((const SimHandler*)(uintptr_t)vtor)[e];
+}
+
+
+static void Take(int e)
+{
+    SimHandler handler = Vector(e);
+
+    if (!handler)
+    {
+	// The weak default handler in startup_stm32f4xx.s loops forever.
+	Sim_Printf("sim: %s is not defined\n", g_simVectorNames[e]);
+	Sim_Stop();
+    }
+
+    Set(s_pending, e, 0);
+    Set(s_active, e, 1);
+    s_stack[s_depth++] = e;
+    s_nested[s_depth] = 0;
+    s_start[s_depth] = Sim_GetCycles();
+    s_taken++;
+    s_exclusiveAddr = 0;
+    UpdateICSR();
+    Sim_Trace("-> %s", g_simVectorNames[e]);
+    Sim_Advance(SIM_ENTRY_CYCLES, 0);
+
+    handler();
+    SimCore_ExitException();
+}
+
+
+// Returns from the active exception. The start of the handler is kept by
+// depth rather than on the stack, as a context switch (see Sim_SwitchContext)
+// may return from another exception than the one it entered.
+void SimCore_ExitException(void)
+{
+    int e = s_stack[s_depth - 1];
+    uint64_t start = s_start[s_depth];
+
+    Sim_Advance(SIM_EXIT_CYCLES, 0);
+    s_depth--;
+    Set(s_active, e, 0);
+    s_exclusiveAddr = 0;
+    UpdateICSR();
+
+    // Time spent in handlers that preempted this one is theirs.
+    uint64_t total = Sim_GetCycles() - start;
+    uint64_t cycles = total - s_nested[s_depth + 1];
+    s_nested[s_depth] += total;
+    s_stats[e].count++;
+    s_stats[e].cycles += cycles;
+    if (cycles > s_stats[e].maxCycles)
+    {
+	s_stats[e].maxCycles = cycles;
+    }
+}
+
+
+void SimCore_Dispatch(void)
+{
+    for (;;)
+    {
+	int e = HighestPending();
+	if (e < 0 || GroupPriority(Priority(e)) >= CurrentPriority())
+	{
+	    return;
+	}
+	Take(e);
+    }
+}
+
+
+void SimCore_Reset(void)
+{
+    memset(s_enabled, 0, sizeof(s_enabled));
+    memset(s_pending, 0, sizeof(s_pending));
+    memset(s_active, 0, sizeof(s_active));
+    s_depth = 0;
+    s_primask = 0;
+    s_basepri = 0;
+
+    REG(SCB_BASE + 0x00) = 0x410FC241;	// CPUID: Cortex-M4 r0p1.
+    REG(SCB_AIRCR) = 0xFA050000;
+    UpdateICSR();
+}
+
+
+void SimCore_Write(u32 addr, u32 old, u32 value)
+{
+    if (addr - NVIC_ISER < 0x20 || addr - NVIC_ICER < 0x20)
+    {
+	// Enable and disable both read back the enable state.
+	u32 w = (addr & 0x1F) / 4;
+	if (addr < NVIC_ICER)
+	{
+	    s_enabled[w] |= value;
+	}
+	else
+	{
+	    s_enabled[w] &= ~value;
+	}
+	REG(NVIC_ISER + 4 * w) = s_enabled[w];
+	REG(NVIC_ICER + 4 * w) = s_enabled[w];
+    }
+    else if (addr - NVIC_ISPR < 0x20 || addr - NVIC_ICPR < 0x20)
+    {
+	u32 w = (addr & 0x1F) / 4;
+	for (int n=0; n<32; n++)
+	{
+	    if (value & (1u << n) && w * 32 + n < SIM_IRQS)
+	    {
+		Set(s_pending, 16 + w * 32 + n, addr < NVIC_ICPR);
+	    }
+	}
+	UpdateICSR();
+    }
+    else if (addr - NVIC_IABR < 0x20)
+    {
+	REG(addr) = old;
+    }
+    else if (addr == NVIC_STIR)
+    {
+	if ((value & 0x1FF) < SIM_IRQS)
+	{
+	    SimCore_SetPending(16 + (value & 0x1FF));
+	}
+	REG(addr) = 0;
+    }
+    else if (addr == SCB_ICSR)
+    {
+	if (value & SCB_ICSR_PENDSVSET_Msk)
+	{
+	    Set(s_pending, SIM_PENDSV, 1);
+	}
+	if (value & SCB_ICSR_PENDSVCLR_Msk)
+	{
+	    Set(s_pending, SIM_PENDSV, 0);
+	}
+	if (value & SCB_ICSR_PENDSTSET_Msk)
+	{
+	    Set(s_pending, SIM_SYSTICK, 1);
+	}
+	if (value & SCB_ICSR_PENDSTCLR_Msk)
+	{
+	    Set(s_pending, SIM_SYSTICK, 0);
+	}
+	UpdateICSR();
+    }
+    else if (addr == SCB_AIRCR)
+    {
+	if ((value >> 16) != 0x05FA)
+	{
+	    REG(addr) = old;
+	}
+	else if (value & SCB_AIRCR_SYSRESETREQ_Msk)
+	{
+	    Sim_Printf("sim: system reset requested\n");
+	    Sim_Stop();
+	}
+	else
+	{
+	    REG(addr) = 0xFA050000 | (value & SCB_AIRCR_PRIGROUP_Msk);
+	}
+    }
+    else if (addr == SYSTICK_CTRL)
+    {
+	// COUNTFLAG is read-only.
+	if ((value & SysTick_CTRL_ENABLE_Msk) && !(old & SysTick_CTRL_ENABLE_Msk))
+	{
+	    s_tickPhase = 0;
+	}
+	REG(addr) = (value & 0x7) | (old & SysTick_CTRL_COUNTFLAG_Msk);
+    }
+    else if (addr == SYSTICK_LOAD)
+    {
+	REG(addr) = value & SysTick_LOAD_RELOAD_Msk;
+    }
+    else if (addr == SYSTICK_VAL)
+    {
+	// Any write clears the counter and COUNTFLAG.
+	REG(addr) = 0;
+	REG(SYSTICK_CTRL) &= ~SysTick_CTRL_COUNTFLAG_Msk;
+    }
+}
+
+
+void SimCore_Read(u32 addr)
+{
+    if (addr == SYSTICK_CTRL)
+    {
+	REG(addr) &= ~SysTick_CTRL_COUNTFLAG_Msk;
+    }
+}
+
+
+static int CycleCounterEnabled(void)
+{
+    return (REG(COREDEBUG_DEMCR) & CoreDebug_DEMCR_TRCENA_Msk) && (REG(DWT_CTRL) & 1);
+}
+
+
+uint64_t SimCore_CyclesToEvent(void)
+{
+    u32 ctrl = REG(SYSTICK_CTRL);
+    u32 load = REG(SYSTICK_LOAD);
+    u32 val = REG(SYSTICK_VAL);
+
+    if (!(ctrl & SysTick_CTRL_ENABLE_Msk) || !load)
+    {
+	return UINT64_MAX;
+    }
+
+    // From 0 the counter first reloads, then counts down to 0 again.
+    uint64_t div = (ctrl & SysTick_CTRL_CLKSOURCE_Msk) ? 1 : 8;
+    uint64_t ticks = val ? val : (uint64_t)load + 1;
+    return ticks * div - s_tickPhase;
+}
+
+
+void SimCore_Step(uint64_t cycles)
+{
+    u32 ctrl = REG(SYSTICK_CTRL);
+
+    if (CycleCounterEnabled())
+    {
+	REG(DWT_CYCCNT) += (u32)cycles;
+    }
+
+    if (!(ctrl & SysTick_CTRL_ENABLE_Msk) || !REG(SYSTICK_LOAD))
+    {
+	return;
+    }
+
+    uint64_t div = (ctrl & SysTick_CTRL_CLKSOURCE_Msk) ? 1 : 8;
+    s_tickPhase += cycles;
+    uint64_t ticks = s_tickPhase / div;
+    s_tickPhase %= div;
+
+    u32 load = REG(SYSTICK_LOAD);
+    u32 val = REG(SYSTICK_VAL);
+    while (ticks)
+    {
+	if (!val)
+	{
+	    val = load;
+	    ticks--;
+	}
+	else if (ticks >= val)
+	{
+	    ticks -= val;
+	    val = 0;
+	    REG(SYSTICK_CTRL) |= SysTick_CTRL_COUNTFLAG_Msk;
+	    if (ctrl & SysTick_CTRL_TICKINT_Msk)
+	    {
+		SimCore_SetPending(SIM_SYSTICK);
+	    }
+	}
+	else
+	{
+	    val -= (u32)ticks;
+	    ticks = 0;
+	}
+    }
+    REG(SYSTICK_VAL) = val;
+}
+
+
+void Sim_SetPrimask(u32 primask)
+{
+    s_primask = primask & 1;
+    if (!s_primask)
+    {
+	Sim_DispatchFromThread();
+    }
+}
+
+
+u32 Sim_GetPrimask(void)
+{
+    return s_primask;
+}
+
+
+void Sim_SetBasepri(u32 basepri)
+{
+    s_basepri = basepri & 0xFF;
+    Sim_DispatchFromThread();
+}
+
+
+u32 Sim_GetBasepri(void)
+{
+    return s_basepri;
+}
+
+
+u32 Sim_GetIPSR(void)
+{
+    return s_depth ? (u32)s_stack[s_depth - 1] : 0;
+}
+
+
+// The exclusive monitor. Exception entry and return clear it as on the
+// device. The store itself is a compare-and-swap so that an interrupt taken
+// between the monitor check and the store cannot be lost.
+void Sim_ClearExclusive(void)
+{
+    s_exclusiveAddr = 0;
+}
+
+
+u32 Sim_LoadExclusive(volatile void* addr, u32 size)
+{
+    u32 value;
+
+    switch (size)
+    {
+    case 1:
+	value = *(volatile u8*)addr;
+	break;
+    case 2:
+	value = *(volatile u16*)addr;
+	break;
+    default:
+	value = *(volatile u32*)addr;
+	break;
+    }
+
+    s_exclusiveValue = value;
+    s_exclusiveAddr = addr;
+    return value;
+}
+
+
+u32 Sim_StoreExclusive(u32 value, volatile void* addr, u32 size)
+{
+    int stored;
+
+    if (s_exclusiveAddr != addr)
+    {
+	return 1;
+    }
+    s_exclusiveAddr = 0;
+
+    switch (size)
+    {
+    case 1:
+    {
+	u8 expected = (u8)s_exclusiveValue;
+	stored = __atomic_compare_exchange_n((u8*)addr, &expected, (u8)value, 0,
+	                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	break;
+    }
+    case 2:
+    {
+	u16 expected = (u16)s_exclusiveValue;
+	stored = __atomic_compare_exchange_n((u16*)addr, &expected, (u16)value, 0,
+	                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	break;
+    }
+    default:
+    {
+	u32 expected = s_exclusiveValue;
+	stored = __atomic_compare_exchange_n((u32*)addr, &expected, value, 0,
+	                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	break;
+    }
+    }
+    return stored ? 0 : 1;
+}
+
+
+void SimCore_Report(void)
+{
+    uint64_t total = Sim_GetCycles();
+    int header = 0;
+
+    for (int e=0; e<SIM_EXCEPTIONS; e++)
+    {
+	SimExceptionStats* s = &s_stats[e];
+	if (!s->count)
+	{
+	    continue;
+	}
+	if (!header)
+	{
+	    Sim_Printf("\n%-24s %8s %12s %8s %8s %7s\n", "Exceptions", "Taken",
+	               "Cycles", "Average", "Max", "Load");
+	    header = 1;
+	}
+	Sim_Printf("%-24s %8u %12llu %8llu %8llu %6.2f%%\n", g_simVectorNames[e],
+	           s->count, (unsigned long long)s->cycles,
+	           (unsigned long long)(s->cycles / s->count),
+	           (unsigned long long)s->maxCycles,
+	           total ? 100.0 * s->cycles / total : 0.0);
+    }
+}
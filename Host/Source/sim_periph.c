@@ -0,0 +1,1792 @@
+////////////////////////// HOST SIMULATION PERIPHERALS ////////////////////////
+// Model of the device peripherals used by the programs: RCC (clock tree),
+// GPIO ports, SYSCFG/EXTI, the timers TIM2-TIM8 and the DMA controllers.
+
+// Registers hold their state in the simulated register space itself (see
+// REG()). Only what the hardware keeps out of sight is kept here: the shadow
+// registers of the timers, their prescaler counters, the levels driven onto
+// the pins from outside and the position of the DMA streams.
+
+#include <string.h>
+
+#include "sim_internal.h"
+
+
+#define SIM_PORTS		9	// GPIOA..GPIOI
+#define SIM_TIMERS		7	// TIM2..TIM7, TIM8
+#define SIM_DMAS		2
+#define SIM_STREAMS		8
+#define SIM_NONE		0xFF
+#define SIM_MAX_WIRES		4
+
+// Register offsets.
+#define GPIO_MODER		0x00
+#define GPIO_PUPDR		0x0C
+#define GPIO_IDR		0x10
+#define GPIO_ODR		0x14
+#define GPIO_BSRR		0x18
+#define GPIO_AFR		0x20
+
+#define TIM_CR1			0x00
+#define TIM_CR2			0x04
+#define TIM_SMCR		0x08
+#define TIM_DIER		0x0C
+#define TIM_SR			0x10
+#define TIM_EGR			0x14
+#define TIM_CCMR1		0x18
+#define TIM_CCMR2		0x1C
+#define TIM_CCER		0x20
+#define TIM_CNT			0x24
+#define TIM_PSC			0x28
+#define TIM_ARR			0x2C
+#define TIM_CCR1		0x34
+#define TIM_CCR4		0x40
+#define TIM_BDTR		0x44
+#define TIM_DCR			0x48
+#define TIM_DMAR		0x4C
+
+#define DMA_LISR		0x00
+#define DMA_LIFCR		0x08
+#define DMA_SCR			0x00	// Stream registers, from the stream base.
+#define DMA_SNDTR		0x04
+#define DMA_SPAR		0x08
+#define DMA_SM0AR		0x0C
+#define DMA_SM1AR		0x10
+#define DMA_SFCR		0x14
+
+#define EXTI_IMR		(EXTI_BASE + 0x00)
+#define EXTI_RTSR		(EXTI_BASE + 0x08)
+#define EXTI_FTSR		(EXTI_BASE + 0x0C)
+#define EXTI_SWIER		(EXTI_BASE + 0x10)
+#define EXTI_PR			(EXTI_BASE + 0x14)
+#define SYSCFG_EXTICR		(SYSCFG_BASE + 0x08)
+
+#define RCC_CR_ADDR		(RCC_BASE + 0x00)
+#define RCC_PLLCFGR_ADDR	(RCC_BASE + 0x04)
+#define RCC_CFGR_ADDR		(RCC_BASE + 0x08)
+#define RCC_AHB1RSTR_ADDR	(RCC_BASE + 0x10)
+#define RCC_APB1RSTR_ADDR	(RCC_BASE + 0x20)
+#define RCC_APB2RSTR_ADDR	(RCC_BASE + 0x24)
+#define RCC_AHB1ENR_ADDR	(RCC_BASE + 0x30)
+#define RCC_APB1ENR_ADDR	(RCC_BASE + 0x40)
+#define RCC_APB2ENR_ADDR	(RCC_BASE + 0x44)
+
+#define TIMREG(t, offset)	REG((t)->base + (offset))
+#define PORTREG(port, offset)	REG(GPIOA_BASE + 0x400 * (port) + (offset))
+#define DMAREG(d, offset)	REG(((d) ? DMA2_BASE : DMA1_BASE) + (offset))
+#define STREAMREG(s, offset)	REG((s)->base + (offset))
+
+// DMA requests of a timer.
+#define SIM_DMA_UP		0
+#define SIM_DMA_CC1		1	// CC1..CC4 follow.
+#define SIM_DMA_TRIG		5
+
+
+typedef struct
+{
+    const char* name;
+    u32 base;
+    int irq;
+    int ccIrq;		// Capture/compare interrupt, if not 'irq'.
+    u8 apb;		// APB bus and bit of the timer in RCC_APBxENR.
+    u8 bit;
+    u8 advanced;	// Outputs gated by BDTR.MOE.
+    u8 is32;
+    u8 channels;
+    u8 af;		// Alternate function number of the channel pins.
+    u8 itr[4];		// Timers on the internal trigger inputs ITR0..ITR3.
+
+    u32 psc;		// Shadow registers, loaded on an update event.
+    u32 arr;
+    u32 ccr[4];
+    uint64_t phase;	// Core cycles counted towards the next counter tick.
+    u8 down;		// Counting down in center-aligned mode.
+    u8 gate;		// Trigger input level for the gated slave mode.
+    u8 ref[4];		// Output compare reference signals (OCxREF).
+    u8 ti[4];		// Levels on the channel inputs.
+    u8 burst;		// Transfers of the DMA burst through DMAR so far.
+    u8 etr;		// Level on the external trigger input.
+    u8 etrEdges;	// Counted towards the ETR prescaler.
+    u32 updates;
+} SimTimer;
+
+// A pin that can be connected to a timer channel.
+typedef struct
+{
+    u8 port;
+    u8 pin;
+    u8 timer;
+    u8 channel;
+    u8 etr;		// The pin is also the external trigger input (ETR).
+} SimTimerPin;
+
+// A wire from a pin to another, which it drives as an input.
+typedef struct
+{
+    u8 fromPort;
+    u8 fromPin;
+    u8 toPort;
+    u8 toPin;
+} SimWire;
+
+typedef struct
+{
+    u32 changes;
+    uint64_t highNs;
+    uint64_t sinceNs;
+} SimPinStats;
+
+// A DMA stream. Its registers are the state seen by the program; the
+// position within the buffer is kept here.
+typedef struct
+{
+    u32 base;		// Stream registers.
+    u32 count;		// NDTR when the buffer was started.
+    u32 done;		// Items of the buffer transferred.
+    u32 transfers;
+} SimDmaStream;
+
+// A DMA request line of a timer and the stream and channel it goes to.
+typedef struct
+{
+    u8 timer;
+    u8 request;
+    u8 dma;
+    u8 stream;
+    u8 channel;
+} SimDmaRequest;
+
+
+static SimTimer s_timers[SIM_TIMERS] = {
+    { "TIM2", TIM2_BASE, TIM2_IRQn, TIM2_IRQn,		1, 0, 0, 1, 4, 1, { SIM_NONE, 6, 1, 2 } },
+    { "TIM3", TIM3_BASE, TIM3_IRQn, TIM3_IRQn,		1, 1, 0, 0, 4, 2, { SIM_NONE, 0, 3, 2 } },
+    { "TIM4", TIM4_BASE, TIM4_IRQn, TIM4_IRQn,		1, 2, 0, 0, 4, 2, { SIM_NONE, 0, 1, 6 } },
+    { "TIM5", TIM5_BASE, TIM5_IRQn, TIM5_IRQn,		1, 3, 0, 1, 4, 2, { 0, 1, 2, 6 } },
+    { "TIM6", TIM6_BASE, TIM6_DAC_IRQn, TIM6_DAC_IRQn,	1, 4, 0, 0, 0, 0, { SIM_NONE, SIM_NONE, SIM_NONE, SIM_NONE } },
+    { "TIM7", TIM7_BASE, TIM7_IRQn, TIM7_IRQn,		1, 5, 0, 0, 0, 0, { SIM_NONE, SIM_NONE, SIM_NONE, SIM_NONE } },
+    { "TIM8", TIM8_BASE, TIM8_UP_TIM13_IRQn, TIM8_CC_IRQn,	2, 1, 1, 0, 4, 3, { SIM_NONE, 0, 2, 3 } },
+};
+
+static const SimTimerPin s_timerPins[] = {
+    { 0, 0, 0, 0, 1 }, { 0, 1, 0, 1 }, { 0, 2, 0, 2 }, { 0, 3, 0, 3 },	// TIM2
+    { 0, 5, 0, 0, 1 }, { 0, 15, 0, 0, 1 }, { 1, 3, 0, 1 }, { 1, 10, 0, 2 }, { 1, 11, 0, 3 },
+    { 0, 6, 1, 0 }, { 0, 7, 1, 1 }, { 1, 0, 1, 2 }, { 1, 1, 1, 3 },	// TIM3
+    { 1, 4, 1, 0 }, { 1, 5, 1, 1 }, { 2, 6, 1, 0 }, { 2, 7, 1, 1 }, { 2, 8, 1, 2 }, { 2, 9, 1, 3 },
+    { 1, 6, 2, 0 }, { 1, 7, 2, 1 }, { 1, 8, 2, 2 }, { 1, 9, 2, 3 },	// TIM4
+    { 3, 12, 2, 0 }, { 3, 13, 2, 1 }, { 3, 14, 2, 2 }, { 3, 15, 2, 3 },
+    { 0, 0, 3, 0 }, { 0, 1, 3, 1 }, { 0, 2, 3, 2 }, { 0, 3, 3, 3 },	// TIM5
+    { 2, 6, 6, 0 }, { 2, 7, 6, 1 }, { 2, 8, 6, 2 }, { 2, 9, 6, 3 },	// TIM8
+};
+
+#define SIM_TIMER_PINS	(sizeof(s_timerPins) / sizeof(s_timerPins[0]))
+
+// Timer requests of DMA1 (TIM2-TIM7) and DMA2 (TIM8).
+static const SimDmaRequest s_dmaRequests[] = {
+    { 0, SIM_DMA_UP, 0, 1, 3 }, { 0, SIM_DMA_UP, 0, 7, 3 },		// TIM2
+    { 0, SIM_DMA_CC1, 0, 5, 3 }, { 0, SIM_DMA_CC1 + 1, 0, 6, 3 },
+    { 0, SIM_DMA_CC1 + 2, 0, 1, 3 }, { 0, SIM_DMA_CC1 + 3, 0, 6, 3 }, { 0, SIM_DMA_CC1 + 3, 0, 7, 3 },
+    { 1, SIM_DMA_UP, 0, 2, 5 }, { 1, SIM_DMA_CC1, 0, 4, 5 },		// TIM3
+    { 1, SIM_DMA_CC1 + 1, 0, 5, 5 }, { 1, SIM_DMA_CC1 + 2, 0, 7, 5 },
+    { 1, SIM_DMA_CC1 + 3, 0, 2, 5 }, { 1, SIM_DMA_TRIG, 0, 4, 5 },
+    { 2, SIM_DMA_UP, 0, 6, 2 }, { 2, SIM_DMA_CC1, 0, 0, 2 },		// TIM4
+    { 2, SIM_DMA_CC1 + 1, 0, 3, 2 }, { 2, SIM_DMA_CC1 + 2, 0, 7, 2 },
+    { 3, SIM_DMA_UP, 0, 0, 6 }, { 3, SIM_DMA_UP, 0, 6, 6 },		// TIM5
+    { 3, SIM_DMA_CC1, 0, 2, 6 }, { 3, SIM_DMA_CC1 + 1, 0, 4, 6 }, { 3, SIM_DMA_CC1 + 2, 0, 0, 6 },
+    { 3, SIM_DMA_CC1 + 3, 0, 1, 6 }, { 3, SIM_DMA_CC1 + 3, 0, 3, 6 },
+    { 3, SIM_DMA_TRIG, 0, 1, 6 }, { 3, SIM_DMA_TRIG, 0, 3, 6 },
+    { 4, SIM_DMA_UP, 0, 1, 7 },						// TIM6
+    { 5, SIM_DMA_UP, 0, 2, 1 }, { 5, SIM_DMA_UP, 0, 4, 1 },		// TIM7
+    { 6, SIM_DMA_UP, 1, 1, 7 }, { 6, SIM_DMA_CC1, 1, 2, 7 },		// TIM8
+    { 6, SIM_DMA_CC1 + 1, 1, 3, 7 }, { 6, SIM_DMA_CC1 + 2, 1, 4, 7 },
+    { 6, SIM_DMA_CC1 + 3, 1, 7, 7 }, { 6, SIM_DMA_TRIG, 1, 7, 7 },
+    { 6, SIM_DMA_CC1, 1, 2, 0 }, { 6, SIM_DMA_CC1 + 1, 1, 2, 0 }, { 6, SIM_DMA_CC1 + 2, 1, 2, 0 },
+};
+
+#define SIM_DMA_REQUESTS	(sizeof(s_dmaRequests) / sizeof(s_dmaRequests[0]))
+
+static const u8 s_dmaIrqs[SIM_DMAS][SIM_STREAMS] = {
+    { DMA1_Stream0_IRQn, DMA1_Stream1_IRQn, DMA1_Stream2_IRQn, DMA1_Stream3_IRQn,
+      DMA1_Stream4_IRQn, DMA1_Stream5_IRQn, DMA1_Stream6_IRQn, DMA1_Stream7_IRQn },
+    { DMA2_Stream0_IRQn, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn, DMA2_Stream3_IRQn,
+      DMA2_Stream4_IRQn, DMA2_Stream5_IRQn, DMA2_Stream6_IRQn, DMA2_Stream7_IRQn },
+};
+
+static u16 s_inputs[SIM_PORTS];		// Levels driven from outside.
+static u16 s_inputDriven[SIM_PORTS];
+static u16 s_afLevels[SIM_PORTS];	// Levels driven by the timers.
+static u16 s_afDriven[SIM_PORTS];
+static u16 s_levels[SIM_PORTS];		// Pin levels last seen.
+static SimWire s_wires[SIM_MAX_WIRES];
+static u32 s_wireCount;
+static SimPinStats s_pins[SIM_PORTS][16];
+static SimDmaStream s_streams[SIM_DMAS][SIM_STREAMS];
+
+static void TimerInput(SimTimer* t, u32 channel, u8 level);
+static void TimerEtr(SimTimer* t, u8 level);
+static void TimerTrc(SimTimer* t);
+static void TimerCountTicks(SimTimer* t, uint64_t ticks);
+static void DmaRequest(u32 timer, u32 request);
+
+
+/////////////////////////////////// RCC ///////////////////////////////////////
+
+u32 SimRcc_SYSCLK(void)
+{
+    u32 pllcfgr = REG(RCC_PLLCFGR_ADDR);
+
+    switch ((REG(RCC_CFGR_ADDR) >> 2) & 3)
+    {
+    case 1:
+	return HSE_VALUE;
+    case 2:
+    {
+	uint64_t source = (pllcfgr & RCC_PLLCFGR_PLLSRC) ? HSE_VALUE : HSI_VALUE;
+	u32 m = pllcfgr & RCC_PLLCFGR_PLLM;
+	u32 n = (pllcfgr & RCC_PLLCFGR_PLLN) >> 6;
+	u32 p = (((pllcfgr & RCC_PLLCFGR_PLLP) >> 16) + 1) * 2;
+	return m ? (u32)(source * n / m / p) : HSI_VALUE;
+    }
+    default:
+	return HSI_VALUE;
+    }
+}
+
+
+u32 SimRcc_HCLK(void)
+{
+    static const u8 shift[8] = { 1, 2, 3, 4, 6, 7, 8, 9 };
+    u32 hpre = (REG(RCC_CFGR_ADDR) & RCC_CFGR_HPRE) >> 4;
+    return (hpre < 8) ? SimRcc_SYSCLK() : SimRcc_SYSCLK() >> shift[hpre - 8];
+}
+
+
+static u32 ApbClock(u32 ppre)
+{
+    return (ppre < 4) ? SimRcc_HCLK() : SimRcc_HCLK() >> (ppre - 3);
+}
+
+
+u32 SimRcc_PCLK1(void)
+{
+    return ApbClock((REG(RCC_CFGR_ADDR) & RCC_CFGR_PPRE1) >> 10);
+}
+
+
+u32 SimRcc_PCLK2(void)
+{
+    return ApbClock((REG(RCC_CFGR_ADDR) & RCC_CFGR_PPRE2) >> 13);
+}
+
+
+static void RccWrite(u32 addr, u32 old, u32 value)
+{
+    if (addr == RCC_CR_ADDR)
+    {
+	// Oscillators and PLLs are ready as soon as they are switched on.
+	u32 ready = 0;
+	ready |= (value & RCC_CR_HSION) ? RCC_CR_HSIRDY : 0;
+	ready |= (value & RCC_CR_HSEON) ? RCC_CR_HSERDY : 0;
+	ready |= (value & RCC_CR_PLLON) ? RCC_CR_PLLRDY : 0;
+	ready |= (value & RCC_CR_PLLI2SON) ? RCC_CR_PLLI2SRDY : 0;
+	REG(addr) = (value & ~(RCC_CR_HSIRDY | RCC_CR_HSERDY | RCC_CR_PLLRDY | RCC_CR_PLLI2SRDY)) | ready;
+    }
+    else if (addr == RCC_CFGR_ADDR)
+    {
+	// The clock switch is immediate.
+	REG(addr) = (value & ~RCC_CFGR_SWS) | ((value & RCC_CFGR_SW) << 2);
+    }
+    else if (addr == RCC_AHB1RSTR_ADDR || addr == RCC_APB1RSTR_ADDR || addr == RCC_APB2RSTR_ADDR)
+    {
+	u32 reset = value & ~old;
+	for (u32 i=0; i<32; i++)
+	{
+	    if (!(reset & (1u << i)))
+	    {
+		continue;
+	    }
+	    if (addr == RCC_AHB1RSTR_ADDR && i < SIM_PORTS)
+	    {
+		extern void SimGpio_Reset(u32 port);
+		SimGpio_Reset(i);
+	    }
+	    else if (addr == RCC_AHB1RSTR_ADDR && (1u << i) == RCC_AHB1RSTR_DMA1RST)
+	    {
+		extern void SimDma_Reset(u32 dma);
+		SimDma_Reset(0);
+	    }
+	    else if (addr == RCC_AHB1RSTR_ADDR && (1u << i) == RCC_AHB1RSTR_DMA2RST)
+	    {
+		extern void SimDma_Reset(u32 dma);
+		SimDma_Reset(1);
+	    }
+	    else if (addr == RCC_APB2RSTR_ADDR && (1u << i) == RCC_APB2RSTR_SYSCFGRST)
+	    {
+		memset(SimAlias(SYSCFG_BASE), 0, 0x24);
+	    }
+
+	    for (u32 t=0; t<SIM_TIMERS; t++)
+	    {
+		if (addr == (s_timers[t].apb == 2 ? RCC_APB2RSTR_ADDR : RCC_APB1RSTR_ADDR) &&
+		    i == s_timers[t].bit)
+		{
+		    extern void SimTimer_Reset(u32 timer);
+		    SimTimer_Reset(t);
+		}
+	    }
+	}
+    }
+}
+
+
+static void RccReset(void)
+{
+    memset(SimAlias(RCC_BASE), 0, 0x400);
+    REG(RCC_CR_ADDR) = RCC_CR_HSION | RCC_CR_HSIRDY;
+    REG(RCC_PLLCFGR_ADDR) = 0x24003010;
+}
+
+
+/////////////////////////////////// GPIO //////////////////////////////////////
+
+static void PinChanged(u32 port, u32 pin, u8 level)
+{
+    SimPinStats* s = &s_pins[port][pin];
+    uint64_t now = Sim_GetTimeNs();
+
+    s->changes++;
+    if (level)
+    {
+	s->sinceNs = now;
+    }
+    else
+    {
+	s->highNs += now - s->sinceNs;
+    }
+    Sim_Trace("P%c%u %u", 'A' + port, pin, level);
+
+    // The EXTI line of the pin, if the line is connected to this port.
+    u32 source = (REG(SYSCFG_EXTICR + 4 * (pin / 4)) >> (4 * (pin % 4))) & 0xF;
+    u32 line = 1u << pin;
+    if (source == port && (REG(EXTI_IMR) & line) &&
+	(REG(level ? EXTI_RTSR : EXTI_FTSR) & line))
+    {
+	REG(EXTI_PR) |= line;
+    }
+
+    // Timer inputs on the pin.
+    u32 moder = PORTREG(port, GPIO_MODER);
+    u32 af = (PORTREG(port, GPIO_AFR + 4 * (pin / 8)) >> (4 * (pin % 8))) & 0xF;
+    for (u32 i=0; i<SIM_TIMER_PINS; i++)
+    {
+	const SimTimerPin* p = &s_timerPins[i];
+	if (p->port == port && p->pin == pin && ((moder >> (2 * pin)) & 3) == 2 &&
+	    af == s_timers[p->timer].af)
+	{
+	    TimerInput(&s_timers[p->timer], p->channel, level);
+	    if (p->etr)
+	    {
+		TimerEtr(&s_timers[p->timer], level);
+	    }
+	}
+    }
+
+    // Pins wired to this one follow it.
+    for (u32 i=0; i<s_wireCount; i++)
+    {
+	if (s_wires[i].fromPort == port && s_wires[i].fromPin == pin)
+	{
+	    SimPeriph_SetPin(s_wires[i].toPort, s_wires[i].toPin, level);
+	}
+    }
+}
+
+
+// Recomputes the input data register from the pin modes, the output data
+// register and what drives the pins, and reports the pins that changed.
+static void RefreshPort(u32 port)
+{
+    u32 moder = PORTREG(port, GPIO_MODER);
+    u32 pupdr = PORTREG(port, GPIO_PUPDR);
+    u32 odr = PORTREG(port, GPIO_ODR);
+    u16 idr = 0;
+
+    for (u32 pin=0; pin<16; pin++)
+    {
+	u32 bit = 1u << pin;
+	u32 level;
+
+	switch ((moder >> (2 * pin)) & 3)
+	{
+	case 1:
+	    level = odr & bit;
+	    break;
+	case 2:
+	    if (s_afDriven[port] & bit)
+	    {
+		level = s_afLevels[port] & bit;
+		break;
+	    }
+	    // Fall through: an alternate function input reads the pin.
+	case 0:
+	    if (s_inputDriven[port] & bit)
+	    {
+		level = s_inputs[port] & bit;
+	    }
+	    else
+	    {
+		level = ((pupdr >> (2 * pin)) & 3) == 1 ? bit : 0;
+	    }
+	    break;
+	default:
+	    level = 0;
+	    break;
+	}
+	idr |= level;
+    }
+
+    PORTREG(port, GPIO_IDR) = idr;
+
+    u16 changed = idr ^ s_levels[port];
+    s_levels[port] = idr;
+    for (u32 pin=0; changed; pin++, changed >>= 1)
+    {
+	if (changed & 1)
+	{
+	    PinChanged(port, pin, (idr >> pin) & 1);
+	}
+    }
+}
+
+
+void SimGpio_Reset(u32 port)
+{
+    memset(SimAlias(GPIOA_BASE + 0x400 * port), 0, 0x400);
+
+    // The debug pins are in alternate function mode after reset.
+    if (port == 0)
+    {
+	PORTREG(0, GPIO_MODER) = 0xA8000000;
+	PORTREG(0, 0x08) = 0x0C000000;
+	PORTREG(0, GPIO_PUPDR) = 0x64000000;
+    }
+    else if (port == 1)
+    {
+	PORTREG(1, GPIO_MODER) = 0x00000280;
+	PORTREG(1, 0x08) = 0x000000C0;
+	PORTREG(1, GPIO_PUPDR) = 0x00000100;
+    }
+    RefreshPort(port);
+}
+
+
+void SimPeriph_Wire(u32 fromPort, u32 fromPin, u32 toPort, u32 toPin)
+{
+    if (s_wireCount == SIM_MAX_WIRES || fromPort >= SIM_PORTS || toPort >= SIM_PORTS ||
+	fromPin >= 16 || toPin >= 16)
+    {
+	return;
+    }
+
+    SimWire* w = &s_wires[s_wireCount++];
+    w->fromPort = fromPort;
+    w->fromPin = fromPin;
+    w->toPort = toPort;
+    w->toPin = toPin;
+}
+
+
+void SimPeriph_SetPin(u32 port, u32 pin, u8 level)
+{
+    if (port >= SIM_PORTS || pin >= 16)
+    {
+	return;
+    }
+
+    s_inputDriven[port] |= 1u << pin;
+    s_inputs[port] = level ? (s_inputs[port] | (1u << pin)) : (s_inputs[port] & ~(1u << pin));
+    RefreshPort(port);
+}
+
+
+/////////////////////////////////// TIMERS ////////////////////////////////////
+
+static u32 CounterMax(SimTimer* t)
+{
+    return t->is32 ? 0xFFFFFFFF : 0xFFFF;
+}
+
+
+// ARR and CCRx are used directly unless their preload is enabled.
+static u32 Arr(SimTimer* t)
+{
+    if (TIMREG(t, TIM_CR1) & TIM_CR1_ARPE)
+    {
+	return t->arr;
+    }
+    return TIMREG(t, TIM_ARR) & CounterMax(t);
+}
+
+
+static u32 ChannelMode(SimTimer* t, u32 c)
+{
+    return (TIMREG(t, TIM_CCMR1 + 4 * (c / 2)) >> (8 * (c % 2))) & 0xFF;
+}
+
+
+static int IsOutput(SimTimer* t, u32 c)
+{
+    return (ChannelMode(t, c) & 3) == 0;
+}
+
+
+static u32 Ccr(SimTimer* t, u32 c)
+{
+    if (ChannelMode(t, c) & TIM_CCMR1_OC1PE)
+    {
+	return t->ccr[c];
+    }
+    return TIMREG(t, TIM_CCR1 + 4 * c) & CounterMax(t);
+}
+
+
+static int CountingDown(SimTimer* t)
+{
+    u32 cr1 = TIMREG(t, TIM_CR1);
+    return (cr1 & TIM_CR1_CMS) ? t->down : (cr1 & TIM_CR1_DIR) != 0;
+}
+
+
+static int ClockEnabled(SimTimer* t)
+{
+    return (REG(t->apb == 2 ? RCC_APB2ENR_ADDR : RCC_APB1ENR_ADDR) >> t->bit) & 1;
+}
+
+
+static int Clocked(SimTimer* t)
+{
+    u32 smcr = TIMREG(t, TIM_SMCR);
+    u32 sms = smcr & TIM_SMCR_SMS;
+
+    // The counter is blocked while ARR is 0. The external clock and the
+    // encoder modes count edges instead of the internal clock.
+    return (TIMREG(t, TIM_CR1) & TIM_CR1_CEN) && ClockEnabled(t) &&
+	sms != 7 && (sms < 1 || sms > 3) && !(smcr & TIM_SMCR_ECE) &&
+	(sms != 5 || t->gate) && Arr(t);
+}
+
+
+// Core cycles per counter tick. The timers run at twice the clock of their
+// APB bus when its prescaler is not 1.
+static uint64_t Period(SimTimer* t)
+{
+    u32 apb = SimRcc_HCLK() / (t->apb == 2 ? SimRcc_PCLK2() : SimRcc_PCLK1());
+    return (uint64_t)(t->psc + 1) * (apb > 1 ? apb / 2 : 1);
+}
+
+
+// Master mode: pulse the trigger output into the slaves on ITRx.
+static void TimerTrgo(SimTimer* t)
+{
+    extern void SimTimer_Trigger(SimTimer* t);
+    static int depth;
+    u32 index = t - s_timers;
+
+    if (depth > SIM_TIMERS)
+    {
+	return;
+    }
+    depth++;
+
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	SimTimer* s = &s_timers[i];
+	u32 smcr = TIMREG(s, TIM_SMCR);
+	u32 ts = (smcr & TIM_SMCR_TS) >> 4;
+
+	if (s == t || ts >= 4 || s->itr[ts] != index)
+	{
+	    continue;
+	}
+	if (smcr & TIM_SMCR_SMS)
+	{
+	    SimTimer_Trigger(s);
+	}
+	else
+	{
+	    TimerTrc(s);
+	}
+    }
+
+    depth--;
+}
+
+
+static u32 MasterMode(SimTimer* t)
+{
+    return (TIMREG(t, TIM_CR2) & TIM_CR2_MMS) >> 4;
+}
+
+
+// Drives the channel outputs onto the pins in the timer's alternate function.
+static void TimerOutputs(SimTimer* t)
+{
+    u32 index = t - s_timers;
+    u32 ccer = TIMREG(t, TIM_CCER);
+    u16 touched = 0;
+
+    // The outputs of an advanced timer are off until MOE is set.
+    if (t->advanced && !(TIMREG(t, TIM_BDTR) & TIM_BDTR_MOE))
+    {
+	ccer = 0;
+    }
+
+    for (u32 i=0; i<SIM_TIMER_PINS; i++)
+    {
+	const SimTimerPin* p = &s_timerPins[i];
+	if (p->timer != index)
+	{
+	    continue;
+	}
+
+	u32 bit = 1u << p->pin;
+	u32 af = (PORTREG(p->port, GPIO_AFR + 4 * (p->pin / 8)) >> (4 * (p->pin % 8))) & 0xF;
+	u32 c = p->channel;
+
+	if (af == t->af && IsOutput(t, c) && (ccer & (TIM_CCER_CC1E << (4 * c))))
+	{
+	    u32 level = t->ref[c] ^ ((ccer >> (4 * c + 1)) & 1);
+	    s_afDriven[p->port] |= bit;
+	    s_afLevels[p->port] = level ? (s_afLevels[p->port] | bit) : (s_afLevels[p->port] & ~bit);
+	}
+	else if (af == t->af)
+	{
+	    s_afDriven[p->port] &= ~bit;
+	}
+	touched |= 1u << p->port;
+    }
+
+    for (u32 port=0; touched; port++, touched >>= 1)
+    {
+	if (touched & 1)
+	{
+	    RefreshPort(port);
+	}
+    }
+}
+
+
+// Output compare: flags on a match and the reference signals.
+static void TimerCompare(SimTimer* t, int match)
+{
+    u32 cnt = TIMREG(t, TIM_CNT);
+    int down = CountingDown(t);
+
+    for (u32 c=0; c<t->channels; c++)
+    {
+	if (!IsOutput(t, c))
+	{
+	    continue;
+	}
+
+	u32 ccr = Ccr(t, c);
+	u8 ref = t->ref[c];
+	u32 mode = (ChannelMode(t, c) >> 4) & 7;
+
+	if (match && cnt == ccr)
+	{
+	    TIMREG(t, TIM_SR) |= TIM_SR_CC1IF << c;
+	    DmaRequest(t - s_timers, SIM_DMA_CC1 + c);
+	    if (c == 0 && MasterMode(t) == 3)
+	    {
+		TimerTrgo(t);
+	    }
+	    if (mode == 1 || mode == 2 || mode == 3)
+	    {
+		ref = (mode == 1) ? 1 : (mode == 2) ? 0 : !ref;
+	    }
+	}
+
+	switch (mode)
+	{
+	case 4:
+	case 5:
+	    ref = mode == 5;
+	    break;
+	case 6:
+	case 7:
+	    // PWM mode 1 is active while CNT < CCR counting up and while
+	    // CNT <= CCR counting down. PWM mode 2 is the inverse.
+	    ref = down ? (cnt <= ccr) : (cnt < ccr);
+	    ref ^= (mode == 7);
+	    break;
+	}
+
+	if (ref && !t->ref[c] && MasterMode(t) == 4 + c)
+	{
+	    t->ref[c] = ref;
+	    TimerTrgo(t);
+	}
+	t->ref[c] = ref;
+    }
+
+    if (t->channels)
+    {
+	TimerOutputs(t);
+    }
+}
+
+
+// Update event (UEV): loads the shadow registers.
+static void TimerUpdate(SimTimer* t, int software)
+{
+    u32 cr1 = TIMREG(t, TIM_CR1);
+
+    if (cr1 & TIM_CR1_UDIS)
+    {
+	return;
+    }
+
+    t->psc = TIMREG(t, TIM_PSC) & 0xFFFF;
+    t->arr = TIMREG(t, TIM_ARR) & CounterMax(t);
+    for (u32 c=0; c<t->channels; c++)
+    {
+	t->ccr[c] = TIMREG(t, TIM_CCR1 + 4 * c) & CounterMax(t);
+    }
+    t->updates++;
+
+    // With URS set only overflows raise the flag and the DMA request, not
+    // UG.
+    if (!software || !(cr1 & TIM_CR1_URS))
+    {
+	TIMREG(t, TIM_SR) |= TIM_SR_UIF;
+	DmaRequest(t - s_timers, SIM_DMA_UP);
+    }
+
+    u32 mms = MasterMode(t);
+    if (mms == 2 || (mms == 0 && software))
+    {
+	TimerTrgo(t);
+    }
+
+    if (!software && (cr1 & TIM_CR1_OPM))
+    {
+	TIMREG(t, TIM_CR1) &= ~TIM_CR1_CEN;
+    }
+}
+
+
+// Counter re-initialization by UG or by the reset slave mode.
+static void TimerReinit(SimTimer* t)
+{
+    u32 cr1 = TIMREG(t, TIM_CR1);
+
+    t->phase = 0;
+    t->down = 0;
+    TimerUpdate(t, 1);
+
+    int down = !(cr1 & TIM_CR1_CMS) && (cr1 & TIM_CR1_DIR);
+    TIMREG(t, TIM_CNT) = down ? Arr(t) : 0;
+    TimerCompare(t, 0);
+}
+
+
+// Ticks until the counter reaches a value where something happens: an
+// overflow, an underflow or a compare match.
+static uint64_t TicksToEvent(SimTimer* t)
+{
+    u32 cnt = TIMREG(t, TIM_CNT) & CounterMax(t);
+    u32 arr = Arr(t);
+    int center = (TIMREG(t, TIM_CR1) & TIM_CR1_CMS) != 0;
+    int down = CountingDown(t);
+    uint64_t ticks;
+
+    if (center)
+    {
+	ticks = down ? (cnt ? cnt : 1) : (cnt < arr ? arr - cnt : 1);
+    }
+    else if (down)
+    {
+	ticks = (uint64_t)cnt + 1;
+    }
+    else
+    {
+	ticks = (cnt <= arr) ? (uint64_t)arr - cnt + 1 : (uint64_t)CounterMax(t) - cnt + 1;
+    }
+
+    for (u32 c=0; c<t->channels; c++)
+    {
+	if (!IsOutput(t, c))
+	{
+	    continue;
+	}
+
+	u32 ccr = Ccr(t, c);
+	if (!down && ccr > cnt && ccr - cnt < ticks)
+	{
+	    ticks = ccr - cnt;
+	}
+	else if (down && ccr < cnt && cnt - ccr < ticks)
+	{
+	    ticks = cnt - ccr;
+	}
+    }
+    return ticks;
+}
+
+
+// One counter tick, with its events.
+static void TimerTick(SimTimer* t)
+{
+    u32 cr1 = TIMREG(t, TIM_CR1);
+    u32 cnt = TIMREG(t, TIM_CNT) & CounterMax(t);
+    u32 arr = Arr(t);
+    int update = 0;
+
+    if (cr1 & TIM_CR1_CMS)
+    {
+	if (!t->down)
+	{
+	    if (++cnt >= arr)
+	    {
+		cnt = arr;
+		t->down = 1;
+		update = 1;
+	    }
+	}
+	else
+	{
+	    if (cnt)
+	    {
+		cnt--;
+	    }
+	    if (!cnt)
+	    {
+		t->down = 0;
+		update = 1;
+	    }
+	}
+	TIMREG(t, TIM_CR1) = t->down ? (cr1 | TIM_CR1_DIR) : (cr1 & ~TIM_CR1_DIR);
+    }
+    else if (!(cr1 & TIM_CR1_DIR))
+    {
+	if (cnt == arr)
+	{
+	    cnt = 0;
+	    update = 1;
+	}
+	else
+	{
+	    cnt = (cnt + 1) & CounterMax(t);
+	}
+    }
+    else
+    {
+	if (!cnt)
+	{
+	    cnt = arr;
+	    update = 1;
+	}
+	else
+	{
+	    cnt--;
+	}
+    }
+
+    TIMREG(t, TIM_CNT) = cnt;
+    if (update)
+    {
+	TimerUpdate(t, 0);
+    }
+    TimerCompare(t, 1);
+}
+
+
+// Moves the counter by 'ticks' without crossing any event.
+static void TimerSkip(SimTimer* t, uint64_t ticks)
+{
+    if (CountingDown(t))
+    {
+	TIMREG(t, TIM_CNT) -= (u32)ticks;
+    }
+    else
+    {
+	TIMREG(t, TIM_CNT) += (u32)ticks;
+    }
+}
+
+
+static void TimerCountTicks(SimTimer* t, uint64_t ticks)
+{
+    while (ticks && (TIMREG(t, TIM_CR1) & TIM_CR1_CEN) && Arr(t))
+    {
+	uint64_t next = TicksToEvent(t);
+	if (next > ticks)
+	{
+	    TimerSkip(t, ticks);
+	    return;
+	}
+	TimerSkip(t, next - 1);
+	TimerTick(t);
+	ticks -= next;
+    }
+}
+
+
+static void TimerCapture(SimTimer* t, u32 c)
+{
+    if (TIMREG(t, TIM_SR) & (TIM_SR_CC1IF << c))
+    {
+	TIMREG(t, TIM_SR) |= TIM_SR_CC1OF << c;
+    }
+    TIMREG(t, TIM_CCR1 + 4 * c) = TIMREG(t, TIM_CNT);
+    TIMREG(t, TIM_SR) |= TIM_SR_CC1IF << c;
+    DmaRequest(t - s_timers, SIM_DMA_CC1 + c);
+
+    if (c == 0 && MasterMode(t) == 3)
+    {
+	TimerTrgo(t);
+    }
+}
+
+
+// Input capture on the channels mapped to TRC, the trigger input selected
+// by TS. It works without a slave mode.
+static void TimerTrc(SimTimer* t)
+{
+    for (u32 c=0; c<t->channels; c++)
+    {
+	if ((ChannelMode(t, c) & 3) == 3 && (TIMREG(t, TIM_CCER) & (TIM_CCER_CC1E << (4 * c))))
+	{
+	    TimerCapture(t, c);
+	}
+    }
+}
+
+
+// Slave mode: an edge on the trigger input (TRGI).
+void SimTimer_Trigger(SimTimer* t)
+{
+    u32 cr1 = TIMREG(t, TIM_CR1);
+
+    TimerTrc(t);
+    TIMREG(t, TIM_SR) |= TIM_SR_TIF;
+    DmaRequest(t - s_timers, SIM_DMA_TRIG);
+
+    switch (TIMREG(t, TIM_SMCR) & TIM_SMCR_SMS)
+    {
+    case 4:	// Reset mode.
+	TimerReinit(t);
+	break;
+    case 6:	// Trigger mode.
+	if (!(cr1 & TIM_CR1_CEN))
+	{
+	    TIMREG(t, TIM_CR1) = cr1 | TIM_CR1_CEN;
+	    if (MasterMode(t) == 1)
+	    {
+		TimerTrgo(t);
+	    }
+	}
+	break;
+    case 7:	// External clock mode 1.
+	if (ClockEnabled(t))
+	{
+	    TimerCountTicks(t, 1);
+	}
+	break;
+    }
+}
+
+
+// Does an edge to 'level' match the polarity (CCxP/CCxNP) of channel c?
+static int EdgeMatches(SimTimer* t, u32 c, u8 level)
+{
+    u32 ccer = TIMREG(t, TIM_CCER) >> (4 * c);
+    int p = (ccer >> 1) & 1;
+    int np = (ccer >> 3) & 1;
+
+    if (p && np)
+    {
+	return 1;
+    }
+    return p ? !level : level;
+}
+
+
+static void TimerInput(SimTimer* t, u32 channel, u8 level)
+{
+    if (t->ti[channel] == level)
+    {
+	return;
+    }
+    t->ti[channel] = level;
+
+    // Encoder modes: each edge of TI1 (SMS 1 and 3) or of TI2 (SMS 2 and 3)
+    // counts up or down by its direction and the level of the other input,
+    // both after their polarity (TI1FP1 and TI2FP2).
+    u32 sms = TIMREG(t, TIM_SMCR) & TIM_SMCR_SMS;
+    if (sms >= 1 && sms <= 3 && channel < 2 && (sms & (1u << channel)))
+    {
+	u32 ccer = TIMREG(t, TIM_CCER);
+	u32 cr1 = TIMREG(t, TIM_CR1);
+	u8 a = t->ti[0] ^ ((ccer >> 1) & 1);
+	u8 b = t->ti[1] ^ ((ccer >> 5) & 1);
+	int up = (channel == 0) ? (a != b) : (a == b);
+
+	if (ClockEnabled(t) && (cr1 & TIM_CR1_CEN))
+	{
+	    TIMREG(t, TIM_CR1) = up ? (cr1 & ~TIM_CR1_DIR) : (cr1 | TIM_CR1_DIR);
+	    TimerCountTicks(t, 1);
+	}
+    }
+
+    // Input capture on the channels mapped to this input (direct) or to its
+    // neighbour (indirect).
+    for (u32 c=0; c<t->channels; c++)
+    {
+	u32 selection = ChannelMode(t, c) & 3;
+	u32 source = (selection == 1) ? c : (selection == 2) ? (c ^ 1) : SIM_NONE;
+
+	if (source == channel && EdgeMatches(t, c, level) &&
+	    (TIMREG(t, TIM_CCER) & (TIM_CCER_CC1E << (4 * c))))
+	{
+	    TimerCapture(t, c);
+	}
+    }
+
+    // Trigger input of the slave mode controller.
+    u32 ts = (TIMREG(t, TIM_SMCR) & TIM_SMCR_TS) >> 4;
+    if ((ts == 4 && channel == 0) ||
+	(ts == 5 && channel == 0) ||
+	(ts == 6 && channel == 1))
+    {
+	u32 c = (ts == 6) ? 1 : 0;
+	t->gate = level ^ ((TIMREG(t, TIM_CCER) >> (4 * c + 1)) & 1);
+	if (ts == 4 || EdgeMatches(t, c, level))
+	{
+	    SimTimer_Trigger(t);
+	}
+    }
+}
+
+
+// External clock mode 2: the edges on ETR, divided by ETPS, clock the
+// counter. ETP selects the falling edges.
+static void TimerEtr(SimTimer* t, u8 level)
+{
+    u32 smcr = TIMREG(t, TIM_SMCR);
+
+    if (t->etr == level)
+    {
+	return;
+    }
+    t->etr = level;
+
+    if (!(smcr & TIM_SMCR_ECE) || level == ((smcr & TIM_SMCR_ETP) != 0))
+    {
+	return;
+    }
+    if (++t->etrEdges < (1u << ((smcr & TIM_SMCR_ETPS) >> 12)))
+    {
+	return;
+    }
+    t->etrEdges = 0;
+    if (ClockEnabled(t))
+    {
+	TimerCountTicks(t, 1);
+    }
+}
+
+
+// A DMA read of DMAR reads the register DBA words after CR1, plus the
+// transfers of the burst so far, as a write does (see TimerWrite()).
+static int TimerReadDmar(u32 addr, u32* value)
+{
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	SimTimer* t = &s_timers[i];
+	if (addr != t->base + TIM_DMAR)
+	{
+	    continue;
+	}
+
+	u32 dcr = TIMREG(t, TIM_DCR);
+	u32 target = 4 * ((dcr & TIM_DCR_DBA) + t->burst);
+	t->burst = (t->burst + 1) % (((dcr & TIM_DCR_DBL) >> 8) + 1);
+	*value = (target < TIM_DCR) ? TIMREG(t, target) : 0;
+	return 1;
+    }
+    return 0;
+}
+
+
+void SimTimer_Reset(u32 timer)
+{
+    SimTimer* t = &s_timers[timer];
+
+    memset(SimAlias(t->base), 0, 0x54);
+    t->psc = 0;
+    t->arr = 0;
+    memset(t->ccr, 0, sizeof(t->ccr));
+    memset(t->ref, 0, sizeof(t->ref));
+    t->burst = 0;
+    t->etrEdges = 0;
+    t->phase = 0;
+    t->down = 0;
+    TIMREG(t, TIM_ARR) = CounterMax(t);
+    t->arr = CounterMax(t);
+}
+
+
+static void TimerWrite(SimTimer* t, u32 offset, u32 old, u32 value)
+{
+    switch (offset)
+    {
+    case TIM_CR1:
+	// DIR is read-only in center-aligned mode. Entering it, the counter
+	// goes on in the direction DIR had.
+	if (value & TIM_CR1_CMS)
+	{
+	    value = (value & ~TIM_CR1_DIR) | (old & TIM_CR1_DIR);
+	    TIMREG(t, TIM_CR1) = value;
+	    if (!(old & TIM_CR1_CMS))
+	    {
+		t->down = (value & TIM_CR1_DIR) != 0;
+	    }
+	}
+	if ((value & TIM_CR1_CEN) && !(old & TIM_CR1_CEN) && MasterMode(t) == 1)
+	{
+	    TimerTrgo(t);
+	}
+	break;
+
+    case TIM_SR:
+	// Flags are cleared by writing 0.
+	TIMREG(t, TIM_SR) = old & value & 0xFFFF;
+	break;
+
+    case TIM_EGR:
+	TIMREG(t, TIM_EGR) = 0;
+	if (value & TIM_EGR_UG)
+	{
+	    TimerReinit(t);
+	}
+	for (u32 c=0; c<t->channels; c++)
+	{
+	    if (!(value & (TIM_EGR_CC1G << c)))
+	    {
+		continue;
+	    }
+	    if (IsOutput(t, c))
+	    {
+		TIMREG(t, TIM_SR) |= TIM_SR_CC1IF << c;
+		DmaRequest(t - s_timers, SIM_DMA_CC1 + c);
+	    }
+	    else
+	    {
+		TimerCapture(t, c);
+	    }
+	}
+	if (value & TIM_EGR_TG)
+	{
+	    TIMREG(t, TIM_SR) |= TIM_SR_TIF;
+	    DmaRequest(t - s_timers, SIM_DMA_TRIG);
+	}
+	break;
+
+    case TIM_DCR:
+	t->burst = 0;
+	break;
+
+    case TIM_DMAR:
+    {
+	// The write goes on to the register DBA words after CR1, plus the
+	// transfers of the burst so far (see DmaRequest()). A DMA read goes
+	// the same way (see TimerReadDmar()).
+	u32 dcr = TIMREG(t, TIM_DCR);
+	u32 target = 4 * ((dcr & TIM_DCR_DBA) + t->burst);
+	t->burst = (t->burst + 1) % (((dcr & TIM_DCR_DBL) >> 8) + 1);
+	TIMREG(t, TIM_DMAR) = 0;
+	if (target < TIM_DCR)
+	{
+	    u32 before = TIMREG(t, target);
+	    TIMREG(t, target) = value;
+	    TimerWrite(t, target, before, value);
+	}
+	break;
+    }
+
+    case TIM_CNT:
+	TIMREG(t, TIM_CNT) = value & CounterMax(t);
+	TimerCompare(t, 0);
+	break;
+
+    case TIM_CCMR1:
+    case TIM_CCMR2:
+    case TIM_CCER:
+    case TIM_BDTR:
+	TimerCompare(t, 0);
+	break;
+
+    default:
+	if (offset >= TIM_CCR1 && offset <= TIM_CCR4)
+	{
+	    // Without preload the write goes to the active register too, which
+	    // stays when the preload is enabled again.
+	    u32 c = (offset - TIM_CCR1) / 4;
+	    if (!(ChannelMode(t, c) & TIM_CCMR1_OC1PE))
+	    {
+		t->ccr[c] = value & CounterMax(t);
+	    }
+	    TimerCompare(t, 0);
+	}
+	break;
+    }
+}
+
+
+/////////////////////////////////// EXTI //////////////////////////////////////
+
+static void ExtiWrite(u32 addr, u32 old, u32 value)
+{
+    if (addr == EXTI_SWIER)
+    {
+	// A 0 to 1 transition raises the request of an unmasked line.
+	REG(EXTI_PR) |= value & ~old & REG(EXTI_IMR);
+    }
+    else if (addr == EXTI_PR)
+    {
+	// Pending bits are cleared by writing 1, which also clears SWIER.
+	REG(EXTI_PR) = old & ~value;
+	REG(EXTI_SWIER) &= ~value;
+    }
+}
+
+
+static u32 ExtiLines(int irq)
+{
+    switch (irq)
+    {
+    case EXTI0_IRQn:
+    case EXTI1_IRQn:
+    case EXTI2_IRQn:
+    case EXTI3_IRQn:
+    case EXTI4_IRQn:
+	return 1u << (irq - EXTI0_IRQn);
+    case EXTI9_5_IRQn:
+	return 0x03E0;
+    case EXTI15_10_IRQn:
+	return 0xFC00;
+    default:
+	return 0;
+    }
+}
+
+
+/////////////////////////////////// DMA ///////////////////////////////////////
+
+// A request moves one item at once, at the time of the event that raised
+// it, or DBL + 1 items to the DMAR of a timer (a timer DMA burst). The FIFO,
+// the memory and peripheral bursts and the arbitration between streams are
+// not modelled, nor memory-to-memory transfers. An item is PSIZE wide on both
+// sides. The memory addresses are the host addresses of program variables,
+// which fit 32 bits in the non-PIE build.
+
+static SimDmaStream* Stream(u32 d, u32 n)
+{
+    return &s_streams[d][n];
+}
+
+
+// Bit position of the flags of stream 'n' in LISR/HISR.
+static u32 FlagShift(u32 n)
+{
+    static const u8 shift[4] = { 0, 6, 16, 22 };
+    return shift[n % 4];
+}
+
+
+static void DmaFlags(u32 d, u32 n, u32 flags)
+{
+    DMAREG(d, DMA_LISR + 4 * (n / 4)) |= flags << FlagShift(n);
+}
+
+
+static void DmaDisable(SimDmaStream* s)
+{
+    STREAMREG(s, DMA_SCR) &= ~DMA_SxCR_EN;
+}
+
+
+// Peripheral side. DMA1 reaches only the APB1 peripherals: it has no path
+// through the bus matrix to the GPIO ports, for example.
+static int DmaRegister(u32 d, u32 addr)
+{
+    if (d == 0)
+    {
+	return addr - APB1PERIPH_BASE < 0x8000;
+    }
+    return addr - PERIPH_BASE < 0x80000;
+}
+
+
+static u32 DmaRead(u32 addr, u32 size, int reg)
+{
+    u32 value = 0;
+    if (reg && TimerReadDmar(addr, &value))
+    {
+	return value;
+    }
+    memcpy(&value, reg ? SimAlias(addr) : (void*)(uintptr_t)addr, size);
+    return value;
+}
+
+
+static void DmaWrite(u32 addr, u32 size, u32 value, int reg)
+{
+    if (!reg)
+    {
+	memcpy((void*)(uintptr_t)addr, &value, size);
+	return;
+    }
+
+    u32 word = addr & ~3u;
+    u32 old = REG(word);
+    memcpy(SimAlias(addr), &value, size);
+    SimPeriph_Write(word, old, REG(word));
+}
+
+
+static void DmaTransfer(u32 d, u32 n)
+{
+    SimDmaStream* s = Stream(d, n);
+    u32 cr = STREAMREG(s, DMA_SCR);
+    u32 size = 1u << ((cr & DMA_SxCR_PSIZE) >> 11);
+    u32 periph = STREAMREG(s, DMA_SPAR) + ((cr & DMA_SxCR_PINC) ? s->done * size : 0);
+    u32 memory = STREAMREG(s, (cr & DMA_SxCR_CT) ? DMA_SM1AR : DMA_SM0AR) +
+	((cr & DMA_SxCR_MINC) ? s->done * size : 0);
+
+    if (!DmaRegister(d, periph))
+    {
+	DmaFlags(d, n, DMA_LISR_TEIF0);
+	DmaDisable(s);
+	return;
+    }
+
+    if ((cr & DMA_SxCR_DIR) == DMA_SxCR_DIR_0)
+    {
+	DmaWrite(periph, size, DmaRead(memory, size, 0), 1);
+    }
+    else
+    {
+	DmaWrite(memory, size, DmaRead(periph, size, 1), 0);
+    }
+
+    s->done++;
+    s->transfers++;
+    STREAMREG(s, DMA_SNDTR) = s->count - s->done;
+
+    if (s->count > 1 && s->done == s->count / 2)
+    {
+	DmaFlags(d, n, DMA_LISR_HTIF0);
+    }
+    if (s->done < s->count)
+    {
+	return;
+    }
+
+    // End of the buffer. Circular streams start over, in double buffer mode
+    // with the other buffer.
+    DmaFlags(d, n, DMA_LISR_TCIF0);
+    cr = STREAMREG(s, DMA_SCR);
+    if (cr & (DMA_SxCR_CIRC | DMA_SxCR_DBM))
+    {
+	s->done = 0;
+	STREAMREG(s, DMA_SNDTR) = s->count;
+	if (cr & DMA_SxCR_DBM)
+	{
+	    STREAMREG(s, DMA_SCR) = cr ^ DMA_SxCR_CT;
+	}
+    }
+    else
+    {
+	DmaDisable(s);
+    }
+}
+
+
+static void DmaRequest(u32 timer, u32 request)
+{
+    u32 enable = (request == SIM_DMA_TRIG) ? TIM_DIER_TDE : TIM_DIER_UDE << request;
+
+    if (!(TIMREG(&s_timers[timer], TIM_DIER) & enable))
+    {
+	return;
+    }
+
+    for (u32 i=0; i<SIM_DMA_REQUESTS; i++)
+    {
+	const SimDmaRequest* r = &s_dmaRequests[i];
+	SimDmaStream* s = Stream(r->dma, r->stream);
+	u32 cr = STREAMREG(s, DMA_SCR);
+
+	if (r->timer == timer && r->request == request &&
+	    (cr & DMA_SxCR_EN) && ((cr & DMA_SxCR_CHSEL) >> 25) == r->channel &&
+	    (REG(RCC_AHB1ENR_ADDR) & (r->dma ? RCC_AHB1ENR_DMA2EN : RCC_AHB1ENR_DMA1EN)))
+	{
+	    // A stream that writes DMAR gets the request for the whole burst.
+	    SimTimer* t = &s_timers[timer];
+	    u32 items = 1;
+	    if (STREAMREG(s, DMA_SPAR) == t->base + TIM_DMAR)
+	    {
+		items = ((TIMREG(t, TIM_DCR) & TIM_DCR_DBL) >> 8) + 1;
+		t->burst = 0;
+	    }
+	    for (u32 k=0; k<items && (STREAMREG(s, DMA_SCR) & DMA_SxCR_EN); k++)
+	    {
+		DmaTransfer(r->dma, r->stream);
+	    }
+	}
+    }
+}
+
+
+static void StreamWrite(u32 d, u32 n, u32 offset, u32 old, u32 value)
+{
+    SimDmaStream* s = Stream(d, n);
+    u32 cr = STREAMREG(s, DMA_SCR);
+
+    if (offset == DMA_SCR)
+    {
+	// Only EN and the interrupt enables can be changed while enabled.
+	u32 open = DMA_SxCR_EN | DMA_SxCR_TCIE | DMA_SxCR_HTIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE;
+	if (old & DMA_SxCR_EN)
+	{
+	    value = (old & ~open) | (value & open);
+	    STREAMREG(s, DMA_SCR) = value;
+	}
+
+	if ((value & DMA_SxCR_EN) && !(old & DMA_SxCR_EN))
+	{
+	    s->count = STREAMREG(s, DMA_SNDTR) & 0xFFFF;
+	    s->done = 0;
+	}
+	else if (!(value & DMA_SxCR_EN) && (old & DMA_SxCR_EN))
+	{
+	    // Stopped by the program: the transfer is over as well.
+	    DmaFlags(d, n, DMA_LISR_TCIF0);
+	}
+	return;
+    }
+
+    if (!(cr & DMA_SxCR_EN))
+    {
+	return;
+    }
+
+    // In double buffer mode the buffer not in use may be changed. Writing the
+    // one in use is an error that stops the stream.
+    if ((cr & DMA_SxCR_DBM) && (offset == DMA_SM0AR || offset == DMA_SM1AR))
+    {
+	if ((offset == DMA_SM1AR) != ((cr & DMA_SxCR_CT) != 0))
+	{
+	    return;
+	}
+	DmaFlags(d, n, DMA_LISR_TEIF0);
+	DmaDisable(s);
+    }
+    STREAMREG(s, offset) = old;
+}
+
+
+static void DmaRegisterWrite(u32 d, u32 offset, u32 old, u32 value)
+{
+    if (offset < DMA_LIFCR)
+    {
+	// LISR and HISR are read only.
+	DMAREG(d, offset) = old;
+    }
+    else if (offset < 0x10)
+    {
+	// Flags are cleared by writing 1. The register always reads 0.
+	DMAREG(d, offset - 8) &= ~value;
+	DMAREG(d, offset) = 0;
+    }
+    else if (offset < 0x10 + 0x18 * SIM_STREAMS)
+    {
+	StreamWrite(d, (offset - 0x10) / 0x18, (offset - 0x10) % 0x18, old, value);
+    }
+}
+
+
+static int DmaIrqLine(u32 d, u32 n)
+{
+    SimDmaStream* s = Stream(d, n);
+    u32 flags = DMAREG(d, DMA_LISR + 4 * (n / 4)) >> FlagShift(n);
+    u32 cr = STREAMREG(s, DMA_SCR);
+
+    // TCIE, HTIE, TEIE and DMEIE are one bit below their flags.
+    return ((flags & (cr << 1) & 0x3C) != 0) ||
+	((flags & DMA_LISR_FEIF0) && (STREAMREG(s, DMA_SFCR) & DMA_SxFCR_FEIE));
+}
+
+
+void SimDma_Reset(u32 d)
+{
+    u32 base = d ? DMA2_BASE : DMA1_BASE;
+
+    memset(SimAlias(base), 0, 0x10 + 0x18 * SIM_STREAMS);
+    for (u32 n=0; n<SIM_STREAMS; n++)
+    {
+	SimDmaStream* s = Stream(d, n);
+	memset(s, 0, sizeof(*s));
+	s->base = base + 0x10 + 0x18 * n;
+	STREAMREG(s, DMA_SFCR) = 0x21;	// FIFO empty, threshold 1/2.
+    }
+}
+
+
+///////////////////////////////// INTERFACE ///////////////////////////////////
+
+void SimPeriph_Reset(void)
+{
+    RccReset();
+    memset(SimAlias(SYSCFG_BASE), 0, 0x24);
+    memset(SimAlias(EXTI_BASE), 0, 0x18);
+
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	SimTimer_Reset(i);
+    }
+
+    for (u32 d=0; d<SIM_DMAS; d++)
+    {
+	SimDma_Reset(d);
+    }
+
+    for (u32 port=0; port<SIM_PORTS; port++)
+    {
+	SimGpio_Reset(port);
+    }
+    memset(s_pins, 0, sizeof(s_pins));
+}
+
+
+void SimPeriph_Write(u32 addr, u32 old, u32 value)
+{
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	if (addr - s_timers[i].base < 0x400)
+	{
+	    TimerWrite(&s_timers[i], addr & 0x3FF, old, value);
+	    return;
+	}
+    }
+
+    if (addr - DMA1_BASE < 0x400 || addr - DMA2_BASE < 0x400)
+    {
+	DmaRegisterWrite(addr >= DMA2_BASE, addr & 0x3FF, old, value);
+    }
+    else if (addr - GPIOA_BASE < SIM_PORTS * 0x400)
+    {
+	u32 port = (addr - GPIOA_BASE) / 0x400;
+
+	switch (addr & 0x3FF)
+	{
+	case GPIO_IDR:
+	    REG(addr) = old;
+	    break;
+	case GPIO_BSRR:
+	{
+	    // Set has priority over reset. The register always reads 0.
+	    u32 odr = PORTREG(port, GPIO_ODR);
+	    PORTREG(port, GPIO_ODR) = (odr & ~(value >> 16)) | (value & 0xFFFF);
+	    REG(addr) = 0;
+	    break;
+	}
+	case GPIO_MODER:
+	case GPIO_AFR:
+	case GPIO_AFR + 4:
+	    for (u32 i=0; i<SIM_TIMERS; i++)
+	    {
+		TimerOutputs(&s_timers[i]);
+	    }
+	    break;
+	}
+	RefreshPort(port);
+    }
+    else if (addr - EXTI_BASE < 0x400)
+    {
+	ExtiWrite(addr, old, value);
+    }
+    else if (addr - RCC_BASE < 0x400)
+    {
+	RccWrite(addr, old, value);
+    }
+}
+
+
+void SimPeriph_Read(u32 addr)
+{
+}
+
+
+int SimPeriph_IrqLine(int irq)
+{
+    u32 lines = ExtiLines(irq);
+
+    if (lines)
+    {
+	return (REG(EXTI_PR) & REG(EXTI_IMR) & lines) != 0;
+    }
+
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	SimTimer* t = &s_timers[i];
+	u32 flags = 0;
+
+	// UIF, CCxIF and TIF and their enables share their bit positions.
+	// TIM8 has a vector of its own for the compare flags (TIF, on the
+	// TRG_COM vector, is not simulated there).
+	if (t->irq == irq)
+	{
+	    flags = (t->ccIrq == irq) ? 0x5F : TIM_SR_UIF;
+	}
+	else if (t->ccIrq == irq)
+	{
+	    flags = TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF;
+	}
+	if (flags)
+	{
+	    return (TIMREG(t, TIM_SR) & TIMREG(t, TIM_DIER) & flags) != 0;
+	}
+    }
+
+    for (u32 d=0; d<SIM_DMAS; d++)
+    {
+	for (u32 n=0; n<SIM_STREAMS; n++)
+	{
+	    if (s_dmaIrqs[d][n] == irq)
+	    {
+		return DmaIrqLine(d, n);
+	    }
+	}
+    }
+    return 0;
+}
+
+
+uint64_t SimPeriph_CyclesToEvent(void)
+{
+    uint64_t best = UINT64_MAX;
+
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	SimTimer* t = &s_timers[i];
+	if (!Clocked(t))
+	{
+	    continue;
+	}
+
+	uint64_t cycles = TicksToEvent(t) * Period(t);
+	cycles = (cycles > t->phase) ? cycles - t->phase : 1;
+	if (cycles < best)
+	{
+	    best = cycles;
+	}
+    }
+    return best;
+}
+
+
+void SimPeriph_Step(uint64_t cycles)
+{
+    uint64_t ticks[SIM_TIMERS];
+
+    // Find out what every timer counts before applying it, so that a timer
+    // started by another one's trigger does not count the time before.
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	SimTimer* t = &s_timers[i];
+	ticks[i] = 0;
+	if (Clocked(t))
+	{
+	    uint64_t period = Period(t);
+	    t->phase += cycles;
+	    ticks[i] = t->phase / period;
+	    t->phase %= period;
+	}
+    }
+
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	if (ticks[i])
+	{
+	    TimerCountTicks(&s_timers[i], ticks[i]);
+	}
+    }
+}
+
+
+void SimPeriph_Report(void)
+{
+    uint64_t now = Sim_GetTimeNs();
+    int header = 0;
+
+    for (u32 i=0; i<SIM_TIMERS; i++)
+    {
+	if (!s_timers[i].updates)
+	{
+	    continue;
+	}
+	if (!header)
+	{
+	    Sim_Printf("\n%-10s %10s\n", "Timers", "Updates");
+	    header = 1;
+	}
+	Sim_Printf("%-10s %10u\n", s_timers[i].name, s_timers[i].updates);
+    }
+
+    header = 0;
+    for (u32 d=0; d<SIM_DMAS; d++)
+    {
+	for (u32 n=0; n<SIM_STREAMS; n++)
+	{
+	    if (!s_streams[d][n].transfers)
+	    {
+		continue;
+	    }
+	    if (!header)
+	    {
+		Sim_Printf("\n%-10s %10s\n", "DMA", "Transfers");
+		header = 1;
+	    }
+	    Sim_Printf("DMA%u S%-5u %10u\n", d + 1, n, s_streams[d][n].transfers);
+	}
+    }
+
+    header = 0;
+    for (u32 port=0; port<SIM_PORTS; port++)
+    {
+	for (u32 pin=0; pin<16; pin++)
+	{
+	    SimPinStats* s = &s_pins[port][pin];
+	    uint64_t high = s->highNs;
+
+	    if (!s->changes)
+	    {
+		continue;
+	    }
+	    if (s_levels[port] & (1u << pin))
+	    {
+		high += now - s->sinceNs;
+	    }
+	    if (!header)
+	    {
+		Sim_Printf("\n%-10s %10s %7s\n", "Pins", "Changes", "High");
+		header = 1;
+	    }
+	    Sim_Printf("P%c%-9u %10u %6.2f%%\n", 'A' + port, pin, s->changes,
+	               now ? 100.0 * high / now : 0.0);
+	}
+    }
+}
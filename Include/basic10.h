@@ -0,0 +1,3 @@
+#pragma once
+
+void Basic10();
\ No newline at end of file
@@ -0,0 +1,3 @@
+#pragma once
+
+void Basic13();
\ No newline at end of file
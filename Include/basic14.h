@@ -0,0 +1,3 @@
+#pragma once
+
+void Basic14();
\ No newline at end of file
@@ -0,0 +1,3 @@
+#pragma once
+
+void Basic17();
\ No newline at end of file
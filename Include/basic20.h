@@ -0,0 +1,3 @@
+#pragma once
+
+void Basic20();
\ No newline at end of file
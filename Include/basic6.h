@@ -1,3 +1,4 @@
 #pragma once
 
-void Basic6();
\ No newline at end of file
+void Basic6();
+void Basic6_OnUpdate();
\ No newline at end of file
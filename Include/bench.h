@@ -0,0 +1,47 @@
+#pragma once
+
+// Micro-benchmarks timed with the DWT cycle counter (see bench.c).
+
+// The CMSIS version used here does not define the DWT. Only its control
+// register and the cycle counter are needed, here and in profile.c.
+#define DWT_CTRL		(*(volatile u32*)0xE0001000)
+#define DWT_CYCCNT		(*(volatile u32*)0xE0001004)
+#define DWT_CTRL_CYCCNTENA	0x00000001
+
+#define BENCH_MAX_SAMPLES	256
+
+// A named code region timed once per Bench_Start()/Bench_Stop() pair.
+typedef struct
+{
+    const char* name;
+    u32 start;
+    u32 count;
+    u32 samples[BENCH_MAX_SAMPLES];
+} BenchRegion;
+
+// The distribution of the samples of a region.
+typedef struct
+{
+    const char* name;
+    u32 count;
+    u32 min;
+    u32 median;
+    u32 p99;
+    u32 max;
+} BenchResult;
+
+void Bench_Init();
+u32 Bench_Now();
+const char* Bench_Unit();
+
+void Bench_Begin(BenchRegion* region, const char* name);
+void Bench_Start(BenchRegion* region);
+void Bench_Stop(BenchRegion* region);
+void Bench_Summarize(BenchRegion* region, BenchResult* result);
+
+// Times 'function' over 'iterations' calls (at most BENCH_MAX_SAMPLES).
+void Bench_Run(const char* name, void (*function)(), u32 iterations,
+	       BenchResult* result);
+
+void Bench_PrintHeader();
+void Bench_Print(const BenchResult* result);
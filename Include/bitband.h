@@ -0,0 +1,114 @@
+#pragma once
+
+//////////////////////////////////// BIT-BAND /////////////////////////////////
+// Sets and clears single bits of peripheral registers and of SRAM words with
+// one store. Everything is inline in this header.
+
+// TIM_Cmd(TIM6, ENABLE) does CR1 |= CEN: it reads CR1, sets the bit and
+// writes CR1 back. An interrupt that changes another bit of CR1 in between
+// has its change undone. The usual cure is to disable the interrupts around
+// the three instructions.
+
+// The Cortex-M4 maps each bit of the first 1 MB of the SRAM (0x20000000) and
+// of the peripherals (0x40000000) to a word of its own in an alias region
+// (0x22000000 and 0x42000000). Bit n of the byte at offset b is the word
+// at
+//	alias base + b * 32 + n * 4
+// A store of 1 or 0 to the word sets or clears the bit, a load reads it. The
+// bus matrix does the read-modify-write of the word itself, and nothing can
+// come between, neither an interrupt nor the DMA.
+
+// The bus still writes the whole register back. Status registers whose
+// flags are cleared by writing 0 (TIM SR) or 1 (EXTI PR) must not be
+// bit-banded: a flag set by the hardware during the read-modify-write is
+// cleared by the write back. TIM_ClearITPendingBit() and
+// EXTI_ClearITPendingBit() are single stores already, and are right.
+
+// The alias addresses are constant expressions when the register is, so
+// BITBAND_SET(TIM6->CR1, TIM_CR1_CEN) compiles to a store of a constant to a
+// constant address. The region check is an assert_param(), which is
+// nothing unless USE_FULL_ASSERT is defined.
+
+// BitFlags is a set of flags in SRAM that interrupts and the main loop can
+// set and clear without a critical section, through the SRAM alias. In the
+// host build (SIM_HOST) variables are not at their device addresses, so the
+// flags use atomic operations of the host instead. Basic13 passes the
+// events of its interrupts to the main loop this way.
+
+
+// Index of the bit of a one-bit mask.
+#define BITBAND_BIT2(mask)	(((mask) & 0x2) ? 1 : 0)
+#define BITBAND_BIT4(mask)	(((mask) & 0xC) ? 2 + BITBAND_BIT2((mask) >> 2) : BITBAND_BIT2(mask))
+#define BITBAND_BIT8(mask)	(((mask) & 0xF0) ? 4 + BITBAND_BIT4((mask) >> 4) : BITBAND_BIT4(mask))
+#define BITBAND_BIT16(mask)	(((mask) & 0xFF00) ? 8 + BITBAND_BIT8((mask) >> 8) : BITBAND_BIT8(mask))
+#define BITBAND_BIT(mask)						\
+    (((u32)(mask) & 0xFFFF0000) ? 16 + BITBAND_BIT16((u32)(mask) >> 16)	\
+				: BITBAND_BIT16((u32)(mask)))
+
+// Whether 'addr' is in the 1 MB bit-band region from 'base'. Peripherals
+// beyond it (the AHB2 ones from 0x50000000, the FSMC) and the CCM RAM have
+// no alias.
+#define BITBAND_IN_REGION(addr, base)	((u32)(addr) - (base) < 0x100000)
+
+// Alias word of bit 'bit' of the peripheral register or SRAM word at 'addr'.
+// An address outside the region fails assert_param() (USE_FULL_ASSERT).
+#define BITBAND_PERIPH(addr, bit)					\
+    (assert_param(BITBAND_IN_REGION(addr, PERIPH_BASE) && (bit) < 32),	\
+     (volatile u32*)(PERIPH_BB_BASE + (((u32)(addr) - PERIPH_BASE) << 5) + ((bit) << 2)))
+#define BITBAND_SRAM(addr, bit)						\
+    (assert_param(BITBAND_IN_REGION(addr, SRAM_BASE) && (bit) < 32),	\
+     (volatile u32*)(SRAM_BB_BASE + (((u32)(addr) - SRAM_BASE) << 5) + ((bit) << 2)))
+
+// 'reg' is a register (TIM6->CR1) and 'mask' one bit of it (TIM_CR1_CEN).
+#define BITBAND_SET(reg, mask)	(*BITBAND_PERIPH(&(reg), BITBAND_BIT(mask)) = 1)
+#define BITBAND_CLEAR(reg, mask) (*BITBAND_PERIPH(&(reg), BITBAND_BIT(mask)) = 0)
+#define BITBAND_WRITE(reg, mask, value) \
+    (*BITBAND_PERIPH(&(reg), BITBAND_BIT(mask)) = ((value) != 0))
+#define BITBAND_READ(reg, mask)	(*BITBAND_PERIPH(&(reg), BITBAND_BIT(mask)))
+
+
+// A set of flags is an array of words, cleared at start up:
+//	static BitFlags s_flags[BITFLAGS_WORDS(40)];
+// It must be in the first 1 MB of the SRAM, which excludes the CCM RAM.
+typedef volatile u32 BitFlags;
+
+#define BITFLAGS_WORDS(flags)	(((flags) + 31) / 32)
+
+
+static __INLINE void BitFlags_Set(BitFlags* flags, u32 flag)
+{
+#ifdef SIM_HOST
+    __atomic_or_fetch(&flags[flag / 32], 1u << (flag % 32), __ATOMIC_SEQ_CST);
+#else
+    *BITBAND_SRAM(&flags[flag / 32], flag % 32) = 1;
+#endif
+}
+
+
+static __INLINE void BitFlags_Clear(BitFlags* flags, u32 flag)
+{
+#ifdef SIM_HOST
+    __atomic_and_fetch(&flags[flag / 32], ~(1u << (flag % 32)), __ATOMIC_SEQ_CST);
+#else
+    *BITBAND_SRAM(&flags[flag / 32], flag % 32) = 0;
+#endif
+}
+
+
+static __INLINE u32 BitFlags_Test(const BitFlags* flags, u32 flag)
+{
+    return (flags[flag / 32] >> (flag % 32)) & 1;
+}
+
+
+// Clears the flag if it is set. A flag set again between the test and the
+// clear counts once, as if it had been set twice before the test.
+static __INLINE u32 BitFlags_Take(BitFlags* flags, u32 flag)
+{
+    if (!BitFlags_Test(flags, flag))
+    {
+	return 0;
+    }
+    BitFlags_Clear(flags, flag);
+    return 1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Clock profiles: named system clock configurations that can be switched at
+// run time (see clock.c).
+
+typedef enum
+{
+    CLOCK_PROFILE_16MHZ,	// HSI, PLL off.
+    CLOCK_PROFILE_42MHZ,
+    CLOCK_PROFILE_84MHZ,
+    CLOCK_PROFILE_168MHZ,
+    CLOCK_PROFILES
+} ClockProfile;
+
+typedef struct
+{
+    const char* name;
+    u32 sysclk;
+    u32 pllp;			// 0 when the profile runs from the HSI directly.
+    u32 hclkDivider;		// RCC_SYSCLK_DivX
+    u32 pclk1Divider;		// RCC_HCLK_DivX
+    u32 pclk2Divider;		// RCC_HCLK_DivX
+    u32 latency;		// FLASH_Latency_X
+} ClockProfileConfig;
+
+#define CLOCK_MAX_TIMERS	8
+
+ErrorStatus	Clock_SetProfile(ClockProfile profile);
+ClockProfile	Clock_GetProfile();
+const ClockProfileConfig* Clock_GetProfileConfig(ClockProfile profile);
+
+u32		Clock_GetTimerClock(TIM_TypeDef* TIMx);
+ErrorStatus	Clock_RegisterTimer(TIM_TypeDef* TIMx, u32 counterClock);
+void		Clock_UnregisterTimer(TIM_TypeDef* TIMx);
@@ -0,0 +1,94 @@
+#pragma once
+
+// Stackless coroutines run by one event loop (see coro.c).
+
+#define CORO_TICK_HZ		1000
+
+// The line of a coroutine that has returned.
+#define CORO_DONE		0xFFFF
+
+typedef struct Coro Coro;
+typedef void (*CoroFunction)(Coro* co);
+
+struct Coro
+{
+    struct Coro* next;		// Run list.
+    CoroFunction function;
+    void* context;
+    u32 wake;			// Tick to resume at while delayed.
+    u16 line;			// Where to resume, 0 at the start.
+};
+
+// Posted by interrupts (an EXTI edge, a DMA transfer complete...) and taken
+// by one coroutine. Posts are counted, so none is lost while the coroutine
+// is busy with something else.
+typedef struct
+{
+    volatile u32 count;
+} CoroEvent;
+
+
+// The body of a coroutine is put between CORO_BEGIN and CORO_END. Its local
+// variables do not survive a wait: keep state in statics or the context.
+// A wait cannot be inside a switch statement of the body.
+#define CORO_BEGIN(co)		switch ((co)->line) { case 0:
+#define CORO_END(co)		} (co)->line = CORO_DONE
+
+// Returns until 'condition' holds. It is evaluated again whenever the loop
+// runs the coroutines, that is after Coro_Signal().
+#define CORO_WAIT_UNTIL(co, condition)					\
+    do									\
+    {									\
+	(co)->line = __LINE__; case __LINE__:				\
+	if (!(condition)) return;					\
+    } while (0)
+
+// Lets the other coroutines run once.
+#define CORO_YIELD(co)							\
+    do									\
+    {									\
+	(co)->line = __LINE__;						\
+	Coro_Signal();							\
+	return;								\
+	case __LINE__: ;						\
+    } while (0)
+
+// Awaitables.
+#define CORO_DELAY(co, ticks)						\
+    do									\
+    {									\
+	(co)->wake = Coro_Now() + (ticks);				\
+	CORO_WAIT_UNTIL(co, Coro_Due(co));				\
+    } while (0)
+
+#define CORO_DELAY_UNTIL(co, tick)					\
+    do									\
+    {									\
+	(co)->wake = (tick);						\
+	CORO_WAIT_UNTIL(co, Coro_Due(co));				\
+    } while (0)
+
+#define CORO_WAIT_EVENT(co, event)	CORO_WAIT_UNTIL(co, Coro_Take(event))
+
+// The producer of the ring calls Coro_Signal() after writing (see ring.h).
+#define CORO_WAIT_RING(co, ring)	CORO_WAIT_UNTIL(co, Ring_Count(ring))
+
+
+// Starts the SysTick that times the delays.
+void		Coro_Init();
+void		Coro_Start(Coro* co, CoroFunction function, void* context);
+
+// Runs the coroutines and sleeps (WFI) while none can go on. Never
+// returns.
+void		Coro_Run();
+
+// Makes the loop run the coroutines again. Can be called from any
+// interrupt.
+void		Coro_Signal();
+
+u32		Coro_Now();
+int		Coro_Due(Coro* co);
+
+void		Coro_EventInit(CoroEvent* event);
+void		Coro_Post(CoroEvent* event);
+int		Coro_Take(CoroEvent* event);
\ No newline at end of file
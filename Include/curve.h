@@ -0,0 +1,87 @@
+#pragma once
+
+////////////////////////////////// CURVE TABLES ///////////////////////////////
+// Tables of a curve over a PWM range, computed by the compiler. Everything
+// is in this header.
+
+// Basic6 breathes its LED by stepping the duty cycle linearly, but the eye
+// does not see light linearly: the LED looks fully on for most of the ramp
+// and only dims at the bottom. The correction is a curve, and computing it
+// with floating point in an interrupt would cost far more than the rest of
+// the handler.
+
+// The repeat macros expand an entry for each index of the table, and each
+// entry is an arithmetic constant expression of its index. So the compiler
+// evaluates the curve while compiling, and a const table ends up in the
+// flash like any other constant: no code, no floating point at run time and
+// no RAM. The DMA can read the flash, so a table can feed it as it is.
+
+//	static const u16 s_fade[64] = CURVE_TABLE(CURVE_CIE, 64, 999);
+
+// gives 64 compare values from 0 to 999 along the lightness curve of
+// CIE 1931. A curve is any function-like macro of x from 0 to 1 whose
+// result stays between 0 and 1. It may use only arithmetic and the ?:
+// operator, which rules out pow(), exp() and sin(): the curves below make
+// do with polynomials. They may nest, CURVE_CIE(CURVE_SINE(x)), but their
+// argument is expanded several times, so the macros grow quickly with the
+// nesting.
+
+
+// Table of 'n' entries, 16, 32, 64, 128 or 256, going from 'curve' at 0 to
+// 'curve' at 1, scaled to 0..'top'. The braces are included.
+#define CURVE_TABLE(curve, n, top)	CURVE_TABLE_(curve, n, top)
+#define CURVE_TABLE_(curve, n, top)	{ CURVE_REPEAT_##n(curve, n, top, 0) }
+
+// Entry 'i' of such a table, rounded.
+#define CURVE_ENTRY(curve, n, top, i)	((u16)((curve((i) / ((n) - 1.0))) * (top) + 0.5))
+
+
+//////////////////////////////////// CURVES ///////////////////////////////////
+
+#define CURVE_LINEAR(x)		(x)
+#define CURVE_SQUARE(x)		((x) * (x))
+#define CURVE_CUBE(x)		((x) * (x) * (x))
+
+// Luminance for a lightness of x (CIE 1931): what the eye sees as even steps
+// of brightness. Close to x^2.5 but linear near 0.
+#define CURVE_CIE(x)							\
+    ((x) > 0.08 ? CURVE_CUBE(((x) * 100 + 16) / 116) : (x) * 100 / 903.3)
+
+// Up and down again in a sine: (1 - cos(2 pi x)) / 2, written as
+// cos(pi (x - 0.5))^2. The cosine is its Taylor series to the x^10 term,
+// which is within 5e-7 over the half period.
+#define CURVE_SINE(x)		CURVE_SQUARE(CURVE_COS_(3.14159265358979 * ((x) - 0.5)))
+#define CURVE_COS_(a)		CURVE_COS_V_((a) * (a))
+#define CURVE_COS_V_(v)							\
+    (1 - (v) / 2 * (1 - (v) / 12 * (1 - (v) / 30 * (1 - (v) / 56 * (1 - (v) / 90)))))
+
+// Exponential from 0 to 1, steeper with 'k' (0 < k <= 8). Each step of x
+// multiplies the light by the same factor, as the steps of a dimmer. e^y is
+// (e^(y/16))^16, the small power by its Taylor series to the y^7 term.
+#define CURVE_EXP(x, k)		((CURVE_EXP_((k) * (x)) - 1) / (CURVE_EXP_(k) - 1))
+#define CURVE_EXP_(y)							\
+    CURVE_SQUARE(CURVE_SQUARE(CURVE_SQUARE(CURVE_SQUARE(CURVE_EXP_SMALL_((y) / 16.0)))))
+#define CURVE_EXP_SMALL_(y)						\
+    (1 + (y) * (1 + (y) / 2 * (1 + (y) / 3 * (1 + (y) / 4 *		\
+    (1 + (y) / 5 * (1 + (y) / 6 * (1 + (y) / 7)))))))
+
+
+/////////////////////////////////// REPEATS ///////////////////////////////////
+// CURVE_REPEAT_n expands the entries 'i' to 'i' + n - 1.
+
+#define CURVE_REPEAT_4(c, n, t, i)					\
+    CURVE_ENTRY(c, n, t, (i)), CURVE_ENTRY(c, n, t, (i) + 1),		\
+    CURVE_ENTRY(c, n, t, (i) + 2), CURVE_ENTRY(c, n, t, (i) + 3)
+#define CURVE_REPEAT_16(c, n, t, i)					\
+    CURVE_REPEAT_4(c, n, t, (i)), CURVE_REPEAT_4(c, n, t, (i) + 4),	\
+    CURVE_REPEAT_4(c, n, t, (i) + 8), CURVE_REPEAT_4(c, n, t, (i) + 12)
+#define CURVE_REPEAT_32(c, n, t, i)					\
+    CURVE_REPEAT_16(c, n, t, (i)), CURVE_REPEAT_16(c, n, t, (i) + 16)
+#define CURVE_REPEAT_64(c, n, t, i)					\
+    CURVE_REPEAT_16(c, n, t, (i)), CURVE_REPEAT_16(c, n, t, (i) + 16),	\
+    CURVE_REPEAT_16(c, n, t, (i) + 32), CURVE_REPEAT_16(c, n, t, (i) + 48)
+#define CURVE_REPEAT_128(c, n, t, i)					\
+    CURVE_REPEAT_64(c, n, t, (i)), CURVE_REPEAT_64(c, n, t, (i) + 64)
+#define CURVE_REPEAT_256(c, n, t, i)					\
+    CURVE_REPEAT_64(c, n, t, (i)), CURVE_REPEAT_64(c, n, t, (i) + 64),	\
+    CURVE_REPEAT_64(c, n, t, (i) + 128), CURVE_REPEAT_64(c, n, t, (i) + 192)
@@ -0,0 +1,26 @@
+#pragma once
+
+// Deferred interrupt work run by PendSV (see defer.c).
+
+// Priorities of the work: 0 runs first. Work of one priority runs in the
+// order it was posted.
+#define DEFER_PRIORITIES	4
+
+// Work items each priority holds at most. A power of two.
+#define DEFER_DEPTH		16
+
+typedef void (*DeferFunction)(void* context);
+
+void		Defer_Init();
+
+// Queues 'function' to be called with 'context' once no interrupt is active
+// and pends PendSV. Fails when the queue of the priority is full. Can be
+// called from any interrupt or the main loop.
+ErrorStatus	Defer_Post(DeferFunction function, void* context, u32 priority);
+
+// Work posted while its queue was full.
+u32		Defer_Dropped();
+
+// Runs the queued work. Called by the PendSV handler, or set as the
+// PendSV vector itself with Isr_SetVector().
+void		Defer_Process();
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+
+// Sigma-delta dithering of PWM compare values, for duty cycles finer than a
+// counter tick (see dither.c).
+
+#define DITHER_BITS		16	// Fraction bits of a target.
+#define DITHER_ONE		(1 << DITHER_BITS)
+#define DITHER_MAX		0x7FFC	// Highest compare value.
+
+// Target of 'ticks' counter ticks and 'fraction' / DITHER_ONE of a tick.
+#define DITHER_TARGET(ticks, fraction)	(((u32)(ticks) << DITHER_BITS) + (fraction))
+
+typedef struct
+{
+    u8 order;			// 1 or 2.
+    u16 max;			// Highest compare value.
+    s32 error[2];		// Of the last two values, in 1 / DITHER_ONE.
+} Dither;
+
+// 'max' is the highest compare value, the period for a full duty cycle,
+// up to DITHER_MAX.
+void	Dither_Init(Dither* dither, u32 order, u32 max);
+
+// Next compare value for 'target'. Averaged over many periods the values
+// come to 'target'.
+u32	Dither_Next(Dither* dither, u32 target);
+
+// 'count' compare values for 'target', 'stride' values apart from 'values'
+// on: one channel of the frames of a PWM stream (see pwm_stream.h).
+void	Dither_Fill(Dither* dither, u32 target, u16* values, u32 count, u32 stride);
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+// Quadrature encoders counted by TIM2 to TIM5, with 64-bit counts and
+// velocity estimates (see encoder.c).
+
+#define ENCODER_MAX		4
+#define ENCODER_SAMPLE_HZ	1000	// Counts sampled, velocities estimated.
+#define ENCODER_TICK_HZ		1000000	// Time unit of the snapshots (us).
+#define ENCODER_T_BELOW		16	// Counts per sample under which the
+					// edges are timed...
+#define ENCODER_M_ABOVE		32	// ...and over which they are not.
+#define ENCODER_STOP_MS		250	// Without an edge the encoder stands.
+
+typedef enum
+{
+    ENCODER_M,			// Counts over the sample period.
+    ENCODER_T,			// Counts between timed edges.
+} EncoderMethod;
+
+typedef struct
+{
+    int64_t count;		// 4 per line, up when A leads B.
+    float velocity;		// Counts per second.
+    u32 time;			// Of the sample, in ENCODER_TICK_HZ ticks.
+    u8 method;			// EncoderMethod of 'velocity'.
+} EncoderSnapshot;
+
+// TIM7 samples the encoders. Its interrupt and those of the encoder timers
+// run at 'priority'.
+ErrorStatus	Encoder_Init(u32 priority);
+
+// Counts the encoder on channels 1 (A) and 2 (B) of 'timer', TIM2 to TIM5,
+// every edge of both. The pins are set up by the caller. 'filter' is the
+// input filter (TIM_ICFilter, 0 to 15).
+ErrorStatus	Encoder_Add(TIM_TypeDef* timer, u8 filter);
+
+// The latest sample of 'encoder', in the order of Encoder_Add(). Does not
+// block the sampling: it can be called from any interrupt.
+void		Encoder_Read(u32 encoder, EncoderSnapshot* snapshot);
\ No newline at end of file
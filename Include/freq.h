@@ -0,0 +1,40 @@
+#pragma once
+
+// Frequency, period and duty cycle of a signal on PA15, measured by TIM2
+// and the DMA (see freq.c).
+
+#define FREQ_BATCH_HZ		10	// Results per second.
+#define FREQ_RING		256	// Edges buffered for the interrupts.
+#define FREQ_GATE_ABOVE		250000	// Hz from which the edges are counted.
+#define FREQ_GATE_BELOW		200000	// Hz below which they are timed again.
+
+typedef enum
+{
+    FREQ_RECIPROCAL,		// Each rising edge timed.
+    FREQ_GATE,			// Rising edges counted during the batch.
+} FreqMode;
+
+typedef struct
+{
+    u8 mode;			// FreqMode of the batch.
+    u32 periods;		// Measured, 0 for none.
+    float frequency;		// Hz.
+
+    // Of the periods, in seconds. Timed batches only, otherwise 0.
+    float duty;			// High time over the period, 0 to 1.
+    float period;
+    float periodMin;
+    float periodMax;
+    float jitter;		// Standard deviation.
+} FreqResult;
+
+// TIM2 measures the signal on PA15, which the caller sets up beforehand
+// (GPIO_AF_TIM2). TIM3 times the batches. The interrupts run at 'priority'.
+ErrorStatus	Freq_Init(u32 priority);
+
+// The result of the latest batch. Returns 0 when there has been none since
+// the last call.
+int		Freq_Read(FreqResult* result);
+
+// Times the DMA went round the ring before the edges were taken.
+u32		Freq_Overruns();
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+////////////////////////////////// PORT WRITES ////////////////////////////////
+// Sets, resets and toggles any pins of a GPIO port in one store, from any
+// priority. Everything is inline in this header.
+
+// GPIO_ToggleBits() does ODR ^= pins: it reads the port, changes the value
+// and writes it back. An interrupt that changes another pin of the port in
+// between has its change undone by the write. GPIO_SetBits() and
+// GPIO_ResetBits() do not have the problem, as they write BSRR, but setting
+// one pin and resetting another takes two calls and the pins change one
+// after the other.
+
+// BSRR (BSRRL and BSRRH as one 32-bit register): a 1 in the low half sets
+// the pin, a 1 in the high half resets it, a 0 leaves it alone. One store
+// sets and resets any pins at once and no other pin is touched.
+
+// Toggling needs to know the state of the pins. A GpioPort keeps a copy of
+// ODR (the shadow) in RAM. The new state is worked out from the shadow and
+// stored into BSRR between LDREX and STREX of the shadow. An interrupt in
+// between makes STREX fail (exception entry and return clear the monitor),
+// and the change is worked out again from the shadow the interrupt has left.
+// The interrupt's own change of a pin both touch may be overwritten for the
+// few cycles until the store is repeated, but not lost.
+
+// The pins toggled through a GpioPort must not be changed any other way, or
+// the shadow goes wrong.
+
+
+// BSRR of 'gpio' as the 32-bit register it is. The CMSIS header has it as
+// two u16 halves; the address goes through an integer so that no u16 is
+// accessed as a u32.
+#define GPIOPORT_BSRR(gpio)	(*(volatile u32*)(u32)&(gpio)->BSRRL)
+
+
+typedef struct
+{
+    GPIO_TypeDef* gpio;
+    volatile u32 shadow;	// ODR as last written.
+} GpioPort;
+
+
+static __INLINE void GpioPort_Init(GpioPort* port, GPIO_TypeDef* gpio)
+{
+    port->gpio = gpio;
+    port->shadow = gpio->ODR;
+}
+
+
+// One store, no shadow. Set wins if a pin is in both.
+static __INLINE void GpioPort_SetReset(GPIO_TypeDef* gpio, u16 set, u16 reset)
+{
+    GPIOPORT_BSRR(gpio) = set | ((u32)reset << 16);
+}
+
+
+// Sets, then resets, then toggles.
+static __INLINE void GpioPort_Apply(GpioPort* port, u16 set, u16 reset, u16 toggle)
+{
+    u32 mask = set | reset | toggle;
+    u32 value;
+
+    do
+    {
+	value = ((__LDREXW(&port->shadow) | set) & ~(u32)reset) ^ toggle;
+	GPIOPORT_BSRR(port->gpio) = (value & mask) | ((~value & mask) << 16);
+    } while (__STREXW(value, &port->shadow));
+}
+
+
+static __INLINE void GpioPort_Set(GpioPort* port, u16 pins)
+{
+    GpioPort_Apply(port, pins, 0, 0);
+}
+
+
+static __INLINE void GpioPort_Reset(GpioPort* port, u16 pins)
+{
+    GpioPort_Apply(port, 0, pins, 0);
+}
+
+
+static __INLINE void GpioPort_Toggle(GpioPort* port, u16 pins)
+{
+    GpioPort_Apply(port, 0, 0, pins);
+}
+
+
+// Writes 'value' to the pins of 'mask', as to a parallel bus.
+static __INLINE void GpioPort_Write(GpioPort* port, u16 mask, u16 value)
+{
+    GpioPort_Apply(port, value & mask, ~value & mask, 0);
+}
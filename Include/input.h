@@ -0,0 +1,48 @@
+#pragma once
+
+// Debounced push buttons and switches, delivered as timestamped events
+// (see input.c).
+
+#define INPUT_MAX		8
+#define INPUT_TICK_HZ		1000	// Time unit of the events (ms).
+#define INPUT_QUEUE		32	// Events waiting to be read.
+
+typedef enum
+{
+    INPUT_PRESS,
+    INPUT_RELEASE,
+    INPUT_LONG_PRESS,		// Held for 'longMs'. Ends a click sequence.
+    INPUT_CLICKS,		// 'clicks' short presses in a row.
+} InputEventType;
+
+typedef struct
+{
+    u32 time;			// Of the first edge. For INPUT_CLICKS of the
+				// last release, for INPUT_LONG_PRESS when due.
+    u8 input;			// In the order of Input_Add().
+    u8 type;			// InputEventType.
+    u8 clicks;
+} InputEvent;
+
+typedef struct
+{
+    u16 debounceMs;		// Time for the contacts to settle.
+    u16 longMs;			// Hold time of a long press.
+    u16 gapMs;			// Longest release within a click sequence.
+} InputTiming;
+
+// TIM3 times the inputs, and its interrupt and the EXTI ones run at
+// 'priority'.
+void		Input_Init(u32 priority);
+
+// 'pin' is a GPIO_PinSourceX of 'gpio', set up as an input beforehand. No
+// two inputs may have the same pin number, as they share the EXTI line.
+ErrorStatus	Input_Add(GPIO_TypeDef* gpio, u8 pin, u8 pressedLevel,
+			  const InputTiming* timing);
+
+// Takes the oldest event. Returns 0 when there is none.
+int		Input_Read(InputEvent* event);
+
+int		Input_IsPressed(u32 input);
+u32		Input_Now();
+u32		Input_Dropped();
\ No newline at end of file
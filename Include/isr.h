@@ -0,0 +1,18 @@
+#pragma once
+
+// Vector table in RAM with interrupt handlers set at run time (see isr.c).
+
+// The 16 exceptions of the core and the 82 interrupts of the STM32F407.
+#define ISR_VECTORS		(16 + FPU_IRQn + 1)
+
+typedef void (*IsrVector)();
+typedef void (*IsrHandler)(void* context);
+
+void		Isr_Init();
+
+// Puts a plain handler straight into the table. Returns the one it replaces.
+IsrVector	Isr_SetVector(IRQn_Type irq, IsrVector vector);
+
+// Handlers that take a context pointer.
+void		Isr_Attach(IRQn_Type irq, IsrHandler handler, void* context);
+void		Isr_Detach(IRQn_Type irq);
\ No newline at end of file
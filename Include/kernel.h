@@ -0,0 +1,81 @@
+#pragma once
+
+// Preemptive fixed priority kernel (see kernel.c).
+
+// Priority 0 is the most urgent. The idle task has the last one.
+#define KERNEL_PRIORITIES	32
+#define KERNEL_IDLE_PRIORITY	(KERNEL_PRIORITIES - 1)
+
+#define KERNEL_TICK_HZ		1000
+#define KERNEL_FOREVER		0xFFFFFFFF
+
+// The task stacks are taken from the CCM RAM.
+#define KERNEL_CCM_BASE		CCMDATARAM_BASE
+#define KERNEL_CCM_SIZE		0x10000
+
+typedef void (*KernelEntry)(void* arg);
+
+typedef struct KernelTask
+{
+    u32* sp;			// Saved stack pointer. First, for kernel_port.s.
+    struct KernelTask* next;	// Ready or wait list.
+    struct KernelTask* nextDelayed;
+    struct KernelTask** waitList; // 0 when not waiting.
+    const char* name;
+    u32 priority;
+    u32 wake;			// Tick to wake at while delayed.
+    u32 delayed;
+    ErrorStatus result;		// Of the last wait.
+    KernelEntry entry;
+    void* arg;
+    u32* stack;			// Bottom of the stack.
+    u32 stackSize;		// In bytes.
+#ifdef SIM_HOST
+    void* context;		// Host context (see Host/Source/sim.c).
+#endif
+} KernelTask;
+
+typedef struct
+{
+    volatile u32 count;
+    KernelTask* waiting;	// Most urgent first.
+} KernelSem;
+
+typedef struct
+{
+    u8* buffer;
+    u32 itemSize;
+    u32 length;			// In items.
+    u32 head;
+    u32 tail;
+    KernelSem items;
+    KernelSem spaces;
+} KernelQueue;
+
+void		Kernel_Init();
+ErrorStatus	Kernel_CreateTask(KernelTask* task, const char* name, u32 priority,
+				  u32 stackSize, KernelEntry entry, void* arg);
+
+// Starts the tick and the most urgent task. Never returns.
+void		Kernel_Start();
+
+KernelTask*	Kernel_Current();
+u32		Kernel_Now();
+void		Kernel_Delay(u32 ticks);
+void		Kernel_DelayUntil(u32* last, u32 period);
+void		Kernel_Yield();
+
+// Bytes of the stack of 'task' that have ever been used, on the device (see
+// kernel.c).
+u32		Kernel_StackUsed(const KernelTask* task);
+
+// Semaphores and queues. Give and send can be called from interrupts, take
+// and receive too with a timeout of 0. Timeouts are in ticks.
+void		Kernel_SemInit(KernelSem* sem, u32 count);
+void		Kernel_SemGive(KernelSem* sem);
+ErrorStatus	Kernel_SemTake(KernelSem* sem, u32 timeout);
+
+void		Kernel_QueueInit(KernelQueue* queue, void* buffer, u32 itemSize,
+				 u32 length);
+ErrorStatus	Kernel_QueueSend(KernelQueue* queue, const void* item, u32 timeout);
+ErrorStatus	Kernel_QueueReceive(KernelQueue* queue, void* item, u32 timeout);
\ No newline at end of file
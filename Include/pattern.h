@@ -0,0 +1,40 @@
+#pragma once
+
+// GPIO patterns played by TIM8 and DMA2 without the CPU (see pattern.c).
+
+// Shortest step, in counter ticks. The DMA stores the length of a step into
+// ARR a few cycles after the step has started.
+#define PATTERN_MIN_TICKS	8
+
+// Entry of Pattern.words: pins to set and pins to reset (see gpio_port.h).
+#define PATTERN_WORD(set, reset)	((u32)(u16)(set) | ((u32)(u16)(reset) << 16))
+
+// Entry of Pattern.words that writes 'value' to the pins of 'mask', as to a
+// parallel bus.
+#define PATTERN_BUS(mask, value)	PATTERN_WORD((value) & (mask), ~(value) & (mask))
+
+// Entry of Pattern.ticks for a step of 'ticks' counter ticks.
+#define PATTERN_TICKS(ticks)	((u16)((ticks) - 1))
+
+typedef struct
+{
+    const u32* words;		// BSRR word of each step.
+    const u16* ticks;		// PATTERN_TICKS() of each step, or 0.
+    u16 count;			// Steps.
+    u16 period;			// Ticks of every step when 'ticks' is 0.
+} Pattern;
+
+// Plays the patterns on 'gpio' with a counter clock of 'tickHz'.
+ErrorStatus	Pattern_Init(GPIO_TypeDef* gpio, u32 tickHz);
+
+// Plays 'pattern' once, or over and over when 'loop' is set. Once over, the
+// last word stays on the pins.
+ErrorStatus	Pattern_Start(const Pattern* pattern, int loop);
+
+// Loops 'pattern' instead of the one looping. It takes over at the start of
+// a pass, the second one to start at the latest. It must have as many steps,
+// and lengths as well if that one has, or the same period.
+ErrorStatus	Pattern_Swap(const Pattern* pattern);
+
+void		Pattern_Stop();
+int		Pattern_IsRunning();
@@ -0,0 +1,144 @@
+#pragma once
+
+//////////////////////////////// PIN DESCRIPTORS //////////////////////////////
+// Configures the pins of a port from constant descriptors, with one write
+// per configuration register. Everything is inline in this header.
+
+// GPIO_Init() goes through the 16 pins one by one and does a read-modify-
+// write of MODER, OSPEEDR, OTYPER and PUPDR for every pin it is given:
+// 16 register accesses for each of the four LEDs. A GPIO_InitTypeDef with a
+// field forgotten configures the pins with whatever was on the stack.
+
+// A PinGroup describes pins of one port that are configured alike. All the
+// fields are given by PIN_GROUP(), which also checks them at compile time: a
+// group without pins, an alternate function on a pin that is not in AF mode
+// or a value out of range stops the build. Pins_Init() takes the groups of a
+// port and ORs their fields into one mask and one value for each register,
+// spreading the pin mask to the 2 or 4 bits a pin has in the register. Then
+// each register is written once. No two groups may share a pin, whose
+// fields would be ORed into another mode (OUT | AF is analog): that fails
+// assert_param() (USE_FULL_ASSERT). Basic19 sets up all its pins of port A,
+// outputs and input, in one call. The groups are constants, so with the
+// optimizer on the compiler does all of this but the writes.
+
+// Pins_Set(), Pins_Reset() and Pins_Read() are single accesses of BSRR and
+// IDR (see gpio_port.h to set and reset pins in one store).
+
+
+typedef struct
+{
+    u16 pins;			// GPIO_Pin_x ORed.
+    u8 mode;			// GPIOMode_TypeDef.
+    u8 otype;			// GPIOOType_TypeDef.
+    u8 speed;			// GPIOSpeed_TypeDef.
+    u8 pull;			// GPIOPuPd_TypeDef.
+    u8 af;			// GPIO_AF_x, in GPIO_Mode_AF only.
+} PinGroup;
+
+#define PIN_VALID(condition)	(0 * sizeof(char[(condition) ? 1 : -1]))
+
+#define PIN_GROUP(pins, mode, otype, speed, pull, af)			\
+    { (u16)((pins) + PIN_VALID((pins) > 0 && (pins) <= 0xFFFF &&	\
+	(mode) <= GPIO_Mode_AN && (otype) <= GPIO_OType_OD &&		\
+	(speed) <= GPIO_Speed_100MHz && (pull) <= GPIO_PuPd_DOWN &&	\
+	(af) <= 15 && ((mode) == GPIO_Mode_AF || (af) == 0))),		\
+      (mode), (otype), (speed), (pull), (af) }
+
+// Common groups.
+#define PIN_OUTPUT(pins, speed) \
+    PIN_GROUP(pins, GPIO_Mode_OUT, GPIO_OType_PP, speed, GPIO_PuPd_NOPULL, 0)
+#define PIN_INPUT(pins, pull) \
+    PIN_GROUP(pins, GPIO_Mode_IN, GPIO_OType_PP, GPIO_Speed_2MHz, pull, 0)
+#define PIN_AF(pins, af, speed) \
+    PIN_GROUP(pins, GPIO_Mode_AF, GPIO_OType_PP, speed, GPIO_PuPd_NOPULL, af)
+
+
+// Bit i of 'pins' to bit 2 * i.
+static __INLINE u32 Pins_Spread2(u32 pins)
+{
+    pins = (pins | (pins << 8)) & 0x00FF00FF;
+    pins = (pins | (pins << 4)) & 0x0F0F0F0F;
+    pins = (pins | (pins << 2)) & 0x33333333;
+    return (pins | (pins << 1)) & 0x55555555;
+}
+
+
+// Bit i of the 8 bits of 'pins' to bit 4 * i.
+static __INLINE u32 Pins_Spread4(u32 pins)
+{
+    pins &= 0xFF;
+    pins = (pins | (pins << 12)) & 0x000F000F;
+    pins = (pins | (pins << 6)) & 0x03030303;
+    return (pins | (pins << 3)) & 0x11111111;
+}
+
+
+static __INLINE void Pins_Init(GPIO_TypeDef* gpio, const PinGroup* groups, u32 count)
+{
+    u32 pins = 0;
+    u32 otype = 0;
+    u32 mode = 0;
+    u32 speed = 0;
+    u32 pull = 0;
+    u32 afMask[2] = { 0, 0 };
+    u32 af[2] = { 0, 0 };
+
+    for (u32 i=0; i<count; i++)
+    {
+	u32 two = Pins_Spread2(groups[i].pins);
+
+	// The fields of groups that share a pin would be ORed together.
+	assert_param(!(pins & groups[i].pins));
+
+	pins |= groups[i].pins;
+	otype |= groups[i].otype ? groups[i].pins : 0;
+	mode |= two * groups[i].mode;
+	speed |= two * groups[i].speed;
+	pull |= two * groups[i].pull;
+
+	if (groups[i].mode == GPIO_Mode_AF)
+	{
+	    u32 low = Pins_Spread4(groups[i].pins);
+	    u32 high = Pins_Spread4(groups[i].pins >> 8);
+
+	    afMask[0] |= low * 0xF;
+	    afMask[1] |= high * 0xF;
+	    af[0] |= low * groups[i].af;
+	    af[1] |= high * groups[i].af;
+	}
+    }
+
+    u32 two = Pins_Spread2(pins) * 3;
+    gpio->OTYPER = (gpio->OTYPER & ~pins) | otype;
+    gpio->OSPEEDR = (gpio->OSPEEDR & ~two) | speed;
+    gpio->PUPDR = (gpio->PUPDR & ~two) | pull;
+    if (afMask[0])
+    {
+	gpio->AFR[0] = (gpio->AFR[0] & ~afMask[0]) | af[0];
+    }
+    if (afMask[1])
+    {
+	gpio->AFR[1] = (gpio->AFR[1] & ~afMask[1]) | af[1];
+    }
+
+    // Last, so that an output starts driving with its type and speed set.
+    gpio->MODER = (gpio->MODER & ~two) | mode;
+}
+
+
+static __INLINE void Pins_Set(GPIO_TypeDef* gpio, u16 pins)
+{
+    gpio->BSRRL = pins;
+}
+
+
+static __INLINE void Pins_Reset(GPIO_TypeDef* gpio, u16 pins)
+{
+    gpio->BSRRH = pins;
+}
+
+
+static __INLINE u16 Pins_Read(GPIO_TypeDef* gpio, u16 pins)
+{
+    return (u16)(gpio->IDR & pins);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Interrupt latency and load profiler (see profile.c).
+
+#include "isr.h"
+
+#define PROFILE_MAX_IRQS	8
+#define PROFILE_BINS		16	// Histogram bins of powers of two cycles.
+
+// Returns the core cycles from the hardware event of an interrupt to now.
+// Called first thing in the interrupt. 'source' is given to Profile_Irq().
+typedef u32 (*ProfileLatency)(void* source);
+
+typedef struct
+{
+    const char* name;
+    IRQn_Type irq;
+    IsrVector handler;		// The profiled handler.
+    ProfileLatency latency;	// 0 when the latency is not measured.
+    void* source;
+    u32 count;
+    uint64_t cycles;		// Spent in the handler, preemptions excluded.
+    u32 maxCycles;
+    uint64_t latencySum;
+    u32 maxLatency;
+    u32 cycleBins[PROFILE_BINS];
+    u32 latencyBins[PROFILE_BINS];
+} ProfileIrq;
+
+void		Profile_Init();
+ErrorStatus	Profile_Irq(const char* name, IRQn_Type irq,
+			    ProfileLatency latency, void* source);
+void		Profile_Start();
+void		Profile_Print();
+
+// Latency sources.
+u32		Profile_SysTickLatency(void* unused);
+u32		Profile_UpdateLatency(void* TIMx);
+u32		Profile_CaptureLatency(void* TIMx);
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+// PWM on up to 16 channels of TIM2 to TIM5, started together and with fixed
+// phases between the timers (see pwm_group.c).
+
+#define PWMGROUP_TIMERS		4	// TIM2 (the master), TIM3, TIM4, TIM5.
+#define PWMGROUP_CHANNELS	(4 * PWMGROUP_TIMERS)
+
+typedef struct
+{
+    u32 tickHz;			// Counter clock of all the timers.
+    u32 period;			// Ticks of a PWM period, even when centered.
+    u8 centered;		// Counts up and down, the pulses centered.
+    u8 timers;			// Bit n for TIM2 + n. TIM2 is always used.
+    u32 phase[PWMGROUP_TIMERS];	// Ticks each timer lags behind the start.
+} PwmGroupConfig;
+
+// Sets up all four channels of the timers in PWM mode 1, all at 0, and
+// leaves them waiting for PwmGroup_Start(). The pins are set up by the
+// caller. The period is at most 65536 ticks, 131070 when centered.
+ErrorStatus	PwmGroup_Init(const PwmGroupConfig* config);
+
+void		PwmGroup_Start();
+
+// Stops all the timers. PwmGroup_Init() again before starting anew.
+void		PwmGroup_Stop();
+
+// Channel 4 * n + c is channel c + 1 of TIM2 + n. The output is active for
+// 'ticks' of each period from the next update of its timer, or from
+// PwmGroup_EndUpdate(), or from the start when set before PwmGroup_Start().
+// When centered, 'ticks' is rounded down to even.
+void		PwmGroup_Set(u32 channel, u32 ticks);
+
+// The channels set in between change together, each timer at its first
+// update after PwmGroup_EndUpdate().
+void		PwmGroup_BeginUpdate();
+void		PwmGroup_EndUpdate();
\ No newline at end of file
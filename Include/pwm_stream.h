@@ -0,0 +1,32 @@
+#pragma once
+
+// PWM duty cycles streamed into TIM4 by the DMA, a frame per period (see
+// pwm_stream.c).
+
+#define PWMSTREAM_MAX_CHANNELS	4
+
+// Fills 'frames' frames at 'values', each the compare values of the
+// channels in order. Called from the DMA interrupt for the half of the
+// buffer just played. It may call PwmStream_Stop().
+typedef void (*PwmStreamRefill)(u16* values, u32 frames);
+
+typedef struct
+{
+    u32 tickHz;			// Counter clock.
+    u16 period;			// Ticks of a PWM period.
+    u8 channels;		// CCR1 to CCRn, 1 to 4.
+    u16* buffer;		// 'frames' * 'channels' values, in the SRAM.
+    u16 frames;			// Even.
+    PwmStreamRefill refill;
+} PwmStreamConfig;
+
+// Configures channels 1 to 'channels' of TIM4 in PWM mode 1, fills the whole
+// buffer and starts. The pins are set up by the caller (GPIO_AF_TIM4). The
+// first period is idle.
+ErrorStatus	PwmStream_Start(const PwmStreamConfig* config);
+
+void		PwmStream_Stop();
+
+// Halves of the buffer played again before they were refilled: the
+// interrupt came too late.
+u32		PwmStream_Overruns();
\ No newline at end of file
@@ -0,0 +1,270 @@
+#pragma once
+
+////////////////////////////////// RING BUFFERS ///////////////////////////////
+// Passes bytes from interrupts to the main loop (or the other way round)
+// without disabling interrupts. Everything is inline in this header.
+
+// The buffer size is a power of two. The head and tail indices run freely
+// over the whole 32-bit range and are masked only to address the buffer, so
+// head - tail is the number of bytes in the ring even across the wrap and a
+// full ring needs no spare byte.
+
+// Ring: single producer, single consumer (SPSC). The producer writes only
+// the head and the consumer only the tail. Each reads the other's index, so
+// no lock is needed at all. The barrier before an index is written makes
+// sure the data is in memory before the other side can see it (this matters
+// for DMA, and keeps the compiler from reordering).
+
+// RingMp: multiple producers, single consumer (MPSC). The producers are
+// interrupts of any priority and the main loop of one core. A producer
+// claims its space by advancing 'reserve' with LDREX/STREX. Then it copies
+// its data and commits. Since interrupts preempt one another in a nested
+// manner, the producers that are busy at any time form a stack. Only the
+// outermost one, the last to finish, moves the head up to 'reserve'. By
+// then all the claims below 'reserve' are written. The consumer side is
+// that of Ring.
+
+// Zero-copy: Ring_Reserve() and Ring_Peek() hand out pointers into the
+// buffer, so the data can be produced or consumed in place. They return the
+// contiguous part only; what wraps around comes with the next call.
+
+#include <string.h>
+
+
+typedef struct
+{
+    u8* buffer;
+    u32 size;			// Power of two.
+    volatile u32 head;		// Written by the producer.
+    volatile u32 tail;		// Written by the consumer.
+} Ring;
+
+typedef struct
+{
+    Ring ring;			// The consumer uses the Ring functions on it.
+    volatile u32 reserve;	// Claimed by the producers, head <= reserve.
+    volatile u32 busy;		// Producers between claim and commit.
+} RingMp;
+
+
+// 'size' must be a power of two.
+static __INLINE void Ring_Init(Ring* ring, u8* buffer, u32 size)
+{
+    assert_param(size && !(size & (size - 1)));
+    ring->buffer = buffer;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+
+static __INLINE u32 Ring_Count(const Ring* ring)
+{
+    return ring->head - ring->tail;
+}
+
+
+static __INLINE u32 Ring_Space(const Ring* ring)
+{
+    return ring->size - (ring->head - ring->tail);
+}
+
+
+// Copies into the buffer starting at index 'at', wrapping around.
+static __INLINE void Ring_CopyIn(Ring* ring, u32 at, const void* data, u32 length)
+{
+    u32 offset = at & (ring->size - 1);
+    u32 first = ring->size - offset;
+
+    if (first > length)
+    {
+	first = length;
+    }
+    memcpy(ring->buffer + offset, data, first);
+    memcpy(ring->buffer, (const u8*)data + first, length - first);
+}
+
+
+static __INLINE void Ring_CopyOut(const Ring* ring, u32 at, void* data, u32 length)
+{
+    u32 offset = at & (ring->size - 1);
+    u32 first = ring->size - offset;
+
+    if (first > length)
+    {
+	first = length;
+    }
+    memcpy(data, ring->buffer + offset, first);
+    memcpy((u8*)data + first, ring->buffer, length - first);
+}
+
+
+////////////////////////////////// PRODUCER ///////////////////////////////////
+
+// Writes as much of 'data' as fits. Returns the number of bytes written.
+static __INLINE u32 Ring_Write(Ring* ring, const void* data, u32 length)
+{
+    u32 space = Ring_Space(ring);
+
+    if (length > space)
+    {
+	length = space;
+    }
+    Ring_CopyIn(ring, ring->head, data, length);
+    __DMB();
+    ring->head += length;
+    return length;
+}
+
+
+// Points 'data' at the free space and returns its contiguous length. The
+// bytes written there are passed on by Ring_Commit().
+static __INLINE u32 Ring_Reserve(Ring* ring, u8** data)
+{
+    u32 offset = ring->head & (ring->size - 1);
+    u32 space = Ring_Space(ring);
+
+    *data = ring->buffer + offset;
+    return (space < ring->size - offset) ? space : ring->size - offset;
+}
+
+
+static __INLINE void Ring_Commit(Ring* ring, u32 length)
+{
+    __DMB();
+    ring->head += length;
+}
+
+
+////////////////////////////////// CONSUMER ///////////////////////////////////
+
+// Reads up to 'length' bytes. Returns the number of bytes read.
+static __INLINE u32 Ring_Read(Ring* ring, void* data, u32 length)
+{
+    u32 count = Ring_Count(ring);
+
+    if (length > count)
+    {
+	length = count;
+    }
+    __DMB();
+    Ring_CopyOut(ring, ring->tail, data, length);
+    __DMB();
+    ring->tail += length;
+    return length;
+}
+
+
+// Points 'data' at the bytes in the ring and returns their contiguous
+// length. They stay in the ring until Ring_Release().
+static __INLINE u32 Ring_Peek(Ring* ring, const u8** data)
+{
+    u32 offset = ring->tail & (ring->size - 1);
+    u32 count = Ring_Count(ring);
+
+    __DMB();
+    *data = ring->buffer + offset;
+    return (count < ring->size - offset) ? count : ring->size - offset;
+}
+
+
+static __INLINE void Ring_Release(Ring* ring, u32 length)
+{
+    __DMB();
+    ring->tail += length;
+}
+
+
+///////////////////////////// MULTIPLE PRODUCERS //////////////////////////////
+
+static __INLINE void RingMp_Init(RingMp* mp, u8* buffer, u32 size)
+{
+    Ring_Init(&mp->ring, buffer, size);
+    mp->reserve = 0;
+    mp->busy = 0;
+}
+
+
+// Claims 'length' bytes starting at '*at', contiguous ones if asked for.
+// Fails when they do not fit, in which case the producer must still call
+// RingMp_Commit().
+static __INLINE u32 RingMp_Claim(RingMp* mp, u32 length, u32 contiguous, u32* at)
+{
+    u32 busy;
+    u32 reserve;
+
+    // Counted as busy before claiming, so that a producer that preempts
+    // this one between the two cannot publish the claim unwritten.
+    do
+    {
+	busy = __LDREXW(&mp->busy);
+    } while (__STREXW(busy + 1, &mp->busy));
+
+    do
+    {
+	reserve = __LDREXW(&mp->reserve);
+	if (mp->ring.size - (reserve - mp->ring.tail) < length ||
+	    (contiguous && mp->ring.size - (reserve & (mp->ring.size - 1)) < length))
+	{
+	    __CLREX();
+	    return 0;
+	}
+    } while (__STREXW(reserve + length, &mp->reserve));
+
+    *at = reserve;
+    return 1;
+}
+
+
+// Ends a claim, written or failed. The outermost producer publishes every
+// claim made so far. An interrupt between setting the head and storing the
+// count clears the exclusive monitor, and the loop runs again with the
+// interrupt's claim included.
+static __INLINE void RingMp_Commit(RingMp* mp)
+{
+    u32 busy;
+
+    do
+    {
+	busy = __LDREXW(&mp->busy);
+	if (busy == 1)
+	{
+	    __DMB();
+	    mp->ring.head = mp->reserve;
+	}
+    } while (__STREXW(busy - 1, &mp->busy));
+}
+
+
+// Writes all of 'data' or nothing. Returns the number of bytes written.
+static __INLINE u32 RingMp_Write(RingMp* mp, const void* data, u32 length)
+{
+    u32 at;
+
+    if (RingMp_Claim(mp, length, 0, &at))
+    {
+	Ring_CopyIn(&mp->ring, at, data, length);
+    }
+    else
+    {
+	length = 0;
+    }
+    RingMp_Commit(mp);
+    return length;
+}
+
+
+// Returns a pointer to 'length' contiguous bytes to write in place, or 0
+// when they do not fit or would wrap around. Records whose size divides the
+// ring size never wrap. Every call is followed by RingMp_Commit(), whether
+// it succeeded or not.
+static __INLINE u8* RingMp_Reserve(RingMp* mp, u32 length)
+{
+    u32 at;
+
+    if (!RingMp_Claim(mp, length, 1, &at))
+    {
+	return 0;
+    }
+    return mp->ring.buffer + (at & (mp->ring.size - 1));
+}
@@ -8,8 +8,19 @@
 #include <stm32f4xx_exti.h>
 #include <stm32f4xx_tim.h>
 #include <stm32f4xx_dbgmcu.h>
+#include <stm32f4xx_crc.h>
+#include <stm32f4xx_flash.h>
+#include <stm32f4xx_dma.h>
+
+// Compile time check: the build fails (negative array size) when the
+// condition is false. 'name' must be unique within the file.
+#define STATIC_ASSERT(condition, name) \
+    typedef char static_assert_##name[(condition) ? 1 : -1]
 
 // Change the number to select the program to run.
 // This is necessary because different programs may use different
 // interrupt handlers or other things differently which may pose a problem.
-#define BASIC_4
\ No newline at end of file
+// The host build (Host/Makefile) passes the selection on the command line.
+#ifndef SIM_HOST
+#define BASIC_4
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+// Software timers multiplexed onto one hardware timer (see swtimer.c).
+
+typedef void (*SwTimerCallback)(void* context);
+typedef u32 (*SwTimerClock)();
+
+typedef struct SwTimer
+{
+    struct SwTimer* next;	// Wheel slot list.
+    struct SwTimer** pprev;	// 0 while the timer is not running.
+    u32 expires;		// Tick at which the timer expires.
+    u32 period;			// Ticks between expiries, 0 for a one-shot.
+    SwTimerCallback callback;
+    void* context;
+} SwTimer;
+
+// Longest delay or period in ticks.
+#define SWTIMER_MAX_DELAY	0x7FFFFFFF
+
+void	SwTimer_Init();
+void	SwTimer_Start(SwTimer* timer, u32 delay, u32 period,
+		      SwTimerCallback callback, void* context);
+void	SwTimer_Stop(SwTimer* timer);
+int	SwTimer_IsRunning(const SwTimer* timer);
+u32	SwTimer_Now();
+
+// Called by the hardware timer interrupt once per tick.
+void	SwTimer_Tick();
+
+// Tickless operation (see tickless.c). The ticks are read from 'clock'
+// instead of being counted, and SwTimer_Wake() pends the callbacks when the
+// deadline given by SwTimer_NextDelay() is reached.
+void	SwTimer_SetClock(SwTimerClock clock);
+u32	SwTimer_NextDelay();
+void	SwTimer_Wake();
+
+// Runs the callbacks of expired timers. Called by the PendSV handler.
+void	SwTimer_Process();
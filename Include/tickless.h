@@ -0,0 +1,18 @@
+#pragma once
+
+// Tickless time base on TIM5 for the software timers (see tickless.c).
+
+// The counter clock of TIM5 and the length of a software timer tick.
+#define TICKLESS_TIMER_HZ	1000000
+#define TICKLESS_TICK_US	1000
+
+void		Tickless_Init();
+uint64_t	Tickless_Now();
+u32		Tickless_Ticks();
+
+// Sleeps until the next software timer is due or an interrupt occurs.
+// Called over and over by the main loop.
+void		Tickless_Idle();
+
+// Called by TIM5_IRQHandler.
+void		Tickless_OnInterrupt();
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+/////////////////////////// TIMER PRESCALER SOLVER ////////////////////////////
+// Works out the prescaler (PSC) and auto-reload (ARR) values of a timer at
+// compile time, from the clock tree and a target frequency or period.
+
+// A timer divides its clock twice: by PSC + 1 to get the counter clock and by
+// ARR + 1 to get the update (overflow) rate:
+//	f = TIMCLK / ((PSC + 1) * (ARR + 1))
+// PSC is 16-bit on every timer. ARR is 16-bit except on TIM2 and TIM5.
+
+// The timer clock is not the APB bus clock. When the APB prescaler is not 1
+// the timers on that bus run at twice the bus clock. At 168 MHz with APB1
+// divided by 4 (42 MHz), TIM2-TIM7 run at 84 MHz.
+
+// The macros below are constant expressions when their arguments are, so the
+// compiler does all the divisions. TIMER_CHECK() stops the build when a
+// target cannot be reached, and TIMER_PRESCALER() checks its own range. The
+// prescaler chosen is the smallest one that lets the period fit into ARR.
+// That gives ARR the most resolution, so the rounding error is at most half
+// a counter clock per period.
+
+// The clock tree the programs run with. SystemInit() leaves the core on the
+// HSI with the AHB and both APB buses undivided. Programs that switch clock
+// profiles (clock.c) must use the values of their profile.
+#define TIMER_HCLK		HSI_VALUE
+#define TIMER_APB1_DIVIDER	1
+#define TIMER_APB2_DIVIDER	1
+
+// Clock of the timers on an APB bus.
+#define TIMER_CLOCK(hclk, apbDivider) \
+    ((apbDivider) == 1 ? (u32)(hclk) : (u32)(2ull * (hclk) / (apbDivider)))
+
+#define TIMER_APB1_CLOCK	TIMER_CLOCK(TIMER_HCLK, TIMER_APB1_DIVIDER)
+#define TIMER_APB2_CLOCK	TIMER_CLOCK(TIMER_HCLK, TIMER_APB2_DIVIDER)
+
+// 0 when 'condition' holds, a compile error when not (a bit-field of
+// negative width), and when it is not a constant expression.
+#define TIMER_VALID(condition) \
+    (0 * sizeof(struct { int valid : (condition) ? 1 : -1; }))
+
+#define TIMER_MAX_16BIT		0xFFFFull
+#define TIMER_MAX_32BIT		0xFFFFFFFFull
+
+// Number of timer clocks in one period, rounded to the nearest.
+#define TIMER_TICKS_HZ(timerClock, hz) \
+    (((unsigned long long)(timerClock) + (hz) / 2) / (hz))
+
+// PSC and ARR for a period of 'ticks' timer clocks. 'arrMax' is
+// TIMER_MAX_16BIT or TIMER_MAX_32BIT.
+#define TIMER_PSC(ticks, arrMax) \
+    ((u32)(((ticks) - 1) / ((arrMax) + 1)))
+#define TIMER_ARR(ticks, arrMax) \
+    ((u32)(((ticks) + (TIMER_PSC(ticks, arrMax) + 1ull) / 2) / (TIMER_PSC(ticks, arrMax) + 1ull) - 1))
+
+// Prescaler alone, for a counter clock of 'hz' (ARR set separately). Fails
+// to compile when the counter clock is faster than the timer clock or
+// slower than the 16-bit prescaler reaches, rather than being truncated.
+// The arguments must be constants.
+#define TIMER_PRESCALER(timerClock, hz) \
+    ((u16)(TIMER_TICKS_HZ(timerClock, hz) - 1 + TIMER_VALID( \
+	TIMER_TICKS_HZ(timerClock, hz) >= 1 && TIMER_TICKS_HZ(timerClock, hz) <= 0x10000)))
+
+// Fails to compile when a period of 'ticks' is out of reach: shorter than 2
+// timer clocks (ARR would be 0, which stops the counter) or longer than the
+// largest prescaler allows.
+#define TIMER_CHECK(name, ticks, arrMax) \
+    STATIC_ASSERT((ticks) >= 2 && TIMER_PSC(ticks, arrMax) <= 0xFFFF, name)
@@ -0,0 +1,9 @@
+#pragma once
+
+// 64-bit timestamps from two chained 32-bit timers (see timestamp.c).
+
+// Counts per second of the timestamp.
+#define TIMESTAMP_HZ		1000000
+
+void		Timestamp_Init();
+uint64_t	Timestamp_Now();
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+// WS2812 and SK6812 LED strips driven by a PWM stream on TIM4 channel 1
+// (see ws2812.c).
+
+#include "bench.h"
+
+#define WS2812_BIT_HZ		800000
+#define WS2812_LEDS_PER_HALF	4	// LEDs expanded per interrupt.
+#define WS2812_MAX_BYTES	4	// Per LED: 3 for RGB, 4 for RGBW.
+#define WS2812_LATCH_US		280	// Low time that ends a frame.
+
+// Sends 'leds' LEDs of 'bytesPerLed' bytes each, in the order they go on
+// the wire (G R B for the WS2812, G R B W for the SK6812 RGBW). 'data' must
+// stay unchanged until Ws2812_IsBusy() returns 0. The pin, PD12 or PB6, is
+// set up by the caller (GPIO_AF_TIM4). Fails while a frame is being sent.
+ErrorStatus	Ws2812_Show(const u8* data, u32 leds, u32 bytesPerLed);
+
+// Until the frame and its latch time are over.
+int		Ws2812_IsBusy();
+
+// Times each refill of WS2812_LEDS_PER_HALF LEDs into 'region', or none
+// when 0. The cycle counter must be on (Bench_Init()).
+void		Ws2812_Measure(BenchRegion* region);
\ No newline at end of file
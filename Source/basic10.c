@@ -0,0 +1,140 @@
+//////////////////////////////// BASIC 10 /////////////////////////////////////
+////////////////////////////// SOFTWARE TIMERS ////////////////////////////////
+// Demonstrates software timers (see swtimer.c) running on the SysTick alone.
+
+// Basic4 spent both basic timers on two blink rates. Here the 3 LEDs blink at
+// their own rates and the push button lights the 4th LED for 1 second, all
+// on the one SysTick interrupt. Pressing the button again before the second
+// is over restarts the second.
+
+#include "stdafx.h"
+#include "basic10.h"
+#include "swtimer.h"
+
+
+static void SetupLEDs();
+static void SetupPushButton();
+static void ToggleLED(void* pin);
+
+static SwTimer s_blink[3];
+static SwTimer s_light;
+
+
+// Interrupt handlers need the C caller convention. This is necessary if
+// the code is compiled as C++ code.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef BASIC_10
+void SysTick_Handler();
+void PendSV_Handler();
+void EXTI0_IRQHandler();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+
+void Basic10()
+{
+    static const u16 pins[3] = { GPIO_Pin_12, GPIO_Pin_13, GPIO_Pin_14 };
+    static const u32 periods[3] = { 500, 250, 125 };
+
+    SetupLEDs();
+    SetupPushButton();
+    SwTimer_Init();
+
+    // Blink every LED at its own rate. The pin is passed to the callback as
+    // its context so that one callback serves all of them.
+    for (u32 i=0; i<3; i++)
+    {
+	SwTimer_Start(&s_blink[i], periods[i], periods[i], ToggleLED, (void*)(u32)pins[i]);
+    }
+
+    // One tick per millisecond.
+    SysTick_Config(SystemCoreClock / 1000);
+
+    while (1)
+    {
+    }
+}
+
+
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_OUT;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    gpio.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_Init(GPIOD, &gpio);
+}
+
+
+static void SetupPushButton()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_IN;
+    gpio.GPIO_Pin = GPIO_Pin_0;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    GPIO_Init(GPIOA, &gpio);
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource0);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = EXTI_Line0;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_Init(&exti);
+
+    NVIC_EnableIRQ(EXTI0_IRQn);
+    NVIC_SetPriority(EXTI0_IRQn, 1);
+}
+
+
+static void ToggleLED(void* pin)
+{
+    GPIO_ToggleBits(GPIOD, (u16)(u32)pin);
+}
+
+
+#ifdef BASIC_10
+static void LightOff(void* pin)
+{
+    GPIO_ResetBits(GPIOD, (u16)(u32)pin);
+}
+
+
+// The tick. It only counts and leaves the timers to PendSV.
+void SysTick_Handler()
+{
+    SwTimer_Tick();
+}
+
+
+// PendSV is the lowest priority exception. The timer callbacks run here.
+void PendSV_Handler()
+{
+    SwTimer_Process();
+}
+
+
+void EXTI0_IRQHandler()
+{
+    EXTI_ClearITPendingBit(EXTI_Line0);
+
+    // A timer can be started from any interrupt. Starting a running timer
+    // starts it over.
+    GPIO_SetBits(GPIOD, GPIO_Pin_15);
+    SwTimer_Start(&s_light, 1000, 0, LightOff, (void*)(u32)GPIO_Pin_15);
+}
+#endif
@@ -0,0 +1,139 @@
+//////////////////////////////// BASIC 11 /////////////////////////////////////
+//////////////////////////////// TICKLESS IDLE ////////////////////////////////
+// Demonstrates software timers without a periodic tick (see tickless.c).
+
+// The LEDs and the push button do what they did in Basic10, but there is no
+// SysTick. The core sleeps until the next LED is due to change or the button
+// is pressed. Basic10 takes 1000 SysTick interrupts a second, this program
+// about 16 TIM5 interrupts: one whenever an LED changes and a few more when
+// the timer wheel cascades (see swtimer.c).
+
+#include "stdafx.h"
+#include "basic11.h"
+#include "swtimer.h"
+#include "tickless.h"
+
+
+static void SetupLEDs();
+static void SetupPushButton();
+static void ToggleLED(void* pin);
+
+static SwTimer s_blink[3];
+static SwTimer s_light;
+
+
+// Interrupt handlers need the C caller convention. This is necessary if
+// the code is compiled as C++ code.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef BASIC_11
+void TIM5_IRQHandler();
+void PendSV_Handler();
+void EXTI0_IRQHandler();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+
+void Basic11()
+{
+    static const u16 pins[3] = { GPIO_Pin_12, GPIO_Pin_13, GPIO_Pin_14 };
+    static const u32 periods[3] = { 500, 250, 125 };
+
+    SetupLEDs();
+    SetupPushButton();
+    SwTimer_Init();
+    Tickless_Init();
+
+    for (u32 i=0; i<3; i++)
+    {
+	SwTimer_Start(&s_blink[i], periods[i], periods[i], ToggleLED, (void*)(u32)pins[i]);
+    }
+
+    // Instead of spinning, the main loop sleeps.
+    while (1)
+    {
+	Tickless_Idle();
+    }
+}
+
+
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_OUT;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    gpio.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_Init(GPIOD, &gpio);
+}
+
+
+static void SetupPushButton()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_IN;
+    gpio.GPIO_Pin = GPIO_Pin_0;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    GPIO_Init(GPIOA, &gpio);
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource0);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = EXTI_Line0;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_Init(&exti);
+
+    NVIC_EnableIRQ(EXTI0_IRQn);
+    NVIC_SetPriority(EXTI0_IRQn, 1);
+}
+
+
+static void ToggleLED(void* pin)
+{
+    GPIO_ToggleBits(GPIOD, (u16)(u32)pin);
+}
+
+
+#ifdef BASIC_11
+static void LightOff(void* pin)
+{
+    GPIO_ResetBits(GPIOD, (u16)(u32)pin);
+}
+
+
+// Counts the overflows and wakes the timers at their deadline.
+void TIM5_IRQHandler()
+{
+    Tickless_OnInterrupt();
+}
+
+
+void PendSV_Handler()
+{
+    SwTimer_Process();
+}
+
+
+void EXTI0_IRQHandler()
+{
+    EXTI_ClearITPendingBit(EXTI_Line0);
+
+    // The interrupt woke the core. The main loop goes back to sleep with the
+    // new timer's deadline.
+    GPIO_SetBits(GPIOD, GPIO_Pin_15);
+    SwTimer_Start(&s_light, 1000, 0, LightOff, (void*)(u32)GPIO_Pin_15);
+}
+#endif
@@ -0,0 +1,244 @@
+//////////////////////////////// BASIC 12 /////////////////////////////////////
+//////////////////////////////// RING BUFFERS /////////////////////////////////
+// Demonstrates passing data from interrupts to the main loop through the
+// lock-free ring buffers of ring.h, and puts them under stress.
+
+// Three timer interrupts of different priorities write numbered records
+// into one multiple producer ring as fast as they can. They preempt one
+// another in the middle of writing. A fourth, of the lowest priority, streams
+// counting bytes through a single producer ring. The main loop reads both
+// rings and checks that every record of a producer comes in order and that
+// the stream has no gap. A report is printed through the debugger's Terminal
+// I/O every BASIC12_REPORT records. No interrupt is ever disabled.
+
+// A full ring drops records rather than waiting. The producers count their
+// drops so that the consumer can tell a drop from a lost record.
+
+#include "stdafx.h"
+#include "basic12.h"
+#include "ring.h"
+#include "tim_solver.h"
+
+#include <stdio.h>
+
+
+#define BASIC12_PRODUCERS	3
+#define BASIC12_REPORT		50000
+
+typedef struct
+{
+    u32 producer;
+    u32 sequence;
+} Record;
+
+// Rates of the producers. Odd ones, so that they keep meeting at different
+// points of one another's code.
+#define BASIC12_TIM3_HZ		7001
+#define BASIC12_TIM4_HZ		11003
+#define BASIC12_TIM5_HZ		13007
+#define BASIC12_TIM7_HZ		5003
+
+TIMER_CHECK(tim3_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM3_HZ), TIMER_MAX_16BIT);
+TIMER_CHECK(tim4_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM4_HZ), TIMER_MAX_16BIT);
+TIMER_CHECK(tim5_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM5_HZ), TIMER_MAX_32BIT);
+TIMER_CHECK(tim7_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM7_HZ), TIMER_MAX_16BIT);
+
+// The record size divides the ring size, so records never wrap around.
+STATIC_ASSERT((512 % sizeof(Record)) == 0, record_size);
+
+static u8 s_recordBuffer[512];
+static u8 s_streamBuffer[64];
+static RingMp s_records;
+static Ring s_stream;
+
+// Written by the producers only.
+static volatile u32 s_sent[BASIC12_PRODUCERS];
+static volatile u32 s_dropped[BASIC12_PRODUCERS];
+static u8 s_streamNext;
+
+static void SetupTimer(TIM_TypeDef* TIMx, u32 period, IRQn_Type irq, u32 priority);
+
+
+// Interrupt handlers need the C caller convention. This is necessary if
+// the code is compiled as C++ code.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef BASIC_12
+void TIM3_IRQHandler();
+void TIM4_IRQHandler();
+void TIM5_IRQHandler();
+void TIM7_IRQHandler();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+
+void Basic12()
+{
+    u32 expected[BASIC12_PRODUCERS] = { 0 };
+    u32 received = 0;
+    u32 outOfOrder = 0;
+    u32 streamed = 0;
+    u32 streamErrors = 0;
+    u8 streamExpected = 0;
+    u32 report = BASIC12_REPORT;
+
+    RingMp_Init(&s_records, s_recordBuffer, sizeof(s_recordBuffer));
+    Ring_Init(&s_stream, s_streamBuffer, sizeof(s_streamBuffer));
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3 | RCC_APB1Periph_TIM4 |
+			   RCC_APB1Periph_TIM5 | RCC_APB1Periph_TIM7, ENABLE);
+
+    // Lower numbers preempt higher ones.
+    SetupTimer(TIM5, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM5_HZ), TIM5_IRQn, 1);
+    SetupTimer(TIM4, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM4_HZ), TIM4_IRQn, 2);
+    SetupTimer(TIM3, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM3_HZ), TIM3_IRQn, 3);
+    SetupTimer(TIM7, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC12_TIM7_HZ), TIM7_IRQn, 4);
+
+    while (1)
+    {
+	// The records are read in place.
+	const u8* data;
+	u32 length = Ring_Peek(&s_records.ring, &data);
+	u32 count = length / sizeof(Record);
+	for (u32 i=0; i<count; i++)
+	{
+	    const Record* record = (const Record*)data + i;
+	    u32 p = record->producer;
+
+	    if (p >= BASIC12_PRODUCERS || record->sequence != expected[p])
+	    {
+		outOfOrder++;
+	    }
+	    if (p < BASIC12_PRODUCERS)
+	    {
+		expected[p] = record->sequence + 1;
+	    }
+	}
+	Ring_Release(&s_records.ring, count * sizeof(Record));
+	received += count;
+
+	// The stream is copied out.
+	u8 bytes[16];
+	length = Ring_Read(&s_stream, bytes, sizeof(bytes));
+	for (u32 i=0; i<length; i++)
+	{
+	    if (bytes[i] != streamExpected)
+	    {
+		streamErrors++;
+	    }
+	    streamExpected = bytes[i] + 1;
+	}
+	streamed += length;
+
+	if (received >= report)
+	{
+	    report += BASIC12_REPORT;
+	    printf("%u records (%u %u %u), %u dropped, %u out of order, "
+		   "%u stream bytes, %u errors\n", received,
+		   expected[0], expected[1], expected[2],
+		   s_dropped[0] + s_dropped[1] + s_dropped[2], outOfOrder,
+		   streamed, streamErrors);
+	}
+    }
+}
+
+
+static void SetupTimer(TIM_TypeDef* TIMx, u32 period, IRQn_Type irq, u32 priority)
+{
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = period - 1;
+    base.TIM_Prescaler = 0;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIMx, &base);
+
+    TIM_ClearITPendingBit(TIMx, TIM_IT_Update);
+    TIM_ITConfig(TIMx, TIM_IT_Update, ENABLE);
+    NVIC_SetPriority(irq, priority);
+    NVIC_EnableIRQ(irq);
+    TIM_Cmd(TIMx, ENABLE);
+}
+
+
+#ifdef BASIC_12
+// A record is either copied in or written in place.
+static void ProduceRecord(u32 producer, u32 inPlace)
+{
+    Record record;
+    u32 written;
+
+    record.producer = producer;
+    record.sequence = s_sent[producer];
+
+    if (inPlace)
+    {
+	Record* slot = (Record*)RingMp_Reserve(&s_records, sizeof(Record));
+	if (slot)
+	{
+	    *slot = record;
+	}
+	RingMp_Commit(&s_records);
+	written = (slot != 0);
+    }
+    else
+    {
+	written = RingMp_Write(&s_records, &record, sizeof(Record));
+    }
+
+    if (written)
+    {
+	s_sent[producer]++;
+    }
+    else
+    {
+	s_dropped[producer]++;
+    }
+}
+
+
+// Three bytes at a time, as many as fit.
+static void ProduceStream()
+{
+    u8 bytes[3];
+
+    for (u32 i=0; i<sizeof(bytes); i++)
+    {
+	bytes[i] = s_streamNext + i;
+    }
+    s_streamNext += Ring_Write(&s_stream, bytes, sizeof(bytes));
+}
+
+
+void TIM3_IRQHandler()
+{
+    TIM_ClearITPendingBit(TIM3, TIM_IT_Update);
+    ProduceRecord(0, 0);
+}
+
+
+void TIM4_IRQHandler()
+{
+    TIM_ClearITPendingBit(TIM4, TIM_IT_Update);
+    ProduceRecord(1, 1);
+}
+
+
+void TIM5_IRQHandler()
+{
+    TIM_ClearITPendingBit(TIM5, TIM_IT_Update);
+    ProduceRecord(2, 0);
+}
+
+
+void TIM7_IRQHandler()
+{
+    TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
+    ProduceStream();
+}
+#endif
@@ -0,0 +1,270 @@
+//////////////////////////////// BASIC 13 /////////////////////////////////////
+//////////////////////////////// IRQ PROFILER /////////////////////////////////
+// Demonstrates measuring interrupt latency and load (see profile.c).
+
+// Runs the interrupts of the earlier programs side by side at different
+// priorities: SysTick, TIM2, TIM4, TIM6, TIM7 and the push button on EXTI0.
+// Like Basic4, TIM6 changes its own prescaler from within its handler every
+// now and then. Every second the report of the profiler is printed through
+// the debugger's Terminal I/O: how often each handler ran, its average and
+// longest run, its share of the CPU and how late it started.
+
+// The push button is also wired to channel 1 of TIM5 (PA0 is TIM5_CH1),
+// which captures the time of the press for the EXTI0 latency.
+
+// The handlers do not toggle the LEDs themselves. Each sets a flag of a
+// BitFlags set (see bitband.h), at its own priority, and the main loop
+// takes the flags and toggles the LEDs. Neither side needs a critical
+// section, and no flag set while another is cleared is lost.
+
+#include "stdafx.h"
+#include "basic13.h"
+#include "bitband.h"
+#include "isr.h"
+#include "profile.h"
+#include "tim_solver.h"
+
+
+#define BASIC13_TIM2_HZ		3000
+#define BASIC13_TIM4_HZ		2000
+#define BASIC13_TIM6_HZ		1000
+#define BASIC13_TIM7_HZ		500
+
+TIMER_CHECK(tim2_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM2_HZ), TIMER_MAX_32BIT);
+TIMER_CHECK(tim4_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM4_HZ), TIMER_MAX_16BIT);
+TIMER_CHECK(tim6_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM6_HZ), TIMER_MAX_16BIT);
+TIMER_CHECK(tim7_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM7_HZ), TIMER_MAX_16BIT);
+
+
+static void SetupLEDs();
+static void SetupPushButton();
+static void SetupTimer(TIM_TypeDef* TIMx, u32 period, IRQn_Type irq, u32 priority);
+static void SysTickHandler();
+static void Timer2Handler();
+static void Timer4Handler();
+static void Timer6Handler();
+static void Timer7Handler();
+static void PushButtonHandler();
+
+typedef enum
+{
+    BASIC13_SECOND,		// From SysTick, for the report.
+    BASIC13_TIM2,		// Green LED.
+    BASIC13_TIM6,		// Orange LED.
+    BASIC13_TIM7,		// Red LED.
+    BASIC13_BUTTON,		// Blue LED.
+    BASIC13_FLAGS
+} Basic13Flag;
+
+static BitFlags s_flags[BITFLAGS_WORDS(BASIC13_FLAGS)];
+static volatile u32 s_work = 0;
+
+
+void Basic13()
+{
+    Profile_Init();
+
+    Isr_SetVector(SysTick_IRQn, SysTickHandler);
+    Isr_SetVector(TIM2_IRQn, Timer2Handler);
+    Isr_SetVector(TIM4_IRQn, Timer4Handler);
+    Isr_SetVector(TIM6_DAC_IRQn, Timer6Handler);
+    Isr_SetVector(TIM7_IRQn, Timer7Handler);
+    Isr_SetVector(EXTI0_IRQn, PushButtonHandler);
+
+    // The profiler wraps the handlers that are set.
+    Profile_Irq("SysTick", SysTick_IRQn, Profile_SysTickLatency, 0);
+    Profile_Irq("TIM2", TIM2_IRQn, Profile_UpdateLatency, TIM2);
+    Profile_Irq("TIM4", TIM4_IRQn, Profile_UpdateLatency, TIM4);
+    Profile_Irq("TIM6", TIM6_DAC_IRQn, Profile_UpdateLatency, TIM6);
+    Profile_Irq("TIM7", TIM7_IRQn, Profile_UpdateLatency, TIM7);
+    Profile_Irq("EXTI0", EXTI0_IRQn, Profile_CaptureLatency, TIM5);
+    Profile_Start();
+
+    SetupLEDs();
+    SetupPushButton();
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2 | RCC_APB1Periph_TIM4 |
+			   RCC_APB1Periph_TIM6 | RCC_APB1Periph_TIM7, ENABLE);
+
+    // Lower numbers preempt higher ones. The timers count without a
+    // prescaler, so that their counters tell the latency to the cycle.
+    SetupTimer(TIM2, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM2_HZ), TIM2_IRQn, 1);
+    SetupTimer(TIM4, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM4_HZ), TIM4_IRQn, 2);
+    SetupTimer(TIM6, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM6_HZ), TIM6_DAC_IRQn, 3);
+    SetupTimer(TIM7, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC13_TIM7_HZ), TIM7_IRQn, 3);
+
+    SysTick_Config(SystemCoreClock / 1000);
+    NVIC_SetPriority(SysTick_IRQn, 0);
+
+    while (1)
+    {
+	if (BitFlags_Take(s_flags, BASIC13_SECOND))
+	{
+	    Profile_Print();
+	}
+	if (BitFlags_Take(s_flags, BASIC13_TIM2))
+	{
+	    GPIO_ToggleBits(GPIOD, GPIO_Pin_12);
+	}
+	if (BitFlags_Take(s_flags, BASIC13_TIM6))
+	{
+	    GPIO_ToggleBits(GPIOD, GPIO_Pin_13);
+	}
+	if (BitFlags_Take(s_flags, BASIC13_TIM7))
+	{
+	    GPIO_ToggleBits(GPIOD, GPIO_Pin_14);
+	}
+	if (BitFlags_Take(s_flags, BASIC13_BUTTON))
+	{
+	    GPIO_ToggleBits(GPIOD, GPIO_Pin_15);
+	}
+    }
+}
+
+
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_OUT;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    gpio.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_Init(GPIOD, &gpio);
+}
+
+
+static void SetupPushButton()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM5, ENABLE);
+
+    // PA0 goes to TIM5 in its alternate function mode. The EXTI still sees
+    // the pin, as the input path works in every mode.
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_AF;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_Pin = GPIO_Pin_0;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    gpio.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_Init(GPIOA, &gpio);
+    GPIO_PinAFConfig(GPIOA, GPIO_PinSource0, GPIO_AF_TIM5);
+
+    // TIM5 runs freely at the timer clock and captures the rising edges.
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = 0xFFFFFFFF;
+    base.TIM_Prescaler = 0;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM5, &base);
+
+    TIM_ICInitTypeDef ic;
+    TIM_ICStructInit(&ic);
+    ic.TIM_Channel = TIM_Channel_1;
+    ic.TIM_ICPolarity = TIM_ICPolarity_Rising;
+    ic.TIM_ICSelection = TIM_ICSelection_DirectTI;
+    TIM_ICInit(TIM5, &ic);
+    TIM_Cmd(TIM5, ENABLE);
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource0);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = EXTI_Line0;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_Init(&exti);
+
+    NVIC_SetPriority(EXTI0_IRQn, 1);
+    NVIC_EnableIRQ(EXTI0_IRQn);
+}
+
+
+static void SetupTimer(TIM_TypeDef* TIMx, u32 period, IRQn_Type irq, u32 priority)
+{
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = period - 1;
+    base.TIM_Prescaler = 0;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIMx, &base);
+
+    TIM_ClearITPendingBit(TIMx, TIM_IT_Update);
+    TIM_ITConfig(TIMx, TIM_IT_Update, ENABLE);
+    NVIC_SetPriority(irq, priority);
+    NVIC_EnableIRQ(irq);
+    TIM_Cmd(TIMx, ENABLE);
+}
+
+
+static void SysTickHandler()
+{
+    static u32 millis = 0;
+
+    if (++millis == 1000)
+    {
+	millis = 0;
+	BitFlags_Set(s_flags, BASIC13_SECOND);
+    }
+}
+
+
+static void Timer2Handler()
+{
+    static u32 count = 0;
+
+    TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+    if (++count == BASIC13_TIM2_HZ / 2)
+    {
+	count = 0;
+	BitFlags_Set(s_flags, BASIC13_TIM2);
+    }
+}
+
+
+// Some work to fill the handler.
+static void Timer4Handler()
+{
+    TIM_ClearITPendingBit(TIM4, TIM_IT_Update);
+    for (u32 i=0; i<32; i++)
+    {
+	s_work += i;
+    }
+}
+
+
+// Switches between two rates every 250 interrupts, from within the
+// handler, like the TIM6 handler of Basic4 does.
+static void Timer6Handler()
+{
+    static u32 count = 0;
+    static u16 prescaler = 0;
+
+    TIM_ClearITPendingBit(TIM6, TIM_IT_Update);
+    if (++count == 250)
+    {
+	count = 0;
+	prescaler ^= 1;
+	TIM_PrescalerConfig(TIM6, prescaler, TIM_PSCReloadMode_Update);
+	BitFlags_Set(s_flags, BASIC13_TIM6);
+    }
+}
+
+
+static void Timer7Handler()
+{
+    TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
+    BitFlags_Set(s_flags, BASIC13_TIM7);
+}
+
+
+static void PushButtonHandler()
+{
+    EXTI_ClearITPendingBit(EXTI_Line0);
+    BitFlags_Set(s_flags, BASIC13_BUTTON);
+}
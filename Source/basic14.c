@@ -0,0 +1,264 @@
+//////////////////////////////// BASIC 14 /////////////////////////////////////
+/////////////////////////////// PREEMPTIVE TASKS //////////////////////////////
+// Demonstrates a 10 kHz control loop that keeps its rate next to slow I/O,
+// as tasks of the kernel (see kernel.c).
+
+// The tasks, most urgent first:
+//	control	Released by TIM6 at 10 kHz through a semaphore. Runs a PI
+//		controller on a simulated plant, in floating point.
+//	blink	Toggles the orange LED every 250 ms.
+//	report	Waits for push button events from a queue and prints them.
+//		Once a second it prints how the control loop is doing.
+//	load	Spins all the time, as a background computation would.
+// The idle task never runs as 'load' is always ready.
+
+// The control task measures how late it starts after the update of TIM6:
+// the counter of TIM6 has counted from 0 since. A run that finds the
+// semaphore given more than once has missed a period.
+
+// The host simulation has two limits here. Each register access of the
+// control loop takes a lot of simulated time, so run it with SIM_SPEED=1
+// or it misses periods. And the tasks run on host stacks of their own (see
+// kernel.c), so the painted stacks only ever hold the initial frame: the
+// stack report shows 68 bytes for every task, and means something on the
+// device only.
+
+#include "stdafx.h"
+#include "basic14.h"
+#include "kernel.h"
+#include "isr.h"
+#include "tim_solver.h"
+
+#include <stdio.h>
+
+
+#define BASIC14_CONTROL_HZ	10000
+
+TIMER_CHECK(control_ticks, TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC14_CONTROL_HZ), TIMER_MAX_16BIT);
+
+enum
+{
+    PRIORITY_CONTROL = 1,
+    PRIORITY_BLINK = 5,
+    PRIORITY_REPORT = 10,
+    PRIORITY_LOAD = 20,
+};
+
+
+static void SetupLEDs();
+static void SetupPushButton();
+static void SetupControlTimer();
+static void ControlTask(void* unused);
+static void BlinkTask(void* unused);
+static void ReportTask(void* unused);
+static void LoadTask(void* unused);
+static void Timer6Handler();
+static void PushButtonHandler();
+
+static KernelTask s_control;
+static KernelTask s_blink;
+static KernelTask s_report;
+static KernelTask s_load;
+
+static KernelSem s_controlTick;
+static KernelQueue s_buttonEvents;
+static u32 s_buttonBuffer[4];
+
+// Written by the control task.
+static volatile u32 s_runs = 0;
+static volatile u32 s_missed = 0;
+static volatile u32 s_maxLate = 0;
+static volatile float s_output = 0;
+static volatile u32 s_spins = 0;
+
+
+void Basic14()
+{
+    SetupLEDs();
+
+    Kernel_Init();
+    Kernel_SemInit(&s_controlTick, 0);
+    Kernel_QueueInit(&s_buttonEvents, s_buttonBuffer, sizeof(u32), 4);
+
+    Kernel_CreateTask(&s_control, "control", PRIORITY_CONTROL, 512, ControlTask, 0);
+    Kernel_CreateTask(&s_blink, "blink", PRIORITY_BLINK, 256, BlinkTask, 0);
+    Kernel_CreateTask(&s_report, "report", PRIORITY_REPORT, 2048, ReportTask, 0);
+    Kernel_CreateTask(&s_load, "load", PRIORITY_LOAD, 256, LoadTask, 0);
+
+    Isr_SetVector(TIM6_DAC_IRQn, Timer6Handler);
+    Isr_SetVector(EXTI0_IRQn, PushButtonHandler);
+    SetupPushButton();
+    SetupControlTimer();
+
+    Kernel_Start();
+}
+
+
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_OUT;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    gpio.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_Init(GPIOD, &gpio);
+}
+
+
+static void SetupPushButton()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_IN;
+    gpio.GPIO_Pin = GPIO_Pin_0;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    GPIO_Init(GPIOA, &gpio);
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource0);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = EXTI_Line0;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_Init(&exti);
+
+    NVIC_SetPriority(EXTI0_IRQn, 2);
+    NVIC_EnableIRQ(EXTI0_IRQn);
+}
+
+
+// TIM6 counts at the timer clock, so its counter tells the lateness of the
+// control task to the timer clock.
+static void SetupControlTimer()
+{
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM6, ENABLE);
+
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = TIMER_TICKS_HZ(TIMER_APB1_CLOCK, BASIC14_CONTROL_HZ) - 1;
+    base.TIM_Prescaler = 0;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM6, &base);
+
+    TIM_ClearITPendingBit(TIM6, TIM_IT_Update);
+    TIM_ITConfig(TIM6, TIM_IT_Update, ENABLE);
+    NVIC_SetPriority(TIM6_DAC_IRQn, 1);
+    NVIC_EnableIRQ(TIM6_DAC_IRQn);
+    TIM_Cmd(TIM6, ENABLE);
+}
+
+
+// A PI controller holds a first order plant at the setpoint, which steps
+// every second.
+static void ControlTask(void* unused)
+{
+    const float kp = 0.5f;
+    const float ki = 0.05f;
+    float plant = 0;
+    float integral = 0;
+    float setpoint = 1;
+
+    while (1)
+    {
+	Kernel_SemTake(&s_controlTick, KERNEL_FOREVER);
+
+	u32 late = TIM6->CNT;
+	if (late > s_maxLate)
+	{
+	    s_maxLate = late;
+	}
+	while (Kernel_SemTake(&s_controlTick, 0) == SUCCESS)
+	{
+	    s_missed++;
+	}
+
+	if (++s_runs % BASIC14_CONTROL_HZ == 0)
+	{
+	    setpoint = -setpoint;
+	    GPIO_ToggleBits(GPIOD, GPIO_Pin_12);
+	}
+
+	float error = setpoint - plant;
+	integral += error;
+	float output = kp * error + ki * integral;
+	plant += 0.01f * (output - plant);
+	s_output = plant;
+    }
+}
+
+
+static void BlinkTask(void* unused)
+{
+    u32 last = Kernel_Now();
+
+    while (1)
+    {
+	Kernel_DelayUntil(&last, 250);
+	GPIO_ToggleBits(GPIOD, GPIO_Pin_13);
+    }
+}
+
+
+static void ReportTask(void* unused)
+{
+    static KernelTask* const tasks[] = { &s_control, &s_blink, &s_report, &s_load };
+    u32 runs = 0;
+    u32 spins = 0;
+
+    while (1)
+    {
+	u32 pressed;
+	if (Kernel_QueueReceive(&s_buttonEvents, &pressed, 1000) == SUCCESS)
+	{
+	    GPIO_ToggleBits(GPIOD, GPIO_Pin_15);
+	    printf("button at %u ms\n", pressed);
+	    continue;
+	}
+
+	// Printing takes long, and the control task preempts it meanwhile.
+	printf("control: %u runs, %u missed, latest start %u timer clocks, "
+	       "output %d/1000; load: %u spins\n", s_runs - runs, s_missed,
+	       s_maxLate, (int)(s_output * 1000), s_spins - spins);
+	runs = s_runs;
+	spins = s_spins;
+	for (u32 i=0; i<sizeof(tasks) / sizeof(tasks[0]); i++)
+	{
+	    printf("  %-8s stack %u of %u bytes\n", tasks[i]->name,
+		   Kernel_StackUsed(tasks[i]), tasks[i]->stackSize);
+	}
+    }
+}
+
+
+static void LoadTask(void* unused)
+{
+    while (1)
+    {
+	s_spins++;
+    }
+}
+
+
+static void Timer6Handler()
+{
+    TIM_ClearITPendingBit(TIM6, TIM_IT_Update);
+    Kernel_SemGive(&s_controlTick);
+}
+
+
+static void PushButtonHandler()
+{
+    EXTI_ClearITPendingBit(EXTI_Line0);
+
+    // The queue is never waited on by an interrupt. A full queue drops the
+    // event.
+    u32 now = Kernel_Now();
+    Kernel_QueueSend(&s_buttonEvents, &now, 0);
+}
\ No newline at end of file
@@ -0,0 +1,203 @@
+//////////////////////////////// BASIC 15 /////////////////////////////////////
+///////////////////////////////// COROUTINES //////////////////////////////////
+// Demonstrates coroutines in one event loop (see coro.c).
+
+// Three activities of earlier programs, each written as sequential code
+// without a busy wait, run side by side:
+//	toggle	The blue LED toggles whenever the push button is pressed
+//		(Basic3).
+//	blink	The green LED blinks five times at 1 Hz, five times at 2 Hz and
+//		stops. Then each press of the button gives one pulse (Basic4).
+//	press	The orange LED is on while the button is held. Once released,
+//		the red LED is on for as long as it was held (Basic8).
+// The push button interrupt posts the events of 'toggle' and 'blink' and
+// writes its edges into a ring buffer for 'press' (see ring.h). In between
+// the core sleeps.
+
+#include "stdafx.h"
+#include "basic15.h"
+#include "coro.h"
+#include "ring.h"
+#include "isr.h"
+
+
+typedef struct
+{
+    u32 tick;
+    u32 level;
+} ButtonEdge;
+
+
+static void SetupLEDs();
+static void SetupPushButton();
+static void ToggleCoro(Coro* co);
+static void BlinkCoro(Coro* co);
+static void PressCoro(Coro* co);
+static void PushButtonHandler();
+
+static Coro s_toggle;
+static Coro s_blink;
+static Coro s_press;
+
+static CoroEvent s_toggleEvent;
+static CoroEvent s_pulseEvent;
+
+static u8 s_edgeBuffer[8 * sizeof(ButtonEdge)];
+static Ring s_edges;
+
+
+void Basic15()
+{
+    SetupLEDs();
+
+    Coro_Init();
+    Coro_EventInit(&s_toggleEvent);
+    Coro_EventInit(&s_pulseEvent);
+    Ring_Init(&s_edges, s_edgeBuffer, sizeof(s_edgeBuffer));
+
+    Coro_Start(&s_toggle, ToggleCoro, 0);
+    Coro_Start(&s_blink, BlinkCoro, 0);
+    Coro_Start(&s_press, PressCoro, 0);
+
+    Isr_SetVector(EXTI0_IRQn, PushButtonHandler);
+    SetupPushButton();
+
+    Coro_Run();
+}
+
+
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_OUT;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    gpio.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_Init(GPIOD, &gpio);
+}
+
+
+// Both edges interrupt, to time the presses.
+static void SetupPushButton()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_IN;
+    gpio.GPIO_Pin = GPIO_Pin_0;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    GPIO_Init(GPIOA, &gpio);
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource0);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = EXTI_Line0;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising_Falling;
+    EXTI_Init(&exti);
+
+    NVIC_SetPriority(EXTI0_IRQn, 1);
+    NVIC_EnableIRQ(EXTI0_IRQn);
+}
+
+
+static void ToggleCoro(Coro* co)
+{
+    CORO_BEGIN(co);
+
+    while (1)
+    {
+	CORO_WAIT_EVENT(co, &s_toggleEvent);
+	GPIO_ToggleBits(GPIOD, GPIO_Pin_15);
+    }
+
+    CORO_END(co);
+}
+
+
+// The state that must survive the waits is static.
+static void BlinkCoro(Coro* co)
+{
+    static u32 blinks;
+
+    CORO_BEGIN(co);
+
+    for (blinks = 0; blinks < 20; blinks++)
+    {
+	GPIO_ToggleBits(GPIOD, GPIO_Pin_12);
+	CORO_DELAY(co, blinks < 10 ? 500 : 250);
+    }
+
+    // Presses during the blinking do not count.
+    while (Coro_Take(&s_pulseEvent))
+    {
+    }
+
+    while (1)
+    {
+	CORO_WAIT_EVENT(co, &s_pulseEvent);
+	GPIO_SetBits(GPIOD, GPIO_Pin_12);
+	CORO_DELAY(co, 250);
+	GPIO_ResetBits(GPIOD, GPIO_Pin_12);
+    }
+
+    CORO_END(co);
+}
+
+
+// The edges written while the red LED is on wait in the ring.
+static void PressCoro(Coro* co)
+{
+    static ButtonEdge edge;
+    static u32 pressed;
+
+    CORO_BEGIN(co);
+
+    while (1)
+    {
+	CORO_WAIT_RING(co, &s_edges);
+	Ring_Read(&s_edges, &edge, sizeof(edge));
+
+	if (edge.level)
+	{
+	    pressed = edge.tick;
+	    GPIO_SetBits(GPIOD, GPIO_Pin_13);
+	    continue;
+	}
+
+	GPIO_ResetBits(GPIOD, GPIO_Pin_13);
+	GPIO_SetBits(GPIOD, GPIO_Pin_14);
+	CORO_DELAY(co, edge.tick - pressed);
+	GPIO_ResetBits(GPIOD, GPIO_Pin_14);
+    }
+
+    CORO_END(co);
+}
+
+
+static void PushButtonHandler()
+{
+    EXTI_ClearITPendingBit(EXTI_Line0);
+
+    ButtonEdge edge;
+    edge.tick = Coro_Now();
+    edge.level = GPIO_ReadInputDataBit(GPIOA, GPIO_Pin_0);
+
+    // Whole edges only. A full ring drops the edge.
+    if (Ring_Space(&s_edges) >= sizeof(edge))
+    {
+	Ring_Write(&s_edges, &edge, sizeof(edge));
+    }
+
+    if (edge.level)
+    {
+	Coro_Post(&s_toggleEvent);
+	Coro_Post(&s_pulseEvent);
+    }
+    Coro_Signal();
+}
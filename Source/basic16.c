@@ -0,0 +1,141 @@
+//////////////////////////////// BASIC 16 /////////////////////////////////////
+/////////////////////////////// PATTERN ENGINE ////////////////////////////////
+// Demonstrates pin sequences played by a timer and the DMA (see pattern.c).
+
+// The LEDs first light up one after the other, 100 ms each, once. Then they
+// chase round in a loop that slows down and speeds up again, each step
+// timed by a table. Each press of the push button swaps in the other loop,
+// the LEDs in pairs, at the start of a pass. All of it happens while the
+// CPU sleeps: after setting things up it only wakes for the button and to
+// finish the swaps.
+
+#include "stdafx.h"
+#include "basic16.h"
+#include "pattern.h"
+#include "pins.h"
+#include "isr.h"
+
+
+// The engine counts at 10 kHz, ticks of 100 us.
+#define TICK_HZ		10000
+#define MS(ms)		PATTERN_TICKS((ms) * (TICK_HZ / 1000))
+
+#define LEDS		(GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15)
+
+
+static void SetupLEDs();
+static void SetupPushButton();
+static void PushButtonHandler();
+
+// Each LED on in turn, and all off at the end.
+static const u32 s_introWords[] = {
+    PATTERN_WORD(GPIO_Pin_12, 0),
+    PATTERN_WORD(GPIO_Pin_13, 0),
+    PATTERN_WORD(GPIO_Pin_14, 0),
+    PATTERN_WORD(GPIO_Pin_15, 0),
+    PATTERN_WORD(0, LEDS),
+};
+
+static const Pattern s_intro = { s_introWords, 0, 5, 100 * (TICK_HZ / 1000) };
+
+// One LED at a time. The steps get longer for one round and shorter for
+// the next.
+static const u32 s_chaseWords[] = {
+    PATTERN_BUS(LEDS, GPIO_Pin_12), PATTERN_BUS(LEDS, GPIO_Pin_13),
+    PATTERN_BUS(LEDS, GPIO_Pin_14), PATTERN_BUS(LEDS, GPIO_Pin_15),
+    PATTERN_BUS(LEDS, GPIO_Pin_12), PATTERN_BUS(LEDS, GPIO_Pin_13),
+    PATTERN_BUS(LEDS, GPIO_Pin_14), PATTERN_BUS(LEDS, GPIO_Pin_15),
+};
+
+static const u16 s_chaseTicks[] = {
+    MS(50), MS(75), MS(100), MS(150), MS(200), MS(150), MS(100), MS(75),
+};
+
+static const Pattern s_chase = { s_chaseWords, s_chaseTicks, 8, 0 };
+
+// Opposite LEDs in pairs, held longer than they are switched.
+static const u32 s_pairWords[] = {
+    PATTERN_BUS(LEDS, GPIO_Pin_12 | GPIO_Pin_14), PATTERN_BUS(LEDS, 0),
+    PATTERN_BUS(LEDS, GPIO_Pin_13 | GPIO_Pin_15), PATTERN_BUS(LEDS, 0),
+    PATTERN_BUS(LEDS, GPIO_Pin_12 | GPIO_Pin_14), PATTERN_BUS(LEDS, 0),
+    PATTERN_BUS(LEDS, GPIO_Pin_13 | GPIO_Pin_15), PATTERN_BUS(LEDS, 0),
+};
+
+static const u16 s_pairTicks[] = {
+    MS(250), MS(50), MS(250), MS(50), MS(100), MS(50), MS(100), MS(50),
+};
+
+static const Pattern s_pairs = { s_pairWords, s_pairTicks, 8, 0 };
+
+static const Pattern* s_looping = &s_chase;
+
+
+void Basic16()
+{
+    SetupLEDs();
+    Pattern_Init(GPIOD, TICK_HZ);
+
+    // The interrupt that stops the timer at the end wakes the core.
+    Pattern_Start(&s_intro, 0);
+    while (Pattern_IsRunning())
+    {
+	__WFI();
+    }
+
+    Pattern_Start(s_looping, 1);
+
+    Isr_SetVector(EXTI0_IRQn, PushButtonHandler);
+    SetupPushButton();
+
+    while (1)
+    {
+	__WFI();
+    }
+}
+
+
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup leds[] = {
+	PIN_OUTPUT(LEDS, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOD, leds, 1);
+}
+
+
+static void SetupPushButton()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    static const PinGroup button[] = {
+	PIN_INPUT(GPIO_Pin_0, GPIO_PuPd_NOPULL),
+    };
+    Pins_Init(GPIOA, button, 1);
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource0);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = EXTI_Line0;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_Init(&exti);
+
+    NVIC_SetPriority(EXTI0_IRQn, 2);
+    NVIC_EnableIRQ(EXTI0_IRQn);
+}
+
+
+static void PushButtonHandler()
+{
+    EXTI_ClearITPendingBit(EXTI_Line0);
+
+    const Pattern* other = (s_looping == &s_chase) ? &s_pairs : &s_chase;
+    if (Pattern_Swap(other) == SUCCESS)
+    {
+	s_looping = other;
+    }
+}
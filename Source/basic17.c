@@ -0,0 +1,88 @@
+//////////////////////////////// BASIC 17 /////////////////////////////////////
+//////////////////////////////// INPUT EVENTS /////////////////////////////////
+// Demonstrates debounced button events (see input.c).
+
+// The push button gives events instead of edges:
+//	press/release	The orange LED is on while the button is held.
+//	one click	Toggles the green LED.
+//	two clicks	Toggles the blue LED.
+//	long press	Toggles the red LED.
+// Three clicks or more toggle both the green and the blue LED. However much
+// the contacts bounce, each press toggles one LED once, where Basic3 may
+// toggle its LED several times. The core sleeps until an event comes.
+
+#include "stdafx.h"
+#include "basic17.h"
+#include "input.h"
+#include "pins.h"
+
+
+#define LED_GREEN	GPIO_Pin_12
+#define LED_ORANGE	GPIO_Pin_13
+#define LED_RED		GPIO_Pin_14
+#define LED_BLUE	GPIO_Pin_15
+
+
+static void SetupLEDs();
+static void SetupPushButton();
+
+static const InputTiming s_timing = { 20, 800, 300 };
+
+
+void Basic17()
+{
+    SetupLEDs();
+    SetupPushButton();
+
+    Input_Init(1);
+    Input_Add(GPIOA, GPIO_PinSource0, Bit_SET, &s_timing);
+
+    while (1)
+    {
+	InputEvent event;
+	while (!Input_Read(&event))
+	{
+	    __WFI();
+	}
+
+	switch (event.type)
+	{
+	case INPUT_PRESS:
+	    GPIO_SetBits(GPIOD, LED_ORANGE);
+	    break;
+	case INPUT_RELEASE:
+	    GPIO_ResetBits(GPIOD, LED_ORANGE);
+	    break;
+	case INPUT_LONG_PRESS:
+	    GPIO_ToggleBits(GPIOD, LED_RED);
+	    break;
+	case INPUT_CLICKS:
+	    GPIO_ToggleBits(GPIOD, (event.clicks == 1) ? LED_GREEN :
+			    (event.clicks == 2) ? LED_BLUE : LED_GREEN | LED_BLUE);
+	    break;
+	}
+    }
+}
+
+
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup leds[] = {
+	PIN_OUTPUT(LED_GREEN | LED_ORANGE | LED_RED | LED_BLUE, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOD, leds, 1);
+}
+
+
+// The button pulls PA0 high when pressed, a resistor on the board low.
+static void SetupPushButton()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+
+    static const PinGroup button[] = {
+	PIN_INPUT(GPIO_Pin_0, GPIO_PuPd_NOPULL),
+    };
+    Pins_Init(GPIOA, button, 1);
+}
@@ -0,0 +1,82 @@
+//////////////////////////////// BASIC 18 /////////////////////////////////////
+/////////////////////////////// PWM STREAMING /////////////////////////////////
+// Demonstrates duty cycles streamed into the timer by the DMA (see
+// pwm_stream.c).
+
+// The four LEDs breathe like the one of Basic6, each a quarter of a breath
+// after the other. The brightness follows a sine corrected for the eye,
+// from a table the compiler computes (see curve.h). The PWM runs at 1 kHz
+// and every period has new duty cycles for all four, yet the CPU is
+// interrupted twice every 50 ms only, to compute the next 25 periods. In
+// between it sleeps.
+
+#include "stdafx.h"
+#include "basic18.h"
+#include "pwm_stream.h"
+#include "curve.h"
+#include "pins.h"
+
+
+#define TICK_HZ		1000000
+#define PERIOD		1000		// 1 kHz.
+#define CHANNELS	4
+#define FRAMES		50
+#define BREATH		2000		// Periods of a breath.
+#define STEPS		256		// Of the breath table.
+
+#define BREATH_CURVE(x)	CURVE_CIE(CURVE_SINE(x))
+
+
+static void SetupLEDs();
+static void Refill(u16* values, u32 frames);
+
+static u16 s_buffer[FRAMES * CHANNELS];
+static u32 s_time = 0;			// Periods computed so far.
+
+// Compare values of a whole breath, up and down.
+static const u16 s_breath[STEPS] = CURVE_TABLE(BREATH_CURVE, STEPS, PERIOD);
+
+
+void Basic18()
+{
+    SetupLEDs();
+
+    PwmStreamConfig config;
+    config.tickHz = TICK_HZ;
+    config.period = PERIOD;
+    config.channels = CHANNELS;
+    config.buffer = s_buffer;
+    config.frames = FRAMES;
+    config.refill = Refill;
+    PwmStream_Start(&config);
+
+    while (1)
+    {
+	__WFI();
+    }
+}
+
+
+// The LEDs on PD12..PD15 are channels 1 to 4 of TIM4.
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup leds[] = {
+	PIN_AF(GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15, GPIO_AF_TIM4, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOD, leds, 1);
+}
+
+
+static void Refill(u16* values, u32 frames)
+{
+    for (u32 f=0; f<frames; f++, s_time++)
+    {
+	for (u32 c=0; c<CHANNELS; c++)
+	{
+	    u32 t = (s_time + c * (BREATH / CHANNELS)) % BREATH;
+	    *values++ = s_breath[t * STEPS / BREATH];
+	}
+    }
+}
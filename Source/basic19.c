@@ -0,0 +1,124 @@
+//////////////////////////////// BASIC 19 /////////////////////////////////////
+///////////////////////////////// PWM GROUPS //////////////////////////////////
+// Demonstrates timers started together with fixed phases (see
+// pwm_group.c).
+
+// Four phases of an interleaved converter, one per timer, a quarter of a
+// period apart at 1 kHz. Each is on for a quarter of the period, centered,
+// so one takes over as the one before turns off:
+//	TIM2 channel 1	PA5
+//	TIM3 channel 1	PA6
+//	TIM4 channel 1	PD12 (the green LED)
+//	TIM5 channel 2	PA1
+// The other LEDs are channels 2 to 4 of TIM4. Each press of the push
+// button sets them to the next of a few brightness levels, all three in the
+// same period.
+
+#include "stdafx.h"
+#include "basic19.h"
+#include "pwm_group.h"
+#include "pins.h"
+#include "isr.h"
+
+
+#define TICK_HZ		1000000
+#define PERIOD		1000		// 1 kHz.
+
+#define CHANNEL(timer, c)	(4 * (timer) + (c) - 1)	// Timer 0 is TIM2.
+
+
+static void SetupPins();
+static void SetupPushButton();
+static void PushButtonHandler();
+
+static const u16 s_levels[][3] = {
+    { 0, 0, 0 }, { 20, 100, 500 }, { 500, 100, 20 }, { 1000, 1000, 1000 },
+};
+
+#define LEVELS		(sizeof(s_levels) / sizeof(s_levels[0]))
+
+
+void Basic19()
+{
+    SetupPins();
+
+    PwmGroupConfig config;
+    config.tickHz = TICK_HZ;
+    config.period = PERIOD;
+    config.centered = 1;
+    config.timers = 0xF;
+    for (u32 n=0; n<PWMGROUP_TIMERS; n++)
+    {
+	config.phase[n] = n * (PERIOD / 4);
+    }
+    PwmGroup_Init(&config);
+
+    // The phases are on for a quarter of the period, centered on the start
+    // of their periods where the counters turn at 0 (PWM mode 1 is active
+    // below the compare): from an eighth of it before to an eighth after.
+    PwmGroup_Set(CHANNEL(0, 1), PERIOD / 4);
+    PwmGroup_Set(CHANNEL(1, 1), PERIOD / 4);
+    PwmGroup_Set(CHANNEL(2, 1), PERIOD / 4);
+    PwmGroup_Set(CHANNEL(3, 2), PERIOD / 4);
+    PwmGroup_Start();
+
+    Isr_SetVector(EXTI0_IRQn, PushButtonHandler);
+    SetupPushButton();
+
+    while (1)
+    {
+	__WFI();
+    }
+}
+
+
+static void SetupPins()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA | RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup portA[] = {
+	PIN_AF(GPIO_Pin_5, GPIO_AF_TIM2, GPIO_Speed_25MHz),
+	PIN_AF(GPIO_Pin_6, GPIO_AF_TIM3, GPIO_Speed_25MHz),
+	PIN_AF(GPIO_Pin_1, GPIO_AF_TIM5, GPIO_Speed_25MHz),
+	PIN_INPUT(GPIO_Pin_0, GPIO_PuPd_NOPULL),	// The push button.
+    };
+    Pins_Init(GPIOA, portA, 4);
+
+    static const PinGroup leds[] = {
+	PIN_AF(GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15, GPIO_AF_TIM4, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOD, leds, 1);
+}
+
+
+static void SetupPushButton()
+{
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource0);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = EXTI_Line0;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_Init(&exti);
+
+    NVIC_SetPriority(EXTI0_IRQn, 2);
+    NVIC_EnableIRQ(EXTI0_IRQn);
+}
+
+
+static void PushButtonHandler()
+{
+    static u32 level = 0;
+
+    EXTI_ClearITPendingBit(EXTI_Line0);
+    level = (level + 1) % LEVELS;
+
+    PwmGroup_BeginUpdate();
+    for (u32 c=0; c<3; c++)
+    {
+	PwmGroup_Set(CHANNEL(2, 2 + c), s_levels[level][c]);
+    }
+    PwmGroup_EndUpdate();
+}
@@ -0,0 +1,83 @@
+//////////////////////////////// BASIC 20 /////////////////////////////////////
+////////////////////////////////// DITHERING //////////////////////////////////
+// Demonstrates duty cycles finer than a counter tick (see dither.c).
+
+// Two LEDs fade in and out at the very bottom of their range, from 0 to 4
+// ticks of a 1000 tick period and back in 4 s. The PWM runs at 16 kHz, the
+// counter at 16 MHz. The green LED has the plain duty cycle rounded to a
+// tick: it jumps between 5 levels. The orange LED has the same duty cycle
+// dithered by the second order modulator and fades smoothly. The duty
+// cycles come by DMA (see pwm_stream.c). The CPU fills the next 128
+// periods every 8 ms.
+
+#include "stdafx.h"
+#include "basic20.h"
+#include "pwm_stream.h"
+#include "dither.h"
+#include "pins.h"
+
+
+#define TICK_HZ		16000000
+#define PERIOD		1000		// 16 kHz.
+#define CHANNELS	2		// Rounded, dithered.
+#define FRAMES		256
+#define FADE		32000		// Periods of a fade in, 2 s.
+#define TOP		4		// Ticks at the top of the fade.
+
+
+static void SetupLEDs();
+static void Refill(u16* values, u32 frames);
+
+static u16 s_buffer[FRAMES * CHANNELS];
+static Dither s_dither;
+static u32 s_time = 0;			// Periods computed so far.
+
+
+void Basic20()
+{
+    SetupLEDs();
+    Dither_Init(&s_dither, 2, PERIOD);
+
+    PwmStreamConfig config;
+    config.tickHz = TICK_HZ;
+    config.period = PERIOD;
+    config.channels = CHANNELS;
+    config.buffer = s_buffer;
+    config.frames = FRAMES;
+    config.refill = Refill;
+    PwmStream_Start(&config);
+
+    while (1)
+    {
+	__WFI();
+    }
+}
+
+
+// The green and orange LEDs, PD12 and PD13, are channels 1 and 2 of TIM4.
+static void SetupLEDs()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup leds[] = {
+	PIN_AF(GPIO_Pin_12 | GPIO_Pin_13, GPIO_AF_TIM4, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOD, leds, 1);
+}
+
+
+// The target changes once for all the frames: 8 ms is a small step of a
+// 2 s fade.
+static void Refill(u16* values, u32 frames)
+{
+    u32 t = s_time % (2 * FADE);
+    u32 up = (t < FADE) ? t : 2 * FADE - t;
+    u32 target = (up << DITHER_BITS) / (FADE / TOP);
+    s_time += frames;
+
+    Dither_Fill(&s_dither, target, values + 1, frames, CHANNELS);
+    for (u32 f=0; f<frames; f++)
+    {
+	values[CHANNELS * f] = (target + DITHER_ONE / 2) >> DITHER_BITS;
+    }
+}
@@ -0,0 +1,105 @@
+//////////////////////////////// BASIC 21 /////////////////////////////////////
+///////////////////////////////// LED STRIPS //////////////////////////////////
+// Demonstrates a strip of WS2812 LEDs sent by a PWM stream (see ws2812.c).
+
+// A rainbow turns round a strip of 60 LEDs, its data input on PD12 (the
+// green LED glows with the bits). A frame takes 60 * 30 us and the latch,
+// about 2.2 ms. The main loop computes the next colours while it waits,
+// and sleeps otherwise: the CPU only wakes every 4 LEDs to expand their
+// bytes. Every 256 frames it prints how long these refills took and how
+// many came too late.
+
+#include "stdafx.h"
+#include "basic21.h"
+#include "ws2812.h"
+#include "pwm_stream.h"
+#include "bench.h"
+#include "pins.h"
+
+#include <stdio.h>
+
+
+#define LEDS		60
+#define BYTES		3		// G R B.
+#define REPORT		256		// Frames between reports.
+
+
+static void SetupStrip();
+static void Rainbow(u8* led, u32 hue);
+
+// Sent from one while the other is computed.
+static u8 s_frames[2][LEDS * BYTES];
+static BenchRegion s_refills;
+
+
+void Basic21()
+{
+    SetupStrip();
+    Bench_Init();
+
+    u32 late = 0;
+    for (u32 frame=0; ; frame++)
+    {
+	u8* leds = s_frames[frame & 1];
+	for (u32 i=0; i<LEDS; i++)
+	{
+	    Rainbow(leds + i * BYTES, (i * 768 / LEDS + frame) % 768);
+	}
+
+	while (Ws2812_IsBusy())
+	{
+	    __WFI();
+	}
+	late += PwmStream_Overruns();
+
+	// No refill runs between frames.
+	if (frame % REPORT == 0)
+	{
+	    if (frame)
+	    {
+		BenchResult result;
+		Bench_Summarize(&s_refills, &result);
+		Bench_PrintHeader();
+		Bench_Print(&result);
+		printf("%u frames, %u late refills\n", frame, late);
+	    }
+	    Bench_Begin(&s_refills, "refill of 4 LEDs");
+	    Ws2812_Measure(&s_refills);
+	}
+
+	Ws2812_Show(leds, LEDS, BYTES);
+    }
+}
+
+
+// The data input of the strip on PD12, channel 1 of TIM4.
+static void SetupStrip()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup strip[] = {
+	PIN_AF(GPIO_Pin_12, GPIO_AF_TIM4, GPIO_Speed_25MHz),
+    };
+    Pins_Init(GPIOD, strip, 1);
+}
+
+
+// A colour wheel of 768 hues at a quarter of the full brightness: red to
+// green to blue and back to red.
+static void Rainbow(u8* led, u32 hue)
+{
+    u32 up = (hue % 256) / 4;
+    u32 down = 63 - up;
+    u32 r = 0, g = 0, b = 0;
+
+    switch (hue / 256)
+    {
+    case 0:	r = down; g = up; break;
+    case 1:	g = down; b = up; break;
+    default:	b = down; r = up; break;
+    }
+
+    led[0] = g;
+    led[1] = r;
+    led[2] = b;
+}
\ No newline at end of file
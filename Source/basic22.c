@@ -0,0 +1,131 @@
+//////////////////////////////// BASIC 22 /////////////////////////////////////
+/////////////////////////////// FREQUENCY METER ///////////////////////////////
+// Demonstrates the measurement of a signal from timestamps of its edges
+// stored by the DMA (see freq.c).
+
+// TIM4 makes a test signal on PD12 (the green LED) that changes every
+// second, from 50 Hz to 2 MHz. A jumper from PD12 to PA15 feeds it to the
+// meter (the host simulation wires them by default, see SIM_WIRE). Each
+// batch prints a line: up to 200 kHz the frequency, duty cycle, period and
+// jitter from the timed edges, above it the frequency from the counted
+// ones.
+
+#include "stdafx.h"
+#include "basic22.h"
+#include "freq.h"
+#include "clock.h"
+#include "pins.h"
+
+#include <stdio.h>
+
+
+typedef struct
+{
+    u32 tickHz;
+    u16 period;
+    u16 pulse;
+} Signal;
+
+static const Signal s_signals[] = {
+    { 1000000,	20000,	5000 },		// 50 Hz, 25 %.
+    { 16000000,	16000,	8000 },		// 1 kHz, 50 %.
+    { 16000000,	333,	111 },		// 48.048 kHz, 33 %.
+    { 16000000,	80,	20 },		// 200 kHz, 25 %.
+    { 16000000,	53,	26 },		// 301.887 kHz, counted.
+    { 16000000,	8,	4 },		// 2 MHz, counted.
+};
+
+#define SIGNALS		(sizeof(s_signals) / sizeof(s_signals[0]))
+
+
+static void SetupPins();
+static void SetSignal(const Signal* signal);
+static void Print(const FreqResult* result);
+
+
+void Basic22()
+{
+    SetupPins();
+    Freq_Init(1);
+
+    u32 batches = 0;
+    u32 signal = 0;
+    SetSignal(&s_signals[0]);
+
+    while (1)
+    {
+	FreqResult result;
+	if (!Freq_Read(&result))
+	{
+	    __WFI();
+	    continue;
+	}
+
+	Print(&result);
+	if (++batches % FREQ_BATCH_HZ == 0)
+	{
+	    signal = (signal + 1) % SIGNALS;
+	    SetSignal(&s_signals[signal]);
+	}
+    }
+}
+
+
+// The signal from TIM4 channel 1 on PD12, into TIM2 channel 1 and ETR on
+// PA15.
+static void SetupPins()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA | RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup signal[] = {
+	PIN_AF(GPIO_Pin_12, GPIO_AF_TIM4, GPIO_Speed_25MHz),
+    };
+    Pins_Init(GPIOD, signal, 1);
+
+    static const PinGroup meter[] = {
+	PIN_AF(GPIO_Pin_15, GPIO_AF_TIM2, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOA, meter, 1);
+}
+
+
+static void SetSignal(const Signal* signal)
+{
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM4, ENABLE);
+    TIM_Cmd(TIM4, DISABLE);
+    Clock_RegisterTimer(TIM4, signal->tickHz);
+
+    TIM_SetAutoreload(TIM4, signal->period - 1);
+    TIM_OCInitTypeDef oc;
+    TIM_OCStructInit(&oc);
+    oc.TIM_OCMode = TIM_OCMode_PWM1;
+    oc.TIM_OutputState = TIM_OutputState_Enable;
+    oc.TIM_Pulse = signal->pulse;
+    TIM_OC1Init(TIM4, &oc);
+
+    // Load the prescaler.
+    TIM_GenerateEvent(TIM4, TIM_EventSource_Update);
+    TIM_Cmd(TIM4, ENABLE);
+
+    printf("signal %u Hz\n", signal->tickHz / signal->period);
+}
+
+
+// Frequencies to the mHz, times to the ns.
+static void Print(const FreqResult* result)
+{
+    u32 hz = (u32)result->frequency;
+    u32 mhz = (u32)((result->frequency - hz) * 1000);
+
+    if (result->mode == FREQ_GATE)
+    {
+	printf("  counted %7u.%03u Hz\n", hz, mhz);
+	return;
+    }
+
+    printf("  timed   %7u.%03u Hz, %4u periods, duty %3u.%u %%, period %u ns "
+	   "(%u..%u), jitter %u ns\n", hz, mhz, result->periods,
+	   (u32)(result->duty * 100), (u32)(result->duty * 1000) % 10,
+	   (u32)(result->period * 1e9f), (u32)(result->periodMin * 1e9f),
+	   (u32)(result->periodMax * 1e9f), (u32)(result->jitter * 1e9f));
+}
\ No newline at end of file
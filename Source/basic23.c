@@ -0,0 +1,135 @@
+//////////////////////////////// BASIC 23 /////////////////////////////////////
+////////////////////////////////// ENCODER ////////////////////////////////////
+// Demonstrates counting a quadrature encoder and estimating its velocity
+// (see encoder.c).
+
+// TIM4 plays the encoder: channels 1 and 2 toggle PD12 (A, the green LED)
+// and PD13 (B, the orange LED) half a period of the timer apart, which
+// makes two square waves a quarter of their period apart, 2 counts per
+// period of the timer. Every 500 ms the speed changes, from standing
+// through 100000 down to 40 counts/s, then the same backwards. Jumpers
+// from PD12 to PB4 and from PD13 to PB5 feed it to TIM3 (the host
+// simulation wires them by default, see SIM_WIRE). Every 100 ms a line
+// shows the count, the velocity and the method it was estimated with.
+
+#include "stdafx.h"
+#include "basic23.h"
+#include "encoder.h"
+#include "clock.h"
+#include "pins.h"
+
+#include <stdio.h>
+
+
+#define BASIC23_TICK_HZ		1000000		// Of TIM4.
+#define BASIC23_STEP_US		500000
+#define BASIC23_PRINT_US	100000
+
+// Counts per second, forward and backward. 0 stands.
+static const s32 s_speeds[] = {
+    0, 100000, 20000, 2000, 200, 40, 0, -100000, -20000, -2000, -200, -40,
+};
+
+#define SPEEDS		(sizeof(s_speeds) / sizeof(s_speeds[0]))
+
+
+static void SetupPins();
+static void SetSpeed(s32 speed);
+static void Print(const EncoderSnapshot* snapshot);
+
+
+void Basic23()
+{
+    SetupPins();
+    Encoder_Init(1);
+    Encoder_Add(TIM3, 3);
+
+    EncoderSnapshot snapshot;
+    Encoder_Read(0, &snapshot);
+    u32 step = snapshot.time;
+    u32 print = snapshot.time;
+    u32 speed = 0;
+    SetSpeed(s_speeds[0]);
+
+    while (1)
+    {
+	__WFI();
+	Encoder_Read(0, &snapshot);
+
+	if (snapshot.time - print >= BASIC23_PRINT_US)
+	{
+	    print += BASIC23_PRINT_US;
+	    Print(&snapshot);
+	}
+	if (snapshot.time - step >= BASIC23_STEP_US)
+	{
+	    step += BASIC23_STEP_US;
+	    speed = (speed + 1) % SPEEDS;
+	    SetSpeed(s_speeds[speed]);
+	}
+    }
+}
+
+
+// TIM4 channels 1 and 2 out on PD12 and PD13, TIM3 channels 1 and 2 in on
+// PB4 and PB5.
+static void SetupPins()
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOB | RCC_AHB1Periph_GPIOD, ENABLE);
+
+    static const PinGroup signal[] = {
+	PIN_AF(GPIO_Pin_12 | GPIO_Pin_13, GPIO_AF_TIM4, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOD, signal, 1);
+
+    static const PinGroup encoder[] = {
+	PIN_AF(GPIO_Pin_4 | GPIO_Pin_5, GPIO_AF_TIM3, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOB, encoder, 1);
+
+    // The outputs stay enabled, so that the levels hold while the speed
+    // changes.
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM4, ENABLE);
+    Clock_RegisterTimer(TIM4, BASIC23_TICK_HZ);
+
+    TIM_OCInitTypeDef oc;
+    TIM_OCStructInit(&oc);
+    oc.TIM_OCMode = TIM_OCMode_Toggle;
+    oc.TIM_OutputState = TIM_OutputState_Enable;
+    TIM_OC1Init(TIM4, &oc);
+    TIM_OC2Init(TIM4, &oc);
+}
+
+
+// The channel toggled first decides the direction: going forward A
+// toggles when A equals B, and B when they differ. Going backward the
+// other way round.
+static void SetSpeed(s32 speed)
+{
+    TIM_Cmd(TIM4, DISABLE);
+    printf("speed %d counts/s\n", speed);
+    if (speed == 0)
+    {
+	return;
+    }
+
+    u32 period = 2 * BASIC23_TICK_HZ / ((speed < 0) ? -speed : speed);
+    u32 a = GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_12);
+    u32 b = GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_13);
+    int aFirst = (a == b) == (speed > 0);
+
+    TIM_SetAutoreload(TIM4, period - 1);
+    TIM_SetCompare1(TIM4, aFirst ? period / 4 : period * 3 / 4);
+    TIM_SetCompare2(TIM4, aFirst ? period * 3 / 4 : period / 4);
+
+    // Load the prescaler.
+    TIM_GenerateEvent(TIM4, TIM_EventSource_Update);
+    TIM_Cmd(TIM4, ENABLE);
+}
+
+
+static void Print(const EncoderSnapshot* snapshot)
+{
+    printf("  count %7d, %7d counts/s (%c)\n", (s32)snapshot->count,
+	   (s32)snapshot->velocity, (snapshot->method == ENCODER_T) ? 'T' : 'M');
+}
\ No newline at end of file
@@ -8,6 +8,12 @@
 
 #include "stdafx.h"
 #include "basic4.h"
+#include "tim_solver.h"
+#include "isr.h"
+#include "defer.h"
+#include "gpio_port.h"
+#include "pins.h"
+#include "bitband.h"
 
 
 static void	SetupLEDs();
@@ -15,24 +21,25 @@ static void	SetupPushButton();
 static void	SetupBasicTimers();
 static void	SetupTimer6();
 static void	SetupTimer7();
-static u16	GetPrescaler(u32 clockSpeed);
-static void	SetTimerClock(TIM_TypeDef* TIMx, u32 clockSpeed);
+static void	SetTimerClock(TIM_TypeDef* TIMx, u16 prescaler);
+static void	Timer6Handler();
+static void	Timer7Handler();
+static void	Timer6Work(void* unused);
+static void	Timer7Work(void* unused);
+static void	PushButtonHandler();
 
-// Interrupt handlers need the C caller convention. This is necessary if
-// the code is compiled as C++ code.
-#ifdef __cplusplus
-extern "C" {
-#endif
+// Prescalers for the counter clocks used here. TIM6 and TIM7 are on APB1.
+// The compiler works them out (see tim_solver.h) and refuses a clock that
+// the 16-bit prescaler cannot reach.
+#define PSC_1KHZ	TIMER_PRESCALER(TIMER_APB1_CLOCK, 1000)
+#define PSC_2KHZ	TIMER_PRESCALER(TIMER_APB1_CLOCK, 2000)
+#define PSC_3KHZ	TIMER_PRESCALER(TIMER_APB1_CLOCK, 3000)
+#define PSC_6KHZ	TIMER_PRESCALER(TIMER_APB1_CLOCK, 6000)
 
-#ifdef BASIC_4    
-void TIM6_DAC_IRQHandler();
-void TIM7_IRQHandler();
-void EXTI0_IRQHandler();
-#endif
+static u32 times = 0;
 
-#ifdef __cplusplus
-}
-#endif
+// The LEDs are changed by the work of both timers (see gpio_port.h).
+static GpioPort s_leds;
 
 
 void Basic4()
@@ -50,6 +57,17 @@ void Basic4()
     // Here we stop the TIM4 with the CPU.
     DBGMCU_APB1PeriphConfig(DBGMCU_TIM6_STOP, ENABLE);
     
+    // The handlers are put into the vector table at run time (see isr.c),
+    // so they need not have the names of startup_stm32f4xx.s and do not
+    // clash with the handlers of the other programs.
+    Isr_SetVector(TIM6_DAC_IRQn, Timer6Handler);
+    Isr_SetVector(TIM7_IRQn, Timer7Handler);
+    Isr_SetVector(EXTI0_IRQn, PushButtonHandler);
+    
+    // The handlers leave their work to PendSV (see defer.c).
+    Defer_Init();
+    Isr_SetVector(PendSV_IRQn, Defer_Process);
+    
     SetupLEDs();
     SetupPushButton();
     SetupBasicTimers();
@@ -65,16 +83,17 @@ static void SetupLEDs()
     // CLock the peripheral.
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
     
-    // Initialize the peripheral description.
-    GPIO_InitTypeDef init;
-    init.GPIO_Mode = GPIO_Mode_OUT;
-    init.GPIO_OType = GPIO_OType_PP;
-    init.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
-    init.GPIO_PuPd = GPIO_PuPd_NOPULL;
-    init.GPIO_Speed = GPIO_Speed_2MHz;
+    // Describe the pins. The description is a constant, checked by the
+    // compiler, and written with one access per register (see pins.h).
+    static const PinGroup leds[] = {
+	PIN_OUTPUT(GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15,
+		   GPIO_Speed_2MHz),
+    };
     
     // Initialize the peripheral.
-    GPIO_Init(GPIOD, &init);
+    Pins_Init(GPIOD, leds, 1);
+    
+    GpioPort_Init(&s_leds, GPIOD);
 }
 
 
@@ -273,7 +292,7 @@ static void SetupTimer6()
     TIM_ARRPreloadConfig(TIM4, ENABLE);
     
     // Set the timer prescaler.
-    SetTimerClock(TIM6, 1000);
+    SetTimerClock(TIM6, PSC_1KHZ);
     
     // Generate a UEV. This will cause the new values of ARR and PSC to take
     // effect. Otherwise the effective value of PSC will only change after the
@@ -319,7 +338,7 @@ static void SetupTimer7()
     TIM_SetAutoreload(TIM7, 999);
     
     // Set the prescaler (PSC).
-    SetTimerClock(TIM7, 3000);
+    SetTimerClock(TIM7, PSC_3KHZ);
     
     // Enable the timer interrupt (Set the UIE flag).
     TIM_ITConfig(TIM7, TIM_IT_Update, ENABLE);
@@ -334,19 +353,8 @@ static void SetupTimer7()
 }
 
 
-// Returns a prescaler for timer required by it to count at the desired speed.
-static u16 GetPrescaler(u32 clockSpeed)
-{
-    u32 f = SystemCoreClock / clockSpeed;
-    // Since 1 means divide by 2 and not divide by 1.
-    f--;
-    return (u16)f;
-}
-
-
-// Sets the timers clock to the desired speed by setting its prescaler
-// appropriately.
-static void SetTimerClock(TIM_TypeDef* TIMx, u32 clockSpeed)
+// Sets the timers clock to the desired speed by setting its prescaler.
+static void SetTimerClock(TIM_TypeDef* TIMx, u16 prescaler)
 {
     /// Set the prescaler of the timer.
     // As we know that the prescaler get updated only on UEV.
@@ -354,42 +362,62 @@ static void SetTimerClock(TIM_TypeDef* TIMx, u32 clockSpeed)
     // In the 3rd arugment Update doesn't sets the UG flag and the change takes
     // place on the next UEV. Immediate sets the UG flag which resets the counter
     // and generates a UEV depending on UDIS.
-    TIM_PrescalerConfig(TIMx, GetPrescaler(clockSpeed), TIM_PSCReloadMode_Update);
+    TIM_PrescalerConfig(TIMx, prescaler, TIM_PSCReloadMode_Update);
 }
 
 
-#ifdef BASIC_4
-static u32 times = 0;
-// This is the TIM6 interrupt handler. Notice the name of the handler. This is
-// because this handler is shared by DAC. But since we are not using DAC we
+// This is the TIM6 interrupt handler. It is set on the TIM6_DAC vector
+// because this interrupt is shared by DAC. But since we are not using DAC we
 // don't need to worry about checking which peripheral made the interrupt.
-void TIM6_DAC_IRQHandler()
+static void Timer6Handler()
 {
     // The interrupt pending bit of the timer (UIF in SR) must be cleared
     // othewise the interrupt will occur again as soon as this function returns.
     // This function does the job for you.
     TIM_ClearITPendingBit(TIM6, TIM_IT_Update);
     
-    // Toggle the LED.
-    GPIO_ToggleBits(GPIOD, GPIO_Pin_12);
+    // The rest can wait until no interrupt is active. The handler returns
+    // at once and does not hold up the interrupts of lower priority. The
+    // work of TIM6 runs before that of TIM7, as TIM6 has the higher
+    // priority.
+    Defer_Post(Timer6Work, 0, 0);
+}
+
+
+// TIM7 Interrupt Request Handler. TIM7 does not share an interrupt handler
+// with any other peripheral.
+static void Timer7Handler()
+{
+    TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
+    Defer_Post(Timer7Work, 0, 1);
+}
+
+
+// The work of the TIM6 interrupt, run by PendSV.
+static void Timer6Work(void* unused)
+{
+    // Toggle the LED. GPIO_ToggleBits() would read and write back the whole
+    // port, undoing the change of an interrupt to another pin meanwhile.
+    GpioPort_Toggle(&s_leds, GPIO_Pin_12);
     
     times++;
     if (times == 5)
     {
-	SetTimerClock(TIM6, 2000);
+	SetTimerClock(TIM6, PSC_2KHZ);
     }
     else if (times == 10)
     {
-	// This sets the timers in one pulse mode. Use Repetitive in place of
-	// Single to revert from OPM.
-	TIM_SelectOnePulseMode(TIM6, TIM_OPMode_Single);
+	// This sets the timers in one pulse mode. Clear OPM to revert. The
+	// bit is set with a single store to its bit-band alias (see
+	// bitband.h). TIM_SelectOnePulseMode() would read and write back CR1,
+	// and could undo the push button interrupt setting CEN meanwhile.
+	BITBAND_SET(TIM6->CR1, TIM_CR1_OPM);
     }
 }
 
 
-// TIM7 Interrupt Request Handler. TIM7 does not share an interrupt handler
-// with any other peripheral.
-void TIM7_IRQHandler()
+// The work of the TIM7 interrupt, run by PendSV.
+static void Timer7Work(void* unused)
 {
     static u32 pins[] = {
 	GPIO_Pin_13,
@@ -400,10 +428,8 @@ void TIM7_IRQHandler()
     static u32 currentPin = 0;
     static u32 oldPin = 2;
     
-    TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
-    
-    GPIO_SetBits(GPIOD, pins[currentPin]);
-    GPIO_ResetBits(GPIOD, pins[oldPin]);
+    // The next LED goes on as the last one goes off, in one store.
+    GpioPort_Apply(&s_leds, pins[currentPin], pins[oldPin], 0);
     
     oldPin = currentPin;
     currentPin++;
@@ -411,20 +437,19 @@ void TIM7_IRQHandler()
     
     if (times == 5)
     {
-	SetTimerClock(TIM7, 6000);
+	SetTimerClock(TIM7, PSC_6KHZ);
     }
     else if (times == 10)
     {
-	TIM_SelectOnePulseMode(TIM7, TIM_OPMode_Single);
+	BITBAND_SET(TIM7->CR1, TIM_CR1_OPM);
     }
 }
 
 
-void EXTI0_IRQHandler()
+static void PushButtonHandler()
 {
     // The EXTI interrupt pending bit must also be cleared.
     EXTI_ClearITPendingBit(EXTI_Line0);
-    TIM_Cmd(TIM6, ENABLE);
-    TIM_Cmd(TIM7, ENABLE);
-}
-#endif
\ No newline at end of file
+    BITBAND_SET(TIM6->CR1, TIM_CR1_CEN);
+    BITBAND_SET(TIM7->CR1, TIM_CR1_CEN);
+}
\ No newline at end of file
@@ -5,29 +5,20 @@
 
 #include "stdafx.h"
 #include "basic5.h"
+#include "isr.h"
 
 
 static void SetupGPIO();
 static void SetupTimer();
-
-
-// Interrupt handlers need the C caller convention. This is necessary if
-// the code is compiled as C++ code.
-#ifdef __cplusplus
-extern "C" {
-#endif
-    
-#ifdef BASIC_5
-void TIM4_IRQHandler();
-#endif
-
-#ifdef __cplusplus
-}
-#endif
+static void TimerHandler(void* pin);
 
 
 void Basic5()
 {
+    // The handler is attached at run time (see isr.c). It gets the LED to
+    // toggle as its context.
+    Isr_Attach(TIM4_IRQn, TimerHandler, (void*)(u32)GPIO_Pin_13);
+    
     SetupGPIO();
     SetupTimer();
     
@@ -240,10 +231,8 @@ static void SetupTimer()
 }
 
 
-#ifdef BASIC_5
-void TIM4_IRQHandler()
+static void TimerHandler(void* pin)
 {
     TIM_ClearITPendingBit(TIM4, TIM_IT_Update);
-    GPIO_ToggleBits(GPIOD, GPIO_Pin_13);
-}
-#endif
\ No newline at end of file
+    GPIO_ToggleBits(GPIOD, (u16)(u32)pin);
+}
\ No newline at end of file
@@ -4,27 +4,13 @@
 
 #include "stdafx.h"
 #include "basic6.h"
+#include "isr.h"
 
 
 static void SetupGPIO();
 static void SetupTimer();
 
 
-// Interrupt handlers need the C caller convention. This is necessary if
-// the code is compiled as C++ code.
-#ifdef __cplusplus
-extern "C" {
-#endif
-    
-#ifdef BASIC_6
-void TIM4_IRQHandler();
-#endif
-
-#ifdef __cplusplus
-}
-#endif
-
-
 void Basic6()
 {
     // The ARM Cortex M has a standardized debug interface. The debug interface
@@ -40,6 +26,10 @@ void Basic6()
     // Here we stop the TIM4 with the CPU.
     DBGMCU_APB1PeriphConfig(DBGMCU_TIM4_STOP, ENABLE);
     
+    // The update handler goes straight into the vector table (see isr.c).
+    // Basic5 uses TIM4 too, and both can be in the same program.
+    Isr_SetVector(TIM4_IRQn, Basic6_OnUpdate);
+    
     SetupGPIO();
     SetupTimer();
     
@@ -193,9 +183,9 @@ static void SetupTimer()
 }
 
 
-// TIM4 Interrupt Request Handler.
-#ifdef BASIC_6
-void TIM4_IRQHandler()
+// The TIM4 interrupt handler. It is set into the vector table at run time
+// and can be benchmarked outside the interrupt as well (see Basic9).
+void Basic6_OnUpdate()
 {
     TIM_ClearITPendingBit(TIM4, TIM_IT_Update);
     
@@ -219,4 +209,3 @@ void TIM4_IRQHandler()
     TIM_SetCompare1(TIM4, (u32)newValue);
     //TIM4->CCR1 = (u32)newValue;
 }
-#endif
\ No newline at end of file
@@ -18,13 +18,18 @@
 
 #include "stdafx.h"
 #include "basic8.h"
+#include "tim_solver.h"
+#include "pins.h"
 
 
 static void SetupLEDs();
 static void SetupPushButton();
 static void SetupPushButtonTimer();
 static void SetupLEDTimer();
-static u16 GetPrescaler(u32 clock);
+
+// Both timers count at 1 kHz. TIM2 and TIM4 are on APB1. The prescaler is
+// worked out by the compiler (see tim_solver.h).
+#define PSC_1KHZ	TIMER_PRESCALER(TIMER_APB1_CLOCK, 1000)
 
 
 #ifdef __cplusplus
@@ -59,13 +64,12 @@ static void SetupLEDs()
     // Clock the peripheral.
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
     
-    // Initialize the peripheral.
-    GPIO_InitTypeDef gpio;
-    gpio.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
-    gpio.GPIO_Mode = GPIO_Mode_OUT;
-    gpio.GPIO_OType = GPIO_OType_PP;
-    gpio.GPIO_Speed = GPIO_Speed_2MHz;
-    GPIO_Init(GPIOD, &gpio);
+    // Initialize the peripheral (see pins.h).
+    static const PinGroup leds[] = {
+	PIN_OUTPUT(GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15,
+		   GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOD, leds, 1);
     
    // GPIO_SetBits(GPIOD, GPIO_Pin_12);
 }
@@ -76,15 +80,12 @@ static void SetupPushButton()
     // Clock it.
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
     
-    // Initialize the push button pin as timer 2's alternate function.
-    GPIO_InitTypeDef gpio;
-    gpio.GPIO_Pin = GPIO_Pin_0;
-    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
-    gpio.GPIO_Mode = GPIO_Mode_AF;
-    GPIO_Init(GPIOA, &gpio);
-    
-    // Configure the pin's alternate function.
-    GPIO_PinAFConfig(GPIOA, GPIO_PinSource0, GPIO_AF_TIM2);
+    // Initialize the push button pin as timer 2's alternate function. The
+    // alternate function is set with the mode.
+    static const PinGroup button[] = {
+	PIN_AF(GPIO_Pin_0, GPIO_AF_TIM2, GPIO_Speed_2MHz),
+    };
+    Pins_Init(GPIOA, button, 1);
 }
 
 
@@ -99,7 +100,7 @@ static void SetupPushButtonTimer()
     base.TIM_CounterMode = TIM_CounterMode_Up;
     // Counter up to maximum value.
     base.TIM_Period = (u32)-1;
-    base.TIM_Prescaler = GetPrescaler(1000);
+    base.TIM_Prescaler = PSC_1KHZ;
     
     // Do it.
     TIM_TimeBaseInit(TIM2, &base);
@@ -260,7 +261,7 @@ static void SetupLEDTimer()
     // timer interrupt.
     base.TIM_Period = 1000;
     // 1 ms clock.
-    base.TIM_Prescaler = GetPrescaler(1000);
+    base.TIM_Prescaler = PSC_1KHZ;
     
     // Initialize the time base.
     TIM_TimeBaseInit(TIM4, &base);
@@ -326,14 +327,6 @@ static void SetupLEDTimer()
 }
 
 
-// Returns a prescaler to run the clock @ the required frequency it Hz.
-static u16 GetPrescaler(u32 clock)
-{
-    u32 t = (SystemCoreClock / clock) - 1;
-    return t;
-}
-
-
 // Counter to store the time differnence between rising and falling edges of
 // the push-button.
 static u32 counter = 0;
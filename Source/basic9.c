@@ -0,0 +1,147 @@
+//////////////////////////////// BASIC 9 //////////////////////////////////////
+/////////////////////////////// BENCHMARKING //////////////////////////////////
+// Demonstrates how to measure the execution time of code in core clock cycles
+// with the cycle counter of the DWT (see bench.c).
+// Times a few library calls and interrupt handlers of the previous programs
+// and prints the results through the debugger's Terminal I/O.
+
+
+#include "stdafx.h"
+#include "basic9.h"
+#include "basic6.h"
+#include "bench.h"
+#include "clock.h"
+#include "timestamp.h"
+
+
+#define BASIC9_RUNS		100
+#define BASIC9_CRC_WORDS	64
+
+
+static void GpioInit();
+static void TimeBaseInit();
+static void CalcBlockCrc();
+static void WaitOneMilli();
+static void ReadTimestamp();
+
+static u32 s_crcData[BASIC9_CRC_WORDS];
+
+
+void Basic9()
+{
+    // Timing code with a timer, or by toggling a pin and looking at it with
+    // an oscilloscope, works but is tedious. The Cortex-M4 counts its own
+    // clock cycles in the DWT, which costs nothing while it runs and can be
+    // read at any point of the code.
+    Bench_Init();
+
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_CRC, ENABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM4, ENABLE);
+
+    for (u32 i=0; i<BASIC9_CRC_WORDS; i++)
+    {
+	s_crcData[i] = i * 0x9E3779B9;
+    }
+
+    // A single run can be made longer by an interrupt or a flash wait, so
+    // every benchmark is run a number of times. The median tells the usual
+    // cost and the 99th percentile and max the worst case one has to plan for.
+    BenchResult result;
+    Bench_PrintHeader();
+
+    Bench_Run("GPIO_Init", GpioInit, BASIC9_RUNS, &result);
+    Bench_Print(&result);
+
+    Bench_Run("TIM_TimeBaseInit", TimeBaseInit, BASIC9_RUNS, &result);
+    Bench_Print(&result);
+
+    // The body of the PWM interrupt handler of Basic6.
+    Bench_Run("Basic6 TIM4 update", Basic6_OnUpdate, BASIC9_RUNS, &result);
+    Bench_Print(&result);
+
+    Bench_Run("CRC_CalcBlockCRC 64", CalcBlockCrc, BASIC9_RUNS, &result);
+    Bench_Print(&result);
+
+    // Basic1 waits by counting nop loops. The result shows how far such a
+    // delay is off from the SystemCoreClock / 1000 cycles of a millisecond.
+    Bench_Run("nop loop 1 ms", WaitOneMilli, 10, &result);
+    Bench_Print(&result);
+
+    // A 64-bit microsecond timestamp from two chained timers (see
+    // timestamp.c). It takes a few bus reads and no interrupt.
+    Timestamp_Init();
+    Bench_Run("Timestamp_Now", ReadTimestamp, BASIC9_RUNS, &result);
+    Bench_Print(&result);
+
+    // The handler of Basic6 again at every clock profile (see clock.c). It
+    // takes more cycles the faster the core runs: the flash needs more wait
+    // states and TIM4 sits on the APB1 bus which runs at 42 MHz at most.
+    // TIM4 is registered with the clock module so that its counter keeps
+    // running at 100 kHz whatever the profile.
+    static const char* names[CLOCK_PROFILES] = {
+	"TIM4 update 16 MHz",
+	"TIM4 update 42 MHz",
+	"TIM4 update 84 MHz",
+	"TIM4 update 168 MHz",
+    };
+    Clock_RegisterTimer(TIM4, 100000);
+    for (u32 p=0; p<CLOCK_PROFILES; p++)
+    {
+	Clock_SetProfile((ClockProfile)p);
+	Bench_Run(names[p], Basic6_OnUpdate, BASIC9_RUNS, &result);
+	Bench_Print(&result);
+    }
+
+    while (1)
+    {
+    }
+}
+
+
+static void GpioInit()
+{
+    GPIO_InitTypeDef gpio;
+    gpio.GPIO_Mode = GPIO_Mode_OUT;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_Pin = GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
+    gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    gpio.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_Init(GPIOD, &gpio);
+}
+
+
+static void TimeBaseInit()
+{
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = 1000 - 1;
+    base.TIM_Prescaler = (SystemCoreClock / 100000) - 1;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM4, &base);
+}
+
+
+static void CalcBlockCrc()
+{
+    CRC_ResetDR();
+    CRC_CalcBlockCRC(s_crcData, BASIC9_CRC_WORDS);
+}
+
+
+// The delay loop of Basic1.
+static void WaitOneMilli()
+{
+    u32 m = SystemCoreClock / 2000;
+    for (u32 j=0; j<m; j++)
+    {
+	asm("nop");
+    }
+}
+
+
+static void ReadTimestamp()
+{
+    Timestamp_Now();
+}
@@ -0,0 +1,144 @@
+///////////////////////////////// BENCHMARKS //////////////////////////////////
+// Times code regions in core clock cycles with the cycle counter of the Data
+// Watchpoint and Trace (DWT) unit and reports the min, median, 99th
+// percentile and max over a number of runs.
+
+// The DWT is one of the debug components of the Cortex-M4. Besides its
+// watchpoints it has a free running 32-bit counter of core clock cycles
+// (CYCCNT). Like all the debug components it is only powered when the TRCENA
+// bit of the Debug Exception and Monitor Control Register (DEMCR) is set.
+// A 32-bit cycle count wraps after 25 s at 168 MHz which is plenty for the
+// regions timed here. The difference of two counts is correct across a wrap.
+
+// In the host build (SIM_HOST) the simulation counts CYCCNT on its virtual
+// clock, so the numbers are cycles there too: the modelled bus cycles of the
+// register accesses, plus the quanta the host interval timer adds while the
+// program runs (see sim.c). The quanta still follow the host, so the counts
+// come in steps of one quantum; SIM_SPEED=1 makes the steps finest.
+
+#include "stdafx.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static BenchRegion s_region;
+static u32 s_overhead = 0;
+
+
+static int CompareSamples(const void* a, const void* b)
+{
+    u32 x = *(const u32*)a;
+    u32 y = *(const u32*)b;
+    return (x > y) - (x < y);
+}
+
+
+void Bench_Init()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+    // The cost of timing an empty region is taken off every sample.
+    s_overhead = 0;
+    Bench_Begin(&s_region, "overhead");
+    for (u32 i=0; i<16; i++)
+    {
+	Bench_Start(&s_region);
+	Bench_Stop(&s_region);
+    }
+
+    BenchResult result;
+    Bench_Summarize(&s_region, &result);
+    s_overhead = result.min;
+}
+
+
+u32 Bench_Now()
+{
+    return DWT_CYCCNT;
+}
+
+
+const char* Bench_Unit()
+{
+    return "cycles";
+}
+
+
+void Bench_Begin(BenchRegion* region, const char* name)
+{
+    region->name = name;
+    region->count = 0;
+}
+
+
+void Bench_Start(BenchRegion* region)
+{
+    region->start = Bench_Now();
+}
+
+
+void Bench_Stop(BenchRegion* region)
+{
+    u32 elapsed = Bench_Now() - region->start;
+
+    // Samples beyond the buffer are dropped.
+    if (region->count < BENCH_MAX_SAMPLES)
+    {
+	region->samples[region->count++] = (elapsed > s_overhead) ? elapsed - s_overhead : 0;
+    }
+}
+
+
+void Bench_Summarize(BenchRegion* region, BenchResult* result)
+{
+    u32 n = region->count;
+
+    result->name = region->name;
+    result->count = n;
+    if (n == 0)
+    {
+	result->min = result->median = result->p99 = result->max = 0;
+	return;
+    }
+
+    // Sorting the samples destroys their order, which is not needed anymore.
+    qsort(region->samples, n, sizeof(u32), CompareSamples);
+    result->min = region->samples[0];
+    result->median = region->samples[n / 2];
+    result->p99 = region->samples[(n * 99 + 99) / 100 - 1];
+    result->max = region->samples[n - 1];
+}
+
+
+void Bench_Run(const char* name, void (*function)(), u32 iterations,
+	       BenchResult* result)
+{
+    Bench_Begin(&s_region, name);
+    for (u32 i=0; i<iterations; i++)
+    {
+	Bench_Start(&s_region);
+	function();
+	Bench_Stop(&s_region);
+    }
+    Bench_Summarize(&s_region, result);
+}
+
+
+void Bench_PrintHeader()
+{
+    printf("%-24s %6s %10s %10s %10s %10s  (%s)\n", "Benchmark", "Runs",
+	   "Min", "Median", "P99", "Max", Bench_Unit());
+}
+
+
+void Bench_Print(const BenchResult* result)
+{
+    printf("%-24s %6u %10u %10u %10u %10u\n", result->name,
+	   (unsigned)result->count, (unsigned)result->min,
+	   (unsigned)result->median, (unsigned)result->p99,
+	   (unsigned)result->max);
+}
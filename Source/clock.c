@@ -0,0 +1,287 @@
+/////////////////////////////// CLOCK PROFILES ////////////////////////////////
+// Switches the system clock between a few named configurations at run time.
+
+// After reset, and after SystemInit(), the core runs from the 16 MHz HSI. It
+// can run up to 168 MHz from the main PLL. The PLL here is fed from the HSI:
+//	VCO = HSI / PLLM * PLLN = 16 MHz / 16 * 336 = 336 MHz
+//	SYSCLK = VCO / PLLP (2, 4 or 8 gives 168, 84 or 42 MHz)
+//	USB/SDIO clock = VCO / PLLQ = 336 MHz / 7 = 48 MHz
+// The APB1 bus may not run above 42 MHz and the APB2 bus not above 84 MHz,
+// so their prescalers change with the profile. Timers on an APB bus whose
+// prescaler is not 1 run at twice the bus clock.
+
+// The flash memory cannot be read at the core clock. The number of wait
+// states (latency) for 2.7 V to 3.6 V is one per started 30 MHz. The
+// latency must be raised before the clock goes up and may only be lowered
+// after it came down.
+
+// Everything clocked from SYSCLK changes with the profile. Timers registered
+// with Clock_RegisterTimer() get a new prescaler so that their counters keep
+// their clock, and with it the periods configured in ARR. The SysTick reload
+// value is scaled likewise. A profile where a timer or the SysTick cannot
+// keep its period is refused before anything changes. The switch runs with
+// interrupts disabled so no handler sees a half changed clock tree.
+
+#include "stdafx.h"
+#include "clock.h"
+
+
+#define CLOCK_PLLM		16
+#define CLOCK_PLLN		336
+#define CLOCK_PLLQ		7
+
+
+typedef struct
+{
+    TIM_TypeDef* timer;
+    u32 counterClock;
+} ClockTimer;
+
+
+static const ClockProfileConfig s_profiles[CLOCK_PROFILES] = {
+    { "16 MHz",	16000000,	0, RCC_SYSCLK_Div1, RCC_HCLK_Div1, RCC_HCLK_Div1, FLASH_Latency_0 },
+    { "42 MHz",	42000000,	8, RCC_SYSCLK_Div1, RCC_HCLK_Div1, RCC_HCLK_Div1, FLASH_Latency_1 },
+    { "84 MHz",	84000000,	4, RCC_SYSCLK_Div1, RCC_HCLK_Div2, RCC_HCLK_Div1, FLASH_Latency_2 },
+    { "168 MHz",	168000000,	2, RCC_SYSCLK_Div1, RCC_HCLK_Div4, RCC_HCLK_Div2, FLASH_Latency_5 },
+};
+
+static ClockProfile s_profile = CLOCK_PROFILE_16MHZ;
+static ClockTimer s_timers[CLOCK_MAX_TIMERS];
+
+
+// The APB prescaler as a number from its RCC_HCLK_DivX value.
+static u32 ApbDivider(u32 divider)
+{
+    return (divider & RCC_CFGR_PPRE1_2) ? 2u << ((divider >> 10) & 3) : 1;
+}
+
+
+// The AHB prescaler as a number from its RCC_SYSCLK_DivX value: 2 to 16,
+// then 64 to 512 (there is no 32).
+static u32 AhbDivider(u32 divider)
+{
+    u32 index = (divider >> 4) & 7;
+    return (divider & RCC_CFGR_HPRE_3) ? 2u << (index + (index >= 4)) : 1;
+}
+
+
+// Timers on APB2 (TIM1, TIM8-TIM11) follow PCLK2, the others PCLK1.
+static int IsApb2Timer(TIM_TypeDef* TIMx)
+{
+    return (u32)TIMx >= APB2PERIPH_BASE;
+}
+
+
+static u32 TimerClock(u32 pclk, u32 hclk)
+{
+    return (pclk == hclk) ? pclk : 2 * pclk;
+}
+
+
+// Rounds to the nearest prescaler. Returns 0 if the counter clock cannot be
+// reached from the timer clock.
+static int GetPrescaler(u32 timerClock, u32 counterClock, u32* prescaler)
+{
+    u32 divider = (timerClock + counterClock / 2) / counterClock;
+
+    if (divider == 0 || divider > 0x10000)
+    {
+	return 0;
+    }
+    *prescaler = divider - 1;
+    return 1;
+}
+
+
+static u32 ProfileHclk(const ClockProfileConfig* config)
+{
+    return config->sysclk / AhbDivider(config->hclkDivider);
+}
+
+
+static u32 ProfileTimerClock(const ClockProfileConfig* config, TIM_TypeDef* TIMx)
+{
+    u32 hclk = ProfileHclk(config);
+    u32 divider = ApbDivider(IsApb2Timer(TIMx) ? config->pclk2Divider : config->pclk1Divider);
+    return TimerClock(hclk / divider, hclk);
+}
+
+
+// Loads a new prescaler right away. PSC is preloaded and would otherwise
+// only be used from the next update event on. The update event generated
+// here does not set the update flag (URS) and the counter keeps its value.
+static void Retune(TIM_TypeDef* TIMx, u32 prescaler)
+{
+    u32 cnt = TIMx->CNT;
+    u16 cr1 = TIMx->CR1;
+
+    TIMx->PSC = prescaler;
+    TIMx->CR1 = cr1 | TIM_CR1_URS;
+    TIMx->EGR = TIM_EGR_UG;
+    TIMx->CNT = cnt;
+    TIMx->CR1 = cr1;
+}
+
+
+static void SwitchSysClock(u32 source)
+{
+    RCC_SYSCLKConfig(source);
+    while (RCC_GetSYSCLKSource() != (source << 2))
+    {
+    }
+}
+
+
+ErrorStatus Clock_SetProfile(ClockProfile profile)
+{
+    if (profile >= CLOCK_PROFILES)
+    {
+	return ERROR;
+    }
+
+    const ClockProfileConfig* config = &s_profiles[profile];
+    u32 prescalers[CLOCK_MAX_TIMERS];
+
+    // Refuse a profile where a registered timer or the SysTick cannot keep
+    // its clock before anything is changed. SysTick counts HCLK cycles.
+    int sysTick = (SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) != 0;
+    uint64_t reload = (uint64_t)(SysTick->LOAD + 1) * ProfileHclk(config) / SystemCoreClock;
+    if (sysTick && (reload == 0 || reload - 1 > SysTick_LOAD_RELOAD_Msk))
+    {
+	return ERROR;
+    }
+
+    for (u32 i=0; i<CLOCK_MAX_TIMERS; i++)
+    {
+	ClockTimer* t = &s_timers[i];
+	if (t->timer && !GetPrescaler(ProfileTimerClock(config, t->timer), t->counterClock, &prescalers[i]))
+	{
+	    return ERROR;
+	}
+    }
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    u32 latency = FLASH->ACR & FLASH_ACR_LATENCY;
+
+    if (config->latency > latency)
+    {
+	FLASH_SetLatency(config->latency);
+    }
+
+    // The PLL can only be changed while it is off, so the core runs from the
+    // HSI meanwhile.
+    SwitchSysClock(RCC_SYSCLKSource_HSI);
+    RCC_PLLCmd(DISABLE);
+
+    RCC_HCLKConfig(config->hclkDivider);
+    RCC_PCLK1Config(config->pclk1Divider);
+    RCC_PCLK2Config(config->pclk2Divider);
+
+    if (config->pllp)
+    {
+	RCC_PLLConfig(RCC_PLLSource_HSI, CLOCK_PLLM, CLOCK_PLLN, config->pllp, CLOCK_PLLQ);
+	RCC_PLLCmd(ENABLE);
+	while (RCC_GetFlagStatus(RCC_FLAG_PLLRDY) == RESET)
+	{
+	}
+	SwitchSysClock(RCC_SYSCLKSource_PLLCLK);
+    }
+
+    if (config->latency < latency)
+    {
+	FLASH_SetLatency(config->latency);
+    }
+
+    SystemCoreClockUpdate();
+    s_profile = profile;
+
+    for (u32 i=0; i<CLOCK_MAX_TIMERS; i++)
+    {
+	if (s_timers[i].timer)
+	{
+	    Retune(s_timers[i].timer, prescalers[i]);
+	}
+    }
+
+    if (sysTick)
+    {
+	SysTick->LOAD = (u32)reload - 1;
+	SysTick->VAL = 0;
+    }
+
+    __set_PRIMASK(primask);
+    return SUCCESS;
+}
+
+
+ClockProfile Clock_GetProfile()
+{
+    return s_profile;
+}
+
+
+const ClockProfileConfig* Clock_GetProfileConfig(ClockProfile profile)
+{
+    return (profile < CLOCK_PROFILES) ? &s_profiles[profile] : 0;
+}
+
+
+u32 Clock_GetTimerClock(TIM_TypeDef* TIMx)
+{
+    RCC_ClocksTypeDef clocks;
+    RCC_GetClocksFreq(&clocks);
+
+    u32 pclk = IsApb2Timer(TIMx) ? clocks.PCLK2_Frequency : clocks.PCLK1_Frequency;
+    return TimerClock(pclk, clocks.HCLK_Frequency);
+}
+
+
+// Sets the prescaler of the timer for a counter clock of 'counterClock' Hz
+// and keeps it there across profile switches.
+ErrorStatus Clock_RegisterTimer(TIM_TypeDef* TIMx, u32 counterClock)
+{
+    ClockTimer* slot = 0;
+    u32 prescaler;
+
+    if (counterClock == 0 || !GetPrescaler(Clock_GetTimerClock(TIMx), counterClock, &prescaler))
+    {
+	return ERROR;
+    }
+
+    for (u32 i=0; i<CLOCK_MAX_TIMERS; i++)
+    {
+	if (s_timers[i].timer == TIMx)
+	{
+	    slot = &s_timers[i];
+	    break;
+	}
+	if (!slot && !s_timers[i].timer)
+	{
+	    slot = &s_timers[i];
+	}
+    }
+
+    if (!slot)
+    {
+	return ERROR;
+    }
+
+    slot->timer = TIMx;
+    slot->counterClock = counterClock;
+    TIM_PrescalerConfig(TIMx, prescaler, TIM_PSCReloadMode_Update);
+    return SUCCESS;
+}
+
+
+void Clock_UnregisterTimer(TIM_TypeDef* TIMx)
+{
+    for (u32 i=0; i<CLOCK_MAX_TIMERS; i++)
+    {
+	if (s_timers[i].timer == TIMx)
+	{
+	    s_timers[i].timer = 0;
+	}
+    }
+}
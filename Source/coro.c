@@ -0,0 +1,201 @@
+///////////////////////////////// COROUTINES //////////////////////////////////
+// Many concurrent activities in one superloop, without a stack for each.
+
+// A superloop polls flags set by interrupts and keeps the state of every
+// activity by hand: which step it is at, when it is due. The kernel (see
+// kernel.c) lets each activity be written as sequential code, but needs a
+// stack per task. A coroutine is a function that returns whenever it has to
+// wait and resumes where it left off the next time it is called. It is
+// written as sequential code and its whole state is a Coro of 20 bytes.
+
+// The resume point is kept as a line number. CORO_BEGIN opens a switch on
+// it, and each wait stores __LINE__ and puts a case label of the same number
+// just before its condition. Calling the function again jumps right back to
+// the condition (this is how protothreads work). Local variables are lost at
+// every wait, since the function returns.
+
+// THE LOOP: Coro_Run() calls every coroutine in turn. Each one runs until it
+// waits for a condition that does not hold. When a whole round is over and
+// nothing has signalled meanwhile, the core sleeps in WFI. Interrupts that
+// make a condition hold call Coro_Signal(), which makes the loop run
+// another round.
+
+// DELAYS: A delayed coroutine tells the loop its wake tick. The SysTick
+// counts the ticks, but signals only once the earliest wake tick is reached,
+// so a loop whose coroutines all wait wakes up just for the interrupts.
+
+#include "stdafx.h"
+#include "coro.h"
+#include "isr.h"
+
+
+static Coro* s_first = 0;
+static Coro* s_last = 0;
+static volatile u32 s_signaled = 0;
+static volatile u32 s_now = 0;
+static volatile u32 s_wake = 0;		// Earliest wake tick of this round.
+static volatile u32 s_waking = 0;	// Whether s_wake is set.
+
+
+static void Tick()
+{
+    u32 now = s_now + 1;
+    s_now = now;
+
+    if (s_waking && (s32)(now - s_wake) >= 0)
+    {
+	s_waking = 0;
+	s_signaled = 1;
+    }
+}
+
+
+void Coro_Init()
+{
+    s_first = 0;
+    s_last = 0;
+    s_signaled = 0;
+    s_now = 0;
+    s_waking = 0;
+
+    Isr_SetVector(SysTick_IRQn, Tick);
+    SysTick_Config(SystemCoreClock / CORO_TICK_HZ);
+}
+
+
+void Coro_Start(Coro* co, CoroFunction function, void* context)
+{
+    co->next = 0;
+    co->function = function;
+    co->context = context;
+    co->wake = 0;
+    co->line = 0;
+
+    if (s_last)
+    {
+	s_last->next = co;
+    }
+    else
+    {
+	s_first = co;
+    }
+    s_last = co;
+    s_signaled = 1;
+}
+
+
+void Coro_Run()
+{
+    while (1)
+    {
+	// A signal from now on asks for another round.
+	s_signaled = 0;
+	s_waking = 0;
+
+	Coro* previous = 0;
+	Coro* co = s_first;
+	while (co)
+	{
+	    Coro* next = co->next;
+
+	    co->function(co);
+	    if (co->line == CORO_DONE)
+	    {
+		if (previous)
+		{
+		    previous->next = next;
+		}
+		else
+		{
+		    s_first = next;
+		}
+		if (s_last == co)
+		{
+		    s_last = previous;
+		}
+	    }
+	    else
+	    {
+		previous = co;
+	    }
+	    co = next;
+	}
+
+	// With the interrupts disabled no signal can come between the test
+	// and the sleep. WFI still wakes up on a pending interrupt, which runs
+	// once they are enabled again.
+	__disable_irq();
+	if (!s_signaled)
+	{
+	    __WFI();
+	}
+	__enable_irq();
+    }
+}
+
+
+void Coro_Signal()
+{
+    s_signaled = 1;
+}
+
+
+u32 Coro_Now()
+{
+    return s_now;
+}
+
+
+// Whether the wake tick of 'co' is reached. If not, the loop is woken for
+// it. The tick may not come between the test and setting the wake tick.
+int Coro_Due(Coro* co)
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    int due = (s32)(s_now - co->wake) >= 0;
+    if (!due && (!s_waking || (s32)(co->wake - s_wake) < 0))
+    {
+	s_wake = co->wake;
+	s_waking = 1;
+    }
+
+    __set_PRIMASK(primask);
+    return due;
+}
+
+
+void Coro_EventInit(CoroEvent* event)
+{
+    event->count = 0;
+}
+
+
+void Coro_Post(CoroEvent* event)
+{
+    u32 count;
+    do
+    {
+	count = __LDREXW(&event->count);
+    } while (__STREXW(count + 1, &event->count));
+
+    Coro_Signal();
+}
+
+
+// Takes one post of 'event' if there is any.
+int Coro_Take(CoroEvent* event)
+{
+    u32 count;
+    do
+    {
+	count = __LDREXW(&event->count);
+	if (!count)
+	{
+	    __CLREX();
+	    return 0;
+	}
+    } while (__STREXW(count - 1, &event->count));
+
+    return 1;
+}
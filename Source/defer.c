@@ -0,0 +1,104 @@
+///////////////////////////////// DEFERRED WORK ///////////////////////////////
+// Lets an interrupt handler leave the slow part of its work for later.
+
+// An interrupt of a high priority blocks every interrupt of the same or a
+// lower priority for as long as its handler runs. The worst latency of those
+// interrupts is the longest handler above them. So the handler does only
+// what cannot wait (clearing the flag, reading the data register) and posts
+// the rest as a work item: a function and its context. The work runs in
+// PendSV, which has the lowest priority of all, once every interrupt is
+// done. Any interrupt can preempt it.
+
+// Each priority of work has its own multiple producer ring (see ring.h) of
+// work items, so posting needs no lock and interrupts of any priority can
+// post at the same time. PendSV is the only consumer. It always takes the
+// oldest item of the highest priority that has one, so an urgent item
+// posted meanwhile runs before the rest of a long queue. With a single
+// priority the work runs in plain FIFO order.
+
+// An item posted while PendSV runs sets PendSV pending again, so no item is
+// ever left in a queue until the next post.
+
+#include "stdafx.h"
+#include "defer.h"
+#include "ring.h"
+
+
+typedef struct
+{
+    DeferFunction function;
+    void* context;
+} DeferWork;
+
+static u8 s_buffers[DEFER_PRIORITIES][DEFER_DEPTH * sizeof(DeferWork)];
+static RingMp s_queues[DEFER_PRIORITIES];
+static volatile u32 s_dropped = 0;
+
+
+void Defer_Init()
+{
+    for (u32 i=0; i<DEFER_PRIORITIES; i++)
+    {
+	RingMp_Init(&s_queues[i], s_buffers[i], sizeof(s_buffers[i]));
+    }
+    s_dropped = 0;
+
+    // The lowest priority of all.
+    NVIC_SetPriority(PendSV_IRQn, 0xFF);
+}
+
+
+ErrorStatus Defer_Post(DeferFunction function, void* context, u32 priority)
+{
+    DeferWork work;
+
+    assert_param(priority < DEFER_PRIORITIES);
+    work.function = function;
+    work.context = context;
+
+    if (!RingMp_Write(&s_queues[priority], &work, sizeof(DeferWork)))
+    {
+	u32 dropped;
+	do
+	{
+	    dropped = __LDREXW(&s_dropped);
+	} while (__STREXW(dropped + 1, &s_dropped));
+	return ERROR;
+    }
+
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    return SUCCESS;
+}
+
+
+u32 Defer_Dropped()
+{
+    return s_dropped;
+}
+
+
+// Takes the oldest item of the highest priority.
+static u32 Take(DeferWork* work)
+{
+    for (u32 i=0; i<DEFER_PRIORITIES; i++)
+    {
+	if (Ring_Count(&s_queues[i].ring) >= sizeof(DeferWork))
+	{
+	    Ring_Read(&s_queues[i].ring, work, sizeof(DeferWork));
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+
+// One item at a time, so that the queues are looked at again after each.
+void Defer_Process()
+{
+    DeferWork work;
+
+    while (Take(&work))
+    {
+	work.function(work.context);
+    }
+}
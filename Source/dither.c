@@ -0,0 +1,100 @@
+////////////////////////////////// DITHERING //////////////////////////////////
+// Gives a PWM channel duty cycles finer than a counter tick by changing its
+// compare value from period to period, so that the average is right.
+
+// A PWM period of N ticks gives N + 1 duty cycles. Basic6 has 1000 ticks at
+// 100 Hz; at 16 kHz from a 16 MHz counter there are still 1000, but at
+// 160 kHz only 100. The steps show most at the bottom: 1 tick of 1000 is an
+// LED visibly on, and a motor current or a heater that needs 0.3 tick has
+// no value at all.
+
+// A target here has DITHER_BITS fraction bits below the tick. Each period
+// the modulator rounds the target to a whole compare value and keeps the
+// rounding error, which is fed back into the next periods. The error never
+// grows beyond a tick, so the average of the values over n periods is
+// within 1/n tick of the target: 65536 periods resolve all 16 fraction
+// bits. The DMA of a PWM stream (see pwm_stream.c) takes a value per period
+// and the CPU fills its buffer from time to time.
+
+// NOISE SHAPING: The rounding errors are noise in the output, and the load
+// sees only their low frequencies: the LED through the eye, a motor
+// through its inductance, a heater through its mass. With the error
+// e[n] = y[n] - v[n] of the quantizer fed back as
+//	first order	v[n] = x[n] - e[n-1]
+//	second order	v[n] = x[n] - 2 e[n-1] + e[n-2]
+// the output is y = x + (1 - z^-1) e, or x + (1 - z^-1)^2 e: the noise is
+// pushed up toward half the PWM frequency, by 20 or 40 dB per decade less
+// at the low frequencies. The first order repeats short patterns for some
+// targets (idle tones), the second order much less so but its values swing
+// over more ticks. The host model (Host/Model/dither.c) checks the slopes
+// and the resolution.
+
+// The first order gives one of the two values next to the target, the
+// second order values up to 2 ticks away. Within 2 ticks of 0 or of 'max'
+// those could be out of range, so there the second order works as the
+// first: the error is the same quantity in both, and the change is smooth.
+// Only a target out of range is clipped, and the error with it, to a tick.
+
+#include "stdafx.h"
+#include "dither.h"
+
+
+void Dither_Init(Dither* dither, u32 order, u32 max)
+{
+    dither->order = (order == 2) ? 2 : 1;
+    dither->max = (max > DITHER_MAX) ? DITHER_MAX : max;
+    dither->error[0] = 0;
+    dither->error[1] = 0;
+}
+
+
+u32 Dither_Next(Dither* dither, u32 target)
+{
+    if (target > ((u32)dither->max << DITHER_BITS))
+    {
+	target = (u32)dither->max << DITHER_BITS;
+    }
+
+    // The second order needs 2 ticks of room on either side.
+    s32 v = (s32)target - dither->error[0];
+    if (dither->order == 2 && target >= 2 * DITHER_ONE &&
+	target <= ((u32)dither->max - 2) << DITHER_BITS)
+    {
+	v += dither->error[1] - dither->error[0];
+    }
+
+    // Rounded to the nearest tick, within 0..max.
+    s32 y = (v + DITHER_ONE / 2) >> DITHER_BITS;
+    if (y < 0)
+    {
+	y = 0;
+    }
+    else if (y > dither->max)
+    {
+	y = dither->max;
+    }
+
+    s32 e = (y << DITHER_BITS) - v;
+    if (e > DITHER_ONE)
+    {
+	e = DITHER_ONE;
+    }
+    else if (e < -DITHER_ONE)
+    {
+	e = -DITHER_ONE;
+    }
+
+    dither->error[1] = dither->error[0];
+    dither->error[0] = e;
+    return y;
+}
+
+
+void Dither_Fill(Dither* dither, u32 target, u16* values, u32 count, u32 stride)
+{
+    for (u32 i=0; i<count; i++)
+    {
+	*values = Dither_Next(dither, target);
+	values += stride;
+    }
+}
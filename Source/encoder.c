@@ -0,0 +1,410 @@
+/////////////////////////////////// ENCODERS //////////////////////////////////
+// Counts quadrature encoders with the encoder mode of the general purpose
+// timers and estimates their velocities, switching between the M and the T
+// method by the speed.
+
+// An incremental encoder gives two square waves, A and B, a quarter of a
+// period apart: A leads B one way round and lags it the other. A program
+// that polls the pins misses edges once they come faster than it polls,
+// and then counts wrong for good.
+
+// ENCODER MODE: With SMS = 3 in SMCR the counter of a timer is clocked by
+// every edge of TI1 and TI2, up or down by the level of the other input:
+// four counts per line, without the CPU and without missing an edge (the
+// input filter only has to let them through). The counter is 16 or 32
+// bits wide and wraps.
+
+// 64 BITS: TIM7 interrupts ENCODER_SAMPLE_HZ times a second. Each sample
+// adds the difference to the last counter value, taken as signed, to a
+// 64-bit count. That is right as long as the counter moves less than half
+// its range between two samples, 32767 counts in 1 ms for the 16-bit
+// timers. The update interrupt is not used: whether the counter went over
+// or under depends on DIR, which may have changed again by the time the
+// interrupt reads it.
+
+// M METHOD: The velocity is the counts of a sample over its time. One
+// count more or less is 1000 counts/s at 1 kHz: fine at speed, useless
+// when the encoder turns slowly.
+
+// T METHOD: Below ENCODER_T_BELOW counts per sample the capture of channel
+// 1 interrupts at each rising edge of A, once per line. The capture latches
+// the counter, and its DMA request has a stream copy the counter of TIM7
+// next to it, some bus cycles later. So the time of the edge does not
+// depend on when the interrupt runs, behind the sampling or any other
+// interrupt; it only has to run within a sample period, as TIM7 counts one
+// period only. At the next sample the velocity is the counts between the
+// last edge of the previous sample and the last one since, over the time
+// between these edges: good to a microsecond however few edges there were.
+// With no edge since, the velocity can only have dropped below one line
+// over the time since the last one, and after ENCODER_STOP_MS it is taken
+// as 0. Above ENCODER_M_ABOVE counts per sample the interrupts and the
+// requests are turned off again, so there are at most some thousands of
+// them a second.
+
+// SNAPSHOTS: Each sample stores the count, the velocity and the time of an
+// encoder into one of two snapshots, the one not read last, and then
+// publishes it by incrementing a sequence number. Encoder_Read() copies the
+// published snapshot and tries again if the sequence number changed
+// meanwhile. So a control loop in an interrupt of any priority gets a
+// consistent snapshot without disabling interrupts, and never waits for
+// the sampling.
+
+#include "stdafx.h"
+#include "encoder.h"
+#include "clock.h"
+#include "isr.h"
+
+#include <string.h>
+
+
+#define ENCODER_SAMPLE_TICKS	(ENCODER_TICK_HZ / ENCODER_SAMPLE_HZ)
+#define ENCODER_STOP_TICKS	(ENCODER_STOP_MS * (ENCODER_TICK_HZ / 1000))
+
+
+// The DMA1 stream and channel of the channel 1 requests of TIM2 to TIM5.
+typedef struct
+{
+    DMA_Stream_TypeDef* stream;
+    u32 channel;
+} EncoderDma;
+
+
+typedef struct
+{
+    TIM_TypeDef* timer;
+    DMA_Stream_TypeDef* stream;
+    u8 is32;
+    u8 method;
+    u32 counter;		// At the last sample.
+    int64_t count;
+    u32 sampleTime;
+    float velocity;
+
+    // T method: the last edge, and the one the velocity is taken from.
+    int64_t edgeCount;
+    u32 edgeTime;
+    int64_t baseCount;
+    u32 baseTime;
+    u8 edges;			// Edges recorded since the method changed, up
+				// to 2.
+    volatile u16 stamp;		// TIM7 at the last capture, by the DMA.
+
+    EncoderSnapshot snapshots[2];
+    volatile u32 sequence;	// Publishes snapshots[sequence & 1].
+} Encoder;
+
+static Encoder s_encoders[ENCODER_MAX];
+static u32 s_count = 0;
+static u32 s_priority = 0;
+static volatile u32 s_samples = 0;	// Periods of TIM7.
+
+
+static void SampleHandler();
+static void EdgeHandler();
+
+
+ErrorStatus Encoder_Init(u32 priority)
+{
+    s_count = 0;
+    s_samples = 0;
+    s_priority = priority;
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM7, ENABLE);
+
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = ENCODER_SAMPLE_TICKS - 1;
+    base.TIM_Prescaler = Clock_GetTimerClock(TIM7) / ENCODER_TICK_HZ - 1;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM7, &base);
+
+    // Keeps counting microseconds if the clock profile changes.
+    if (Clock_RegisterTimer(TIM7, ENCODER_TICK_HZ) != SUCCESS)
+    {
+	return ERROR;
+    }
+
+    TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
+    TIM_ITConfig(TIM7, TIM_IT_Update, ENABLE);
+    Isr_SetVector(TIM7_IRQn, SampleHandler);
+    NVIC_SetPriority(TIM7_IRQn, priority);
+    NVIC_EnableIRQ(TIM7_IRQn);
+
+    TIM_Cmd(TIM7, ENABLE);
+    return SUCCESS;
+}
+
+
+// Ticks since Encoder_Init(), and the TIM7 counter value they were read
+// at in 'counter'. Only for the interrupts of the encoders, which the
+// sample interrupt cannot preempt. A wrap of TIM7 whose interrupt is still
+// pending shows in UIF, or in the counter going back.
+static u32 Now(u32* counter)
+{
+    u32 before = TIM7->CNT;
+    u32 wrapped = TIM7->SR & TIM_SR_UIF;
+    u32 after = TIM7->CNT;
+
+    wrapped = wrapped || after < before;
+    *counter = after;
+    return (s_samples + (wrapped ? 1 : 0)) * ENCODER_SAMPLE_TICKS + after;
+}
+
+
+// The time of a TIM7 counter value 'stamp' less than a period before the
+// value 'counter' read at 'now'. The ticks wrap at 2^32, which is not a
+// whole number of periods, so the age comes from the counter values.
+static u32 Stamped(u32 now, u32 counter, u32 stamp)
+{
+    return now - (counter + ENCODER_SAMPLE_TICKS - stamp) % ENCODER_SAMPLE_TICKS;
+}
+
+
+static IRQn_Type TimerIrq(TIM_TypeDef* timer)
+{
+    return (timer == TIM2) ? TIM2_IRQn : (timer == TIM3) ? TIM3_IRQn :
+	(timer == TIM4) ? TIM4_IRQn : TIM5_IRQn;
+}
+
+
+ErrorStatus Encoder_Add(TIM_TypeDef* timer, u8 filter)
+{
+    static const u32 s_clocks[] = {
+	RCC_APB1Periph_TIM2, RCC_APB1Periph_TIM3, RCC_APB1Periph_TIM4, RCC_APB1Periph_TIM5,
+    };
+    static TIM_TypeDef* const s_timers[] = { TIM2, TIM3, TIM4, TIM5 };
+    static const EncoderDma s_dmas[] = {
+	{ DMA1_Stream5, DMA_Channel_3 }, { DMA1_Stream4, DMA_Channel_5 },
+	{ DMA1_Stream0, DMA_Channel_2 }, { DMA1_Stream2, DMA_Channel_6 },
+    };
+
+    u32 index = 0;
+    while (index < 4 && s_timers[index] != timer)
+    {
+	index++;
+    }
+    if (index == 4 || s_count == ENCODER_MAX || filter > 15)
+    {
+	return ERROR;
+    }
+
+    RCC_APB1PeriphClockCmd(s_clocks[index], ENABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+
+    Encoder* e = &s_encoders[s_count];
+    memset(e, 0, sizeof(*e));
+    e->timer = timer;
+    e->stream = s_dmas[index].stream;
+    e->is32 = (timer == TIM2 || timer == TIM5);
+    e->method = ENCODER_M;
+
+    TIM_TimeBaseInitTypeDef base;
+    TIM_TimeBaseStructInit(&base);
+    base.TIM_Period = e->is32 ? 0xFFFFFFFF : 0xFFFF;
+    TIM_TimeBaseInit(timer, &base);
+
+    // Both inputs count, on both edges. The capture of channel 1 takes
+    // the rising edges of A.
+    TIM_EncoderInterfaceConfig(timer, TIM_EncoderMode_TI12, TIM_ICPolarity_Rising,
+			       TIM_ICPolarity_Rising);
+    timer->CCMR1 = (timer->CCMR1 & ~(TIM_CCMR1_IC1F | TIM_CCMR1_IC2F)) |
+	(filter << 4) | (filter << 12);
+    TIM_CCxCmd(timer, TIM_Channel_1, TIM_CCx_Enable);
+
+    // Each capture request copies TIM7 into 'stamp'. The requests are
+    // enabled with the T method.
+    DMA_Cmd(e->stream, DISABLE);
+    while (DMA_GetCmdStatus(e->stream) != DISABLE);
+    DMA_InitTypeDef dma;
+    DMA_StructInit(&dma);
+    dma.DMA_Channel = s_dmas[index].channel;
+    dma.DMA_PeripheralBaseAddr = (u32)&TIM7->CNT;
+    dma.DMA_Memory0BaseAddr = (u32)&e->stamp;
+    dma.DMA_DIR = DMA_DIR_PeripheralToMemory;
+    dma.DMA_BufferSize = 1;
+    dma.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    dma.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    dma.DMA_Mode = DMA_Mode_Circular;
+    dma.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_Init(e->stream, &dma);
+    DMA_Cmd(e->stream, ENABLE);
+
+    TIM_ClearITPendingBit(timer, TIM_IT_CC1);
+    Isr_SetVector(TimerIrq(timer), EdgeHandler);
+    NVIC_SetPriority(TimerIrq(timer), s_priority);
+    NVIC_EnableIRQ(TimerIrq(timer));
+
+    // Sampled from the next sample on.
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    e->counter = timer->CNT;
+    e->sampleTime = s_samples * ENCODER_SAMPLE_TICKS + TIM7->CNT;
+    TIM_Cmd(timer, ENABLE);
+    s_count++;
+    __set_PRIMASK(primask);
+    return SUCCESS;
+}
+
+
+// The counter at 'counter' as a 64-bit count, relative to the last sample.
+static int64_t Extend(Encoder* e, u32 counter)
+{
+    s32 delta = e->is32 ? (s32)(counter - e->counter) : (s16)(counter - e->counter);
+    return e->count + delta;
+}
+
+
+static void SetMethod(Encoder* e, EncoderMethod method)
+{
+    e->method = method;
+    e->edges = 0;
+    TIM_ClearITPendingBit(e->timer, TIM_IT_CC1);
+    TIM_ClearFlag(e->timer, TIM_FLAG_CC1OF);
+    TIM_DMACmd(e->timer, TIM_DMA_CC1, method == ENCODER_T ? ENABLE : DISABLE);
+    TIM_ITConfig(e->timer, TIM_IT_CC1, method == ENCODER_T ? ENABLE : DISABLE);
+}
+
+
+// T method, with 'elapsed' ticks since the last edge.
+static float TimedVelocity(Encoder* e, u32 elapsed)
+{
+    float velocity = e->velocity;
+
+    if (e->edges < 2)
+    {
+	return (elapsed > ENCODER_STOP_TICKS) ? 0 : velocity;
+    }
+
+    if (e->edgeTime != e->baseTime)
+    {
+	velocity = (float)(e->edgeCount - e->baseCount) * ENCODER_TICK_HZ /
+	    (u32)(e->edgeTime - e->baseTime);
+	e->baseCount = e->edgeCount;
+	e->baseTime = e->edgeTime;
+    }
+    else if (elapsed > ENCODER_STOP_TICKS)
+    {
+	velocity = 0;
+    }
+    else
+    {
+	// No edge since: at most one line over the time since the last.
+	float bound = 4.0f * ENCODER_TICK_HZ / elapsed;
+	if (velocity > bound)
+	{
+	    velocity = bound;
+	}
+	else if (velocity < -bound)
+	{
+	    velocity = -bound;
+	}
+    }
+    return velocity;
+}
+
+
+static void Sample(Encoder* e, u32 now)
+{
+    u32 counter = e->timer->CNT;
+    int64_t count = Extend(e, counter);
+    s32 delta = (s32)(count - e->count);
+    u32 distance = (delta < 0) ? -delta : delta;
+    u32 elapsed = now - e->sampleTime;
+
+    e->counter = counter;
+    e->count = count;
+    e->sampleTime = now;
+
+    if (e->method == ENCODER_M)
+    {
+	e->velocity = (float)delta * ENCODER_TICK_HZ / elapsed;
+	if (distance < ENCODER_T_BELOW)
+	{
+	    SetMethod(e, ENCODER_T);
+	}
+    }
+    else
+    {
+	e->velocity = TimedVelocity(e, now - e->edgeTime);
+	if (distance > ENCODER_M_ABOVE)
+	{
+	    SetMethod(e, ENCODER_M);
+	}
+    }
+
+    // Into the snapshot not published.
+    u32 sequence = e->sequence;
+    EncoderSnapshot* snapshot = &e->snapshots[(sequence + 1) & 1];
+    snapshot->count = count;
+    snapshot->velocity = e->velocity;
+    snapshot->time = now;
+    snapshot->method = e->method;
+    __DMB();
+    e->sequence = sequence + 1;
+}
+
+
+static void SampleHandler()
+{
+    TIM_ClearITPendingBit(TIM7, TIM_IT_Update);
+    u32 now = ++s_samples * ENCODER_SAMPLE_TICKS + TIM7->CNT;
+
+    for (u32 i=0; i<s_count; i++)
+    {
+	Sample(&s_encoders[i], now);
+    }
+}
+
+
+// A rising edge of A on one of the encoders timed. The DMA has copied
+// TIM7 before the interrupt enters. An edge that comes while the capture
+// and the stamp are read makes them read again, so that they are of the
+// same edge.
+static void EdgeHandler()
+{
+    u32 counter;
+    u32 now = Now(&counter);
+
+    for (u32 i=0; i<s_count; i++)
+    {
+	Encoder* e = &s_encoders[i];
+	if (TIM_GetITStatus(e->timer, TIM_IT_CC1) != SET)
+	{
+	    continue;
+	}
+
+	u32 capture;
+	u32 stamp;
+	do
+	{
+	    TIM_ClearITPendingBit(e->timer, TIM_IT_CC1);
+	    capture = TIM_GetCapture1(e->timer);
+	    stamp = e->stamp;
+	} while (TIM_GetFlagStatus(e->timer, TIM_FLAG_CC1) == SET);
+	TIM_ClearFlag(e->timer, TIM_FLAG_CC1OF);
+
+	e->edgeCount = Extend(e, capture);
+	e->edgeTime = Stamped(now, counter, stamp);
+	if (e->edges < 2 && ++e->edges == 1)
+	{
+	    e->baseCount = e->edgeCount;
+	    e->baseTime = e->edgeTime;
+	}
+    }
+}
+
+
+void Encoder_Read(u32 encoder, EncoderSnapshot* snapshot)
+{
+    Encoder* e = &s_encoders[encoder];
+    u32 sequence;
+
+    do
+    {
+	sequence = e->sequence;
+	__DMB();
+	*snapshot = e->snapshots[sequence & 1];
+	__DMB();
+    } while (e->sequence != sequence);
+}
\ No newline at end of file
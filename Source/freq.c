@@ -0,0 +1,374 @@
+/////////////////////////////// FREQUENCY METER ///////////////////////////////
+// Measures the frequency, period, duty cycle and period jitter of a signal
+// on PA15 in batches of FREQ_BATCH_HZ per second, from timestamps of its
+// edges stored by the DMA.
+
+// Basic8 takes an interrupt per captured edge. Each costs some hundred
+// cycles to enter, read the capture and leave, so a signal of some 100 kHz
+// keeps the CPU busy on its own, and an edge that comes while the last
+// capture has not been read yet is lost.
+
+// RECIPROCAL COUNTING: TIM2 counts at the timer clock, 32-bit and never
+// reset. Channel 1 captures the counter at each rising edge of TI1, channel
+// 2 at each falling edge (TI1 to channel 2 indirectly). Every capture of
+// channel 1 makes DMA1 stream 5 (channel 3) read a burst of CCR1 and CCR2
+// through DMAR (see pwm_stream.c for the bursts): the rising edge and the
+// falling one before it, a record per period, into a circular ring. The
+// difference of two rising edges is a period and the falling edge in
+// between gives its high time. A batch spans all its periods back to back,
+// so the frequency, the periods over their total time, is good to one
+// timer tick over the batch: 0.6 ppm from a 16 MHz clock in 100 ms,
+// whatever the frequency.
+
+// GATE COUNTING: Each edge still costs a DMA transfer and a few cycles of
+// the statistics. Above FREQ_GATE_ABOVE the meter counts the edges
+// instead: TIM2 is clocked by the signal itself through ETR (the same pin,
+// external clock mode 2), and the update of TIM3 at the end of each batch
+// captures its counter through TRC. The capture is exact whatever the
+// latency of the interrupt. The frequency is good to one edge per batch,
+// 10 Hz, which is better than the timing above some MHz anyway, and there
+// are no periods or duty cycles. Below FREQ_GATE_BELOW the meter goes back
+// to timing the edges. The counter is sampled by the timer clock: the
+// signal can go up to about a third of it.
+
+// BATCHES: The half transfer and transfer complete interrupts, and the
+// update of TIM3 at the end of each batch, take the records the DMA has
+// written so far and add them to the sums of the batch. So long periods
+// get into their batch too, and fast edges do not wait for the batch.
+// Freq_Read() works out the results from the sums of the latest batch.
+
+// The ring must be in the SRAM. The DMA cannot reach the CCM RAM.
+
+#include "stdafx.h"
+#include "freq.h"
+#include "clock.h"
+#include "isr.h"
+
+#include <math.h>
+#include <string.h>
+
+
+#define FREQ_DMA		DMA1_Stream5	// TIM2_CH1, channel 3.
+#define FREQ_GATE_TICK_HZ	10000		// Of TIM3.
+
+
+// What the DMA stores at each capture of channel 1.
+typedef struct
+{
+    u32 rise;			// Counter at the rising edge (edges at the
+				// end of the batch when counting).
+    u32 fall;			// At the falling edge before.
+} FreqEdge;
+
+// The sums of a batch.
+typedef struct
+{
+    u8 mode;
+    u32 hz;			// Of the time unit: the timer clock, or the
+				// batch rate when counting.
+    u32 periods;
+    uint64_t time;		// The periods took, in the time unit.
+    u32 highs;			// Periods with a falling edge.
+    uint64_t high;
+    u32 min;
+    u32 max;
+    u32 first;			// Period the deviations are taken from.
+    float deviation;
+    float square;
+} FreqBatch;
+
+static FreqEdge s_ring[FREQ_RING];
+static u32 s_read = 0;			// Next record to take.
+static u32 s_last = 0;			// Rising edge of the last record.
+static int s_started = 0;		// s_last is valid.
+static FreqMode s_mode = FREQ_RECIPROCAL;
+static FreqBatch s_sums;		// Of the batch in progress.
+static FreqBatch s_batch;		// The latest one.
+static volatile u32 s_batches = 0;
+static u32 s_taken = 0;			// Read by Freq_Read().
+static volatile u32 s_overruns = 0;
+static u32 s_batchOverruns = 0;
+
+
+static void HalfDone();
+static void BatchDone();
+
+
+static void StartSums()
+{
+    memset(&s_sums, 0, sizeof(s_sums));
+    s_sums.mode = s_mode;
+    s_sums.hz = (s_mode == FREQ_GATE) ? FREQ_BATCH_HZ : Clock_GetTimerClock(TIM2);
+    s_sums.min = 0xFFFFFFFF;
+    s_batchOverruns = s_overruns;
+}
+
+
+// Sets TIM2 and the DMA up for 's_mode' and starts them.
+static void StartCapture()
+{
+    TIM_Cmd(TIM2, DISABLE);
+    TIM_DMACmd(TIM2, TIM_DMA_CC1, DISABLE);
+    DMA_Cmd(FREQ_DMA, DISABLE);
+    while (DMA_GetCmdStatus(FREQ_DMA) == ENABLE)
+    {
+    }
+    DMA_DeInit(FREQ_DMA);
+
+    TIM_ICInitTypeDef ic;
+    TIM_ICStructInit(&ic);
+    if (s_mode == FREQ_GATE)
+    {
+	// Clocked by the rising edges on ETR, captured at TRGO of TIM3.
+	TIM_ETRClockMode2Config(TIM2, TIM_ExtTRGPSC_OFF, TIM_ExtTRGPolarity_NonInverted, 0);
+	TIM_SelectInputTrigger(TIM2, TIM_TS_ITR2);
+	ic.TIM_Channel = TIM_Channel_1;
+	ic.TIM_ICSelection = TIM_ICSelection_TRC;
+	TIM_ICInit(TIM2, &ic);
+	TIM_CCxCmd(TIM2, TIM_Channel_2, TIM_CCx_Disable);
+    }
+    else
+    {
+	TIM2->SMCR = 0;
+	ic.TIM_Channel = TIM_Channel_1;
+	ic.TIM_ICPolarity = TIM_ICPolarity_Rising;
+	ic.TIM_ICSelection = TIM_ICSelection_DirectTI;
+	TIM_ICInit(TIM2, &ic);
+	ic.TIM_Channel = TIM_Channel_2;
+	ic.TIM_ICPolarity = TIM_ICPolarity_Falling;
+	ic.TIM_ICSelection = TIM_ICSelection_IndirectTI;
+	TIM_ICInit(TIM2, &ic);
+    }
+    TIM_SetCounter(TIM2, 0);
+
+    DMA_InitTypeDef dma;
+    DMA_StructInit(&dma);
+    dma.DMA_Channel = DMA_Channel_3;
+    dma.DMA_PeripheralBaseAddr = (u32)&TIM2->DMAR;
+    dma.DMA_Memory0BaseAddr = (u32)s_ring;
+    dma.DMA_DIR = DMA_DIR_PeripheralToMemory;
+    dma.DMA_BufferSize = 2 * FREQ_RING;
+    dma.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    dma.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+    dma.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+    dma.DMA_Mode = DMA_Mode_Circular;
+    dma.DMA_Priority = DMA_Priority_High;
+    DMA_Init(FREQ_DMA, &dma);
+    DMA_ITConfig(FREQ_DMA, DMA_IT_HT | DMA_IT_TC, ENABLE);
+    DMA_Cmd(FREQ_DMA, ENABLE);
+
+    s_read = 0;
+    s_started = 0;
+    StartSums();
+
+    // A burst of CCR1 and CCR2 at each capture of channel 1.
+    TIM_DMAConfig(TIM2, TIM_DMABase_CCR1, TIM_DMABurstLength_2Transfers);
+    TIM_DMACmd(TIM2, TIM_DMA_CC1, ENABLE);
+    TIM_Cmd(TIM2, ENABLE);
+}
+
+
+ErrorStatus Freq_Init(u32 priority)
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2 | RCC_APB1Periph_TIM3, ENABLE);
+
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = 0xFFFFFFFF;
+    base.TIM_Prescaler = 0;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM2, &base);
+
+    // TIM3 ends the batches, and keeps its rate if the clock profile
+    // changes.
+    base.TIM_Period = FREQ_GATE_TICK_HZ / FREQ_BATCH_HZ - 1;
+    base.TIM_Prescaler = Clock_GetTimerClock(TIM3) / FREQ_GATE_TICK_HZ - 1;
+    TIM_TimeBaseInit(TIM3, &base);
+    if (Clock_RegisterTimer(TIM3, FREQ_GATE_TICK_HZ) != SUCCESS)
+    {
+	return ERROR;
+    }
+    TIM_SelectOutputTrigger(TIM3, TIM_TRGOSource_Update);
+
+    s_mode = FREQ_RECIPROCAL;
+    s_batches = 0;
+    s_taken = 0;
+    s_overruns = 0;
+    StartCapture();
+
+    Isr_SetVector(DMA1_Stream5_IRQn, HalfDone);
+    Isr_SetVector(TIM3_IRQn, BatchDone);
+    NVIC_SetPriority(DMA1_Stream5_IRQn, priority);
+    NVIC_SetPriority(TIM3_IRQn, priority);
+    NVIC_EnableIRQ(DMA1_Stream5_IRQn);
+    NVIC_EnableIRQ(TIM3_IRQn);
+
+    TIM_ClearITPendingBit(TIM3, TIM_IT_Update);
+    TIM_ITConfig(TIM3, TIM_IT_Update, ENABLE);
+    TIM_Cmd(TIM3, ENABLE);
+    return SUCCESS;
+}
+
+
+// Records the DMA has written in full. A burst may be halfway.
+static u32 Written()
+{
+    u32 words = 2 * FREQ_RING - DMA_GetCurrDataCounter(FREQ_DMA);
+    return (words / 2) % FREQ_RING;
+}
+
+
+// Adds the new records to the batch.
+static void Take()
+{
+    FreqBatch* b = &s_sums;
+    u32 end = Written();
+
+    for (; s_read != end; s_read = (s_read + 1) % FREQ_RING)
+    {
+	const FreqEdge* e = &s_ring[s_read];
+	u32 period = e->rise - s_last;
+	u32 high = e->fall - s_last;
+
+	s_last = e->rise;
+	if (!s_started)
+	{
+	    s_started = 1;
+	    continue;
+	}
+
+	// Counting: the edges of one batch.
+	if (b->mode == FREQ_GATE)
+	{
+	    b->periods += period;
+	    b->time++;
+	    continue;
+	}
+
+	if (b->periods++ == 0)
+	{
+	    b->first = period;
+	}
+	b->time += period;
+	if (high < period)
+	{
+	    b->highs++;
+	    b->high += high;
+	}
+	b->min = (period < b->min) ? period : b->min;
+	b->max = (period > b->max) ? period : b->max;
+
+	float d = (float)(s32)(period - b->first);
+	b->deviation += d;
+	b->square += d * d;
+    }
+}
+
+
+static void HalfDone()
+{
+    u32 half;
+
+    if (DMA_GetITStatus(FREQ_DMA, DMA_IT_HTIF5))
+    {
+	DMA_ClearITPendingBit(FREQ_DMA, DMA_IT_HTIF5);
+	half = 0;
+    }
+    else
+    {
+	DMA_ClearITPendingBit(FREQ_DMA, DMA_IT_TCIF5);
+	half = 1;
+    }
+    Take();
+
+    // The DMA must still be in the other half.
+    if ((Written() >= FREQ_RING / 2) == half)
+    {
+	s_overruns++;
+    }
+}
+
+
+static void BatchDone()
+{
+    TIM_ClearITPendingBit(TIM3, TIM_IT_Update);
+    Take();
+
+    FreqBatch* b = &s_sums;
+    uint64_t rate = (uint64_t)b->periods * b->hz;		// Frequency times time.
+
+    // Just after going over to counting there is no count yet.
+    if (b->time || b->mode == FREQ_RECIPROCAL)
+    {
+	s_batch = *b;
+	s_batches++;
+    }
+
+    // Edges too fast to time are counted, and slow ones timed again.
+    if (b->mode == FREQ_RECIPROCAL &&
+	(rate > (uint64_t)FREQ_GATE_ABOVE * b->time || s_overruns != s_batchOverruns))
+    {
+	s_mode = FREQ_GATE;
+	StartCapture();
+    }
+    else if (b->mode == FREQ_GATE && b->time && rate < (uint64_t)FREQ_GATE_BELOW * b->time)
+    {
+	s_mode = FREQ_RECIPROCAL;
+	StartCapture();
+    }
+    else
+    {
+	StartSums();
+    }
+}
+
+
+int Freq_Read(FreqResult* result)
+{
+    FreqBatch b;
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    u32 batches = s_batches;
+    b = s_batch;
+    __set_PRIMASK(primask);
+
+    if (batches == s_taken)
+    {
+	return 0;
+    }
+    s_taken = batches;
+
+    memset(result, 0, sizeof(*result));
+    result->mode = b.mode;
+    result->periods = b.periods;
+    if (!b.periods)
+    {
+	return 1;
+    }
+
+    result->frequency = (float)b.periods * b.hz / b.time;
+    if (b.mode == FREQ_GATE)
+    {
+	return 1;
+    }
+
+    float unit = 1.0f / b.hz;
+    float mean = b.deviation / b.periods;
+    float variance = b.square / b.periods - mean * mean;
+
+    result->period = (float)b.time / b.periods * unit;
+    result->duty = b.highs ? ((float)b.high / b.highs) / ((float)b.time / b.periods) : 0;
+    result->periodMin = b.min * unit;
+    result->periodMax = b.max * unit;
+    result->jitter = (variance > 0) ? sqrtf(variance) * unit : 0;
+    return 1;
+}
+
+
+u32 Freq_Overruns()
+{
+    return s_overruns;
+}
\ No newline at end of file
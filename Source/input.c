@@ -0,0 +1,444 @@
+////////////////////////////////// INPUT EVENTS ///////////////////////////////
+// Debounces push buttons and switches and turns what they do into events:
+// press, release, long press and clicks, each with the time it happened.
+
+// The contacts of a push button do not close cleanly. They bounce for a few
+// ms and every bounce is an edge. Basic3 and Basic4 toggle their LEDs on each
+// raw EXTI edge, and Basic7 warns that its count may look wrong for it. Each
+// bounce is also an interrupt that preempts whatever runs at a lower
+// priority.
+
+// The input filter of a timer channel (TIM_ICFilter, Basic8) ignores pulses
+// shorter than 8 of its samples. At the slowest sampling (timer clock / 128)
+// that is 64 us at 16 MHz, far too short for a bounce. So here the first
+// edge interrupts through the EXTI, gets its timestamp and masks the EXTI
+// line: the bounces that follow do not interrupt at all. 'debounceMs' later
+// the TIM3 compare samples the pin. If the level differs from the debounced
+// one the change is reported with the time of its first edge, if not it was
+// a glitch. Then the line is unmasked. A press and release cost four
+// interrupts however much the contacts bounce.
+
+// TIME: TIM3 counts at 10 kHz in 16 bits and its update interrupt counts
+// the overflows, which gives a 32-bit clock of 100 us ticks for the
+// deadlines (see tickless.c). The ms of Input_Now() and of the events are
+// divided from the overflows and the counter as a 64-bit count, so they
+// wrap at 2^32 like any other clock, not at a tenth of it. Channel 1
+// compares with the earliest deadline of all inputs: the end of settling,
+// of a long press or of a click sequence. With no deadline near, TIM3 only
+// interrupts at the overflows, every 6.5 s.
+
+// CLICKS: A press released before 'longMs' is a click. Clicks follow one
+// another until no press comes within 'gapMs' of a release, then
+// INPUT_CLICKS tells how many there were. A press held for 'longMs' is a
+// long press instead, which ends the sequence without INPUT_CLICKS.
+
+// The EXTI and TIM3 interrupts have the same priority and never preempt each
+// other. The state of the inputs needs no lock, and the ring the events go
+// into (see ring.h) has a single producer.
+
+#include "stdafx.h"
+#include "input.h"
+#include "bitband.h"
+#include "clock.h"
+#include "ring.h"
+#include "isr.h"
+
+
+#define INPUT_TIMER_HZ		10000
+#define INPUT_MS		(INPUT_TIMER_HZ / 1000)
+
+// The compare reaches half a counter round ahead at most. Deadlines further
+// away are reached in steps.
+#define INPUT_MAX_WAIT		0x8000
+
+// What an input waits for besides settling.
+#define INPUT_WAIT_NONE		0
+#define INPUT_WAIT_LONG		1
+#define INPUT_WAIT_GAP		2
+
+
+typedef struct
+{
+    GPIO_TypeDef* gpio;
+    u16 pin;			// GPIO_Pin_x, the mask of its EXTI line too.
+    u8 line;
+    u8 pressedLevel;
+    u8 pressed;			// Debounced.
+    u8 settling;		// Line masked until 'settle'.
+    u8 wait;			// INPUT_WAIT_x, until 'due'.
+    u8 clicks;
+    InputTiming timing;
+    u32 edge;			// First edge of the change settling.
+    u32 settle;
+    u32 due;
+    u32 release;		// Last release of the click sequence.
+} Input;
+
+
+static Input s_inputs[INPUT_MAX];
+static volatile u32 s_count = 0;
+static volatile u32 s_high = 0;		// Overflows of TIM3.
+static volatile u32 s_dropped = 0;
+static u32 s_priority = 0;
+static u8 s_buffer[INPUT_QUEUE * sizeof(InputEvent)];
+static Ring s_events;
+
+
+static void EdgeHandler();
+static void TimerHandler();
+
+
+void Input_Init(u32 priority)
+{
+    s_count = 0;
+    s_high = 0;
+    s_dropped = 0;
+    s_priority = priority;
+    Ring_Init(&s_events, s_buffer, sizeof(s_buffer));
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = 0xFFFF;
+    base.TIM_Prescaler = Clock_GetTimerClock(TIM3) / INPUT_TIMER_HZ - 1;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM3, &base);
+
+    // Keeps counting at 10 kHz if the clock profile changes.
+    Clock_RegisterTimer(TIM3, INPUT_TIMER_HZ);
+
+    // Channel 1 compares without driving a pin.
+    TIM_OCInitTypeDef oc;
+    TIM_OCStructInit(&oc);
+    oc.TIM_OCMode = TIM_OCMode_Timing;
+    TIM_OC1Init(TIM3, &oc);
+
+    TIM_ClearITPendingBit(TIM3, TIM_IT_Update | TIM_IT_CC1);
+    TIM_ITConfig(TIM3, TIM_IT_Update, ENABLE);
+    Isr_SetVector(TIM3_IRQn, TimerHandler);
+    NVIC_SetPriority(TIM3_IRQn, priority);
+    NVIC_EnableIRQ(TIM3_IRQn);
+
+    TIM_Cmd(TIM3, ENABLE);
+}
+
+
+static IRQn_Type ExtiIrq(u8 line)
+{
+    if (line < 5)
+    {
+	return (IRQn_Type)(EXTI0_IRQn + line);
+    }
+    return (line < 10) ? EXTI9_5_IRQn : EXTI15_10_IRQn;
+}
+
+
+ErrorStatus Input_Add(GPIO_TypeDef* gpio, u8 pin, u8 pressedLevel,
+		      const InputTiming* timing)
+{
+    u32 count = s_count;
+    u16 mask = 1u << pin;
+
+    if (count == INPUT_MAX || pin > 15)
+    {
+	return ERROR;
+    }
+    for (u32 i=0; i<count; i++)
+    {
+	if (s_inputs[i].pin == mask)
+	{
+	    return ERROR;
+	}
+    }
+
+    // The level found now counts as settled.
+    Input* in = &s_inputs[count];
+    in->gpio = gpio;
+    in->pin = mask;
+    in->line = pin;
+    in->pressedLevel = pressedLevel;
+    in->pressed = GPIO_ReadInputDataBit(gpio, mask) == pressedLevel;
+    in->settling = 0;
+    in->wait = INPUT_WAIT_NONE;
+    in->clicks = 0;
+    in->timing = *timing;
+    s_count = count + 1;
+
+    SYSCFG_EXTILineConfig(((u32)gpio - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE), pin);
+
+    EXTI_InitTypeDef exti;
+    exti.EXTI_Line = mask;
+    exti.EXTI_LineCmd = ENABLE;
+    exti.EXTI_Mode = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger = EXTI_Trigger_Rising_Falling;
+    EXTI_Init(&exti);
+
+    IRQn_Type irq = ExtiIrq(pin);
+    Isr_SetVector(irq, EdgeHandler);
+    NVIC_SetPriority(irq, s_priority);
+    NVIC_EnableIRQ(irq);
+    return SUCCESS;
+}
+
+
+int Input_Read(InputEvent* event)
+{
+    if (Ring_Count(&s_events) < sizeof(*event))
+    {
+	return 0;
+    }
+    Ring_Read(&s_events, event, sizeof(*event));
+    return 1;
+}
+
+
+int Input_IsPressed(u32 input)
+{
+    return input < s_count && s_inputs[input].pressed;
+}
+
+
+// Ticks of the timer since Input_Init(), extended past 32 bits with the
+// overflows. Can be called from any interrupt.
+static uint64_t Ticks()
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    u32 high = s_high;
+    u32 low = TIM3->CNT;
+
+    // An overflow whose interrupt has not run yet (see tickless.c).
+    if ((TIM3->SR & TIM_SR_UIF) && low < 0x8000)
+    {
+	high++;
+    }
+
+    __set_PRIMASK(primask);
+    return ((uint64_t)high << 16) | low;
+}
+
+
+// Ticks of INPUT_TICK_HZ since Input_Init(), wrapping at 2^32. Can be
+// called from any interrupt.
+u32 Input_Now()
+{
+    return (u32)(Ticks() / (INPUT_TIMER_HZ / INPUT_TICK_HZ));
+}
+
+
+// Events lost to a full queue.
+u32 Input_Dropped()
+{
+    return s_dropped;
+}
+
+
+// Time of the timer, in its own ticks. The deadlines are kept in these,
+// not rounded to INPUT_TICK_HZ.
+static u32 TimerNow()
+{
+    return (u32)Ticks();
+}
+
+
+// A recent time of the timer in ticks of INPUT_TICK_HZ, on the clock of
+// Input_Now(). Dividing the 32-bit ticks alone would wrap the result at
+// 2^32 / 10 instead of 2^32.
+static u32 ToTick(u32 time)
+{
+    uint64_t now = Ticks();
+    return (u32)((now - (u32)((u32)now - time)) / (INPUT_TIMER_HZ / INPUT_TICK_HZ));
+}
+
+
+static int Reached(u32 deadline, u32 now)
+{
+    return (s32)(now - deadline) >= 0;
+}
+
+
+static void Post(u32 input, InputEventType type, u32 time, u32 clicks)
+{
+    InputEvent event;
+    event.time = ToTick(time);
+    event.input = input;
+    event.type = type;
+    event.clicks = clicks;
+
+    if (Ring_Space(&s_events) < sizeof(event))
+    {
+	s_dropped++;
+	return;
+    }
+    Ring_Write(&s_events, &event, sizeof(event));
+}
+
+
+// A debounced change of the input, which started at 'time'.
+static void Change(u32 input, u32 pressed, u32 time)
+{
+    Input* in = &s_inputs[input];
+
+    in->pressed = pressed;
+    if (pressed)
+    {
+	Post(input, INPUT_PRESS, time, 0);
+	in->wait = INPUT_WAIT_LONG;
+	in->due = time + in->timing.longMs * INPUT_MS;
+	return;
+    }
+
+    Post(input, INPUT_RELEASE, time, 0);
+    if (in->wait == INPUT_WAIT_LONG)
+    {
+	in->clicks += (in->clicks < 0xFF);
+	in->release = time;
+	in->wait = INPUT_WAIT_GAP;
+	in->due = time + in->timing.gapMs * INPUT_MS;
+    }
+}
+
+
+// The contacts have settled.
+static void Sample(u32 input)
+{
+    Input* in = &s_inputs[input];
+
+    // The bounces may have left the line pending while it was masked. The
+    // pin is read after unmasking, so an edge from then on is not missed.
+    in->settling = 0;
+    EXTI->PR = in->pin;
+    *BITBAND_PERIPH(&EXTI->IMR, in->line) = 1;
+
+    u32 pressed = GPIO_ReadInputDataBit(in->gpio, in->pin) == in->pressedLevel;
+    if (pressed != in->pressed)
+    {
+	Change(input, pressed, in->edge);
+    }
+}
+
+
+// A long press or click sequence that is due. Not while settling: the edge
+// being settled may have come before the deadline.
+static void Expire(u32 input)
+{
+    Input* in = &s_inputs[input];
+
+    if (in->wait == INPUT_WAIT_LONG)
+    {
+	Post(input, INPUT_LONG_PRESS, in->due, 0);
+    }
+    else
+    {
+	Post(input, INPUT_CLICKS, in->release, in->clicks);
+    }
+    in->wait = INPUT_WAIT_NONE;
+    in->clicks = 0;
+}
+
+
+// Sets the compare to the earliest deadline, or turns it off.
+static void Schedule()
+{
+    u32 now = TimerNow();
+    u32 next = now + INPUT_MAX_WAIT;
+    int waiting = 0;
+
+    for (u32 i=0; i<s_count; i++)
+    {
+	Input* in = &s_inputs[i];
+	if (in->settling)
+	{
+	    next = Reached(in->settle, next) ? in->settle : next;
+	    waiting = 1;
+	}
+	else if (in->wait)
+	{
+	    next = Reached(in->due, next) ? in->due : next;
+	    waiting = 1;
+	}
+    }
+
+    if (!waiting)
+    {
+	TIM_ITConfig(TIM3, TIM_IT_CC1, DISABLE);
+	return;
+    }
+
+    TIM_SetCompare1(TIM3, (u16)next);
+    TIM_ClearITPendingBit(TIM3, TIM_IT_CC1);
+    TIM_ITConfig(TIM3, TIM_IT_CC1, ENABLE);
+
+    // The counter may have passed the deadline while it was being set.
+    if (Reached(next, TimerNow()))
+    {
+	TIM_GenerateEvent(TIM3, TIM_EventSource_CC1);
+    }
+}
+
+
+static void EdgeHandler()
+{
+    u32 now = TimerNow();
+
+    for (u32 i=0; i<s_count; i++)
+    {
+	Input* in = &s_inputs[i];
+	if (!(EXTI->PR & in->pin))
+	{
+	    continue;
+	}
+
+	// The bounces that follow are masked.
+	EXTI->PR = in->pin;
+	*BITBAND_PERIPH(&EXTI->IMR, in->line) = 0;
+	in->settling = 1;
+	in->edge = now;
+	in->settle = now + in->timing.debounceMs * INPUT_MS;
+    }
+
+    Schedule();
+}
+
+
+static void TimerHandler()
+{
+    // Input_Now() must not see the flag cleared before the overflow is
+    // counted, even from an interrupt of higher priority.
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (TIM3->SR & TIM_SR_UIF)
+    {
+	TIM3->SR = ~TIM_SR_UIF;
+	s_high++;
+    }
+
+    __set_PRIMASK(primask);
+
+    if (!(TIM3->SR & TIM_SR_CC1IF) || !(TIM3->DIER & TIM_DIER_CC1IE))
+    {
+	return;
+    }
+    TIM3->SR = ~TIM_SR_CC1IF;
+
+    u32 now = TimerNow();
+    for (u32 i=0; i<s_count; i++)
+    {
+	Input* in = &s_inputs[i];
+	if (in->settling && Reached(in->settle, now))
+	{
+	    Sample(i);
+	}
+	if (!in->settling && in->wait && Reached(in->due, now))
+	{
+	    Expire(i);
+	}
+    }
+
+    Schedule();
+}
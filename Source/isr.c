@@ -0,0 +1,105 @@
+///////////////////////////// RUN TIME INTERRUPTS /////////////////////////////
+// Moves the vector table to RAM so that interrupt handlers can be set while
+// the program runs.
+
+// The vector table of startup_stm32f4xx.s is in the flash and holds the
+// handlers by name, as Basic3 explains. Two modules that both handle TIM4
+// cannot be in the same program, and one module cannot pass its handler any
+// data but globals. The core finds the table through the Vector Table Offset
+// Register (VTOR) of the SCB. Once the table is copied to RAM and VTOR
+// points there, any entry can be written at any time.
+
+// The table must be aligned to its size rounded up to a power of two:
+// 98 vectors of 4 bytes need 512. It is kept in the main SRAM. The CCM RAM
+// would be faster, but the core cannot fetch vectors from it: it sits on the
+// data bus only.
+
+// Isr_SetVector() writes a handler into the table: the core jumps to it
+// directly. Isr_Attach() writes Dispatch() instead, which looks up the
+// handler and its context by the number of the active exception (IPSR).
+// That costs a few cycles.
+
+#include "stdafx.h"
+#include "isr.h"
+
+
+typedef struct
+{
+    IsrHandler handler;
+    void* context;
+} IsrEntry;
+
+#if defined(__ICCARM__)
+#pragma data_alignment=512
+static IsrVector s_vectors[ISR_VECTORS];
+#else
+static IsrVector s_vectors[ISR_VECTORS] __attribute__((aligned(512)));
+#endif
+
+static IsrVector s_defaults[ISR_VECTORS];	// The vectors in the flash.
+static IsrEntry s_entries[ISR_VECTORS];
+
+
+static void Dispatch()
+{
+    u32 vector = __get_IPSR() & 0x1FF;
+    s_entries[vector].handler(s_entries[vector].context);
+}
+
+
+// Copies the table the core uses now into RAM and switches to the copy.
+// Further calls do nothing.
+void Isr_Init()
+{
+    const IsrVector* table = (const IsrVector*)SCB->VTOR;
+
+    if (table == s_vectors)
+    {
+	return;
+    }
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    for (u32 i=0; i<ISR_VECTORS; i++)
+    {
+	s_defaults[i] = table[i];
+	s_vectors[i] = table[i];
+    }
+    SCB->VTOR = (u32)s_vectors;
+    __DSB();
+
+    __set_PRIMASK(primask);
+}
+
+
+IsrVector Isr_SetVector(IRQn_Type irq, IsrVector vector)
+{
+    Isr_Init();
+
+    IsrVector old = s_vectors[irq + 16];
+    s_vectors[irq + 16] = vector;
+    __DSB();
+    return old;
+}
+
+
+void Isr_Attach(IRQn_Type irq, IsrHandler handler, void* context)
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    s_entries[irq + 16].handler = handler;
+    s_entries[irq + 16].context = context;
+    Isr_SetVector(irq, Dispatch);
+
+    __set_PRIMASK(primask);
+}
+
+
+// Puts the handler of the flash table back.
+void Isr_Detach(IRQn_Type irq)
+{
+    Isr_SetVector(irq, s_defaults[irq + 16]);
+    s_entries[irq + 16].handler = 0;
+}
@@ -0,0 +1,609 @@
+/////////////////////////////////// KERNEL ////////////////////////////////////
+// A small preemptive kernel: tasks of fixed priorities, each with a stack of
+// its own, and semaphores and queues to pass events between tasks and
+// interrupts.
+
+// A superloop runs one thing after the other. A 10 kHz control loop that
+// shares it with slow I/O waits for the I/O to finish and misses its
+// deadlines. Here each activity is a task. The most urgent task that is
+// ready runs, and a task that becomes ready preempts a less urgent one at
+// once, be it made ready by an interrupt (a semaphore given, a queue sent
+// to) or by the tick (a delay over).
+
+// SCHEDULING: There is a ready list per priority and a 32-bit ready map
+// with bit 31 - p set while priority p has a ready task. The count of
+// leading zeros (__CLZ, a single instruction) of the map is the most urgent
+// priority, so picking the next task takes the same time however many tasks
+// there are. Tasks of the same priority run in turn: each runs until it
+// waits or yields.
+
+// CONTEXT SWITCH: Switching is left to PendSV, the exception of the lowest
+// priority. It never preempts another handler, so a handler that makes
+// a task ready only pends it and the switch happens once every handler is
+// done. The tasks run in thread mode on the process stack (PSP) and the
+// handlers on the main stack (MSP). On entry to PendSV the core has already
+// pushed R0-R3, R12, LR, PC and xPSR of the task onto its stack. Kernel_PendSV
+// (kernel_port.s) pushes R4-R11 and the EXC_RETURN value and stores the
+// stack pointer in the task. Then it does the same backwards for the next
+// task.
+
+// FPU: A task that has used the FPU has bit 4 of its EXC_RETURN clear. Only
+// then are S16-S31 saved too; S0-S15 and FPSCR are in the frame of the core.
+// The core reserves room for them but stores them lazily, only when the
+// handler itself uses the FPU. Tasks that do not use the FPU cost nothing.
+
+// STACKS: The stacks are taken from the 64 KB of CCM RAM, which is on the
+// data bus of the core only. Stacks there do not compete with the DMA for
+// the main SRAM. On the other hand no DMA buffer may be put on a task stack.
+// The stacks are painted when created so that Kernel_StackUsed() can tell
+// how much of each has been used.
+
+// The kernel keeps its lists with the interrupts disabled. Those sections
+// are short and take the same time whatever the number of tasks, except
+// for sorting a task into a delay or wait list.
+
+// In the host build (SIM_HOST) the tasks run on host stacks of their own
+// and PendSV switches between them through the simulation. The painted
+// stacks are not used beyond the initial frame there, so
+// Kernel_StackUsed() only tells the size of that frame.
+
+#include "stdafx.h"
+#include "kernel.h"
+#include "isr.h"
+
+#include <string.h>
+
+#ifdef SIM_HOST
+#include "sim.h"
+#endif
+
+
+// The initial frame of a task: R4-R11 and EXC_RETURN as pushed by
+// Kernel_PendSV, then R0-R3, R12, LR, PC and xPSR as pushed by the core.
+#define KERNEL_FRAME_WORDS	17
+#define KERNEL_EXC_RETURN	0xFFFFFFFD	// Thread mode, PSP, no FPU state.
+#define KERNEL_XPSR		0x01000000	// Thumb state.
+#define KERNEL_STACK_PAINT	0xCCCCCCCC
+#define KERNEL_IDLE_STACK	256
+
+#define KERNEL_BIT(priority)	(0x80000000u >> (priority))
+
+
+static KernelTask* s_readyHead[KERNEL_PRIORITIES];
+static KernelTask* s_readyTail[KERNEL_PRIORITIES];
+static volatile u32 s_readyMap = 0;
+static KernelTask* s_delayed = 0;	// Sorted by wake tick.
+static KernelTask* volatile s_current = 0;
+static KernelTask* volatile s_next = 0;
+static volatile u32 s_ticks = 0;
+static u32 s_started = 0;
+static u32 s_ccmUsed = 0;
+static KernelTask s_idle;
+
+#ifndef SIM_HOST
+// Where the switch to the first task saves the registers of main(). A full
+// frame of the FPU fits in case main() has used it.
+static u32 s_boot[KERNEL_FRAME_WORDS + 16];
+
+void Kernel_PendSV();			// kernel_port.s
+u32* Kernel_Switch(u32* sp);
+#else
+void Kernel_PendSV();
+#endif
+
+
+static void MakeReady(KernelTask* task)
+{
+    u32 priority = task->priority;
+
+    task->next = 0;
+    if (s_readyTail[priority])
+    {
+	s_readyTail[priority]->next = task;
+    }
+    else
+    {
+	s_readyHead[priority] = task;
+    }
+    s_readyTail[priority] = task;
+    s_readyMap |= KERNEL_BIT(priority);
+}
+
+
+static void Unready(KernelTask* task)
+{
+    u32 priority = task->priority;
+    KernelTask** link = &s_readyHead[priority];
+    KernelTask* previous = 0;
+
+    // The running task is the first of its list.
+    while (*link != task)
+    {
+	previous = *link;
+	link = &previous->next;
+    }
+    *link = task->next;
+    if (s_readyTail[priority] == task)
+    {
+	s_readyTail[priority] = previous;
+    }
+    if (!s_readyHead[priority])
+    {
+	s_readyMap &= ~KERNEL_BIT(priority);
+    }
+    task->next = 0;
+}
+
+
+static void Delay(KernelTask* task, u32 ticks)
+{
+    KernelTask** link = &s_delayed;
+
+    task->wake = s_ticks + ticks;
+    task->delayed = 1;
+    while (*link && (s32)((*link)->wake - task->wake) <= 0)
+    {
+	link = &(*link)->nextDelayed;
+    }
+    task->nextDelayed = *link;
+    *link = task;
+}
+
+
+static void Undelay(KernelTask* task)
+{
+    KernelTask** link = &s_delayed;
+
+    while (*link != task)
+    {
+	link = &(*link)->nextDelayed;
+    }
+    *link = task->nextDelayed;
+    task->nextDelayed = 0;
+    task->delayed = 0;
+}
+
+
+// Wait lists are sorted by priority, so that the most urgent task waiting
+// gets the semaphore. Tasks of one priority get it in turn.
+static void WaitOn(KernelTask** list, KernelTask* task)
+{
+    task->waitList = list;
+    while (*list && (*list)->priority <= task->priority)
+    {
+	list = &(*list)->next;
+    }
+    task->next = *list;
+    *list = task;
+}
+
+
+static void StopWaiting(KernelTask* task)
+{
+    KernelTask** link = task->waitList;
+
+    while (*link != task)
+    {
+	link = &(*link)->next;
+    }
+    *link = task->next;
+    task->next = 0;
+    task->waitList = 0;
+}
+
+
+static void Wake(KernelTask* task, ErrorStatus result)
+{
+    if (task->waitList)
+    {
+	StopWaiting(task);
+    }
+    if (task->delayed)
+    {
+	Undelay(task);
+    }
+    task->result = result;
+    MakeReady(task);
+}
+
+
+// Makes the most urgent ready task the next to run. PendSV switches to it
+// once the interrupts are enabled and no other handler is active.
+static void Schedule()
+{
+    if (!s_started)
+    {
+	return;
+    }
+
+    s_next = s_readyHead[__CLZ(s_readyMap)];
+    if (s_next != s_current)
+    {
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+
+
+// Puts the running task to sleep on 'list' (0 for none) for 'timeout' ticks
+// at most and switches away. Called by a task with the interrupts disabled
+// by the caller, who passes the PRIMASK saved before. The switch takes place
+// when it is restored, so it must not be called within another critical
+// section.
+static ErrorStatus Block(KernelTask** list, u32 timeout, u32 primask)
+{
+    KernelTask* task = s_current;
+
+    Unready(task);
+    if (list)
+    {
+	WaitOn(list, task);
+    }
+    if (timeout != KERNEL_FOREVER)
+    {
+	Delay(task, timeout);
+    }
+    task->result = SUCCESS;
+    Schedule();
+
+    __set_PRIMASK(primask);
+    return task->result;
+}
+
+
+// The SysTick handler.
+static void Tick()
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    s_ticks++;
+    while (s_delayed && (s32)(s_ticks - s_delayed->wake) >= 0)
+    {
+	// Still on a wait list means the wait has timed out.
+	Wake(s_delayed, s_delayed->waitList ? ERROR : SUCCESS);
+    }
+    Schedule();
+
+    __set_PRIMASK(primask);
+}
+
+
+// A task that returns from its entry is taken off for good.
+static void TaskStart(void* arg)
+{
+    KernelTask* task = (KernelTask*)arg;
+
+    task->entry(task->arg);
+
+    __disable_irq();
+    Unready(task);
+    Schedule();
+    __enable_irq();
+    while (1)
+    {
+    }
+}
+
+
+static void Idle(void* unused)
+{
+    while (1)
+    {
+	__WFI();
+    }
+}
+
+
+void Kernel_Init()
+{
+    for (u32 i=0; i<KERNEL_PRIORITIES; i++)
+    {
+	s_readyHead[i] = 0;
+	s_readyTail[i] = 0;
+    }
+    s_readyMap = 0;
+    s_delayed = 0;
+    s_current = 0;
+    s_next = 0;
+    s_ticks = 0;
+    s_started = 0;
+    s_ccmUsed = 0;
+
+    // There is always a task ready, so the ready map is never 0.
+    Kernel_CreateTask(&s_idle, "idle", KERNEL_IDLE_PRIORITY, KERNEL_IDLE_STACK, Idle, 0);
+}
+
+
+// Creates a task of 'priority' with 'stackSize' bytes of stack that runs
+// 'entry' with 'arg'. It becomes ready at once. Fails when the CCM RAM has
+// no room left for the stack.
+ErrorStatus Kernel_CreateTask(KernelTask* task, const char* name, u32 priority,
+			      u32 stackSize, KernelEntry entry, void* arg)
+{
+    stackSize = (stackSize + 7) & ~7u;
+    if (priority >= KERNEL_PRIORITIES || stackSize < 4 * KERNEL_FRAME_WORDS ||
+	stackSize > KERNEL_CCM_SIZE - s_ccmUsed)
+    {
+	return ERROR;
+    }
+
+    memset(task, 0, sizeof(KernelTask));
+    task->name = name;
+    task->priority = priority;
+    task->entry = entry;
+    task->arg = arg;
+    task->stack = (u32*)(KERNEL_CCM_BASE + s_ccmUsed);
+    task->stackSize = stackSize;
+    s_ccmUsed += stackSize;
+
+    for (u32 i=0; i<stackSize / 4; i++)
+    {
+	task->stack[i] = KERNEL_STACK_PAINT;
+    }
+
+    // The stack grows down. The first switch to the task pops this frame
+    // and returns to TaskStart(task). The stack is 8-byte aligned as the
+    // calling convention requires.
+    u32* sp = task->stack + stackSize / 4 - KERNEL_FRAME_WORDS;
+    for (u32 i=0; i<8; i++)
+    {
+	sp[i] = 0;			// R4-R11
+    }
+    sp[8] = KERNEL_EXC_RETURN;
+    sp[9] = (u32)task;			// R0
+    sp[10] = 0;				// R1
+    sp[11] = 0;				// R2
+    sp[12] = 0;				// R3
+    sp[13] = 0;				// R12
+    sp[14] = 0;				// LR
+    sp[15] = (u32)TaskStart & ~1u;	// PC
+    sp[16] = KERNEL_XPSR;
+    task->sp = sp;
+
+#ifdef SIM_HOST
+    task->context = Sim_CreateContext(TaskStart, task);
+#endif
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    MakeReady(task);
+    Schedule();
+    __set_PRIMASK(primask);
+
+    return SUCCESS;
+}
+
+
+void Kernel_Start()
+{
+    __disable_irq();
+
+    Isr_SetVector(PendSV_IRQn, Kernel_PendSV);
+    Isr_SetVector(SysTick_IRQn, Tick);
+    SysTick_Config(SystemCoreClock / KERNEL_TICK_HZ);
+
+    // Both at the lowest priority. The tick only makes tasks ready.
+    NVIC_SetPriority(PendSV_IRQn, 0xFF);
+    NVIC_SetPriority(SysTick_IRQn, 0xFF);
+
+#ifndef SIM_HOST
+    __set_PSP((u32)(s_boot + sizeof(s_boot) / sizeof(s_boot[0])));
+#endif
+
+    s_started = 1;
+    Schedule();
+    __enable_irq();
+
+    // PendSV has switched to the first task and never comes back here.
+    while (1)
+    {
+    }
+}
+
+
+#ifndef SIM_HOST
+// Called by Kernel_PendSV with the interrupts disabled. Takes the stack
+// pointer of the task switched away from and gives that of the next task.
+u32* Kernel_Switch(u32* sp)
+{
+    if (s_current)
+    {
+	s_current->sp = sp;
+    }
+    s_current = s_next;
+    return s_current->sp;
+}
+#else
+void Kernel_PendSV()
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    KernelTask* from = s_current;
+    s_current = s_next;
+    __set_PRIMASK(primask);
+
+    if (from != s_current)
+    {
+	Sim_SwitchContext(from ? (SimContext*)from->context : 0,
+			  (SimContext*)s_current->context);
+    }
+}
+#endif
+
+
+KernelTask* Kernel_Current()
+{
+    return s_current;
+}
+
+
+u32 Kernel_Now()
+{
+    return s_ticks;
+}
+
+
+void Kernel_Delay(u32 ticks)
+{
+    if (!ticks)
+    {
+	Kernel_Yield();
+	return;
+    }
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    Block(0, ticks, primask);
+}
+
+
+// Delays until 'period' ticks after '*last' and advances '*last' by the
+// period. A periodic task keeps its rate however long each run takes.
+// A deadline that has passed already does not wait.
+void Kernel_DelayUntil(u32* last, u32 period)
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    *last += period;
+    s32 ticks = (s32)(*last - s_ticks);
+    if (ticks > 0)
+    {
+	Block(0, (u32)ticks, primask);
+    }
+    else
+    {
+	__set_PRIMASK(primask);
+    }
+}
+
+
+// Lets the other ready tasks of the same priority run first.
+void Kernel_Yield()
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    Unready(s_current);
+    MakeReady(s_current);
+    Schedule();
+
+    __set_PRIMASK(primask);
+}
+
+
+u32 Kernel_StackUsed(const KernelTask* task)
+{
+    u32 words = task->stackSize / 4;
+    u32 unused = 0;
+
+    while (unused < words && task->stack[unused] == KERNEL_STACK_PAINT)
+    {
+	unused++;
+    }
+    return (words - unused) * 4;
+}
+
+
+///////////////////////////////// SEMAPHORES //////////////////////////////////
+
+void Kernel_SemInit(KernelSem* sem, u32 count)
+{
+    sem->count = count;
+    sem->waiting = 0;
+}
+
+
+// Wakes the most urgent task waiting, if any, else counts.
+void Kernel_SemGive(KernelSem* sem)
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (sem->waiting)
+    {
+	Wake(sem->waiting, SUCCESS);
+	Schedule();
+    }
+    else
+    {
+	sem->count++;
+    }
+
+    __set_PRIMASK(primask);
+}
+
+
+// Waits up to 'timeout' ticks for the semaphore. An interrupt only takes it
+// if it is free.
+ErrorStatus Kernel_SemTake(KernelSem* sem, u32 timeout)
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (sem->count)
+    {
+	sem->count--;
+	__set_PRIMASK(primask);
+	return SUCCESS;
+    }
+    if (!timeout || __get_IPSR())
+    {
+	__set_PRIMASK(primask);
+	return ERROR;
+    }
+    return Block(&sem->waiting, timeout, primask);
+}
+
+
+/////////////////////////////////// QUEUES ////////////////////////////////////
+// Items are copied in and out. One semaphore counts the items and another
+// the free places, so senders wait while the queue is full and receivers
+// while it is empty.
+
+void Kernel_QueueInit(KernelQueue* queue, void* buffer, u32 itemSize, u32 length)
+{
+    queue->buffer = (u8*)buffer;
+    queue->itemSize = itemSize;
+    queue->length = length;
+    queue->head = 0;
+    queue->tail = 0;
+    Kernel_SemInit(&queue->items, 0);
+    Kernel_SemInit(&queue->spaces, length);
+}
+
+
+ErrorStatus Kernel_QueueSend(KernelQueue* queue, const void* item, u32 timeout)
+{
+    if (Kernel_SemTake(&queue->spaces, timeout) != SUCCESS)
+    {
+	return ERROR;
+    }
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    memcpy(queue->buffer + queue->head * queue->itemSize, item, queue->itemSize);
+    queue->head = (queue->head + 1 == queue->length) ? 0 : queue->head + 1;
+    __set_PRIMASK(primask);
+
+    Kernel_SemGive(&queue->items);
+    return SUCCESS;
+}
+
+
+ErrorStatus Kernel_QueueReceive(KernelQueue* queue, void* item, u32 timeout)
+{
+    if (Kernel_SemTake(&queue->items, timeout) != SUCCESS)
+    {
+	return ERROR;
+    }
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    memcpy(item, queue->buffer + queue->tail * queue->itemSize, queue->itemSize);
+    queue->tail = (queue->tail + 1 == queue->length) ? 0 : queue->tail + 1;
+    __set_PRIMASK(primask);
+
+    Kernel_SemGive(&queue->spaces);
+    return SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+;////////////////////////////// KERNEL CONTEXT SWITCH ////////////////////////////
+; The PendSV handler of the kernel (see kernel.c). Saves the registers of the
+; running task on its process stack, asks Kernel_Switch() for the stack of
+; the next task and restores its registers from there.
+;
+; On entry the core has pushed R0-R3, R12, LR, PC and xPSR (and S0-S15 and
+; FPSCR, lazily, if the task has used the FPU) onto the process stack. LR
+; holds the EXC_RETURN value. Its bit 4 is clear when the frame has the FPU
+; state. It is saved with the task, as it differs from task to task.
+
+        MODULE  ?kernel_port
+
+        EXTERN  Kernel_Switch
+        PUBLIC  Kernel_PendSV
+
+        SECTION .text:CODE:REORDER:NOROOT(2)
+        THUMB
+
+Kernel_PendSV
+        CPSID   I
+        MRS     R0, PSP
+        TST     LR, #0x10               ; FPU state in the frame?
+        IT      EQ
+        VSTMDBEQ R0!, {S16-S31}
+        STMDB   R0!, {R4-R11, LR}
+
+        BL      Kernel_Switch           ; R0: stack of the next task.
+
+        LDMIA   R0!, {R4-R11, LR}
+        TST     LR, #0x10
+        IT      EQ
+        VLDMIAEQ R0!, {S16-S31}
+        MSR     PSP, R0
+        CPSIE   I
+        BX      LR
+
+        END
@@ -48,6 +48,34 @@
 //		interrupt.c	(Interrupt routines).
 //		basicx.h/c	(Different basic programs. Follow them in
 //				ascending order).
+//		bench.h/c	(Cycle counting benchmarks, see Basic9).
+//		clock.h/c	(Run time switching of the system clock).
+//		tim_solver.h	(Compile time timer prescaler/auto-reload values).
+//		swtimer.h/c	(Software timers on one hardware timer).
+//		tickless.h/c	(Software timers without a periodic tick).
+//		timestamp.h/c	(64-bit microsecond clock from two chained timers).
+//		ring.h		(Lock-free ring buffers).
+//		isr.h/c		(Vector table in RAM, handlers set at run time).
+//		profile.h/c	(Interrupt latency and load profiler).
+//		defer.h/c	(Interrupt work deferred to PendSV).
+//		kernel.h/c	(Preemptive fixed priority kernel, with
+//				kernel_port.s for the context switch).
+//		coro.h/c	(Stackless coroutines in one event loop).
+//		gpio_port.h	(Atomic writes of many pins of a port).
+//		pins.h		(Pin configuration from constant descriptors).
+//		bitband.h	(Single bit stores through the bit-band alias).
+//		pattern.h/c	(Pin sequences played by a timer and the DMA).
+//		input.h/c	(Debounced button events with timestamps).
+//		pwm_stream.h/c	(PWM duty cycles streamed by DMA bursts).
+//		curve.h		(Curve tables computed by the compiler).
+//		pwm_group.h/c	(Timers started together with fixed phases).
+//		dither.h/c	(Sigma-delta dithering of PWM duty cycles).
+//		ws2812.h/c	(WS2812 and SK6812 LED strips by PWM stream).
+//		freq.h/c	(Frequency meter from DMA edge timestamps).
+//		encoder.h/c	(Quadrature encoders with velocity estimates).
+//
+//	Host ->		(Not part of the IAR project. Runs the programs on a PC
+//			against a simulated peripheral model. See Host/Makefile).
 ///////////////////////////////////////////////////////////////////////////////
 */
 
@@ -61,6 +89,21 @@
 #include "basic6.h"
 #include "basic7.h"
 #include "basic8.h"
+#include "basic9.h"
+#include "basic10.h"
+#include "basic11.h"
+#include "basic12.h"
+#include "basic13.h"
+#include "basic14.h"
+#include "basic15.h"
+#include "basic16.h"
+#include "basic17.h"
+#include "basic18.h"
+#include "basic19.h"
+#include "basic20.h"
+#include "basic21.h"
+#include "basic22.h"
+#include "basic23.h"
 
 int main()
 {
@@ -171,6 +214,66 @@ int main()
 #ifdef BASIC_8
     Basic8();
 #endif
+    
+#ifdef BASIC_9
+    Basic9();
+#endif
+    
+#ifdef BASIC_10
+    Basic10();
+#endif
+    
+#ifdef BASIC_11
+    Basic11();
+#endif
+    
+#ifdef BASIC_12
+    Basic12();
+#endif
+    
+#ifdef BASIC_13
+    Basic13();
+#endif
+    
+#ifdef BASIC_14
+    Basic14();
+#endif
+    
+#ifdef BASIC_15
+    Basic15();
+#endif
+    
+#ifdef BASIC_16
+    Basic16();
+#endif
+    
+#ifdef BASIC_17
+    Basic17();
+#endif
+    
+#ifdef BASIC_18
+    Basic18();
+#endif
+    
+#ifdef BASIC_19
+    Basic19();
+#endif
+    
+#ifdef BASIC_20
+    Basic20();
+#endif
+    
+#ifdef BASIC_21
+    Basic21();
+#endif
+    
+#ifdef BASIC_22
+    Basic22();
+#endif
+    
+#ifdef BASIC_23
+    Basic23();
+#endif
 }
 
 
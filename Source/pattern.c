@@ -0,0 +1,253 @@
+//////////////////////////////// PATTERN ENGINE ///////////////////////////////
+// Plays a table of pin states on a GPIO port, each at its own time, with a
+// timer and the DMA doing all the work.
+
+// Basic1 sequences the LEDs with a busy loop, Basic4 with a timer interrupt
+// per step. Either way the CPU writes the pins. A step is late by as much as
+// an interrupt of higher priority or a critical section keeps the CPU, and
+// at a MHz step rate the CPU does nothing else.
+
+// A pattern is a table of BSRR words (see gpio_port.h), one per step. Each
+// update event of TIM8 requests DMA2 stream 1, which stores the next word
+// into the BSRR of the port. The pins change a few bus cycles after the
+// update event whatever the CPU is doing, and all at once. It has to be DMA2
+// and TIM8 (or TIM1, the only other timer whose requests go to DMA2): DMA1
+// reaches the APB1 peripherals only, and the GPIO ports are on the AHB1.
+
+// STEP LENGTHS: Without a second table every step is 'period' ticks long.
+// With one, the compare event of channel 1 at CNT = 0, right after each
+// update, requests stream 2, which stores the length of the step just
+// started into ARR. ARR is not preloaded, so the length counts for that
+// very step, provided the store lands before the counter gets there (hence
+// PATTERN_MIN_TICKS). With the preload the table would have to be one step
+// ahead of the words.
+
+// LOOPS AND SWAPS: A looping pattern runs the streams in double buffer mode,
+// both buffers on the same table. At the end of a pass the DMA goes on with
+// the other buffer without missing a step. To swap in another pattern the
+// buffer just finished is pointed at it from the transfer complete
+// interrupt: it is not used again for a whole pass. At the next interrupt
+// the other buffer follows, and the interrupt is disabled again. NDTR is
+// common to both buffers, so the patterns have the same number of steps.
+
+// The tables must be in the SRAM or the flash. The DMA cannot reach the CCM
+// RAM.
+
+#include "stdafx.h"
+#include "pattern.h"
+#include "bitband.h"
+#include "clock.h"
+#include "isr.h"
+
+
+#define PATTERN_WORDS		DMA2_Stream1	// TIM8_UP, channel 7.
+#define PATTERN_LENGTHS		DMA2_Stream2	// TIM8_CH1, channel 7.
+
+
+static GPIO_TypeDef* s_gpio = 0;
+static const Pattern* s_pattern = 0;	// What both buffers point at.
+static const Pattern* s_next = 0;	// Being swapped in.
+static volatile u32 s_swaps = 0;	// Buffers still to point at s_next.
+static int s_loop = 0;
+
+
+static void WordsDone();
+static void LengthsDone();
+
+
+ErrorStatus Pattern_Init(GPIO_TypeDef* gpio, u32 tickHz)
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM8, ENABLE);
+
+    if (Clock_RegisterTimer(TIM8, tickHz) != SUCCESS)
+    {
+	return ERROR;
+    }
+
+    // Load the prescaler. With URS set this raises neither the update flag
+    // nor the DMA request.
+    TIM_UpdateRequestConfig(TIM8, TIM_UpdateSource_Regular);
+    TIM_GenerateEvent(TIM8, TIM_EventSource_Update);
+
+    // Channel 1 only compares, at 0.
+    TIM_OCInitTypeDef oc;
+    TIM_OCStructInit(&oc);
+    TIM_OC1Init(TIM8, &oc);
+
+    s_gpio = gpio;
+
+    Isr_SetVector(DMA2_Stream1_IRQn, WordsDone);
+    Isr_SetVector(DMA2_Stream2_IRQn, LengthsDone);
+    NVIC_SetPriority(DMA2_Stream1_IRQn, 1);
+    NVIC_SetPriority(DMA2_Stream2_IRQn, 1);
+    NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+    NVIC_EnableIRQ(DMA2_Stream2_IRQn);
+    return SUCCESS;
+}
+
+
+static void SetupStream(DMA_Stream_TypeDef* stream, volatile void* target,
+			const void* table, u32 size, u32 count, u32 priority)
+{
+    DMA_InitTypeDef dma;
+    DMA_StructInit(&dma);
+    dma.DMA_Channel = DMA_Channel_7;
+    dma.DMA_PeripheralBaseAddr = (u32)target;
+    dma.DMA_Memory0BaseAddr = (u32)table;
+    dma.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+    dma.DMA_BufferSize = count;
+    dma.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    dma.DMA_PeripheralDataSize = (size == 4) ? DMA_PeripheralDataSize_Word : DMA_PeripheralDataSize_HalfWord;
+    dma.DMA_MemoryDataSize = (size == 4) ? DMA_MemoryDataSize_Word : DMA_MemoryDataSize_HalfWord;
+    dma.DMA_Mode = s_loop ? DMA_Mode_Circular : DMA_Mode_Normal;
+    dma.DMA_Priority = priority;
+    DMA_Init(stream, &dma);
+
+    if (s_loop)
+    {
+	DMA_DoubleBufferModeConfig(stream, (u32)table, DMA_Memory_0);
+	DMA_DoubleBufferModeCmd(stream, ENABLE);
+    }
+    DMA_Cmd(stream, ENABLE);
+}
+
+
+static void StopStream(DMA_Stream_TypeDef* stream)
+{
+    DMA_Cmd(stream, DISABLE);
+    while (DMA_GetCmdStatus(stream) == ENABLE)
+    {
+    }
+    DMA_DeInit(stream);
+}
+
+
+// The stream that moves last at each step, which the interrupts follow.
+static DMA_Stream_TypeDef* LastStream(const Pattern* pattern)
+{
+    return pattern->ticks ? PATTERN_LENGTHS : PATTERN_WORDS;
+}
+
+
+ErrorStatus Pattern_Start(const Pattern* pattern, int loop)
+{
+    if (!s_gpio || !pattern->count || (!pattern->ticks && pattern->period < PATTERN_MIN_TICKS))
+    {
+	return ERROR;
+    }
+
+    Pattern_Stop();
+    s_pattern = pattern;
+    s_next = 0;
+    s_swaps = 0;
+    s_loop = loop;
+
+    u16 requests = TIM_DMA_Update;
+    SetupStream(PATTERN_WORDS, &s_gpio->BSRRL, pattern->words, 4, pattern->count,
+		DMA_Priority_VeryHigh);
+    if (pattern->ticks)
+    {
+	SetupStream(PATTERN_LENGTHS, &TIM8->ARR, pattern->ticks, 2, pattern->count,
+		    DMA_Priority_High);
+	requests |= TIM_DMA_CC1;
+    }
+
+    // Once played, the interrupt stops the timer.
+    if (!loop)
+    {
+	DMA_ITConfig(LastStream(pattern), DMA_IT_TC, ENABLE);
+    }
+
+    // With the counter at ARR the first tick is an update: step 0 starts
+    // one tick after the counter.
+    TIM_SetAutoreload(TIM8, pattern->ticks ? PATTERN_MIN_TICKS - 1 : pattern->period - 1);
+    TIM_SetCounter(TIM8, TIM8->ARR);
+    TIM_DMACmd(TIM8, requests, ENABLE);
+    BITBAND_SET(TIM8->CR1, TIM_CR1_CEN);
+    return SUCCESS;
+}
+
+
+ErrorStatus Pattern_Swap(const Pattern* pattern)
+{
+    const Pattern* playing = s_pattern;
+
+    if (!s_loop || !playing || pattern->count != playing->count ||
+	!pattern->ticks != !playing->ticks ||
+	(!pattern->ticks && pattern->period != playing->period))
+    {
+	return ERROR;
+    }
+
+    // A transfer complete flag left from an earlier pass would interrupt
+    // at once, when the buffer just finished may be about to be used.
+    DMA_Stream_TypeDef* last = LastStream(playing);
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    s_next = pattern;
+    s_swaps = 2;
+    DMA_ClearITPendingBit(last, last == PATTERN_WORDS ? DMA_IT_TCIF1 : DMA_IT_TCIF2);
+    DMA_ITConfig(last, DMA_IT_TC, ENABLE);
+
+    __set_PRIMASK(primask);
+    return SUCCESS;
+}
+
+
+void Pattern_Stop()
+{
+    BITBAND_CLEAR(TIM8->CR1, TIM_CR1_CEN);
+    TIM_DMACmd(TIM8, TIM_DMA_Update | TIM_DMA_CC1, DISABLE);
+    StopStream(PATTERN_WORDS);
+    StopStream(PATTERN_LENGTHS);
+    s_swaps = 0;
+}
+
+
+int Pattern_IsRunning()
+{
+    return BITBAND_READ(TIM8->CR1, TIM_CR1_CEN);
+}
+
+
+// Transfer complete of the stream that moves last: the end of a pass.
+static void PassDone(DMA_Stream_TypeDef* stream)
+{
+    if (!s_loop)
+    {
+	BITBAND_CLEAR(TIM8->CR1, TIM_CR1_CEN);
+	DMA_ITConfig(stream, DMA_IT_TC, DISABLE);
+	return;
+    }
+
+    // The DMA has just gone on to the other buffer. The one it left is not
+    // used again until the end of this pass.
+    u32 idle = DMA_GetCurrentMemoryTarget(stream) ? DMA_Memory_0 : DMA_Memory_1;
+    DMA_MemoryTargetConfig(PATTERN_WORDS, (u32)s_next->words, idle);
+    if (s_next->ticks)
+    {
+	DMA_MemoryTargetConfig(PATTERN_LENGTHS, (u32)s_next->ticks, idle);
+    }
+
+    if (--s_swaps == 0)
+    {
+	s_pattern = s_next;
+	DMA_ITConfig(stream, DMA_IT_TC, DISABLE);
+    }
+}
+
+
+static void WordsDone()
+{
+    DMA_ClearITPendingBit(PATTERN_WORDS, DMA_IT_TCIF1);
+    PassDone(PATTERN_WORDS);
+}
+
+
+static void LengthsDone()
+{
+    DMA_ClearITPendingBit(PATTERN_LENGTHS, DMA_IT_TCIF2);
+    PassDone(PATTERN_LENGTHS);
+}
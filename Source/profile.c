@@ -0,0 +1,245 @@
+/////////////////////////////// IRQ PROFILER //////////////////////////////////
+// Measures for every profiled interrupt how late its handler starts after
+// the hardware event (latency), how long it runs and which share of the CPU
+// all of that takes over a window of time.
+
+// The profiler puts a trampoline into the RAM vector table (see isr.c) in
+// place of the handler. The trampoline reads the cycle counter of the DWT
+// (see bench.c), asks the latency source of the interrupt how long ago the
+// event was, calls the handler and reads the cycle counter again. Handlers
+// that preempt one another are counted apart: the time of a nested handler
+// is taken off the one it preempted.
+
+// The hardware event cannot be seen by software, but the peripheral that
+// raised it can tell how long ago that was:
+//	SysTick		Counts core cycles down from LOAD, so LOAD - VAL cycles
+//			have passed since it reloaded.
+//	Timer update	The counter restarted from 0 at the update, so CNT
+//			timer clocks have passed. Exact with a prescaler of 0.
+//	Capture		A timer channel captures the counter on the edge of the
+//			input that also raises the interrupt (say PA0 on
+//			TIM5_CH1 and EXTI0), so CNT - CCR timer clocks have
+//			passed.
+// The latency includes the 12 cycles the core takes to enter an exception
+// and the few of the trampoline before the source is read.
+
+// The durations are also counted in histograms of powers of two cycles: bin
+// n holds the durations from 2^n to 2^(n+1) - 1 cycles. The cycle counter is
+// 32-bit, so a window must be shorter than 2^32 cycles (25 s at 168 MHz).
+
+#include "stdafx.h"
+#include "isr.h"
+#include "profile.h"
+#include "bench.h"
+
+#include <stdio.h>
+
+
+#define PROFILE_MAX_DEPTH	16
+
+
+static ProfileIrq s_irqs[PROFILE_MAX_IRQS];
+static u32 s_count = 0;
+static u8 s_byVector[ISR_VECTORS];		// Index + 1 into s_irqs.
+static u32 s_windowStart = 0;
+
+// Cycles of the handlers nested in the one at each depth.
+static u32 s_depth = 0;
+static u32 s_nested[PROFILE_MAX_DEPTH + 1];
+
+
+static u32 Bin(u32 cycles)
+{
+    u32 bin = 31 - __CLZ(cycles | 1);
+    return (bin < PROFILE_BINS) ? bin : PROFILE_BINS - 1;
+}
+
+
+static void Trampoline()
+{
+    u32 start = DWT_CYCCNT;
+    ProfileIrq* p = &s_irqs[s_byVector[__get_IPSR() & 0x1FF] - 1];
+    u32 latency = p->latency ? p->latency(p->source) : 0;
+    u32 depth = s_depth++;
+
+    s_nested[depth + 1] = 0;
+    p->handler();
+
+    u32 total = DWT_CYCCNT - start;
+    u32 cycles = total - s_nested[depth + 1];
+    s_depth = depth;
+    s_nested[depth] += total;
+
+    p->count++;
+    p->cycles += cycles;
+    if (cycles > p->maxCycles)
+    {
+	p->maxCycles = cycles;
+    }
+    p->cycleBins[Bin(cycles)]++;
+
+    if (p->latency)
+    {
+	p->latencySum += latency;
+	if (latency > p->maxLatency)
+	{
+	    p->maxLatency = latency;
+	}
+	p->latencyBins[Bin(latency)]++;
+    }
+}
+
+
+void Profile_Init()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    Isr_Init();
+}
+
+
+// Profiles the handler that is set for 'irq' now, so it is called after the
+// handler is set. 'latency' may be 0.
+ErrorStatus Profile_Irq(const char* name, IRQn_Type irq,
+			ProfileLatency latency, void* source)
+{
+    if (s_count == PROFILE_MAX_IRQS || s_byVector[irq + 16])
+    {
+	return ERROR;
+    }
+
+    ProfileIrq* p = &s_irqs[s_count];
+    p->name = name;
+    p->irq = irq;
+    p->latency = latency;
+    p->source = source;
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    s_byVector[irq + 16] = ++s_count;
+    p->handler = Isr_SetVector(irq, Trampoline);
+    __set_PRIMASK(primask);
+
+    return SUCCESS;
+}
+
+
+// Starts a new window: all the counts start from 0.
+void Profile_Start()
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    for (u32 i=0; i<s_count; i++)
+    {
+	ProfileIrq* p = &s_irqs[i];
+	p->count = 0;
+	p->cycles = 0;
+	p->maxCycles = 0;
+	p->latencySum = 0;
+	p->maxLatency = 0;
+	for (u32 b=0; b<PROFILE_BINS; b++)
+	{
+	    p->cycleBins[b] = 0;
+	    p->latencyBins[b] = 0;
+	}
+    }
+    s_windowStart = DWT_CYCCNT;
+
+    __set_PRIMASK(primask);
+}
+
+
+static void PrintBins(const char* name, const u32* bins)
+{
+    printf("  %-8s", name);
+    for (u32 b=0; b<PROFILE_BINS; b++)
+    {
+	if (bins[b])
+	{
+	    printf(" %u:%u", 1u << b, (unsigned)bins[b]);
+	}
+    }
+    printf("\n");
+}
+
+
+// Prints the window so far and starts the next one. The counts are copied
+// and reset in one go, so that no interrupt falls between the windows, and
+// then printed while the interrupts go on.
+void Profile_Print()
+{
+    static ProfileIrq copy[PROFILE_MAX_IRQS];
+
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+    u32 window = DWT_CYCCNT - s_windowStart;
+    for (u32 i=0; i<s_count; i++)
+    {
+	copy[i] = s_irqs[i];
+    }
+    Profile_Start();
+    __set_PRIMASK(primask);
+
+    uint64_t busy = 0;
+    printf("%-12s %8s %8s %8s %7s %8s %8s\n", "IRQ", "Count", "Avg", "Max",
+	   "Load", "Lat avg", "Lat max");
+    for (u32 i=0; i<s_count; i++)
+    {
+	ProfileIrq* p = &copy[i];
+	u32 average = p->count ? (u32)(p->cycles / p->count) : 0;
+	u32 latency = p->count ? (u32)(p->latencySum / p->count) : 0;
+
+	busy += p->cycles;
+	printf("%-12s %8u %8u %8u %6.2f%% %8u %8u\n", p->name,
+	       (unsigned)p->count, (unsigned)average, (unsigned)p->maxCycles,
+	       window ? 100.0 * p->cycles / window : 0.0,
+	       (unsigned)latency, (unsigned)p->maxLatency);
+	PrintBins("cycles", p->cycleBins);
+	if (p->latency)
+	{
+	    PrintBins("latency", p->latencyBins);
+	}
+    }
+    printf("%-12s %8s %8s %8s %6.2f%% of %u cycles\n", "Total", "", "", "",
+	   window ? 100.0 * busy / window : 0.0, (unsigned)window);
+}
+
+
+u32 Profile_SysTickLatency(void* unused)
+{
+    return SysTick->LOAD - SysTick->VAL;
+}
+
+
+// Core cycles per timer clock. The timers on an APB bus that is divided run
+// at twice its clock (see tim_solver.h).
+static u32 CyclesPerTimerClock(TIM_TypeDef* TIMx)
+{
+    static const u8 dividers[8] = { 1, 1, 1, 1, 2, 4, 8, 16 };
+    u32 apb2 = (TIMx == TIM1 || TIMx == TIM8 || TIMx == TIM9 ||
+		TIMx == TIM10 || TIMx == TIM11);
+    u32 ppre = apb2 ? (RCC->CFGR >> 13) & 7 : (RCC->CFGR >> 10) & 7;
+    u32 divider = dividers[ppre];
+
+    return (divider == 1) ? 1 : divider / 2;
+}
+
+
+u32 Profile_UpdateLatency(void* TIMx)
+{
+    TIM_TypeDef* tim = (TIM_TypeDef*)TIMx;
+    return tim->CNT * (tim->PSC + 1) * CyclesPerTimerClock(tim);
+}
+
+
+u32 Profile_CaptureLatency(void* TIMx)
+{
+    TIM_TypeDef* tim = (TIM_TypeDef*)TIMx;
+    u32 cnt = tim->CNT;
+    u32 ccr = tim->CCR1;
+
+    // The counter may have rolled over since the capture.
+    u32 ticks = (cnt >= ccr) ? cnt - ccr : cnt + tim->ARR + 1 - ccr;
+    return ticks * (tim->PSC + 1) * CyclesPerTimerClock(tim);
+}
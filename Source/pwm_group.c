@@ -0,0 +1,253 @@
+///////////////////////////////// PWM GROUPS //////////////////////////////////
+// Runs PWM on TIM2 to TIM5 as one group: the timers start on the same clock
+// and keep fixed phases between them, which gives up to 16 channels in
+// known relation to each other.
+
+// Started one after the other with TIM_Cmd(), the timers are apart by the
+// few instructions in between, more if an interrupt comes: the phases are
+// whatever they happen to be. A multiphase power stage or an interleaved
+// converter needs each phase a set fraction of the period after the other.
+
+// THE START: TIM2 is the master. Its trigger output follows its counter
+// enable (TIM_TRGOSource_Enable), and the others wait for it in trigger
+// slave mode (Basic8), TIM2 being on ITR1 of TIM3 and TIM4 and on ITR0 of
+// TIM5. Enabling TIM2 enables them all, on the same clock edge. The
+// trigger goes through the input resynchronization of the slaves, so they
+// start a couple of timer clocks after TIM2, all of them together. Where
+// that matters TIM2 can be given that much phase.
+
+// PHASES: Before the start each counter is put where its period would be
+// at that point if it had started 'phase' ticks later: at 'period' -
+// 'phase'. Counting up it gets to 0 'phase' ticks after the start. Centered
+// (TIM_CounterMode_CenterAligned1, Basic7) a counter goes from 0 up to ARR
+// and back down, so a period is 2 * ARR. In the second half the counter is
+// put at the mirrored value, counting down. DIR is read-only in center-
+// aligned mode, so it is set while the timer still counts up, and the mode
+// after.
+
+// UPDATES: ARR and the compare registers are preloaded. A duty cycle
+// changes at the update of its timer, never within a period, so there is
+// no short or doubled pulse. PwmGroup_Start() loads the values set before
+// it, so the first pulses are whole too. To change several channels at
+// once, PwmGroup_BeginUpdate() sets UDIS in every timer: updates do not
+// load the shadow registers until PwmGroup_EndUpdate() clears it. The
+// timers update at their own phase, so each takes the new values at its
+// first update after that.
+
+#include "stdafx.h"
+#include "pwm_group.h"
+#include "bitband.h"
+#include "clock.h"
+
+
+static TIM_TypeDef* const s_timers[PWMGROUP_TIMERS] = { TIM2, TIM3, TIM4, TIM5 };
+
+// The input trigger on which each slave sees TIM2.
+static const u16 s_triggers[PWMGROUP_TIMERS] = { 0, TIM_TS_ITR1, TIM_TS_ITR1, TIM_TS_ITR0 };
+
+static const u32 s_clocks[PWMGROUP_TIMERS] = {
+    RCC_APB1Periph_TIM2, RCC_APB1Periph_TIM3, RCC_APB1Periph_TIM4, RCC_APB1Periph_TIM5,
+};
+
+static u32 s_used = 0;			// Bit n for TIM2 + n.
+static int s_centered = 0;
+
+
+static void SetupChannels(TIM_TypeDef* tim)
+{
+    static void (*const s_ocInit[])(TIM_TypeDef*, TIM_OCInitTypeDef*) = {
+	TIM_OC1Init, TIM_OC2Init, TIM_OC3Init, TIM_OC4Init,
+    };
+    static void (*const s_ocPreload[])(TIM_TypeDef*, uint16_t) = {
+	TIM_OC1PreloadConfig, TIM_OC2PreloadConfig, TIM_OC3PreloadConfig, TIM_OC4PreloadConfig,
+    };
+
+    TIM_OCInitTypeDef oc;
+    TIM_OCStructInit(&oc);
+    oc.TIM_OCMode = TIM_OCMode_PWM1;
+    oc.TIM_OutputState = TIM_OutputState_Enable;
+    oc.TIM_OCPolarity = TIM_OCPolarity_High;
+    oc.TIM_Pulse = 0;
+    for (u32 c=0; c<4; c++)
+    {
+	s_ocInit[c](tim, &oc);
+	s_ocPreload[c](tim, TIM_OCPreload_Enable);
+    }
+}
+
+
+// Puts the counter where it is 'at' ticks into its period.
+static void SetupPosition(TIM_TypeDef* tim, u32 period, u32 at)
+{
+    if (!s_centered)
+    {
+	TIM_SetCounter(tim, at);
+	return;
+    }
+
+    if (at < period / 2)
+    {
+	TIM_SetCounter(tim, at);
+    }
+    else
+    {
+	TIM_SetCounter(tim, period - at);
+	tim->CR1 |= TIM_CR1_DIR;
+    }
+    tim->CR1 |= TIM_CounterMode_CenterAligned1;
+}
+
+
+ErrorStatus PwmGroup_Init(const PwmGroupConfig* config)
+{
+    u32 period = config->period;
+
+    if (config->centered ? (period & 1) || period < 2 || period / 2 > 0xFFFF
+			 : period < 2 || period > 0x10000)
+    {
+	return ERROR;
+    }
+
+    PwmGroup_Stop();
+    s_used = config->timers | 1;
+    s_centered = config->centered;
+
+    for (u32 n=0; n<PWMGROUP_TIMERS; n++)
+    {
+	TIM_TypeDef* tim = s_timers[n];
+	if (!(s_used & (1u << n)))
+	{
+	    continue;
+	}
+
+	RCC_APB1PeriphClockCmd(s_clocks[n], ENABLE);
+	TIM_DeInit(tim);
+
+	// Counting up for now. The update event loads the prescaler, the
+	// period and the compare values 0.
+	TIM_TimeBaseInitTypeDef base;
+	base.TIM_ClockDivision = TIM_CKD_DIV1;
+	base.TIM_CounterMode = TIM_CounterMode_Up;
+	base.TIM_Period = s_centered ? period / 2 : period - 1;
+	base.TIM_Prescaler = Clock_GetTimerClock(tim) / config->tickHz - 1;
+	base.TIM_RepetitionCounter = 0;
+	TIM_TimeBaseInit(tim, &base);
+
+	if (Clock_RegisterTimer(tim, config->tickHz) != SUCCESS)
+	{
+	    s_used = 0;
+	    return ERROR;
+	}
+
+	TIM_ARRPreloadConfig(tim, ENABLE);
+	SetupChannels(tim);
+	TIM_GenerateEvent(tim, TIM_EventSource_Update);
+	TIM_ClearFlag(tim, TIM_FLAG_Update);
+
+	SetupPosition(tim, period, (period - config->phase[n] % period) % period);
+
+	if (n == 0)
+	{
+	    TIM_SelectOutputTrigger(tim, TIM_TRGOSource_Enable);
+	}
+	else
+	{
+	    TIM_SelectInputTrigger(tim, s_triggers[n]);
+	    TIM_SelectSlaveMode(tim, TIM_SlaveMode_Trigger);
+	}
+    }
+    return SUCCESS;
+}
+
+
+// The compare values set before the start are only in the preload
+// registers, and the first period would compare with the 0s of
+// PwmGroup_Init(). With preload off a write goes to the active register,
+// so each value is written once more that way.
+static void LoadCompares(TIM_TypeDef* tim)
+{
+    static const u16 s_preload[] = {
+	TIM_CCMR1_OC1PE, TIM_CCMR1_OC2PE, TIM_CCMR2_OC3PE, TIM_CCMR2_OC4PE,
+    };
+
+    for (u32 c=0; c<4; c++)
+    {
+	volatile u16* ccmr = (c < 2) ? &tim->CCMR1 : &tim->CCMR2;
+	volatile u32* ccr = &(&tim->CCR1)[c];
+	u32 ticks = *ccr;
+
+	*ccmr &= ~s_preload[c];
+	*ccr = ticks;
+	*ccmr |= s_preload[c];
+    }
+}
+
+
+void PwmGroup_Start()
+{
+    if (!s_used)
+    {
+	return;
+    }
+
+    // TIM2 last: an output active at its starting position goes active
+    // with the load, and is then that little ahead of the start.
+    for (s32 n=PWMGROUP_TIMERS - 1; n>=0; n--)
+    {
+	if (s_used & (1u << n))
+	{
+	    LoadCompares(s_timers[n]);
+	}
+    }
+    TIM_Cmd(TIM2, ENABLE);
+}
+
+
+void PwmGroup_Stop()
+{
+    for (u32 n=0; n<PWMGROUP_TIMERS; n++)
+    {
+	if (s_used & (1u << n))
+	{
+	    TIM_Cmd(s_timers[n], DISABLE);
+	}
+    }
+}
+
+
+void PwmGroup_Set(u32 channel, u32 ticks)
+{
+    u32 n = channel / 4;
+
+    if (n >= PWMGROUP_TIMERS || !(s_used & (1u << n)))
+    {
+	return;
+    }
+
+    // The compare registers follow each other from CCR1.
+    (&s_timers[n]->CCR1)[channel % 4] = s_centered ? ticks / 2 : ticks;
+}
+
+
+void PwmGroup_BeginUpdate()
+{
+    for (u32 n=0; n<PWMGROUP_TIMERS; n++)
+    {
+	if (s_used & (1u << n))
+	{
+	    BITBAND_SET(s_timers[n]->CR1, TIM_CR1_UDIS);
+	}
+    }
+}
+
+
+void PwmGroup_EndUpdate()
+{
+    for (u32 n=0; n<PWMGROUP_TIMERS; n++)
+    {
+	if (s_used & (1u << n))
+	{
+	    BITBAND_CLEAR(s_timers[n]->CR1, TIM_CR1_UDIS);
+	}
+    }
+}
@@ -0,0 +1,181 @@
+/////////////////////////////// PWM STREAMING /////////////////////////////////
+// Feeds the duty cycles of up to four PWM channels of TIM4 from a buffer, a
+// new set every period, with the DMA and without an interrupt per period.
+
+// Basic6 changes its duty cycle from the update interrupt of TIM4: one
+// interrupt per period. At 100 Hz that is cheap, but a motor or LED driver
+// that changes four duty cycles at some kHz spends much of its time entering
+// and leaving the handler, and a late interrupt leaves an old value for one
+// more period.
+
+// DMA BURSTS: A timer has one DMA request per event, but it can turn one
+// request into a burst of writes. DCR gives the first register (DBA, here
+// CCR1) and the number of transfers (DBL). Each write of the DMA to DMAR
+// goes on to the next register of the burst, and the timer keeps its
+// request up until the burst is done. So each update of TIM4 makes DMA1
+// stream 6 (channel 2) store one frame, the compare values of all the
+// channels, into CCR1 to CCRn.
+
+// The compare registers are preloaded. The frame stored at an update is
+// loaded at the next one and used for the whole period after it, however
+// late in the period the DMA gets the bus. Without the preload a compare
+// value below the time the store takes would be missed and the output
+// would stay active for the whole period. The price is one period of
+// latency, and the first period is idle.
+
+// REFILLS: The stream runs in circular mode over a buffer of an even number
+// of frames. Its half transfer interrupt comes when the DMA goes on to the
+// second half, and the transfer complete one when it starts the first half
+// again. Each refills the half just played, two interrupts per 'frames'
+// periods. If the DMA is back in the half being refilled by the time the
+// refill is over, it has played old frames: PwmStream_Overruns() counts
+// these. A refill may also stop the stream, at the end of a finite one.
+
+// The buffer must be in the SRAM. The DMA cannot reach the CCM RAM.
+
+#include "stdafx.h"
+#include "pwm_stream.h"
+#include "clock.h"
+#include "isr.h"
+
+
+#define PWMSTREAM_DMA		DMA1_Stream6	// TIM4_UP, channel 2.
+
+
+static PwmStreamConfig s_config;
+static volatile u32 s_overruns = 0;
+
+
+static void HalfDone();
+
+
+ErrorStatus PwmStream_Start(const PwmStreamConfig* config)
+{
+    static void (*const s_ocInit[])(TIM_TypeDef*, TIM_OCInitTypeDef*) = {
+	TIM_OC1Init, TIM_OC2Init, TIM_OC3Init, TIM_OC4Init,
+    };
+    static void (*const s_ocPreload[])(TIM_TypeDef*, uint16_t) = {
+	TIM_OC1PreloadConfig, TIM_OC2PreloadConfig, TIM_OC3PreloadConfig, TIM_OC4PreloadConfig,
+    };
+
+    if (!config->channels || config->channels > PWMSTREAM_MAX_CHANNELS ||
+	!config->frames || (config->frames & 1) || config->period < 2)
+    {
+	return ERROR;
+    }
+
+    PwmStream_Stop();
+
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM4, ENABLE);
+
+    if (Clock_RegisterTimer(TIM4, config->tickHz) != SUCCESS)
+    {
+	return ERROR;
+    }
+
+    s_config = *config;
+    s_overruns = 0;
+
+    TIM_SetAutoreload(TIM4, config->period - 1);
+    TIM_ARRPreloadConfig(TIM4, ENABLE);
+
+    TIM_OCInitTypeDef oc;
+    TIM_OCStructInit(&oc);
+    oc.TIM_OCMode = TIM_OCMode_PWM1;
+    oc.TIM_OutputState = TIM_OutputState_Enable;
+    oc.TIM_OCPolarity = TIM_OCPolarity_High;
+    oc.TIM_Pulse = 0;
+    for (u32 c=0; c<config->channels; c++)
+    {
+	s_ocInit[c](TIM4, &oc);
+	s_ocPreload[c](TIM4, TIM_OCPreload_Enable);
+    }
+
+    // Load the prescaler, the period and the idle compare values. With URS
+    // set this raises neither the update flag nor the DMA request.
+    TIM_UpdateRequestConfig(TIM4, TIM_UpdateSource_Regular);
+    TIM_GenerateEvent(TIM4, TIM_EventSource_Update);
+
+    config->refill(config->buffer, config->frames);
+
+    DMA_InitTypeDef dma;
+    DMA_StructInit(&dma);
+    dma.DMA_Channel = DMA_Channel_2;
+    dma.DMA_PeripheralBaseAddr = (u32)&TIM4->DMAR;
+    dma.DMA_Memory0BaseAddr = (u32)config->buffer;
+    dma.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+    dma.DMA_BufferSize = config->frames * config->channels;
+    dma.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    dma.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    dma.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    dma.DMA_Mode = DMA_Mode_Circular;
+    dma.DMA_Priority = DMA_Priority_High;
+    DMA_Init(PWMSTREAM_DMA, &dma);
+
+    Isr_SetVector(DMA1_Stream6_IRQn, HalfDone);
+    NVIC_SetPriority(DMA1_Stream6_IRQn, 1);
+    NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+    DMA_ITConfig(PWMSTREAM_DMA, DMA_IT_HT | DMA_IT_TC, ENABLE);
+    DMA_Cmd(PWMSTREAM_DMA, ENABLE);
+
+    // A burst of one frame from CCR1 at each update.
+    TIM_DMAConfig(TIM4, TIM_DMABase_CCR1, (config->channels - 1) << 8);
+    TIM_DMACmd(TIM4, TIM_DMA_Update, ENABLE);
+    TIM_Cmd(TIM4, ENABLE);
+    return SUCCESS;
+}
+
+
+void PwmStream_Stop()
+{
+    TIM_Cmd(TIM4, DISABLE);
+    TIM_DMACmd(TIM4, TIM_DMA_Update, DISABLE);
+
+    DMA_Cmd(PWMSTREAM_DMA, DISABLE);
+    while (DMA_GetCmdStatus(PWMSTREAM_DMA) == ENABLE)
+    {
+    }
+    DMA_DeInit(PWMSTREAM_DMA);
+}
+
+
+u32 PwmStream_Overruns()
+{
+    return s_overruns;
+}
+
+
+static void Refill(u32 half)
+{
+    u32 frames = s_config.frames / 2;
+    u32 values = frames * s_config.channels;
+
+    s_config.refill(s_config.buffer + half * values, frames);
+    if (DMA_GetCmdStatus(PWMSTREAM_DMA) == DISABLE)
+    {
+	return;
+    }
+
+    // The DMA must still be in the other half.
+    u32 left = DMA_GetCurrDataCounter(PWMSTREAM_DMA);
+    if ((left > values) != half)
+    {
+	s_overruns++;
+    }
+}
+
+
+static void HalfDone()
+{
+    if (DMA_GetITStatus(PWMSTREAM_DMA, DMA_IT_HTIF6))
+    {
+	DMA_ClearITPendingBit(PWMSTREAM_DMA, DMA_IT_HTIF6);
+	Refill(0);
+    }
+    if (DMA_GetITStatus(PWMSTREAM_DMA, DMA_IT_TCIF6))
+    {
+	DMA_ClearITPendingBit(PWMSTREAM_DMA, DMA_IT_TCIF6);
+	Refill(1);
+    }
+}
@@ -0,0 +1,304 @@
+/////////////////////////////// SOFTWARE TIMERS ///////////////////////////////
+// Any number of one-shot and periodic timers driven by a single hardware
+// timer interrupt (SysTick or a TIM update) that ticks at a fixed rate.
+
+// The timers are kept in a hierarchical timing wheel. The wheel has 4 levels
+// of 64 slots. Level 0 holds the timers expiring within the next 64 ticks,
+// one slot per tick. Level 1 holds those expiring within 64 * 64 ticks, one
+// slot per 64 ticks, and so on. A slot is found from the expiry tick with a
+// shift and a mask, so starting and stopping a timer take constant time
+// whatever the number of timers. Every 64 ticks one slot of the next level
+// is emptied into the level below (cascade).
+
+// The tick interrupt does nothing but count the tick and set PendSV pending.
+// PendSV has the lowest priority, so the callbacks run after every other
+// interrupt is done and may take their time. The callbacks of one tick run
+// in no particular order.
+
+// Without a tick interrupt (tickless, see tickless.c) the ticks are read
+// from a free running clock. SwTimer_NextDelay() tells how long nothing is
+// due, so that the clock's compare can be set to wake the core just then.
+
+#include "stdafx.h"
+#include "swtimer.h"
+
+
+#define SWTIMER_LEVELS		4
+#define SWTIMER_BITS		6
+#define SWTIMER_SLOTS		(1u << SWTIMER_BITS)
+#define SWTIMER_MASK		(SWTIMER_SLOTS - 1)
+#define SWTIMER_RANGE		(1u << (SWTIMER_LEVELS * SWTIMER_BITS))
+
+
+static SwTimer* s_wheel[SWTIMER_LEVELS][SWTIMER_SLOTS];
+static volatile u32 s_ticks = 0;	// Ticks counted by the interrupt.
+static u32 s_now = 0;			// Last tick the wheel was turned to.
+static SwTimerClock s_clock = 0;	// Tickless clock, 0 to count ticks.
+
+
+static u32 Ticks()
+{
+    return s_clock ? s_clock() : s_ticks;
+}
+
+
+static void Link(SwTimer** slot, SwTimer* timer)
+{
+    timer->next = *slot;
+    if (timer->next)
+    {
+	timer->next->pprev = &timer->next;
+    }
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+
+static void Unlink(SwTimer* timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+    {
+	timer->next->pprev = timer->pprev;
+    }
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+
+static void Insert(SwTimer* timer)
+{
+    u32 expires = timer->expires;
+    u32 delta = expires - s_now;
+    u32 level = 0;
+
+    // Timers further away than the wheel reaches wait in the last slot
+    // that it does reach and are sorted again when it cascades.
+    if (delta >= SWTIMER_RANGE)
+    {
+	expires = s_now + SWTIMER_RANGE - 1;
+	delta = SWTIMER_RANGE - 1;
+    }
+
+    while (level < SWTIMER_LEVELS - 1 && delta >= (1u << ((level + 1) * SWTIMER_BITS)))
+    {
+	level++;
+    }
+
+    Link(&s_wheel[level][(expires >> (level * SWTIMER_BITS)) & SWTIMER_MASK], timer);
+}
+
+
+// Turns the wheel by one tick.
+static void Advance()
+{
+    s_now++;
+
+    for (u32 level=1; level<SWTIMER_LEVELS; level++)
+    {
+	if ((s_now >> ((level - 1) * SWTIMER_BITS)) & SWTIMER_MASK)
+	{
+	    break;
+	}
+
+	SwTimer** slot = &s_wheel[level][(s_now >> (level * SWTIMER_BITS)) & SWTIMER_MASK];
+	SwTimer* timer = *slot;
+	*slot = 0;
+	while (timer)
+	{
+	    SwTimer* next = timer->next;
+	    Insert(timer);
+	    timer = next;
+	}
+    }
+}
+
+
+void SwTimer_Init()
+{
+    for (u32 level=0; level<SWTIMER_LEVELS; level++)
+    {
+	for (u32 i=0; i<SWTIMER_SLOTS; i++)
+	{
+	    s_wheel[level][i] = 0;
+	}
+    }
+    s_ticks = 0;
+    s_now = 0;
+    s_clock = 0;
+
+    // The lowest priority of all.
+    NVIC_SetPriority(PendSV_IRQn, 0xFF);
+}
+
+
+// Starts (or restarts) a timer that expires in 'delay' ticks and then every
+// 'period' ticks. A period of 0 makes a one-shot timer. The callback gets
+// 'context' as its argument.
+void SwTimer_Start(SwTimer* timer, u32 delay, u32 period,
+		   SwTimerCallback callback, void* context)
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (timer->pprev)
+    {
+	Unlink(timer);
+    }
+
+    timer->callback = callback;
+    timer->context = context;
+    timer->period = (period > SWTIMER_MAX_DELAY) ? SWTIMER_MAX_DELAY : period;
+    delay = (delay > SWTIMER_MAX_DELAY) ? SWTIMER_MAX_DELAY : delay;
+    timer->expires = Ticks() + (delay ? delay : 1);
+    Insert(timer);
+
+    __set_PRIMASK(primask);
+}
+
+
+void SwTimer_Stop(SwTimer* timer)
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (timer->pprev)
+    {
+	Unlink(timer);
+    }
+
+    __set_PRIMASK(primask);
+}
+
+
+int SwTimer_IsRunning(const SwTimer* timer)
+{
+    return timer->pprev != 0;
+}
+
+
+u32 SwTimer_Now()
+{
+    return Ticks();
+}
+
+
+void SwTimer_Tick()
+{
+    s_ticks++;
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+
+// Starts reading the ticks from 'clock'. Called once, before any timer is
+// started. The wheel is turned to the clock's current tick.
+void SwTimer_SetClock(SwTimerClock clock)
+{
+    s_clock = clock;
+    s_now = clock();
+}
+
+
+// Ticks from the wheel's tick until it has to be turned next: a timer
+// expires or a slot of an upper level has to be cascaded. Cascades are due
+// when the lower bits of the tick all roll over to 0. SWTIMER_MAX_DELAY when
+// no timer is running.
+static u32 NextTurn()
+{
+    u32 delay = SWTIMER_MAX_DELAY;
+
+    for (u32 i=0; i<SWTIMER_SLOTS; i++)
+    {
+	if (s_wheel[0][(s_now + i) & SWTIMER_MASK])
+	{
+	    delay = i;
+	    break;
+	}
+    }
+
+    for (u32 level=1; level<SWTIMER_LEVELS; level++)
+    {
+	u32 shift = level * SWTIMER_BITS;
+	for (u32 i=1; i<=SWTIMER_SLOTS; i++)
+	{
+	    u32 tick = ((s_now >> shift) + i) << shift;
+	    if (s_wheel[level][(tick >> shift) & SWTIMER_MASK])
+	    {
+		if (tick - s_now < delay)
+		{
+		    delay = tick - s_now;
+		}
+		break;
+	    }
+	}
+    }
+    return delay;
+}
+
+
+// Ticks from now until the wheel has to be turned next. Returns
+// SWTIMER_MAX_DELAY when no timer is running. Called with the interrupts
+// disabled.
+u32 SwTimer_NextDelay()
+{
+    // The wheel is behind when an interrupt other than the deadline woke
+    // the core up.
+    u32 late = Ticks() - s_now;
+    u32 delay = NextTurn();
+    return (delay > late) ? delay - late : 0;
+}
+
+
+// The tickless clock has reached the deadline.
+void SwTimer_Wake()
+{
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+
+void SwTimer_Process()
+{
+    while (1)
+    {
+	u32 primask = __get_PRIMASK();
+	__disable_irq();
+
+	// Catch up with the ticks counted since the last time. Nothing is due
+	// before the next turn, so the wheel jumps to it rather than stepping
+	// through a long sleep tick by tick with the interrupts disabled.
+	SwTimer* timer = s_wheel[0][s_now & SWTIMER_MASK];
+	u32 ticks = Ticks();
+	while (!timer && s_now != ticks)
+	{
+	    u32 skip = NextTurn() - 1;
+	    if (skip >= ticks - s_now)
+	    {
+		s_now = ticks;
+	    }
+	    else
+	    {
+		s_now += skip;
+		Advance();
+	    }
+	    timer = s_wheel[0][s_now & SWTIMER_MASK];
+	}
+
+	if (!timer)
+	{
+	    __set_PRIMASK(primask);
+	    return;
+	}
+
+	// Take one timer off at a time, so that a callback may stop or start
+	// any timer, itself included.
+	Unlink(timer);
+	if (timer->period)
+	{
+	    timer->expires += timer->period;
+	    Insert(timer);
+	}
+
+	__set_PRIMASK(primask);
+	timer->callback(timer->context);
+    }
+}
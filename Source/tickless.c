@@ -0,0 +1,153 @@
+//////////////////////////////// TICKLESS IDLE ////////////////////////////////
+// Drives the software timers (see swtimer.c) without a periodic tick.
+
+// A 1 kHz tick interrupts the core a thousand times a second whether or not a
+// timer is due, and the main loop spins in between. Here TIM5, a 32-bit
+// timer, counts microseconds freely and the core sleeps (WFI) until the
+// compare of channel 1 matches the next deadline of the software timers.
+// Between two deadlines there is no interrupt at all.
+
+// TIM5 overflows every 2^32 us (71 minutes). The update interrupt counts the
+// overflows in the upper 32 bits of a 64-bit clock that never wraps. The time
+// stays correct across the sleeps since TIM5 keeps counting in Sleep mode.
+// Stop and Standby modes would stop it, so WFI is used with SLEEPDEEP clear.
+
+#include "stdafx.h"
+#include "tickless.h"
+#include "swtimer.h"
+#include "clock.h"
+
+
+// The compare is 32-bit. Deadlines further away are reached in steps.
+#define TICKLESS_MAX_SLEEP_US	0x7FFFFFFF
+
+
+static volatile u32 s_high = 0;		// Overflows of TIM5.
+
+
+void Tickless_Init()
+{
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM5, ENABLE);
+
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = 0xFFFFFFFF;
+    base.TIM_Prescaler = Clock_GetTimerClock(TIM5) / TICKLESS_TIMER_HZ - 1;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM5, &base);
+
+    // Keeps counting microseconds if the clock profile changes.
+    Clock_RegisterTimer(TIM5, TICKLESS_TIMER_HZ);
+
+    // Channel 1 compares without driving a pin.
+    TIM_OCInitTypeDef oc;
+    TIM_OCStructInit(&oc);
+    oc.TIM_OCMode = TIM_OCMode_Timing;
+    TIM_OC1Init(TIM5, &oc);
+
+    TIM_ClearITPendingBit(TIM5, TIM_IT_Update | TIM_IT_CC1);
+    TIM_ITConfig(TIM5, TIM_IT_Update, ENABLE);
+    NVIC_SetPriority(TIM5_IRQn, 0);
+    NVIC_EnableIRQ(TIM5_IRQn);
+
+    s_high = 0;
+    TIM_Cmd(TIM5, ENABLE);
+
+    // The debugger loses the core while it sleeps unless this is set.
+    DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+    SwTimer_SetClock(Tickless_Ticks);
+}
+
+
+// Microseconds since Tickless_Init(). Can be called from any interrupt.
+uint64_t Tickless_Now()
+{
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    u32 high = s_high;
+    u32 low = TIM5->CNT;
+
+    // The counter may have overflowed without the interrupt having run yet,
+    // for instance when called with the interrupts disabled. A low count
+    // read with the flag set belongs to the next round.
+    if ((TIM5->SR & TIM_SR_UIF) && low < 0x80000000)
+    {
+	high++;
+    }
+
+    __set_PRIMASK(primask);
+    return ((uint64_t)high << 32) | low;
+}
+
+
+u32 Tickless_Ticks()
+{
+    return (u32)(Tickless_Now() / TICKLESS_TICK_US);
+}
+
+
+void Tickless_Idle()
+{
+    // With the interrupts disabled no timer can be started between reading
+    // the next delay and going to sleep. WFI still wakes up on an interrupt
+    // that is pending, which then runs once they are enabled again.
+    __disable_irq();
+
+    u32 delay = SwTimer_NextDelay();
+    if (!delay)
+    {
+	SwTimer_Wake();
+    }
+    else
+    {
+	// Wake at the start of the tick that is due.
+	uint64_t now = Tickless_Now();
+	uint64_t deadline = (now / TICKLESS_TICK_US + delay) * TICKLESS_TICK_US;
+	if (deadline - now > TICKLESS_MAX_SLEEP_US)
+	{
+	    deadline = now + TICKLESS_MAX_SLEEP_US;
+	}
+
+	TIM5->CCR1 = (u32)deadline;
+	TIM5->SR = ~TIM_SR_CC1IF;
+	TIM5->DIER |= TIM_DIER_CC1IE;
+
+	// The counter may have passed the deadline while it was being set.
+	if (Tickless_Now() >= deadline)
+	{
+	    SwTimer_Wake();
+	}
+
+	__WFI();
+    }
+
+    __enable_irq();
+}
+
+
+void Tickless_OnInterrupt()
+{
+    // Tickless_Now() must not see the flag cleared before the overflow is
+    // counted, even from an interrupt of higher priority.
+    u32 primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (TIM5->SR & TIM_SR_UIF)
+    {
+	TIM5->SR = ~TIM_SR_UIF;
+	s_high++;
+    }
+
+    __set_PRIMASK(primask);
+
+    if ((TIM5->SR & TIM_SR_CC1IF) && (TIM5->DIER & TIM_DIER_CC1IE))
+    {
+	TIM5->SR = ~TIM_SR_CC1IF;
+	TIM5->DIER &= ~TIM_DIER_CC1IE;
+	SwTimer_Wake();
+    }
+}
@@ -0,0 +1,75 @@
+////////////////////////////////// TIMESTAMP //////////////////////////////////
+// A 64-bit microsecond clock made of TIM2 and TIM5 chained as master and
+// slave, the way Basic8 chains two timers.
+
+// TIM2 counts microseconds in its 32-bit counter. At every overflow its
+// update event goes out as the trigger output (TRGO). TIM5 is clocked by that
+// trigger (external clock mode 1 on ITR0) and so counts the overflows: it
+// holds the upper 32 bits. No interrupt is needed, and at a microsecond per
+// count the 64 bits last for half a million years.
+
+// The two counters cannot be read at once. The upper half is read before and
+// after the lower half. When they differ the lower half overflowed in
+// between and the reading is taken again. TIM5 sees the trigger a couple of
+// timer clocks after the overflow, while TIM2 still reads 0, so a 0 is read
+// again too. Nothing is shared but the timers, so it works from any
+// interrupt priority without disabling interrupts.
+
+// TIM5 is also used by tickless.c, the two cannot run together. The rate is
+// set for the clock tree at the time of Timestamp_Init(). It is not kept
+// across clock profile switches (clock.c): retuning the prescaler generates
+// an update, which TIM5 would count.
+
+#include "stdafx.h"
+#include "timestamp.h"
+#include "clock.h"
+
+
+void Timestamp_Init()
+{
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2 | RCC_APB1Periph_TIM5, ENABLE);
+
+    TIM_TimeBaseInitTypeDef base;
+    base.TIM_ClockDivision = TIM_CKD_DIV1;
+    base.TIM_CounterMode = TIM_CounterMode_Up;
+    base.TIM_Period = 0xFFFFFFFF;
+    base.TIM_Prescaler = Clock_GetTimerClock(TIM2) / TIMESTAMP_HZ - 1;
+    base.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM2, &base);
+
+    // The slave counts every trigger, no prescaler.
+    base.TIM_Prescaler = 0;
+    TIM_TimeBaseInit(TIM5, &base);
+
+    // Master: TIM2 signals its updates.
+    TIM_SelectOutputTrigger(TIM2, TIM_TRGOSource_Update);
+
+    // Slave: TIM5 counts on the rising edges of ITR0, which is TIM2's TRGO.
+    TIM_SelectInputTrigger(TIM5, TIM_TS_ITR0);
+    TIM_SelectSlaveMode(TIM5, TIM_SlaveMode_External1);
+
+    // Both stop while the debugger halts the core, so that the time does not
+    // jump while stepping.
+    DBGMCU_APB1PeriphConfig(DBGMCU_TIM2_STOP | DBGMCU_TIM5_STOP, ENABLE);
+
+    TIM_SetCounter(TIM2, 0);
+    TIM_SetCounter(TIM5, 0);
+    TIM_Cmd(TIM5, ENABLE);
+    TIM_Cmd(TIM2, ENABLE);
+}
+
+
+// Microseconds since Timestamp_Init().
+uint64_t Timestamp_Now()
+{
+    u32 high;
+    u32 low;
+
+    do
+    {
+	high = TIM5->CNT;
+	low = TIM2->CNT;
+    } while (high != TIM5->CNT || low == 0);
+
+    return ((uint64_t)high << 32) | low;
+}
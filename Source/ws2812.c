@@ -0,0 +1,188 @@
+///////////////////////////////// LED STRIPS //////////////////////////////////
+// Sends the colours of a strip of WS2812 or SK6812 LEDs, each bit a PWM
+// period of TIM4 streamed in by the DMA (see pwm_stream.c).
+
+// The LEDs take a single wire at 800 kbit/s, each bit a period of 1.25 us
+// that starts high: high for about 0.4 us is a 0, for about 0.8 us a 1. Each
+// LED keeps the first 24 bits (32 for RGBW) it gets and passes the rest on
+// down the strip. A low line of some 280 us ends the frame, and all the LEDs
+// show their new colours at once. A gap of a few us within a frame can
+// already be taken for the end, and bit banging at 800 kHz leaves the CPU
+// nothing else to do.
+
+// Here each bit is a PWM period of channel 1 of TIM4, its compare value the
+// high time of a 0 or a 1, and the DMA stores one per period. The counter
+// runs at the timer clock divided down to about 16 MHz: 20 ticks a bit at
+// 16 MHz, 21 at 16.8 MHz from the 84 MHz of the fast profiles. The times
+// are rounded to the tick, well within the tolerance of the LEDs.
+
+// DOUBLE BUFFER: A compare value per bit is 48 bytes per LED, 14 KB for a
+// strip of 300. So the buffer holds 2 * WS2812_LEDS_PER_HALF LEDs only and
+// the half transfer and transfer complete interrupts expand the bytes of
+// the next LEDs into the half just played. Each byte takes two lookups of
+// 4 compare values, by nibble, from a table made for the timing at the
+// start of the frame: no branch on the bits, the same work for every LED.
+// Ws2812_Measure() times the refills with the cycle counter. The refill has
+// the play time of the other half, 120 us for 4 LEDs, to finish: a late one
+// would send old bits, which PwmStream_Overruns() counts.
+
+// LATCH: After the last LED the halves are filled with 0, which holds the
+// line low. Once enough whole halves of 0 have been played to cover
+// WS2812_LATCH_US, the refill stops the stream. The line stays low, as the
+// compare value in use is 0.
+
+#include "stdafx.h"
+#include "ws2812.h"
+#include "pwm_stream.h"
+#include "clock.h"
+
+#include <string.h>
+
+
+#define WS2812_TICK_HZ		16000000	// About, for the counter.
+#define WS2812_HALF_MAX		(WS2812_LEDS_PER_HALF * WS2812_MAX_BYTES * 8)
+#define WS2812_LATCH_BITS	(WS2812_LATCH_US * (WS2812_BIT_HZ / 1000) / 1000)
+
+
+static u16 s_buffer[2 * WS2812_HALF_MAX];
+static u16 s_nibbles[16][4];		// Compare values of the bits of a nibble.
+
+static const u8* s_data = 0;
+static u32 s_bytes = 0;			// Of the frame.
+static u32 s_next = 0;			// Next byte to expand.
+static u32 s_ledBytes = 0;
+static u32 s_halfFrames = 0;
+static u8 s_zero[2];			// Halves filled with 0 only.
+static u32 s_zeros = 0;			// Such halves played.
+static volatile int s_busy = 0;
+static BenchRegion* s_region = 0;
+
+
+static void Refill(u16* values, u32 frames);
+
+
+ErrorStatus Ws2812_Show(const u8* data, u32 leds, u32 bytesPerLed)
+{
+    if (s_busy || !leds || bytesPerLed < 3 || bytesPerLed > WS2812_MAX_BYTES)
+    {
+	return ERROR;
+    }
+
+    u32 clock = Clock_GetTimerClock(TIM4);
+    if (clock < WS2812_TICK_HZ)
+    {
+	return ERROR;
+    }
+
+    // The high times, 0.4 us for a 0 and 0.8 us for a 1, rounded.
+    u32 tickHz = clock / (clock / WS2812_TICK_HZ);
+    u32 period = (tickHz + WS2812_BIT_HZ / 2) / WS2812_BIT_HZ;
+    u32 zero = (tickHz * 2 + 2500000) / 5000000;
+    u32 one = (tickHz * 4 + 2500000) / 5000000;
+    for (u32 n=0; n<16; n++)
+    {
+	for (u32 b=0; b<4; b++)
+	{
+	    s_nibbles[n][b] = (n & (8 >> b)) ? one : zero;
+	}
+    }
+
+    s_data = data;
+    s_bytes = leds * bytesPerLed;
+    s_next = 0;
+    s_ledBytes = bytesPerLed;
+    s_halfFrames = WS2812_LEDS_PER_HALF * bytesPerLed * 8;
+    s_zeros = 0;
+    s_busy = 1;
+
+    PwmStreamConfig config;
+    config.tickHz = tickHz;
+    config.period = period;
+    config.channels = 1;
+    config.buffer = s_buffer;
+    config.frames = 2 * s_halfFrames;
+    config.refill = Refill;
+    if (PwmStream_Start(&config) != SUCCESS)
+    {
+	s_busy = 0;
+	return ERROR;
+    }
+    return SUCCESS;
+}
+
+
+int Ws2812_IsBusy()
+{
+    return s_busy;
+}
+
+
+void Ws2812_Measure(BenchRegion* region)
+{
+    s_region = region;
+}
+
+
+// The bits of a byte, the most significant first.
+static inline void Expand(u16* values, u32 byte)
+{
+    const u16* high = s_nibbles[byte >> 4];
+    const u16* low = s_nibbles[byte & 15];
+    values[0] = high[0];
+    values[1] = high[1];
+    values[2] = high[2];
+    values[3] = high[3];
+    values[4] = low[0];
+    values[5] = low[1];
+    values[6] = low[2];
+    values[7] = low[3];
+}
+
+
+static void FillHalf(u32 half)
+{
+    u16* values = s_buffer + half * s_halfFrames;
+    u32 end = s_next + WS2812_LEDS_PER_HALF * s_ledBytes;
+    if (end > s_bytes)
+    {
+	end = s_bytes;
+    }
+
+    s_zero[half] = (s_next == end);
+    for (; s_next<end; s_next++, values+=8)
+    {
+	Expand(values, s_data[s_next]);
+    }
+    memset(values, 0, (u8*)(s_buffer + (half + 1) * s_halfFrames) - (u8*)values);
+}
+
+
+static void Refill(u16* values, u32 frames)
+{
+    // The first call fills the whole buffer before the start.
+    if (frames > s_halfFrames)
+    {
+	FillHalf(0);
+	FillHalf(1);
+	return;
+    }
+
+    u32 half = (values != s_buffer);
+    if (s_zero[half] && ++s_zeros * s_halfFrames >= WS2812_LATCH_BITS)
+    {
+	PwmStream_Stop();
+	s_busy = 0;
+	return;
+    }
+
+    if (s_region)
+    {
+	Bench_Start(s_region);
+	FillHalf(half);
+	Bench_Stop(s_region);
+    }
+    else
+    {
+	FillHalf(half);
+    }
+}
\ No newline at end of file